@@ -107,3 +107,77 @@ $cppu$;
 
 COMMENT ON FUNCTION pg_catalog.citus_finish_pg_upgrade()
     IS 'perform tasks to restore citus settings from a location that has been prepared before pg_upgrade';
+
+CREATE FUNCTION pg_catalog.worker_create_schema(bigint)
+    RETURNS void
+    LANGUAGE C STRICT
+    AS 'MODULE_PATHNAME', $$worker_create_schema$$;
+COMMENT ON FUNCTION pg_catalog.worker_create_schema(bigint)
+    IS 'create the schema of a repartition job';
+
+CREATE FUNCTION pg_catalog.worker_repartition_cleanup(bigint)
+    RETURNS void
+    LANGUAGE C STRICT
+    AS 'MODULE_PATHNAME', $$worker_repartition_cleanup$$;
+COMMENT ON FUNCTION pg_catalog.worker_repartition_cleanup(bigint)
+    IS 'remove the directory and the schema of a repartition job';
+
+CREATE FUNCTION pg_catalog.worker_stream_partition_file(bigint, integer, integer, integer, text,
+                                                        integer)
+    RETURNS void
+    LANGUAGE C STRICT
+    AS 'MODULE_PATHNAME', $$worker_stream_partition_file$$;
+COMMENT ON FUNCTION pg_catalog.worker_stream_partition_file(bigint, integer, integer, integer, text,
+                                                            integer)
+    IS 'stream a partition file into the table of its merge task';
+
+CREATE FUNCTION pg_catalog.worker_partition_local_files(bigint, integer, text, text, text[],
+                                                        text[], text, "char", text[], text[])
+    RETURNS bigint
+    LANGUAGE C STRICT
+    AS 'MODULE_PATHNAME', $$worker_partition_local_files$$;
+COMMENT ON FUNCTION pg_catalog.worker_partition_local_files(bigint, integer, text, text, text[],
+                                                            text[], text, "char", text[], text[])
+    IS 'partition local files by the shards of a distributed table';
+
+CREATE FUNCTION pg_catalog.worker_load_partition_files(bigint, integer, regclass, text[],
+                                                       integer[])
+    RETURNS bigint
+    LANGUAGE C STRICT
+    AS 'MODULE_PATHNAME', $$worker_load_partition_files$$;
+COMMENT ON FUNCTION pg_catalog.worker_load_partition_files(bigint, integer, regclass, text[],
+                                                           integer[])
+    IS 'stream the partition files of a shard from all nodes into the shard';
+
+CREATE FUNCTION pg_catalog.master_load_local_files(table_name regclass,
+                                                   file_pattern text,
+                                                   copy_options text DEFAULT '')
+    RETURNS bigint
+    LANGUAGE C STRICT
+    AS 'MODULE_PATHNAME', $$master_load_local_files$$;
+COMMENT ON FUNCTION pg_catalog.master_load_local_files(regclass, text, text)
+    IS 'load files that are present on the worker nodes into the shards of a distributed table';
+
+CREATE FUNCTION pg_catalog.citus_copy_progress(OUT pid int, OUT table_name regclass,
+                                               OUT start_time timestamptz,
+                                               OUT rows_routed bigint, OUT nodename text,
+                                               OUT nodeport int, OUT shards bigint,
+                                               OUT rows_sent bigint, OUT bytes_sent bigint,
+                                               OUT bytes_per_second float8,
+                                               OUT last_send_time timestamptz)
+    RETURNS SETOF RECORD
+    LANGUAGE C STRICT
+    AS 'MODULE_PATHNAME', $$citus_copy_progress$$;
+COMMENT ON FUNCTION pg_catalog.citus_copy_progress(OUT pid int, OUT table_name regclass,
+                                                   OUT start_time timestamptz,
+                                                   OUT rows_routed bigint, OUT nodename text,
+                                                   OUT nodeport int, OUT shards bigint,
+                                                   OUT rows_sent bigint, OUT bytes_sent bigint,
+                                                   OUT bytes_per_second float8,
+                                                   OUT last_send_time timestamptz)
+    IS 'returns the progress of ongoing COPY commands into distributed tables per node';
+
+CREATE VIEW citus.citus_copy_progress AS
+SELECT * FROM pg_catalog.citus_copy_progress();
+ALTER VIEW citus.citus_copy_progress SET SCHEMA pg_catalog;
+GRANT SELECT ON pg_catalog.citus_copy_progress TO PUBLIC;
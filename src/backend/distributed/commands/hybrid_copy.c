@@ -0,0 +1,564 @@
+/*-------------------------------------------------------------------------
+ *
+ * hybrid_copy.c
+ *	  Routines for reading data in Citus' hybrid row format.
+ *
+ * The hybrid row format is postgres' binary COPY format with the
+ * HYBRID_COPY_FORMAT_FLAG set in the header. In it, the values of the
+ * columns that cannot use the binary format, such as arrays of user-defined
+ * types, are sent as their unescaped text output, and all other values are
+ * sent in binary format. AppendCopyRowData() writes such data for the
+ * intermediate results and partition files whose columns are a mix of both
+ * kinds of types. Postgres refuses to read the flag, so the functions in
+ * this file read the data instead. The writer and the reader both use
+ * HybridTextColumns() to decide which columns are sent as text.
+ *
+ * Copyright (c) 2019, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "miscadmin.h"
+
+#include <arpa/inet.h> /* for ntohl */
+#include <netinet/in.h> /* for ntohs */
+
+#include "access/heapam.h"
+#include "access/htup_details.h"
+#include "access/xact.h"
+#include "distributed/commands/hybrid_copy.h"
+#include "distributed/commands/multi_copy.h"
+#include "lib/stringinfo.h"
+#include "storage/fd.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/rel.h"
+
+
+/* size of the buffer into which the data is read */
+#define HYBRID_COPY_BUFFER_SIZE (64 * 1024)
+
+/* flags of the binary COPY header, see CopyStateData in commands/copy.c */
+#define BINARY_SIGNATURE_LENGTH 11
+#define BINARY_FLAGS_OIDS (1 << 16)
+#define BINARY_FLAGS_CRITICAL_MASK 0xFFFF0000
+
+
+/* state of reading hybrid row format data from a file or a data source */
+typedef struct HybridCopyStateData
+{
+	TupleDesc tupleDescriptor;
+
+	/* the data is read from either the file or the data source callback */
+	FILE *file;
+	copy_data_source_cb dataSourceCallback;
+
+	char *buffer;
+	int bufferLength;
+	int bufferOffset;
+	bool reachedEnd;
+
+	/* columns sent as text, or NULL if the data is in plain binary format */
+	bool *textColumns;
+
+	/* receive functions for binary columns, input functions for text columns */
+	FmgrInfo *columnInputFunctions;
+	Oid *columnTypeIOParams;
+	int16 availableColumnCount;
+
+	/* buffer for the value of the current field */
+	StringInfoData fieldBuffer;
+} HybridCopyStateData;
+
+
+static const char BinarySignature[BINARY_SIGNATURE_LENGTH] = "PGCOPY\n\377\r\n\0";
+
+
+static void ReadHybridCopyHeader(HybridCopyState copyState);
+static Datum ReadHybridCopyField(HybridCopyState copyState, int columnIndex,
+								 bool *isNull);
+static int32 ReadHybridCopyInt32(HybridCopyState copyState);
+static int ReadHybridCopyData(HybridCopyState copyState, void *data, int length);
+static void FillHybridCopyBuffer(HybridCopyState copyState);
+
+
+/*
+ * IsHybridCopyHeader returns whether the given data starts with a binary COPY
+ * header that marks the hybrid row format. Since text data cannot contain the
+ * binary signature, this also tells hybrid data apart from text data.
+ */
+bool
+IsHybridCopyHeader(const char *data, int length)
+{
+	uint32 flagsData = 0;
+	int32 flags = 0;
+
+	if (length < HYBRID_COPY_HEADER_LENGTH ||
+		memcmp(data, BinarySignature, BINARY_SIGNATURE_LENGTH) != 0)
+	{
+		return false;
+	}
+
+	memcpy(&flagsData, data + BINARY_SIGNATURE_LENGTH, sizeof(flagsData));
+	flags = (int32) ntohl(flagsData);
+
+	return (flags & HYBRID_COPY_FORMAT_FLAG) != 0;
+}
+
+
+/*
+ * BeginHybridCopyFrom starts reading hybrid row format data with columns of the
+ * given tuple descriptor from the given file or, if fileName is NULL, from the
+ * given data source callback. The function reads the header of the data and
+ * also accepts data in postgres' plain binary format.
+ */
+HybridCopyState
+BeginHybridCopyFrom(char *fileName, copy_data_source_cb dataSourceCallback,
+					TupleDesc tupleDescriptor)
+{
+	HybridCopyState copyState = palloc0(sizeof(HybridCopyStateData));
+	int columnCount = tupleDescriptor->natts;
+	int columnIndex = 0;
+
+	copyState->tupleDescriptor = tupleDescriptor;
+	copyState->dataSourceCallback = dataSourceCallback;
+	copyState->buffer = palloc(HYBRID_COPY_BUFFER_SIZE);
+	initStringInfo(&copyState->fieldBuffer);
+
+	if (fileName != NULL)
+	{
+		copyState->file = AllocateFile(fileName, PG_BINARY_R);
+		if (copyState->file == NULL)
+		{
+			ereport(ERROR, (errcode_for_file_access(),
+							errmsg("could not open file \"%s\" for reading: %m",
+								   fileName)));
+		}
+	}
+
+	ReadHybridCopyHeader(copyState);
+
+	copyState->columnInputFunctions = palloc0(columnCount * sizeof(FmgrInfo));
+	copyState->columnTypeIOParams = palloc0(columnCount * sizeof(Oid));
+
+	for (columnIndex = 0; columnIndex < columnCount; columnIndex++)
+	{
+		Form_pg_attribute currentColumn = TupleDescAttr(tupleDescriptor, columnIndex);
+		Oid *typeIOParam = &copyState->columnTypeIOParams[columnIndex];
+		Oid inputFunctionId = InvalidOid;
+
+		if (currentColumn->attisdropped)
+		{
+			continue;
+		}
+
+		if (copyState->textColumns != NULL && copyState->textColumns[columnIndex])
+		{
+			getTypeInputInfo(currentColumn->atttypid, &inputFunctionId, typeIOParam);
+		}
+		else
+		{
+			getTypeBinaryInputInfo(currentColumn->atttypid, &inputFunctionId,
+								   typeIOParam);
+		}
+
+		fmgr_info(inputFunctionId, &copyState->columnInputFunctions[columnIndex]);
+		copyState->availableColumnCount++;
+	}
+
+	return copyState;
+}
+
+
+/*
+ * ReadHybridCopyHeader reads the header of binary COPY data and determines the
+ * text columns if the header marks the data as being in the hybrid row format.
+ */
+static void
+ReadHybridCopyHeader(HybridCopyState copyState)
+{
+	char signature[BINARY_SIGNATURE_LENGTH];
+	int32 flags = 0;
+	int32 extensionLength = 0;
+
+	if (ReadHybridCopyData(copyState, signature, BINARY_SIGNATURE_LENGTH) !=
+		BINARY_SIGNATURE_LENGTH ||
+		memcmp(signature, BinarySignature, BINARY_SIGNATURE_LENGTH) != 0)
+	{
+		ereport(ERROR, (errcode(ERRCODE_BAD_COPY_FILE_FORMAT),
+						errmsg("COPY file signature not recognized")));
+	}
+
+	flags = ReadHybridCopyInt32(copyState);
+	if ((flags & BINARY_FLAGS_OIDS) != 0)
+	{
+		ereport(ERROR, (errcode(ERRCODE_BAD_COPY_FILE_FORMAT),
+						errmsg("COPY file with OIDs is not supported")));
+	}
+
+	if ((flags & BINARY_FLAGS_CRITICAL_MASK & ~HYBRID_COPY_FORMAT_FLAG) != 0)
+	{
+		ereport(ERROR, (errcode(ERRCODE_BAD_COPY_FILE_FORMAT),
+						errmsg("unrecognized critical flags in COPY file header")));
+	}
+
+	if ((flags & HYBRID_COPY_FORMAT_FLAG) != 0)
+	{
+		copyState->textColumns = HybridTextColumns(copyState->tupleDescriptor);
+		if (copyState->textColumns == NULL)
+		{
+			ereport(ERROR, (errcode(ERRCODE_BAD_COPY_FILE_FORMAT),
+							errmsg("hybrid COPY data does not match the column "
+								   "types")));
+		}
+	}
+
+	/* skip the header extension, we do not use it */
+	extensionLength = ReadHybridCopyInt32(copyState);
+	if (extensionLength < 0)
+	{
+		ereport(ERROR, (errcode(ERRCODE_BAD_COPY_FILE_FORMAT),
+						errmsg("invalid COPY file header (wrong length)")));
+	}
+
+	while (extensionLength > 0)
+	{
+		char extensionData[64];
+		int readLength = Min(extensionLength, (int32) sizeof(extensionData));
+
+		if (ReadHybridCopyData(copyState, extensionData, readLength) != readLength)
+		{
+			ereport(ERROR, (errcode(ERRCODE_BAD_COPY_FILE_FORMAT),
+							errmsg("invalid COPY file header (wrong length)")));
+		}
+
+		extensionLength -= readLength;
+	}
+}
+
+
+/*
+ * NextHybridCopyFrom reads the next row into the given values and nulls, which
+ * have an entry for every column of the tuple descriptor, and returns true. If
+ * there are no more rows, the function returns false. The values are
+ * allocated in the current memory context.
+ */
+bool
+NextHybridCopyFrom(HybridCopyState copyState, Datum *columnValues, bool *columnNulls)
+{
+	TupleDesc tupleDescriptor = copyState->tupleDescriptor;
+	int columnCount = tupleDescriptor->natts;
+	int columnIndex = 0;
+	uint16 fieldCountData = 0;
+	int16 fieldCount = 0;
+	int readLength = 0;
+
+	readLength = ReadHybridCopyData(copyState, &fieldCountData, sizeof(fieldCountData));
+	if (readLength == 0)
+	{
+		/* postgres also accepts data without the trailer */
+		return false;
+	}
+	else if (readLength != sizeof(fieldCountData))
+	{
+		ereport(ERROR, (errcode(ERRCODE_BAD_COPY_FILE_FORMAT),
+						errmsg("unexpected EOF in COPY data")));
+	}
+
+	fieldCount = (int16) ntohs(fieldCountData);
+	if (fieldCount == -1)
+	{
+		char dummy = 0;
+
+		/* like postgres, read up to the end of the data after the trailer */
+		if (ReadHybridCopyData(copyState, &dummy, 1) != 0)
+		{
+			ereport(ERROR, (errcode(ERRCODE_BAD_COPY_FILE_FORMAT),
+							errmsg("received copy data after EOF marker")));
+		}
+
+		return false;
+	}
+
+	if (fieldCount != copyState->availableColumnCount)
+	{
+		ereport(ERROR, (errcode(ERRCODE_BAD_COPY_FILE_FORMAT),
+						errmsg("row field count is %d, expected %d",
+							   (int) fieldCount, copyState->availableColumnCount)));
+	}
+
+	for (columnIndex = 0; columnIndex < columnCount; columnIndex++)
+	{
+		Form_pg_attribute currentColumn = TupleDescAttr(tupleDescriptor, columnIndex);
+
+		if (currentColumn->attisdropped)
+		{
+			columnValues[columnIndex] = (Datum) 0;
+			columnNulls[columnIndex] = true;
+			continue;
+		}
+
+		columnValues[columnIndex] = ReadHybridCopyField(copyState, columnIndex,
+														&columnNulls[columnIndex]);
+	}
+
+	return true;
+}
+
+
+/*
+ * ReadHybridCopyField reads the value of the given column in the current row,
+ * either in binary or in text format, and sets isNull if it is NULL.
+ */
+static Datum
+ReadHybridCopyField(HybridCopyState copyState, int columnIndex, bool *isNull)
+{
+	Form_pg_attribute currentColumn =
+		TupleDescAttr(copyState->tupleDescriptor, columnIndex);
+	FmgrInfo *inputFunction = &copyState->columnInputFunctions[columnIndex];
+	Oid typeIOParam = copyState->columnTypeIOParams[columnIndex];
+	int32 typeModifier = currentColumn->atttypmod;
+	StringInfo fieldBuffer = &copyState->fieldBuffer;
+	bool textColumn = copyState->textColumns != NULL &&
+					  copyState->textColumns[columnIndex];
+	int32 fieldLength = ReadHybridCopyInt32(copyState);
+	Datum fieldValue = 0;
+
+	if (fieldLength == -1)
+	{
+		/* call the input function for NULL as well to check domain constraints */
+		(*isNull) = true;
+
+		if (textColumn)
+		{
+			return InputFunctionCall(inputFunction, NULL, typeIOParam, typeModifier);
+		}
+
+		return ReceiveFunctionCall(inputFunction, NULL, typeIOParam, typeModifier);
+	}
+	else if (fieldLength < 0)
+	{
+		ereport(ERROR, (errcode(ERRCODE_BAD_COPY_FILE_FORMAT),
+						errmsg("invalid field size")));
+	}
+
+	resetStringInfo(fieldBuffer);
+	enlargeStringInfo(fieldBuffer, fieldLength);
+
+	if (ReadHybridCopyData(copyState, fieldBuffer->data, fieldLength) != fieldLength)
+	{
+		ereport(ERROR, (errcode(ERRCODE_BAD_COPY_FILE_FORMAT),
+						errmsg("unexpected EOF in COPY data")));
+	}
+
+	fieldBuffer->len = fieldLength;
+	fieldBuffer->data[fieldLength] = '\0';
+
+	(*isNull) = false;
+
+	if (textColumn)
+	{
+		return InputFunctionCall(inputFunction, fieldBuffer->data, typeIOParam,
+								 typeModifier);
+	}
+
+	fieldValue = ReceiveFunctionCall(inputFunction, fieldBuffer, typeIOParam,
+									 typeModifier);
+	if (fieldBuffer->cursor != fieldBuffer->len)
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+						errmsg("incorrect binary data format")));
+	}
+
+	return fieldValue;
+}
+
+
+/*
+ * ReadHybridCopyInt32 reads a 32-bit integer in network byte order and errors
+ * out if the data ends before it.
+ */
+static int32
+ReadHybridCopyInt32(HybridCopyState copyState)
+{
+	uint32 value = 0;
+
+	if (ReadHybridCopyData(copyState, &value, sizeof(value)) != sizeof(value))
+	{
+		ereport(ERROR, (errcode(ERRCODE_BAD_COPY_FILE_FORMAT),
+						errmsg("unexpected EOF in COPY data")));
+	}
+
+	return (int32) ntohl(value);
+}
+
+
+/*
+ * ReadHybridCopyData reads the given number of bytes into data and returns the
+ * number of bytes read, which is only smaller than length at the end of the
+ * data.
+ */
+static int
+ReadHybridCopyData(HybridCopyState copyState, void *data, int length)
+{
+	int readLength = 0;
+
+	while (readLength < length)
+	{
+		int availableLength = copyState->bufferLength - copyState->bufferOffset;
+		int copyLength = 0;
+
+		if (availableLength == 0)
+		{
+			if (copyState->reachedEnd)
+			{
+				break;
+			}
+
+			FillHybridCopyBuffer(copyState);
+			continue;
+		}
+
+		copyLength = Min(availableLength, length - readLength);
+		memcpy((char *) data + readLength,
+			   copyState->buffer + copyState->bufferOffset, copyLength);
+
+		copyState->bufferOffset += copyLength;
+		readLength += copyLength;
+	}
+
+	return readLength;
+}
+
+
+/*
+ * FillHybridCopyBuffer reads the next chunk of data into the buffer, and marks
+ * the end of the data if there is none left.
+ */
+static void
+FillHybridCopyBuffer(HybridCopyState copyState)
+{
+	int readLength = 0;
+
+	if (copyState->file != NULL)
+	{
+		readLength = fread(copyState->buffer, 1, HYBRID_COPY_BUFFER_SIZE,
+						   copyState->file);
+		if (ferror(copyState->file))
+		{
+			ereport(ERROR, (errcode_for_file_access(),
+							errmsg("could not read from COPY file: %m")));
+		}
+	}
+	else
+	{
+		readLength = copyState->dataSourceCallback(copyState->buffer, 1,
+												   HYBRID_COPY_BUFFER_SIZE);
+	}
+
+	copyState->bufferOffset = 0;
+	copyState->bufferLength = readLength;
+
+	if (readLength == 0)
+	{
+		copyState->reachedEnd = true;
+	}
+}
+
+
+/*
+ * EndHybridCopyFrom closes the file of the given state, if any, and frees the
+ * state.
+ */
+void
+EndHybridCopyFrom(HybridCopyState copyState)
+{
+	if (copyState->file != NULL)
+	{
+		FreeFile(copyState->file);
+	}
+
+	pfree(copyState->fieldBuffer.data);
+	pfree(copyState->columnInputFunctions);
+	pfree(copyState->columnTypeIOParams);
+	pfree(copyState->buffer);
+
+	if (copyState->textColumns != NULL)
+	{
+		pfree(copyState->textColumns);
+	}
+
+	pfree(copyState);
+}
+
+
+/*
+ * CopyHybridDataIntoRelation inserts the rows of the given file, or of the given
+ * data source callback if there is no file, into the given relation and returns
+ * the number of inserted rows. Since the function inserts directly into the
+ * heap, it is only used for the merge tables of repartition jobs, which have
+ * neither indexes nor triggers.
+ */
+uint64
+CopyHybridDataIntoRelation(Relation relation, char *fileName,
+						   copy_data_source_cb dataSourceCallback)
+{
+	TupleDesc tupleDescriptor = RelationGetDescr(relation);
+	int columnCount = tupleDescriptor->natts;
+	Datum *columnValues = palloc0(columnCount * sizeof(Datum));
+	bool *columnNulls = palloc0(columnCount * sizeof(bool));
+	CommandId commandId = GetCurrentCommandId(true);
+	BulkInsertState bulkInsertState = NULL;
+	HybridCopyState copyState = NULL;
+	MemoryContext rowContext = NULL;
+	uint64 copiedRowCount = 0;
+
+	if (relation->rd_rel->relhasindex || relation->trigdesc != NULL)
+	{
+		ereport(ERROR, (errmsg("cannot copy hybrid COPY data into table \"%s\" "
+							   "with indexes or triggers",
+							   RelationGetRelationName(relation))));
+	}
+
+	rowContext = AllocSetContextCreate(CurrentMemoryContext, "HybridCopyRowContext",
+									   ALLOCSET_DEFAULT_SIZES);
+
+	copyState = BeginHybridCopyFrom(fileName, dataSourceCallback, tupleDescriptor);
+	bulkInsertState = GetBulkInsertState();
+
+	while (true)
+	{
+		MemoryContext oldContext = NULL;
+		HeapTuple heapTuple = NULL;
+		bool nextRowFound = false;
+
+		CHECK_FOR_INTERRUPTS();
+
+		MemoryContextReset(rowContext);
+		oldContext = MemoryContextSwitchTo(rowContext);
+
+		nextRowFound = NextHybridCopyFrom(copyState, columnValues, columnNulls);
+		if (!nextRowFound)
+		{
+			MemoryContextSwitchTo(oldContext);
+			break;
+		}
+
+		heapTuple = heap_form_tuple(tupleDescriptor, columnValues, columnNulls);
+		heap_insert(relation, heapTuple, commandId, 0, bulkInsertState);
+
+		MemoryContextSwitchTo(oldContext);
+
+		copiedRowCount++;
+	}
+
+	FreeBulkInsertState(bulkInsertState);
+	EndHybridCopyFrom(copyState);
+	MemoryContextDelete(rowContext);
+
+	pfree(columnValues);
+	pfree(columnNulls);
+
+	return copiedRowCount;
+}
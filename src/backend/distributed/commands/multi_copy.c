@@ -13,10 +13,11 @@
  * node.
  *
  * If this is the first command in the transaction, we open a new connection for
- * every shard placement. Otherwise we open as many connections as we can to
- * not conflict with previous commands in transactions, in which case some shards
- * may share connections. See the comments of CopyConnectionState for how we
- * operate in that case.
+ * every shard placement, up to citus.max_adaptive_executor_pool_size connections
+ * per node. Otherwise we open as many connections as we can to not conflict with
+ * previous commands in transactions. In both cases some shards may share
+ * connections. See the comments of CopyConnectionState for how we operate in
+ * that case.
  *
  * We use the PQputCopyData function to copy the data. Because PQputCopyData
  * transmits data asynchronously, the workers will ingest data at least partially
@@ -69,9 +70,13 @@
 #include "commands/defrem.h"
 #include "distributed/commands/multi_copy.h"
 #include "distributed/commands/utility_hook.h"
+#include "distributed/copy_out_executor.h"
+#include "distributed/copy_progress.h"
 #include "distributed/intermediate_results.h"
+#include "distributed/local_executor.h"
 #include "distributed/master_protocol.h"
 #include "distributed/metadata_cache.h"
+#include "distributed/multi_join_order.h"
 #include "distributed/multi_partitioning_utils.h"
 #include "distributed/multi_physical_planner.h"
 #include "distributed/multi_router_planner.h"
@@ -91,15 +96,30 @@
 #include "nodes/makefuncs.h"
 #include "tsearch/ts_locale.h"
 #include "utils/builtins.h"
+#include "utils/datum.h"
 #include "utils/lsyscache.h"
 #include "utils/rel.h"
 #include "utils/syscache.h"
 #include "utils/memutils.h"
+#include "utils/timestamp.h"
+#include "utils/typcache.h"
 
 
 /* constant used in binary protocol */
 static const char BinarySignature[11] = "PGCOPY\n\377\r\n\0";
 
+/*
+ * Whether COPY FROM in text or csv format may forward the raw fields of the
+ * rows to the workers instead of decoding and re-encoding all their values.
+ */
+bool EnableCopyPassThrough = false;
+
+/* what COPY FROM into existing shards does with conflicting rows */
+int CopyOnConflict = COPY_ON_CONFLICT_ERROR;
+
+/* number of shards that COPY into an append-distributed table fills concurrently */
+int CopyAppendShardCount = 1;
+
 /* use a global connection to the master node in order to skip passing it around */
 static MultiConnection *masterConnection = NULL;
 
@@ -112,6 +132,26 @@ static MultiConnection *masterConnection = NULL;
  */
 #define COPY_SWITCH_OVER_THRESHOLD (4 * 1024 * 1024)
 
+/*
+ * Data size threshold to send the rows of the active placement of a connection.
+ * Rows are batched into CopyData messages of roughly this size to avoid the
+ * overhead of a libpq call and a protocol message per row. It should be well
+ * below COPY_SWITCH_OVER_THRESHOLD.
+ */
+#define COPY_SEND_BATCH_THRESHOLD (64 * 1024)
+
+/*
+ * Data size threshold to move on to the next shard when COPY into an append-
+ * distributed table fills multiple shards concurrently. The rows of a shard
+ * are sent in blocks of roughly this size, and the blocks are distributed
+ * round-robin across the shards. When COPY fills a single shard, every row is
+ * sent as it is read.
+ */
+#define COPY_APPEND_BLOCK_SIZE (64 * 1024)
+
+/* prefix of the intermediate results in which rows are staged for upserts */
+#define COPY_UPSERT_RESULT_PREFIX "citus_copy_upsert"
+
 typedef struct CopyShardState CopyShardState;
 typedef struct CopyPlacementState CopyPlacementState;
 
@@ -120,9 +160,9 @@ typedef struct CopyPlacementState CopyPlacementState;
  * of those placements as the activePlacementState, and others in the
  * bufferedPlacementList. When we want to send a tuple to a CopyPlacementState,
  * we check if it is the active one in its connectionState, and in this case we
- * directly put data on wire. Otherwise, we buffer it so we can put it on wire
- * later, when copy ends or a switch-over happens. See CitusSendTupleToPlacements()
- * for more details.
+ * put data on wire in batches of COPY_SEND_BATCH_THRESHOLD. Otherwise, we buffer
+ * it so we can put it on wire later, when copy ends or a switch-over happens. See
+ * CitusSendTupleToPlacements() for more details.
  *
  * This is done so we are compatible with adaptive_executor. If a previous command
  * in the current transaction has been executed using adaptive_executor.c, then
@@ -130,8 +170,9 @@ typedef struct CopyPlacementState CopyPlacementState;
  * placements. We support that case by the buffering mechanism described above.
  *
  * If no previous command in the current transaction has used adaptive_executor.c,
- * then CopyGetPlacementConnection() returns one connection per placement and no
- * buffering happens and we put the copy data directly on connection.
+ * then CopyGetPlacementConnection() returns one connection per placement until
+ * the pool size of the node is reached, and placements only share connections
+ * beyond that point.
  */
 typedef struct CopyConnectionState
 {
@@ -152,6 +193,9 @@ typedef struct CopyConnectionState
 	 * In this case, old activePlacementState isn't NULL, is added to this list.
 	 */
 	dlist_head bufferedPlacementList;
+
+	/* number of placements that are assigned to the connection */
+	int placementCount;
 } CopyConnectionState;
 
 
@@ -165,13 +209,16 @@ struct CopyPlacementState
 
 	/*
 	 * Buffered COPY data. When the placement is activePlacementState of
-	 * some connection, this is empty. Because in that case we directly
-	 * send the data over connection.
+	 * some connection, this holds less than COPY_SEND_BATCH_THRESHOLD bytes
+	 * of rows that are about to be sent over the connection.
 	 */
 	StringInfo data;
 
 	/* List node for CopyConnectionState->bufferedPlacementList. */
 	dlist_node bufferedPlacementNode;
+
+	/* Progress of the node of the placement, NULL if not tracked. */
+	CopyNodeProgress *nodeProgress;
 };
 
 struct CopyShardState
@@ -184,6 +231,63 @@ struct CopyShardState
 };
 
 
+/*
+ * AppendShardState is a shard that COPY into an append-distributed table is
+ * currently filling. Rows are collected in blockData until a block is full,
+ * and the size and min/max partition column values of the rows that were
+ * copied so far are kept to update the shard statistics when the shard is
+ * finished.
+ */
+typedef struct AppendShardState
+{
+	/* shardId is INVALID_SHARD_ID while no shard is open */
+	ShardConnections *shardConnections;
+
+	/* rows that are not sent to the shard placements yet */
+	StringInfo blockData;
+
+	uint64 copiedDataSizeInBytes;
+
+	/* min/max partition column value, only valid if hasPartitionValue */
+	bool hasPartitionValue;
+	Datum minValue;
+	Datum maxValue;
+} AppendShardState;
+
+
+/*
+ * AppendCopyState holds the shards that COPY into an append-distributed table
+ * fills concurrently, and what is needed to keep their statistics.
+ */
+typedef struct AppendCopyState
+{
+	CopyStmt *copyStatement;
+	CopyOutState copyOutState;
+
+	int shardCount;
+	AppendShardState *shardStateArray;
+
+	/* shard that the next row is copied into */
+	int currentShardIndex;
+
+	/* size from which the block of a shard is sent, 0 to send every row */
+	int blockSize;
+
+	/*
+	 * Whether shard statistics are computed from the copied rows rather than
+	 * fetched from the workers, and how to compare and output the partition
+	 * column values to do so.
+	 */
+	bool localStatistics;
+	AttrNumber partitionColumnIndex;
+	Oid partitionColumnCollation;
+	FmgrInfo *compareFunction;
+	FmgrInfo *outputFunction;
+	int16 partitionTypeLength;
+	bool partitionTypeByValue;
+} AppendCopyState;
+
+
 /* Local functions forward declarations */
 static void CopyFromWorkerNode(CopyStmt *copyStatement, char *completionTag);
 static void CopyToExistingShards(CopyStmt *copyStatement, char *completionTag);
@@ -196,6 +300,7 @@ static void OpenCopyConnectionsForNewShards(CopyStmt *copyStatement,
 											bool useBinaryCopyFormat);
 
 static bool BinaryOutputFunctionDefined(Oid typeId);
+static bool BinaryInputFunctionDefined(Oid typeId);
 static List * MasterShardPlacementList(uint64 shardId);
 static List * RemoteFinalizedShardPlacementList(uint64 shardId);
 static void SendCopyBinaryHeaders(CopyOutState copyOutState, int64 shardId,
@@ -214,6 +319,21 @@ static int64 StartCopyToNewShard(ShardConnections *shardConnections,
 static int64 MasterCreateEmptyShard(char *relationName);
 static int64 CreateEmptyShard(char *relationName);
 static int64 RemoteCreateEmptyShard(char *relationName);
+static AppendCopyState * CreateAppendCopyState(CopyStmt *copyStatement,
+											   CopyOutState copyOutState,
+											   Oid relationId);
+static void CopyRowToAppendShard(AppendCopyState *appendCopyState, Datum *columnValues,
+								 bool *columnNulls, TupleDesc tupleDescriptor,
+								 FmgrInfo *columnOutputFunctions);
+static void AddAppendShardPartitionValue(AppendCopyState *appendCopyState,
+										 AppendShardState *shardState,
+										 Datum *columnValues, bool *columnNulls);
+static void ReplaceAppendShardValue(AppendCopyState *appendCopyState, Datum *target,
+									Datum value);
+static void SendAppendShardBlock(AppendShardState *shardState);
+static void EndAppendShardCopy(AppendCopyState *appendCopyState,
+							   AppendShardState *shardState);
+static text * AppendShardValueText(AppendCopyState *appendCopyState, Datum value);
 static void MasterUpdateShardStatistics(uint64 shardId);
 static void RemoteUpdateShardStatistics(uint64 shardId);
 
@@ -225,7 +345,7 @@ static CopyCoercionData * ColumnCoercionPaths(TupleDesc destTupleDescriptor,
 											  Oid destRelId, List *columnNameList,
 											  Oid *finalColumnTypeArray);
 static FmgrInfo * TypeOutputFunctions(uint32 columnCount, Oid *typeIdArray,
-									  bool binaryFormat);
+									  bool binaryFormat, bool *textColumns);
 static Datum CoerceColumnValue(Datum inputValue, CopyCoercionData *coercionPath);
 static void CreateLocalTable(RangeVar *relation, char *nodeName, int32 nodePort);
 static List * CopyGetAttnums(TupleDesc tupDesc, Relation rel, List *attnamelist);
@@ -239,18 +359,30 @@ static CopyConnectionState * GetConnectionState(HTAB *connectionStateHash,
 												MultiConnection *connection);
 static CopyShardState * GetShardState(uint64 shardId, HTAB *shardStateHash,
 									  HTAB *connectionStateHash, bool stopOnFailure,
-									  bool *found);
-static MultiConnection * CopyGetPlacementConnection(ShardPlacement *placement,
+									  CopyProgress *copyProgress, bool *found);
+static MultiConnection * CopyGetPlacementConnection(HTAB *connectionStateHash,
+													ShardPlacement *placement,
 													bool stopOnFailure);
+static CopyConnectionState * LeastUsedNodeConnectionState(HTAB *connectionStateHash,
+														  ShardPlacement *placement,
+														  int *nodeConnectionCount);
+static MultiConnection * ShareCopyConnection(CopyConnectionState *connectionState,
+											 ShardPlacementAccess *placementAccess);
 static List * ConnectionStateList(HTAB *connectionStateHash);
 static void InitializeCopyShardState(CopyShardState *shardState,
 									 HTAB *connectionStateHash,
-									 uint64 shardId, bool stopOnFailure);
+									 uint64 shardId, bool stopOnFailure,
+									 CopyProgress *copyProgress);
 static void StartPlacementStateCopyCommand(CopyPlacementState *placementState,
 										   CopyStmt *copyStatement,
 										   CopyOutState copyOutState);
 static void EndPlacementStateCopyCommand(CopyPlacementState *placementState,
-										 CopyOutState copyOutState);
+										 CitusCopyDestReceiver *copyDest);
+static char * CopyOnConflictClause(Relation relation, List *columnNameList,
+								   List *copiedColumnNameList);
+static void InitializeCopyUpsert(CitusCopyDestReceiver *copyDest);
+static void UpsertCopiedRows(CitusCopyDestReceiver *copyDest, uint64 shardId,
+							 MultiConnection *connection);
 static void UnclaimCopyConnections(List *connectionStateList);
 static void ShutdownCopyConnectionState(CopyConnectionState *connectionState,
 										CitusCopyDestReceiver *copyDest);
@@ -263,6 +395,16 @@ static void CopySendInt32(CopyOutState outputState, int32 val);
 static void CopySendInt16(CopyOutState outputState, int16 val);
 static void CopyAttributeOutText(CopyOutState outputState, char *string);
 static inline void CopyFlushOutput(CopyOutState outputState, char *start, char *pointer);
+static bool CanUseCopyPassThrough(CopyStmt *copyStatement, Relation relation);
+static void CheckCopyRawFieldCount(int fieldCount, TupleDesc tupleDescriptor);
+static void CitusSendRawFieldsToPlacements(CitusCopyDestReceiver *copyDest,
+										   Datum *columnValues, bool *columnNulls,
+										   char **fieldArray, int fieldCount);
+static void AppendCopyRawFieldsData(char **fieldArray, int fieldCount,
+									CopyOutState rowOutputState);
+static CopyShardState * GetShardStateForRow(CitusCopyDestReceiver *copyDest,
+											int64 shardId);
+static void AppendRowDataToPlacements(CopyShardState *shardState, StringInfo rowData);
 static bool CitusSendTupleToPlacements(TupleTableSlot *slot,
 									   CitusCopyDestReceiver *copyDest);
 static uint64 ShardIdForTuple(CitusCopyDestReceiver *copyDest, Datum *columnValues,
@@ -453,6 +595,12 @@ CopyToExistingShards(CopyStmt *copyStatement, char *completionTag)
 	CopyState copyState = NULL;
 	uint64 processedRowCount = 0;
 
+	bool passThrough = false;
+	int partitionFieldIndex = 0;
+	FmgrInfo partitionInputFunction;
+	Oid partitionTypeIOParam = InvalidOid;
+	int32 partitionTypeMod = -1;
+
 	ErrorContextCallback errorCallback;
 
 	/* allocate column values and nulls arrays */
@@ -487,6 +635,23 @@ CopyToExistingShards(CopyStmt *copyStatement, char *completionTag)
 		}
 
 		columnNameList = lappend(columnNameList, columnName);
+
+		/* raw fields only hold the columns that are not dropped */
+		if (columnIndex < partitionColumnIndex)
+		{
+			partitionFieldIndex++;
+		}
+	}
+
+	passThrough = CanUseCopyPassThrough(copyStatement, distributedRelation);
+	if (passThrough && partitionColumnIndex != INVALID_PARTITION_COLUMN_INDEX)
+	{
+		Oid inputFunctionId = InvalidOid;
+
+		getTypeInputInfo(partitionColumn->vartype, &inputFunctionId,
+						 &partitionTypeIOParam);
+		fmgr_info(inputFunctionId, &partitionInputFunction);
+		partitionTypeMod = partitionColumn->vartypmod;
 	}
 
 	executorState = CreateExecutorState();
@@ -502,6 +667,14 @@ CopyToExistingShards(CopyStmt *copyStatement, char *completionTag)
 	/* set up the destination for the COPY */
 	copyDest = CreateCitusCopyDestReceiver(tableId, columnNameList, partitionColumnIndex,
 										   executorState, stopOnFailure, NULL);
+	copyDest->passThrough = passThrough;
+	if (CopyOnConflict != COPY_ON_CONFLICT_ERROR)
+	{
+		copyDest->upsertConflictClause =
+			CopyOnConflictClause(distributedRelation, columnNameList,
+								 copyStatement->attlist);
+	}
+
 	dest = (DestReceiver *) copyDest;
 	dest->rStartup(dest, 0, tupleDescriptor);
 
@@ -554,15 +727,25 @@ CopyToExistingShards(CopyStmt *copyStatement, char *completionTag)
 	while (true)
 	{
 		bool nextRowFound = false;
+		char **fieldArray = NULL;
+		int fieldCount = 0;
 		MemoryContext oldContext = NULL;
 
 		ResetPerTupleExprContext(executorState);
 
 		oldContext = MemoryContextSwitchTo(executorTupleContext);
 
-		/* parse a row from the input */
-		nextRowFound = NextCopyFromCompat(copyState, executorExpressionContext,
-										  columnValues, columnNulls);
+		if (passThrough)
+		{
+			/* split a row from the input into fields, without decoding them */
+			nextRowFound = NextCopyFromRawFields(copyState, &fieldArray, &fieldCount);
+		}
+		else
+		{
+			/* parse a row from the input */
+			nextRowFound = NextCopyFromCompat(copyState, executorExpressionContext,
+											  columnValues, columnNulls);
+		}
 
 		if (!nextRowFound)
 		{
@@ -570,11 +753,38 @@ CopyToExistingShards(CopyStmt *copyStatement, char *completionTag)
 			break;
 		}
 
+		/* only decode the partition column to find the shard */
+		if (passThrough)
+		{
+			CheckCopyRawFieldCount(fieldCount, tupleDescriptor);
+
+			if (partitionColumnIndex != INVALID_PARTITION_COLUMN_INDEX)
+			{
+				char *partitionField = fieldArray[partitionFieldIndex];
+
+				columnNulls[partitionColumnIndex] = (partitionField == NULL);
+				if (partitionField != NULL)
+				{
+					columnValues[partitionColumnIndex] =
+						InputFunctionCall(&partitionInputFunction, partitionField,
+										  partitionTypeIOParam, partitionTypeMod);
+				}
+			}
+		}
+
 		CHECK_FOR_INTERRUPTS();
 
 		MemoryContextSwitchTo(oldContext);
 
-		dest->receiveSlot(tupleTableSlot, dest);
+		if (passThrough)
+		{
+			CitusSendRawFieldsToPlacements(copyDest, columnValues, columnNulls,
+										   fieldArray, fieldCount);
+		}
+		else
+		{
+			dest->receiveSlot(tupleTableSlot, dest);
+		}
 
 		processedRowCount += 1;
 	}
@@ -604,9 +814,112 @@ CopyToExistingShards(CopyStmt *copyStatement, char *completionTag)
 }
 
 
+/*
+ * CanUseCopyPassThrough returns whether COPY FROM into the given relation can
+ * forward the raw text fields of the rows to the workers, and only decode the
+ * partition column to route the rows. This skips the input and output
+ * functions of all the other columns. The values are then only validated on
+ * the workers, which is why this is only done if citus.enable_copy_pass_through
+ * is set.
+ *
+ * The rows have to contain all the columns, since the defaults of the missing
+ * columns would otherwise be evaluated on the workers, and the per-column
+ * options that are applied after splitting the rows are not supported.
+ */
+static bool
+CanUseCopyPassThrough(CopyStmt *copyStatement, Relation relation)
+{
+	TupleDesc tupleDescriptor = RelationGetDescr(relation);
+	List *copyAttnumList = NIL;
+	List *relationAttnumList = NIL;
+	ListCell *optionCell = NULL;
+
+	if (!EnableCopyPassThrough)
+	{
+		return false;
+	}
+
+	if (CopyStatementHasFormat(copyStatement, "binary"))
+	{
+		return false;
+	}
+
+	foreach(optionCell, copyStatement->options)
+	{
+		DefElem *defel = (DefElem *) lfirst(optionCell);
+
+		if (strncmp(defel->defname, "force_not_null", NAMEDATALEN) == 0 ||
+			strncmp(defel->defname, "force_null", NAMEDATALEN) == 0)
+		{
+			return false;
+		}
+	}
+
+#if PG_VERSION_NUM >= 120000
+	if (tupleDescriptor->constr != NULL && tupleDescriptor->constr->has_generated_stored)
+	{
+		return false;
+	}
+#endif
+
+	copyAttnumList = CopyGetAttnums(tupleDescriptor, relation, copyStatement->attlist);
+	relationAttnumList = CopyGetAttnums(tupleDescriptor, relation, NIL);
+
+	return equal(copyAttnumList, relationAttnumList);
+}
+
+
+/*
+ * CheckCopyRawFieldCount errors out if the number of raw fields in a row
+ * does not match the number of columns, like NextCopyFrom() would.
+ */
+static void
+CheckCopyRawFieldCount(int fieldCount, TupleDesc tupleDescriptor)
+{
+	int columnCount = (int) AvailableColumnCount(tupleDescriptor);
+
+	if (fieldCount > columnCount)
+	{
+		ereport(ERROR, (errcode(ERRCODE_BAD_COPY_FILE_FORMAT),
+						errmsg("extra data after last expected column")));
+	}
+	else if (fieldCount < columnCount)
+	{
+		int availableColumnIndex = 0;
+		int columnIndex = 0;
+
+		for (columnIndex = 0; columnIndex < tupleDescriptor->natts; columnIndex++)
+		{
+			Form_pg_attribute currentColumn = TupleDescAttr(tupleDescriptor,
+															columnIndex);
+
+			if (currentColumn->attisdropped)
+			{
+				continue;
+			}
+
+			if (availableColumnIndex == fieldCount)
+			{
+				ereport(ERROR, (errcode(ERRCODE_BAD_COPY_FILE_FORMAT),
+								errmsg("missing data for column \"%s\"",
+									   NameStr(currentColumn->attname))));
+			}
+
+			availableColumnIndex++;
+		}
+	}
+}
+
+
 /*
  * CopyToNewShards implements the COPY table_name FROM ... for append-partitioned
  * tables where we create new shards into which to copy rows.
+ *
+ * The rows are copied into citus.copy_append_shard_count shards concurrently,
+ * which are created on demand and filled in blocks of COPY_APPEND_BLOCK_SIZE
+ * bytes in round-robin order. When a shard exceeds citus.shard_max_size, it is
+ * finished and a new shard takes its place. With a single shard, rows are sent
+ * one by one and shard statistics are fetched from the placements as before.
  */
 static void
 CopyToNewShards(CopyStmt *copyStatement, char *completionTag, Oid relationId)
@@ -629,14 +942,10 @@ CopyToNewShards(CopyStmt *copyStatement, char *completionTag, Oid relationId)
 
 	ErrorContextCallback errorCallback;
 
-	int64 currentShardId = INVALID_SHARD_ID;
-	uint64 shardMaxSizeInBytes = (int64) ShardMaxSize * 1024L;
-	uint64 copiedDataSizeInBytes = 0;
+	AppendCopyState *appendCopyState = NULL;
+	int shardIndex = 0;
 	uint64 processedRowCount = 0;
 
-	ShardConnections *shardConnections =
-		(ShardConnections *) palloc0(sizeof(ShardConnections));
-
 	/* initialize copy state to read from COPY data source */
 	CopyState copyState = BeginCopyFrom(NULL,
 										distributedRelation,
@@ -668,11 +977,12 @@ CopyToNewShards(CopyStmt *copyStatement, char *completionTag, Oid relationId)
 	 */
 	copyStatement->attlist = NIL;
 
+	appendCopyState = CreateAppendCopyState(copyStatement, copyOutState, relationId);
+
 	while (true)
 	{
 		bool nextRowFound = false;
 		MemoryContext oldContext = NULL;
-		uint64 messageBufferSize = 0;
 
 		ResetPerTupleExprContext(executorState);
 
@@ -698,76 +1008,24 @@ CopyToNewShards(CopyStmt *copyStatement, char *completionTag, Oid relationId)
 		MemoryContextSwitchTo(oldContext);
 		error_context_stack = errorCallback.previous;
 
-		/*
-		 * If copied data size is zero, this means either this is the first
-		 * line in the copy or we just filled the previous shard up to its
-		 * capacity. Either way, we need to create a new shard and
-		 * start copying new rows into it.
-		 */
-		if (copiedDataSizeInBytes == 0)
-		{
-			/* create shard and open connections to shard placements */
-			currentShardId = StartCopyToNewShard(shardConnections, copyStatement,
-												 copyOutState->binary);
-
-			/* send copy binary headers to shard placements */
-			if (copyOutState->binary)
-			{
-				SendCopyBinaryHeaders(copyOutState, currentShardId,
-									  shardConnections->connectionList);
-			}
-		}
-
-		/* replicate row to shard placements */
-		resetStringInfo(copyOutState->fe_msgbuf);
-		AppendCopyRowData(columnValues, columnNulls, tupleDescriptor,
-						  copyOutState, columnOutputFunctions, NULL);
-		SendCopyDataToAll(copyOutState->fe_msgbuf, currentShardId,
-						  shardConnections->connectionList);
-
-		messageBufferSize = copyOutState->fe_msgbuf->len;
-		copiedDataSizeInBytes = copiedDataSizeInBytes + messageBufferSize;
-
-		/*
-		 * If we filled up this shard to its capacity, send copy binary footers
-		 * to shard placements, and update shard statistics.
-		 */
-		if (copiedDataSizeInBytes > shardMaxSizeInBytes)
-		{
-			Assert(currentShardId != INVALID_SHARD_ID);
-
-			if (copyOutState->binary)
-			{
-				SendCopyBinaryFooters(copyOutState, currentShardId,
-									  shardConnections->connectionList);
-			}
-
-			EndRemoteCopy(currentShardId, shardConnections->connectionList);
-			MasterUpdateShardStatistics(shardConnections->shardId);
-
-			copiedDataSizeInBytes = 0;
-			currentShardId = INVALID_SHARD_ID;
-		}
+		CopyRowToAppendShard(appendCopyState, columnValues, columnNulls,
+							 tupleDescriptor, columnOutputFunctions);
 
 		processedRowCount += 1;
 	}
 
 	/*
-	 * For the last shard, send copy binary footers to shard placements,
-	 * and update shard statistics. If no row is send, there is no shard
-	 * to finalize the copy command.
+	 * Finish the shards that are still open. If no row is sent, there is no
+	 * shard to finalize the copy command.
 	 */
-	if (copiedDataSizeInBytes > 0)
+	for (shardIndex = 0; shardIndex < appendCopyState->shardCount; shardIndex++)
 	{
-		Assert(currentShardId != INVALID_SHARD_ID);
+		AppendShardState *shardState = &appendCopyState->shardStateArray[shardIndex];
 
-		if (copyOutState->binary)
+		if (shardState->shardConnections->shardId != INVALID_SHARD_ID)
 		{
-			SendCopyBinaryFooters(copyOutState, currentShardId,
-								  shardConnections->connectionList);
+			EndAppendShardCopy(appendCopyState, shardState);
 		}
-		EndRemoteCopy(currentShardId, shardConnections->connectionList);
-		MasterUpdateShardStatistics(shardConnections->shardId);
 	}
 
 	EndCopyFrom(copyState);
@@ -784,6 +1042,284 @@ CopyToNewShards(CopyStmt *copyStatement, char *completionTag, Oid relationId)
 }
 
 
+/*
+ * CreateAppendCopyState creates the state for copying rows into new shards of
+ * the given append-distributed table.
+ *
+ * When COPY fills multiple shards and the metadata is on this node, the
+ * statistics of the new shards are computed from the copied rows, which avoids
+ * querying the shard placements after every shard. Otherwise, the statistics
+ * are fetched from the placements, on the master node when copying from a
+ * worker, since the partition column is not known locally.
+ */
+static AppendCopyState *
+CreateAppendCopyState(CopyStmt *copyStatement, CopyOutState copyOutState,
+					  Oid relationId)
+{
+	AppendCopyState *appendCopyState = palloc0(sizeof(AppendCopyState));
+	int shardIndex = 0;
+
+	appendCopyState->copyStatement = copyStatement;
+	appendCopyState->copyOutState = copyOutState;
+	appendCopyState->shardCount = CopyAppendShardCount;
+	appendCopyState->shardStateArray =
+		palloc0(appendCopyState->shardCount * sizeof(AppendShardState));
+	appendCopyState->currentShardIndex = 0;
+	appendCopyState->blockSize = 0;
+
+	for (shardIndex = 0; shardIndex < appendCopyState->shardCount; shardIndex++)
+	{
+		AppendShardState *shardState = &appendCopyState->shardStateArray[shardIndex];
+
+		shardState->shardConnections = palloc0(sizeof(ShardConnections));
+		shardState->shardConnections->shardId = INVALID_SHARD_ID;
+		shardState->blockData = makeStringInfo();
+	}
+
+	if (appendCopyState->shardCount == 1)
+	{
+		return appendCopyState;
+	}
+
+	appendCopyState->blockSize = COPY_APPEND_BLOCK_SIZE;
+
+	if (masterConnection == NULL)
+	{
+		uint32 rangeTableId = 1;
+		Var *partitionColumn = PartitionColumn(relationId, rangeTableId);
+		TypeCacheEntry *typeEntry = lookup_type_cache(partitionColumn->vartype,
+													  TYPECACHE_CMP_PROC_FINFO);
+
+		if (OidIsValid(typeEntry->cmp_proc_finfo.fn_oid))
+		{
+			Oid outputFunctionId = InvalidOid;
+			bool typeVarLength = false;
+
+			appendCopyState->localStatistics = true;
+			appendCopyState->partitionColumnIndex = partitionColumn->varattno - 1;
+			appendCopyState->partitionColumnCollation = partitionColumn->varcollid;
+			appendCopyState->compareFunction = &typeEntry->cmp_proc_finfo;
+			appendCopyState->partitionTypeLength = typeEntry->typlen;
+			appendCopyState->partitionTypeByValue = typeEntry->typbyval;
+
+			getTypeOutputInfo(partitionColumn->vartype, &outputFunctionId,
+							  &typeVarLength);
+			appendCopyState->outputFunction = palloc0(sizeof(FmgrInfo));
+			fmgr_info(outputFunctionId, appendCopyState->outputFunction);
+		}
+	}
+
+	return appendCopyState;
+}
+
+
+/*
+ * CopyRowToAppendShard adds the given row to the block of the current shard,
+ * creating the shard if necessary. The block is sent when it is full, and the
+ * shard is finished when it exceeds citus.shard_max_size. Either way, the next
+ * row goes to the next shard.
+ */
+static void
+CopyRowToAppendShard(AppendCopyState *appendCopyState, Datum *columnValues,
+					 bool *columnNulls, TupleDesc tupleDescriptor,
+					 FmgrInfo *columnOutputFunctions)
+{
+	CopyOutState copyOutState = appendCopyState->copyOutState;
+	AppendShardState *shardState =
+		&appendCopyState->shardStateArray[appendCopyState->currentShardIndex];
+	ShardConnections *shardConnections = shardState->shardConnections;
+	uint64 shardMaxSizeInBytes = (int64) ShardMaxSize * 1024L;
+	bool moveToNextShard = false;
+
+	if (shardConnections->shardId == INVALID_SHARD_ID)
+	{
+		/* create shard and open connections to shard placements */
+		int64 shardId = StartCopyToNewShard(shardConnections,
+											appendCopyState->copyStatement,
+											copyOutState->binary);
+
+		/* send copy binary headers to shard placements */
+		if (copyOutState->binary)
+		{
+			SendCopyBinaryHeaders(copyOutState, shardId,
+								  shardConnections->connectionList);
+		}
+	}
+
+	resetStringInfo(copyOutState->fe_msgbuf);
+	AppendCopyRowData(columnValues, columnNulls, tupleDescriptor,
+					  copyOutState, columnOutputFunctions, NULL);
+	appendBinaryStringInfo(shardState->blockData, copyOutState->fe_msgbuf->data,
+						   copyOutState->fe_msgbuf->len);
+
+	shardState->copiedDataSizeInBytes += copyOutState->fe_msgbuf->len;
+
+	AddAppendShardPartitionValue(appendCopyState, shardState, columnValues,
+								 columnNulls);
+
+	if (shardState->copiedDataSizeInBytes > shardMaxSizeInBytes)
+	{
+		/* we filled up this shard to its capacity */
+		EndAppendShardCopy(appendCopyState, shardState);
+		moveToNextShard = true;
+	}
+	else if (shardState->blockData->len >= appendCopyState->blockSize)
+	{
+		SendAppendShardBlock(shardState);
+		moveToNextShard = true;
+	}
+
+	if (moveToNextShard)
+	{
+		appendCopyState->currentShardIndex =
+			(appendCopyState->currentShardIndex + 1) % appendCopyState->shardCount;
+	}
+}
+
+
+/*
+ * AddAppendShardPartitionValue updates the min/max partition column values of
+ * the given shard with the partition column value of the given row.
+ */
+static void
+AddAppendShardPartitionValue(AppendCopyState *appendCopyState,
+							 AppendShardState *shardState,
+							 Datum *columnValues, bool *columnNulls)
+{
+	AttrNumber partitionColumnIndex = appendCopyState->partitionColumnIndex;
+	Oid collation = appendCopyState->partitionColumnCollation;
+	Datum partitionValue = 0;
+
+	if (!appendCopyState->localStatistics || columnNulls[partitionColumnIndex])
+	{
+		return;
+	}
+
+	partitionValue = columnValues[partitionColumnIndex];
+
+	if (!shardState->hasPartitionValue)
+	{
+		ReplaceAppendShardValue(appendCopyState, &shardState->minValue, partitionValue);
+		ReplaceAppendShardValue(appendCopyState, &shardState->maxValue, partitionValue);
+		shardState->hasPartitionValue = true;
+	}
+	else if (DatumGetInt32(FunctionCall2Coll(appendCopyState->compareFunction, collation,
+											 partitionValue,
+											 shardState->minValue)) < 0)
+	{
+		ReplaceAppendShardValue(appendCopyState, &shardState->minValue, partitionValue);
+	}
+	else if (DatumGetInt32(FunctionCall2Coll(appendCopyState->compareFunction, collation,
+											 partitionValue,
+											 shardState->maxValue)) > 0)
+	{
+		ReplaceAppendShardValue(appendCopyState, &shardState->maxValue, partitionValue);
+	}
+}
+
+
+/*
+ * ReplaceAppendShardValue replaces the min or max value in target with a copy
+ * of the given value, and frees the previous value. The values outlive the
+ * per-tuple memory context in which rows are parsed.
+ */
+static void
+ReplaceAppendShardValue(AppendCopyState *appendCopyState, Datum *target, Datum value)
+{
+	bool typeByValue = appendCopyState->partitionTypeByValue;
+	Datum previousValue = *target;
+
+	*target = datumCopy(value, typeByValue, appendCopyState->partitionTypeLength);
+
+	if (!typeByValue && DatumGetPointer(previousValue) != NULL)
+	{
+		pfree(DatumGetPointer(previousValue));
+	}
+}
+
+
+/*
+ * SendAppendShardBlock sends the block of rows of the given shard to all its
+ * placements, if there are any rows.
+ */
+static void
+SendAppendShardBlock(AppendShardState *shardState)
+{
+	ShardConnections *shardConnections = shardState->shardConnections;
+
+	if (shardState->blockData->len == 0)
+	{
+		return;
+	}
+
+	SendCopyDataToAll(shardState->blockData, shardConnections->shardId,
+					  shardConnections->connectionList);
+	resetStringInfo(shardState->blockData);
+}
+
+
+/*
+ * EndAppendShardCopy sends the remaining rows and copy binary footers to the
+ * placements of the given shard, ends the COPY, and updates shard statistics.
+ * Afterwards the shard state is ready to be used for a new shard.
+ */
+static void
+EndAppendShardCopy(AppendCopyState *appendCopyState, AppendShardState *shardState)
+{
+	CopyOutState copyOutState = appendCopyState->copyOutState;
+	ShardConnections *shardConnections = shardState->shardConnections;
+	int64 shardId = shardConnections->shardId;
+
+	Assert(shardId != INVALID_SHARD_ID);
+
+	SendAppendShardBlock(shardState);
+
+	if (copyOutState->binary)
+	{
+		SendCopyBinaryFooters(copyOutState, shardId, shardConnections->connectionList);
+	}
+
+	EndRemoteCopy(shardId, shardConnections->connectionList);
+
+	if (appendCopyState->localStatistics)
+	{
+		text *minValue = NULL;
+		text *maxValue = NULL;
+
+		if (shardState->hasPartitionValue)
+		{
+			minValue = AppendShardValueText(appendCopyState, shardState->minValue);
+			maxValue = AppendShardValueText(appendCopyState, shardState->maxValue);
+		}
+
+		SetShardStatistics(shardId, shardState->copiedDataSizeInBytes, minValue,
+						   maxValue);
+	}
+	else
+	{
+		MasterUpdateShardStatistics(shardId);
+	}
+
+	shardConnections->shardId = INVALID_SHARD_ID;
+	shardConnections->connectionList = NIL;
+	shardState->copiedDataSizeInBytes = 0;
+	shardState->hasPartitionValue = false;
+}
+
+
+/*
+ * AppendShardValueText returns the text representation of the given partition
+ * column value, as it is stored in pg_dist_shard.
+ */
+static text *
+AppendShardValueText(AppendCopyState *appendCopyState, Datum value)
+{
+	char *valueString = OutputFunctionCall(appendCopyState->outputFunction, value);
+
+	return cstring_to_text(valueString);
+}
+
+
 /*
  * MasterNodeAddress gets the master node address from copy options and returns
  * it. Note that if the master_port is not provided, we use 5432 as the default
@@ -1049,7 +1585,7 @@ CanUseBinaryCopyFormat(TupleDesc tupleDescription)
  * CanUseBinaryCopyFormatForType determines whether it is safe to use the
  * binary copy format for the given type. The binary copy format cannot
  * be used for arrays or composite types that contain user-defined types,
- * or when there is no binary output function defined.
+ * or when there is no binary output or input function defined.
  */
 bool
 CanUseBinaryCopyFormatForType(Oid typeId)
@@ -1059,6 +1595,11 @@ CanUseBinaryCopyFormatForType(Oid typeId)
 		return false;
 	}
 
+	if (!BinaryInputFunctionDefined(typeId))
+	{
+		return false;
+	}
+
 	if (typeId >= FirstNormalObjectId)
 	{
 		char typeCategory = '\0';
@@ -1076,6 +1617,68 @@ CanUseBinaryCopyFormatForType(Oid typeId)
 }
 
 
+/*
+ * HybridTextColumns returns which columns of the given tuple descriptor need
+ * to be sent as text when the others are sent in binary format, or NULL if
+ * either all or none of the columns can use the binary format.
+ */
+bool *
+HybridTextColumns(TupleDesc tupleDescriptor)
+{
+	uint32 columnCount = (uint32) tupleDescriptor->natts;
+	Oid *columnTypes = TypeArrayFromTupleDescriptor(tupleDescriptor);
+
+	return HybridTextColumnsForTypes(columnCount, columnTypes);
+}
+
+
+/*
+ * HybridTextColumnsForTypes returns which of the given types cannot use the
+ * binary copy format, or NULL if either all or none of them can use it. Such
+ * a mix of types is copied in Citus' hybrid row format: the binary format, in
+ * which the values of the returned columns are sent as text, and a header
+ * flag that tells the reader which columns these are. Postgres cannot read
+ * the hybrid format, so it is only used where Citus reads the data back.
+ * Dropped columns are passed as InvalidOid and never sent as text.
+ */
+bool *
+HybridTextColumnsForTypes(uint32 columnCount, Oid *typeIdArray)
+{
+	bool *textColumns = palloc0(columnCount * sizeof(bool));
+	bool hasBinaryColumn = false;
+	bool hasTextColumn = false;
+	uint32 columnIndex = 0;
+
+	for (columnIndex = 0; columnIndex < columnCount; columnIndex++)
+	{
+		Oid columnTypeId = typeIdArray[columnIndex];
+
+		if (columnTypeId == InvalidOid)
+		{
+			continue;
+		}
+
+		if (CanUseBinaryCopyFormatForType(columnTypeId))
+		{
+			hasBinaryColumn = true;
+		}
+		else
+		{
+			textColumns[columnIndex] = true;
+			hasTextColumn = true;
+		}
+	}
+
+	if (!hasBinaryColumn || !hasTextColumn)
+	{
+		pfree(textColumns);
+		return NULL;
+	}
+
+	return textColumns;
+}
+
+
 /*
  * BinaryOutputFunctionDefined checks whether binary output function is defined
  * for the given type.
@@ -1102,6 +1705,32 @@ BinaryOutputFunctionDefined(Oid typeId)
 }
 
 
+/*
+ * BinaryInputFunctionDefined checks whether binary input function is defined
+ * for the given type.
+ */
+static bool
+BinaryInputFunctionDefined(Oid typeId)
+{
+	Oid typeFunctionId = InvalidOid;
+	Oid typeIoParam = InvalidOid;
+	int16 typeLength = 0;
+	bool typeByVal = false;
+	char typeAlign = 0;
+	char typeDelim = 0;
+
+	get_type_io_data(typeId, IOFunc_receive, &typeLength, &typeByVal,
+					 &typeAlign, &typeDelim, &typeIoParam, &typeFunctionId);
+
+	if (OidIsValid(typeFunctionId))
+	{
+		return true;
+	}
+
+	return false;
+}
+
+
 /*
  * MasterShardPlacementList dispatches the finalized shard placements call
  * between local or remote master node according to the master connection state.
@@ -1559,10 +2188,12 @@ ColumnCoercionPaths(TupleDesc destTupleDescriptor, TupleDesc inputTupleDescripto
 
 /*
  * TypeOutputFunctions takes an array of types and returns an array of output functions
- * for those types.
+ * for those types. If textColumns is not NULL, the columns it marks use their text
+ * output function even in binary format.
  */
 static FmgrInfo *
-TypeOutputFunctions(uint32 columnCount, Oid *typeIdArray, bool binaryFormat)
+TypeOutputFunctions(uint32 columnCount, Oid *typeIdArray, bool binaryFormat,
+					bool *textColumns)
 {
 	FmgrInfo *columnOutputFunctions = palloc0(columnCount * sizeof(FmgrInfo));
 
@@ -1579,7 +2210,7 @@ TypeOutputFunctions(uint32 columnCount, Oid *typeIdArray, bool binaryFormat)
 		{
 			continue;
 		}
-		else if (binaryFormat)
+		else if (binaryFormat && (textColumns == NULL || !textColumns[columnIndex]))
 		{
 			getTypeBinaryOutputInfo(columnTypeId, &outputFunctionId, &typeVariableLength);
 		}
@@ -1606,7 +2237,25 @@ ColumnOutputFunctions(TupleDesc rowDescriptor, bool binaryFormat)
 	uint32 columnCount = (uint32) rowDescriptor->natts;
 	Oid *columnTypes = TypeArrayFromTupleDescriptor(rowDescriptor);
 	FmgrInfo *outputFunctions =
-		TypeOutputFunctions(columnCount, columnTypes, binaryFormat);
+		TypeOutputFunctions(columnCount, columnTypes, binaryFormat, NULL);
+
+	return outputFunctions;
+}
+
+
+/*
+ * HybridColumnOutputFunctions returns the output functions for writing rows of
+ * the given tuple descriptor in the hybrid row format, in which the given text
+ * columns use their text output function and the others their binary one.
+ */
+FmgrInfo *
+HybridColumnOutputFunctions(TupleDesc rowDescriptor, bool *textColumns)
+{
+	uint32 columnCount = (uint32) rowDescriptor->natts;
+	Oid *columnTypes = TypeArrayFromTupleDescriptor(rowDescriptor);
+	bool binaryFormat = true;
+	FmgrInfo *outputFunctions =
+		TypeOutputFunctions(columnCount, columnTypes, binaryFormat, textColumns);
 
 	return outputFunctions;
 }
@@ -1673,7 +2322,19 @@ AppendCopyRowData(Datum *valueArray, bool *isNullArray, TupleDesc rowDescriptor,
 		}
 		else if (rowOutputState->binary)
 		{
-			if (!isNull)
+			bool *textColumns = rowOutputState->textColumns;
+
+			if (!isNull && textColumns != NULL && textColumns[columnIndex])
+			{
+				/* hybrid row format, send the text without escaping */
+				FmgrInfo *outputFunctionPointer = &columnOutputFunctions[columnIndex];
+				char *columnText = OutputFunctionCall(outputFunctionPointer, value);
+				int32 columnTextLength = strlen(columnText);
+
+				CopySendInt32(rowOutputState, columnTextLength);
+				CopySendData(rowOutputState, columnText, columnTextLength);
+			}
+			else if (!isNull)
 			{
 				FmgrInfo *outputFunctionPointer = &columnOutputFunctions[columnIndex];
 				bytea *outputBytes = SendFunctionCall(outputFunctionPointer, value);
@@ -1799,19 +2460,26 @@ AvailableColumnCount(TupleDesc tupleDescriptor)
 
 /*
  * AppendCopyBinaryHeaders appends binary headers to the copy buffer in
- * headerOutputState.
+ * headerOutputState. If the state has text columns, the headers mark the
+ * data as being in the hybrid row format.
  */
 void
 AppendCopyBinaryHeaders(CopyOutState headerOutputState)
 {
 	const int32 zero = 0;
+	int32 flags = 0;
 	MemoryContext oldContext = MemoryContextSwitchTo(headerOutputState->rowcontext);
 
+	if (headerOutputState->textColumns != NULL)
+	{
+		flags |= HYBRID_COPY_FORMAT_FLAG;
+	}
+
 	/* Signature */
 	CopySendData(headerOutputState, BinarySignature, 11);
 
 	/* Flags field (no OIDs) */
-	CopySendInt32(headerOutputState, zero);
+	CopySendInt32(headerOutputState, flags);
 
 	/* No header extension */
 	CopySendInt32(headerOutputState, zero);
@@ -2216,6 +2884,12 @@ CitusCopyDestReceiverStartup(DestReceiver *dest, int operation,
 	const char *delimiterCharacter = "\t";
 	const char *nullPrintCharacter = "\\N";
 
+	/*
+	 * COPY opens connections to all the placements, which cannot see (and
+	 * could block on) the modifications done by a local execution.
+	 */
+	ErrorIfLocalExecutionHappened();
+
 	/* look up table properties */
 	distributedRelation = heap_open(tableId, RowExclusiveLock);
 	cacheEntry = DistributedTableCacheEntry(tableId);
@@ -2282,7 +2956,8 @@ CitusCopyDestReceiverStartup(DestReceiver *dest, int operation,
 	copyOutState->delim = (char *) delimiterCharacter;
 	copyOutState->null_print = (char *) nullPrintCharacter;
 	copyOutState->null_print_client = (char *) nullPrintCharacter;
-	copyOutState->binary = CanUseBinaryCopyFormat(inputTupleDescriptor);
+	copyOutState->binary = !copyDest->passThrough &&
+						   CanUseBinaryCopyFormat(inputTupleDescriptor);
 	copyOutState->fe_msgbuf = makeStringInfo();
 	copyOutState->rowcontext = GetPerTupleMemoryContext(copyDest->executorState);
 	copyDest->copyOutState = copyOutState;
@@ -2298,8 +2973,26 @@ CitusCopyDestReceiverStartup(DestReceiver *dest, int operation,
 			ColumnCoercionPaths(destTupleDescriptor, inputTupleDescriptor,
 								tableId, columnNameList, finalTypeArray);
 
+		/*
+		 * Intermediate results are read back by Citus, which understands the
+		 * hybrid row format, so only the columns that cannot use the binary
+		 * format need to be sent as text.
+		 */
+		if (!copyDest->passThrough &&
+			(copyDest->intermediateResultIdPrefix != NULL ||
+			 copyDest->upsertConflictClause != NULL))
+		{
+			copyOutState->textColumns =
+				HybridTextColumnsForTypes(columnCount, finalTypeArray);
+			if (copyOutState->textColumns != NULL)
+			{
+				copyOutState->binary = true;
+			}
+		}
+
 		copyDest->columnOutputFunctions =
-			TypeOutputFunctions(columnCount, finalTypeArray, copyOutState->binary);
+			TypeOutputFunctions(columnCount, finalTypeArray, copyOutState->binary,
+								copyOutState->textColumns);
 	}
 
 	/* ensure the column names are properly quoted in the COPY statement */
@@ -2331,6 +3024,18 @@ CitusCopyDestReceiverStartup(DestReceiver *dest, int operation,
 		formatResultOption = makeDefElem("format", (Node *) makeString("result"), -1);
 		copyStatement->options = list_make1(formatResultOption);
 	}
+	else if (copyDest->upsertConflictClause != NULL)
+	{
+		DefElem *formatResultOption = NULL;
+
+		/* stage the rows of each shard, which UpsertCopiedRows() then inserts */
+		copyStatement->relation = makeRangeVar(NULL, COPY_UPSERT_RESULT_PREFIX, -1);
+
+		formatResultOption = makeDefElem("format", (Node *) makeString("result"), -1);
+		copyStatement->options = list_make1(formatResultOption);
+
+		InitializeCopyUpsert(copyDest);
+	}
 	else
 	{
 		copyStatement->relation = makeRangeVar(schemaName, relationName, -1);
@@ -2346,25 +3051,143 @@ CitusCopyDestReceiverStartup(DestReceiver *dest, int operation,
 
 	copyDest->shardStateHash = CreateShardStateHash(TopTransactionContext);
 	copyDest->connectionStateHash = CreateConnectionStateHash(TopTransactionContext);
+	copyDest->copyProgress = CreateCopyProgress(tableId);
 
 	RecordRelationAccessIfReferenceTable(tableId, PLACEMENT_ACCESS_DML);
 }
 
 
 /*
- * CitusCopyDestReceiverReceive implements the receiveSlot function of
- * CitusCopyDestReceiver. It takes a TupleTableSlot and sends the contents to
- * the appropriate shard placement(s).
+ * CitusCopyDestReceiverReceive implements the receiveSlot function of
+ * CitusCopyDestReceiver. It takes a TupleTableSlot and sends the contents to
+ * the appropriate shard placement(s).
+ */
+static bool
+CitusCopyDestReceiverReceive(TupleTableSlot *slot, DestReceiver *dest)
+{
+	bool result = false;
+	CitusCopyDestReceiver *copyDest = (CitusCopyDestReceiver *) dest;
+
+	PG_TRY();
+	{
+		result = CitusSendTupleToPlacements(slot, copyDest);
+	}
+	PG_CATCH();
+	{
+		/*
+		 * We might be able to recover from errors with ROLLBACK TO SAVEPOINT,
+		 * so unclaim the connections before throwing errors.
+		 */
+		List *connectionStateList = ConnectionStateList(copyDest->connectionStateHash);
+		UnclaimCopyConnections(connectionStateList);
+
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	return result;
+}
+
+
+/*
+ * CitusSendTupleToPlacements sends the given TupleTableSlot to the appropriate
+ * shard placement(s).
+ */
+static bool
+CitusSendTupleToPlacements(TupleTableSlot *slot, CitusCopyDestReceiver *copyDest)
+{
+	TupleDesc tupleDescriptor = copyDest->tupleDescriptor;
+
+	CopyShardState *shardState = NULL;
+	CopyOutState copyOutState = copyDest->copyOutState;
+	StringInfo rowData = copyOutState->fe_msgbuf;
+	FmgrInfo *columnOutputFunctions = copyDest->columnOutputFunctions;
+	CopyCoercionData *columnCoercionPaths = copyDest->columnCoercionPaths;
+
+	Datum *columnValues = NULL;
+	bool *columnNulls = NULL;
+
+	int64 shardId = 0;
+
+	EState *executorState = copyDest->executorState;
+	MemoryContext executorTupleContext = GetPerTupleMemoryContext(executorState);
+	MemoryContext oldContext = MemoryContextSwitchTo(executorTupleContext);
+
+	slot_getallattrs(slot);
+
+	columnValues = slot->tts_values;
+	columnNulls = slot->tts_isnull;
+
+	shardId = ShardIdForTuple(copyDest, columnValues, columnNulls);
+
+	/* connections hash is kept in memory context */
+	MemoryContextSwitchTo(copyDest->memoryContext);
+
+	shardState = GetShardStateForRow(copyDest, shardId);
+
+	/* serialize the row once, regardless of the number of placements */
+	resetStringInfo(rowData);
+	AppendCopyRowData(columnValues, columnNulls, tupleDescriptor,
+					  copyOutState, columnOutputFunctions, columnCoercionPaths);
+
+	AppendRowDataToPlacements(shardState, rowData);
+
+	MemoryContextSwitchTo(oldContext);
+
+	copyDest->tuplesSent++;
+	if (copyDest->copyProgress != NULL)
+	{
+		copyDest->copyProgress->rowCount++;
+	}
+
+	/*
+	 * Release per tuple memory allocated in this function. If we're writing
+	 * the results of an INSERT ... SELECT then the SELECT execution will use
+	 * its own executor state and reset the per tuple expression context
+	 * separately.
+	 */
+	ResetPerTupleExprContext(executorState);
+
+	return true;
+}
+
+
+/*
+ * CitusSendRawFieldsToPlacements sends a row that COPY FROM parsed into the
+ * given raw text fields to the appropriate shard placement(s). Only the
+ * partition column value in columnValues and columnNulls is used for routing,
+ * the fields themselves are forwarded to the workers in text format without
+ * calling the input and output functions of their types.
  */
-static bool
-CitusCopyDestReceiverReceive(TupleTableSlot *slot, DestReceiver *dest)
+static void
+CitusSendRawFieldsToPlacements(CitusCopyDestReceiver *copyDest, Datum *columnValues,
+							   bool *columnNulls, char **fieldArray, int fieldCount)
 {
-	bool result = false;
-	CitusCopyDestReceiver *copyDest = (CitusCopyDestReceiver *) dest;
+	CopyShardState *shardState = NULL;
+	CopyOutState copyOutState = copyDest->copyOutState;
+	StringInfo rowData = copyOutState->fe_msgbuf;
+	int64 shardId = 0;
+
+	MemoryContext oldContext = NULL;
+
+	/* pass-through COPY is only used with text format on the workers */
+	Assert(!copyOutState->binary);
 
 	PG_TRY();
 	{
-		result = CitusSendTupleToPlacements(slot, copyDest);
+		shardId = ShardIdForTuple(copyDest, columnValues, columnNulls);
+
+		/* connections hash is kept in memory context */
+		oldContext = MemoryContextSwitchTo(copyDest->memoryContext);
+
+		shardState = GetShardStateForRow(copyDest, shardId);
+
+		resetStringInfo(rowData);
+		AppendCopyRawFieldsData(fieldArray, fieldCount, copyOutState);
+
+		AppendRowDataToPlacements(shardState, rowData);
+
+		MemoryContextSwitchTo(oldContext);
 	}
 	PG_CATCH();
 	{
@@ -2379,52 +3202,75 @@ CitusCopyDestReceiverReceive(TupleTableSlot *slot, DestReceiver *dest)
 	}
 	PG_END_TRY();
 
-	return result;
+	copyDest->tuplesSent++;
+	if (copyDest->copyProgress != NULL)
+	{
+		copyDest->copyProgress->rowCount++;
+	}
 }
 
 
 /*
- * CitusSendTupleToPlacements sends the given TupleTableSlot to the appropriate
- * shard placement(s).
+ * AppendCopyRawFieldsData appends the given raw text fields of a row to the
+ * copy buffer in rowOutputState, in the text format that the workers expect.
  */
-static bool
-CitusSendTupleToPlacements(TupleTableSlot *slot, CitusCopyDestReceiver *copyDest)
+static void
+AppendCopyRawFieldsData(char **fieldArray, int fieldCount, CopyOutState rowOutputState)
 {
-	TupleDesc tupleDescriptor = copyDest->tupleDescriptor;
-	CopyStmt *copyStatement = copyDest->copyStatement;
+	int fieldIndex = 0;
 
-	CopyShardState *shardState = NULL;
-	CopyOutState copyOutState = copyDest->copyOutState;
-	FmgrInfo *columnOutputFunctions = copyDest->columnOutputFunctions;
-	CopyCoercionData *columnCoercionPaths = copyDest->columnCoercionPaths;
-	ListCell *placementStateCell = NULL;
-	bool cachedShardStateFound = false;
-	bool firstTupleInShard = false;
+	MemoryContext oldContext = MemoryContextSwitchTo(rowOutputState->rowcontext);
 
-	bool stopOnFailure = copyDest->stopOnFailure;
+	for (fieldIndex = 0; fieldIndex < fieldCount; fieldIndex++)
+	{
+		char *field = fieldArray[fieldIndex];
 
-	Datum *columnValues = NULL;
-	bool *columnNulls = NULL;
+		if (fieldIndex > 0)
+		{
+			CopySendChar(rowOutputState, rowOutputState->delim[0]);
+		}
 
-	int64 shardId = 0;
+		if (field != NULL)
+		{
+			CopyAttributeOutText(rowOutputState, field);
+		}
+		else
+		{
+			CopySendString(rowOutputState, rowOutputState->null_print_client);
+		}
+	}
 
-	EState *executorState = copyDest->executorState;
-	MemoryContext executorTupleContext = GetPerTupleMemoryContext(executorState);
-	MemoryContext oldContext = MemoryContextSwitchTo(executorTupleContext);
+	/* append default line termination string depending on the platform */
+#ifndef WIN32
+	CopySendChar(rowOutputState, '\n');
+#else
+	CopySendString(rowOutputState, "\r\n");
+#endif
 
-	slot_getallattrs(slot);
+	MemoryContextSwitchTo(oldContext);
+}
 
-	columnValues = slot->tts_values;
-	columnNulls = slot->tts_isnull;
 
-	shardId = ShardIdForTuple(copyDest, columnValues, columnNulls);
+/*
+ * GetShardStateForRow returns the state of the given shard, after starting
+ * the COPY on the placements of the shard if necessary, such that a row
+ * can be appended to the placements with AppendRowDataToPlacements().
+ */
+static CopyShardState *
+GetShardStateForRow(CitusCopyDestReceiver *copyDest, int64 shardId)
+{
+	CopyStmt *copyStatement = copyDest->copyStatement;
+	CopyOutState copyOutState = copyDest->copyOutState;
+	CopyShardState *shardState = NULL;
+	ListCell *placementStateCell = NULL;
+	bool cachedShardStateFound = false;
+	bool firstTupleInShard = false;
 
-	/* connections hash is kept in memory context */
-	MemoryContextSwitchTo(copyDest->memoryContext);
+	bool stopOnFailure = copyDest->stopOnFailure;
 
 	shardState = GetShardState(shardId, copyDest->shardStateHash,
 							   copyDest->connectionStateHash, stopOnFailure,
-							   &cachedShardStateFound);
+							   copyDest->copyProgress, &cachedShardStateFound);
 	if (!cachedShardStateFound)
 	{
 		firstTupleInShard = true;
@@ -2445,13 +3291,17 @@ CitusSendTupleToPlacements(TupleTableSlot *slot, CitusCopyDestReceiver *copyDest
 		}
 	}
 
+	/*
+	 * Switch the active placements of the connections before the row is
+	 * serialized, since starting and ending COPY commands use the same output
+	 * buffer as the row serialization.
+	 */
 	foreach(placementStateCell, shardState->placementStateList)
 	{
 		CopyPlacementState *currentPlacementState = lfirst(placementStateCell);
 		CopyConnectionState *connectionState = currentPlacementState->connectionState;
 		CopyPlacementState *activePlacementState = connectionState->activePlacementState;
 		bool switchToCurrentPlacement = false;
-		bool sendTupleOverConnection = false;
 
 		if (activePlacementState == NULL)
 		{
@@ -2463,7 +3313,7 @@ CitusSendTupleToPlacements(TupleTableSlot *slot, CitusCopyDestReceiver *copyDest
 			switchToCurrentPlacement = true;
 
 			/* before switching, make sure to finish the copy */
-			EndPlacementStateCopyCommand(activePlacementState, copyOutState);
+			EndPlacementStateCopyCommand(activePlacementState, copyDest);
 			dlist_push_head(&connectionState->bufferedPlacementList,
 							&activePlacementState->bufferedPlacementNode);
 		}
@@ -2474,55 +3324,55 @@ CitusSendTupleToPlacements(TupleTableSlot *slot, CitusCopyDestReceiver *copyDest
 										   copyOutState);
 			dlist_delete(&currentPlacementState->bufferedPlacementNode);
 			connectionState->activePlacementState = currentPlacementState;
+		}
+	}
 
-			/* send previously buffered tuples */
-			SendCopyDataToPlacement(currentPlacementState->data, shardId,
-									connectionState->connection);
-			resetStringInfo(currentPlacementState->data);
+	return shardState;
+}
 
-			/* additionaly, we need to send the current tuple too */
-			sendTupleOverConnection = true;
-		}
-		else if (currentPlacementState != activePlacementState)
-		{
-			/* buffer data */
-			StringInfo copyBuffer = copyOutState->fe_msgbuf;
-			resetStringInfo(copyBuffer);
-			AppendCopyRowData(columnValues, columnNulls, tupleDescriptor,
-							  copyOutState, columnOutputFunctions,
-							  columnCoercionPaths);
-			appendBinaryStringInfo(currentPlacementState->data, copyBuffer->data,
-								   copyBuffer->len);
-		}
-		else
+
+/*
+ * AppendRowDataToPlacements appends the given serialized row to the buffers of
+ * all placements of the given shard. The rows of the active placement of a
+ * connection are sent in batches, which also sends the previously buffered
+ * rows of a placement that just became active.
+ */
+static void
+AppendRowDataToPlacements(CopyShardState *shardState, StringInfo rowData)
+{
+	ListCell *placementStateCell = NULL;
+	uint64 shardId = shardState->shardId;
+
+	foreach(placementStateCell, shardState->placementStateList)
+	{
+		CopyPlacementState *currentPlacementState = lfirst(placementStateCell);
+		CopyConnectionState *connectionState = currentPlacementState->connectionState;
+
+		CopyNodeProgress *nodeProgress = currentPlacementState->nodeProgress;
+
+		appendBinaryStringInfo(currentPlacementState->data, rowData->data,
+							   rowData->len);
+
+		if (nodeProgress != NULL)
 		{
-			Assert(currentPlacementState == activePlacementState);
-			sendTupleOverConnection = true;
+			nodeProgress->rowCount++;
+			nodeProgress->byteCount += rowData->len;
 		}
 
-		if (sendTupleOverConnection)
+		if (currentPlacementState == connectionState->activePlacementState &&
+			currentPlacementState->data->len >= COPY_SEND_BATCH_THRESHOLD)
 		{
-			resetStringInfo(copyOutState->fe_msgbuf);
-			AppendCopyRowData(columnValues, columnNulls, tupleDescriptor,
-							  copyOutState, columnOutputFunctions, columnCoercionPaths);
-			SendCopyDataToPlacement(copyOutState->fe_msgbuf, shardId,
+			SendCopyDataToPlacement(currentPlacementState->data, shardId,
 									connectionState->connection);
+			resetStringInfo(currentPlacementState->data);
+
+			/* only look at the clock once per batch */
+			if (nodeProgress != NULL)
+			{
+				nodeProgress->lastSendTime = GetCurrentTimestamp();
+			}
 		}
 	}
-
-	MemoryContextSwitchTo(oldContext);
-
-	copyDest->tuplesSent++;
-
-	/*
-	 * Release per tuple memory allocated in this function. If we're writing
-	 * the results of an INSERT ... SELECT then the SELECT execution will use
-	 * its own executor state and reset the per tuple expression context
-	 * separately.
-	 */
-	ResetPerTupleExprContext(executorState);
-
-	return true;
 }
 
 
@@ -2627,6 +3477,9 @@ CitusCopyDestReceiverShutdown(DestReceiver *destReceiver)
 	}
 	PG_END_TRY();
 
+	FinalizeCopyProgress(copyDest->copyProgress);
+	copyDest->copyProgress = NULL;
+
 	heap_close(distributedRelation, NoLock);
 }
 
@@ -2634,7 +3487,8 @@ CitusCopyDestReceiverShutdown(DestReceiver *destReceiver)
 /*
  * ShutdownCopyConnectionState ends the copy command for the current active
  * placement on connection, and then sends the rest of the buffers over the
- * connection.
+ * connection. EndPlacementStateCopyCommand() sends the buffered data of each
+ * placement before ending its copy.
  */
 static void
 ShutdownCopyConnectionState(CopyConnectionState *connectionState,
@@ -2647,20 +3501,17 @@ ShutdownCopyConnectionState(CopyConnectionState *connectionState,
 	CopyPlacementState *activePlacementState = connectionState->activePlacementState;
 	if (activePlacementState != NULL)
 	{
-		EndPlacementStateCopyCommand(activePlacementState, copyOutState);
+		EndPlacementStateCopyCommand(activePlacementState, copyDest);
 	}
 
 	dlist_foreach(iter, &connectionState->bufferedPlacementList)
 	{
 		CopyPlacementState *placementState =
 			dlist_container(CopyPlacementState, bufferedPlacementNode, iter.cur);
-		uint64 shardId = placementState->shardState->shardId;
 
 		StartPlacementStateCopyCommand(placementState, copyStatement,
 									   copyOutState);
-		SendCopyDataToPlacement(placementState->data, shardId,
-								connectionState->connection);
-		EndPlacementStateCopyCommand(placementState, copyOutState);
+		EndPlacementStateCopyCommand(placementState, copyDest);
 	}
 }
 
@@ -2820,6 +3671,11 @@ ProcessCopyStmt(CopyStmt *copyStatement, char *completionTag, const char *queryS
 				CitusCopyFrom(copyStatement, completionTag);
 				return NULL;
 			}
+			else if (CanStreamCopyOut(copyStatement))
+			{
+				StreamCopyOutFromShards(copyStatement, completionTag);
+				return NULL;
+			}
 			else
 			{
 				/*
@@ -3186,6 +4042,7 @@ GetConnectionState(HTAB *connectionStateHash, MultiConnection *connection)
 		connectionState->connection = connection;
 		connectionState->activePlacementState = NULL;
 		dlist_init(&connectionState->bufferedPlacementList);
+		connectionState->placementCount = 0;
 	}
 
 	return connectionState;
@@ -3224,7 +4081,8 @@ ConnectionStateList(HTAB *connectionStateHash)
  */
 static CopyShardState *
 GetShardState(uint64 shardId, HTAB *shardStateHash,
-			  HTAB *connectionStateHash, bool stopOnFailure, bool *found)
+			  HTAB *connectionStateHash, bool stopOnFailure,
+			  CopyProgress *copyProgress, bool *found)
 {
 	CopyShardState *shardState = NULL;
 
@@ -3233,7 +4091,7 @@ GetShardState(uint64 shardId, HTAB *shardStateHash,
 	if (!*found)
 	{
 		InitializeCopyShardState(shardState, connectionStateHash,
-								 shardId, stopOnFailure);
+								 shardId, stopOnFailure, copyProgress);
 	}
 
 	return shardState;
@@ -3248,7 +4106,7 @@ GetShardState(uint64 shardId, HTAB *shardStateHash,
 static void
 InitializeCopyShardState(CopyShardState *shardState,
 						 HTAB *connectionStateHash, uint64 shardId,
-						 bool stopOnFailure)
+						 bool stopOnFailure, CopyProgress *copyProgress)
 {
 	List *finalizedPlacementList = NIL;
 	ListCell *placementCell = NULL;
@@ -3278,7 +4136,7 @@ InitializeCopyShardState(CopyShardState *shardState,
 		CopyPlacementState *placementState = NULL;
 
 		MultiConnection *connection =
-			CopyGetPlacementConnection(placement, stopOnFailure);
+			CopyGetPlacementConnection(connectionStateHash, placement, stopOnFailure);
 		if (connection == NULL)
 		{
 			failedPlacementCount++;
@@ -3300,6 +4158,15 @@ InitializeCopyShardState(CopyShardState *shardState,
 		placementState->shardState = shardState;
 		placementState->data = makeStringInfo();
 		placementState->connectionState = connectionState;
+		connectionState->placementCount++;
+
+		placementState->nodeProgress = CopyProgressForNode(copyProgress,
+														   placement->nodeName,
+														   placement->nodePort);
+		if (placementState->nodeProgress != NULL)
+		{
+			placementState->nodeProgress->shardCount++;
+		}
 
 		/*
 		 * We don't set connectionState->activePlacementState here even if it
@@ -3334,14 +4201,23 @@ InitializeCopyShardState(CopyShardState *shardState,
  * CopyGetPlacementConnection assigns a connection to the given placement. If
  * a connection has already been assigned the placement in the current transaction
  * then it reuses the connection. Otherwise, it requests a connection for placement.
+ *
+ * For hash-distributed tables, the COPY uses up to
+ * citus.max_adaptive_executor_pool_size connections per worker node, such
+ * that the shards on a node are loaded in parallel by multiple backends. Once
+ * the limit is reached, or the node reached the shared connection limit, the
+ * placement shares the connection of the node that has the fewest placements.
  */
 static MultiConnection *
-CopyGetPlacementConnection(ShardPlacement *placement, bool stopOnFailure)
+CopyGetPlacementConnection(HTAB *connectionStateHash, ShardPlacement *placement,
+						   bool stopOnFailure)
 {
 	MultiConnection *connection = NULL;
 	uint32 connectionFlags = FOR_DML;
 	char *nodeUser = CurrentUserName();
 	ShardPlacementAccess *placementAccess = NULL;
+	CopyConnectionState *leastUsedConnectionState = NULL;
+	int nodeConnectionCount = 0;
 
 	/*
 	 * Determine whether the task has to be assigned to a particular connection
@@ -3359,15 +4235,34 @@ CopyGetPlacementConnection(ShardPlacement *placement, bool stopOnFailure)
 	/*
 	 * For placements that haven't been assigned a connection by a previous command
 	 * in the current transaction, we use a separate connection per placement for
-	 * hash-distributed tables in order to get the maximum performance.
+	 * hash-distributed tables in order to get the maximum performance, up to the
+	 * pool size of the node.
 	 */
 	if (placement->partitionMethod == DISTRIBUTE_BY_HASH &&
 		MultiShardConnectionType != SEQUENTIAL_CONNECTION)
 	{
 		connectionFlags |= CONNECTION_PER_PLACEMENT;
+
+		leastUsedConnectionState = LeastUsedNodeConnectionState(connectionStateHash,
+																placement,
+																&nodeConnectionCount);
+		if (nodeConnectionCount >= MaxAdaptiveExecutorPoolSize)
+		{
+			return ShareCopyConnection(leastUsedConnectionState, placementAccess);
+		}
+		else if (nodeConnectionCount > 0)
+		{
+			/* only open additional connections if the node can accept them */
+			connectionFlags |= OPTIONAL_CONNECTION;
+		}
 	}
 
 	connection = GetPlacementConnection(connectionFlags, placement, nodeUser);
+	if (connection == NULL)
+	{
+		/* the node reached the shared connection limit */
+		return ShareCopyConnection(leastUsedConnectionState, placementAccess);
+	}
 
 	if (PQstatus(connection->pgConn) != CONNECTION_OK)
 	{
@@ -3401,6 +4296,71 @@ CopyGetPlacementConnection(ShardPlacement *placement, bool stopOnFailure)
 }
 
 
+/*
+ * LeastUsedNodeConnectionState returns the connection state of the COPY that
+ * is connected to the node of the given placement and that is assigned the
+ * fewest placements, or NULL if the COPY has no connections to the node. It
+ * also sets nodeConnectionCount to the number of connections of the COPY to
+ * the node.
+ */
+static CopyConnectionState *
+LeastUsedNodeConnectionState(HTAB *connectionStateHash, ShardPlacement *placement,
+							 int *nodeConnectionCount)
+{
+	CopyConnectionState *leastUsedConnectionState = NULL;
+	HASH_SEQ_STATUS status;
+	CopyConnectionState *connectionState = NULL;
+
+	*nodeConnectionCount = 0;
+
+	hash_seq_init(&status, connectionStateHash);
+
+	connectionState = (CopyConnectionState *) hash_seq_search(&status);
+	while (connectionState != NULL)
+	{
+		MultiConnection *connection = connectionState->connection;
+
+		if (strncmp(connection->hostname, placement->nodeName, MAX_NODE_LENGTH) == 0 &&
+			connection->port == placement->nodePort)
+		{
+			(*nodeConnectionCount)++;
+
+			if (leastUsedConnectionState == NULL ||
+				connectionState->placementCount <
+				leastUsedConnectionState->placementCount)
+			{
+				leastUsedConnectionState = connectionState;
+			}
+		}
+
+		connectionState = (CopyConnectionState *) hash_seq_search(&status);
+	}
+
+	return leastUsedConnectionState;
+}
+
+
+/*
+ * ShareCopyConnection assigns the placement of the given placement access to
+ * the connection of the given connection state, which already carries the
+ * COPY of other placements on the same node.
+ */
+static MultiConnection *
+ShareCopyConnection(CopyConnectionState *connectionState,
+					ShardPlacementAccess *placementAccess)
+{
+	MultiConnection *connection = NULL;
+
+	/* we only share connections after opening at least one to the node */
+	Assert(connectionState != NULL);
+
+	connection = connectionState->connection;
+	AssignPlacementListToConnection(list_make1(placementAccess), connection);
+
+	return connection;
+}
+
+
 /*
  * StartPlacementStateCopyCommand sends the COPY for the given placement. It also
  * sends binary headers if this is a binary COPY.
@@ -3439,17 +4399,31 @@ StartPlacementStateCopyCommand(CopyPlacementState *placementState,
 
 
 /*
- * EndPlacementStateCopyCommand ends the COPY for the given placement. It also
- * sends binary footers if this is a binary COPY.
+ * EndPlacementStateCopyCommand ends the COPY for the given placement. It first
+ * sends the data that is still buffered for the placement, and it also sends
+ * binary footers if this is a binary COPY. If the rows were staged for an
+ * upsert, it then inserts them into the shard.
  */
 static void
 EndPlacementStateCopyCommand(CopyPlacementState *placementState,
-							 CopyOutState copyOutState)
+							 CitusCopyDestReceiver *copyDest)
 {
 	MultiConnection *connection = placementState->connectionState->connection;
 	uint64 shardId = placementState->shardState->shardId;
+	CopyOutState copyOutState = copyDest->copyOutState;
 	bool binaryCopy = copyOutState->binary;
 
+	if (placementState->data->len > 0)
+	{
+		SendCopyDataToPlacement(placementState->data, shardId, connection);
+		resetStringInfo(placementState->data);
+
+		if (placementState->nodeProgress != NULL)
+		{
+			placementState->nodeProgress->lastSendTime = GetCurrentTimestamp();
+		}
+	}
+
 	/* send footers and end copy command */
 	if (binaryCopy)
 	{
@@ -3457,6 +4431,174 @@ EndPlacementStateCopyCommand(CopyPlacementState *placementState,
 	}
 
 	EndRemoteCopy(shardId, list_make1(connection));
+
+	if (copyDest->upsertConflictClause != NULL)
+	{
+		UpsertCopiedRows(copyDest, shardId, connection);
+	}
+}
+
+
+/*
+ * CopyOnConflictClause returns the ON CONFLICT clause with which the rows of
+ * COPY FROM are inserted into the shards of the given relation, as configured
+ * by citus.copy_on_conflict.
+ *
+ * With do_update, the conflicts are detected on the primary key, and the other
+ * columns that the COPY lists are updated. Like in INSERT ... ON CONFLICT DO
+ * UPDATE, the rows that are staged together cannot update the same row twice.
+ */
+static char *
+CopyOnConflictClause(Relation relation, List *columnNameList,
+					 List *copiedColumnNameList)
+{
+	Bitmapset *primaryKeyColumns = NULL;
+	StringInfo conflictTargetList = makeStringInfo();
+	StringInfo updateList = makeStringInfo();
+	StringInfo conflictClause = makeStringInfo();
+	ListCell *columnNameCell = NULL;
+
+	if (CopyOnConflict == COPY_ON_CONFLICT_DO_NOTHING)
+	{
+		return "ON CONFLICT DO NOTHING";
+	}
+
+	primaryKeyColumns = RelationGetIndexAttrBitmap(relation,
+												   INDEX_ATTR_BITMAP_PRIMARY_KEY);
+	if (primaryKeyColumns == NULL)
+	{
+		ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+						errmsg("cannot update conflicting rows of table \"%s\" in "
+							   "COPY", RelationGetRelationName(relation)),
+						errdetail("The table does not have a primary key."),
+						errhint("Set citus.copy_on_conflict to 'do_nothing' or "
+								"'error'.")));
+	}
+
+	/* COPY without a column list copies all columns */
+	if (copiedColumnNameList == NIL)
+	{
+		foreach(columnNameCell, columnNameList)
+		{
+			char *columnName = (char *) lfirst(columnNameCell);
+
+			copiedColumnNameList = lappend(copiedColumnNameList,
+										   makeString(columnName));
+		}
+	}
+
+	foreach(columnNameCell, columnNameList)
+	{
+		char *columnName = (char *) lfirst(columnNameCell);
+		const char *quotedColumnName = quote_identifier(columnName);
+		AttrNumber attributeNumber = get_attnum(RelationGetRelid(relation),
+												columnName);
+
+		if (bms_is_member(attributeNumber - FirstLowInvalidHeapAttributeNumber,
+						  primaryKeyColumns))
+		{
+			if (conflictTargetList->len > 0)
+			{
+				appendStringInfoString(conflictTargetList, ", ");
+			}
+
+			appendStringInfoString(conflictTargetList, quotedColumnName);
+		}
+		else if (list_member(copiedColumnNameList, makeString(columnName)))
+		{
+			if (updateList->len > 0)
+			{
+				appendStringInfoString(updateList, ", ");
+			}
+
+			appendStringInfo(updateList, "%s = EXCLUDED.%s", quotedColumnName,
+							 quotedColumnName);
+		}
+	}
+
+	/* there is nothing to update if only the primary key is copied */
+	if (updateList->len == 0)
+	{
+		return "ON CONFLICT DO NOTHING";
+	}
+
+	appendStringInfo(conflictClause, "ON CONFLICT (%s) DO UPDATE SET %s",
+					 conflictTargetList->data, updateList->data);
+
+	return conflictClause->data;
+}
+
+
+/*
+ * InitializeCopyUpsert prepares the parts of the INSERT ... SELECT commands that
+ * move the staged rows into the shards. PostgreSQL cannot prepare transactions
+ * that used temporary tables, so the rows are staged in intermediate results
+ * instead, which are removed at the end of the transaction.
+ */
+static void
+InitializeCopyUpsert(CitusCopyDestReceiver *copyDest)
+{
+	Relation distributedRelation = copyDest->distributedRelation;
+	TupleDesc destTupleDescriptor = RelationGetDescr(distributedRelation);
+	StringInfo columnList = makeStringInfo();
+	StringInfo columnDefinitionList = makeStringInfo();
+	ListCell *columnNameCell = NULL;
+
+	foreach(columnNameCell, copyDest->columnNameList)
+	{
+		char *columnName = (char *) lfirst(columnNameCell);
+		const char *quotedColumnName = quote_identifier(columnName);
+		AttrNumber attributeNumber = get_attnum(RelationGetRelid(distributedRelation),
+												columnName);
+		Form_pg_attribute attribute = TupleDescAttr(destTupleDescriptor,
+													attributeNumber - 1);
+
+		if (columnList->len > 0)
+		{
+			appendStringInfoString(columnList, ", ");
+			appendStringInfoString(columnDefinitionList, ", ");
+		}
+
+		appendStringInfoString(columnList, quotedColumnName);
+		appendStringInfo(columnDefinitionList, "%s %s", quotedColumnName,
+						 format_type_with_typemod(attribute->atttypid,
+												  attribute->atttypmod));
+	}
+
+	copyDest->upsertColumnList = columnList->data;
+	copyDest->upsertColumnDefinitionList = columnDefinitionList->data;
+}
+
+
+/*
+ * UpsertCopiedRows inserts the rows that were staged for the given shard over
+ * the given connection into the shard, and resolves conflicts with the
+ * existing rows as configured by citus.copy_on_conflict.
+ */
+static void
+UpsertCopiedRows(CitusCopyDestReceiver *copyDest, uint64 shardId,
+				 MultiConnection *connection)
+{
+	Oid relationId = copyDest->distributedRelationId;
+	char *schemaName = get_namespace_name(get_rel_namespace(relationId));
+	char *shardName = get_rel_name(relationId);
+	char *resultId = pstrdup(COPY_UPSERT_RESULT_PREFIX);
+	char *copyFormat = copyDest->copyOutState->binary ? "binary" : "text";
+	StringInfo upsertCommand = makeStringInfo();
+
+	AppendShardIdToName(&shardName, shardId);
+	AppendShardIdToName(&resultId, shardId);
+
+	appendStringInfo(upsertCommand,
+					 "INSERT INTO %s (%s) SELECT %s FROM "
+					 "read_intermediate_result(%s, %s) AS citus_copy_result (%s) %s",
+					 quote_qualified_identifier(schemaName, shardName),
+					 copyDest->upsertColumnList, copyDest->upsertColumnList,
+					 quote_literal_cstr(resultId), quote_literal_cstr(copyFormat),
+					 copyDest->upsertColumnDefinitionList,
+					 copyDest->upsertConflictClause);
+
+	ExecuteCriticalRemoteCommand(connection, upsertCommand->data);
 }
 
 
@@ -45,6 +45,7 @@
 #include "distributed/metadata_sync.h"
 #include "distributed/multi_router_executor.h"
 #include "distributed/resource_lock.h"
+#include "distributed/statement_cache.h"
 #include "distributed/transmit.h"
 #include "distributed/version_compat.h"
 #include "distributed/worker_transaction.h"
@@ -562,6 +563,9 @@ ExecuteDistributedDDLJob(DDLJob *ddlJob)
 	EnsureCoordinator();
 	EnsurePartitionTableNotReplicated(ddlJob->targetRelationId);
 
+	/* shard queries that are prepared on the connections might change meaning */
+	InvalidateStatementCache();
+
 	if (!ddlJob->concurrentIndexCmd)
 	{
 		if (shouldSyncMetadata)
@@ -24,9 +24,12 @@
 #include "distributed/hash_helpers.h"
 #include "distributed/placement_connection.h"
 #include "distributed/run_from_same_connection.h"
+#include "distributed/shared_connection_stats.h"
+#include "distributed/statement_cache.h"
 #include "distributed/remote_commands.h"
 #include "distributed/version_compat.h"
 #include "mb/pg_wchar.h"
+#include "storage/ipc.h"
 #include "utils/hsearch.h"
 #include "utils/memutils.h"
 
@@ -47,6 +50,8 @@ static void DefaultCitusNoticeProcessor(void *arg, const char *message);
 static MultiConnection * FindAvailableConnection(dlist_head *connections, uint32 flags);
 static bool RemoteTransactionIdle(MultiConnection *connection);
 static int EventSetSizeForConnectionList(List *connections);
+static void ReleaseSharedConnectionSlot(MultiConnection *connection);
+static void ReleaseAllSharedConnectionSlots(int code, Datum arg);
 
 /* types for async connection management */
 enum MultiConnectionPhase
@@ -73,6 +78,9 @@ static uint32 MultiConnectionStateEventMask(MultiConnectionPollState *connection
 
 static int CitusNoticeLogLevel = DEFAULT_CITUS_NOTICE_LEVEL;
 
+/* whether the connection slots are released when the backend exits */
+static bool RegisteredSharedConnectionCleanup = false;
+
 
 /*
  * Initialize per-backend connection management infrastructure.
@@ -328,9 +336,42 @@ StartNodeUserDatabaseConnection(uint32 flags, const char *hostname, int32 port,
 
 	/*
 	 * Either no caching desired, or no pre-established, non-claimed,
-	 * connection present. Initiate connection establishment.
+	 * connection present. Make sure we do not open more connections to the
+	 * node than it can accept across all backends.
 	 */
-	connection = StartConnectionEstablishment(&key);
+	if (flags & OPTIONAL_CONNECTION)
+	{
+		if (!TryToIncrementSharedConnectionCounter(hostname, port))
+		{
+			return NULL;
+		}
+	}
+	else
+	{
+		IncrementSharedConnectionCounter(hostname, port);
+	}
+
+	if (!RegisteredSharedConnectionCleanup)
+	{
+		/* give the connection slots back if the backend exits */
+		before_shmem_exit(ReleaseAllSharedConnectionSlots, 0);
+		RegisteredSharedConnectionCleanup = true;
+	}
+
+	/* initiate connection establishment, giving the slot back if that fails */
+	PG_TRY();
+	{
+		connection = StartConnectionEstablishment(&key);
+	}
+	PG_CATCH();
+	{
+		DecrementSharedConnectionCounter(hostname, port);
+
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	connection->sharedConnectionCounterIncremented = true;
 
 	dlist_push_tail(entry->connections, &connection->connectionNode);
 
@@ -426,6 +467,8 @@ CloseConnection(MultiConnection *connection)
 		/* same for transaction state and shard/placement machinery */
 		CloseRemoteTransaction(connection);
 		CloseShardPlacementAssociation(connection);
+		ResetConnectionStatementCache(connection);
+		ReleaseSharedConnectionSlot(connection);
 
 		/* we leave the per-host entry alive */
 		pfree(connection);
@@ -1008,6 +1051,52 @@ FreeConnParamsHashEntryFields(ConnParamsHashEntry *entry)
 }
 
 
+/*
+ * ReleaseSharedConnectionSlot decrements the shared connection counter of the
+ * connection's node, if the connection was counted.
+ */
+static void
+ReleaseSharedConnectionSlot(MultiConnection *connection)
+{
+	if (connection->sharedConnectionCounterIncremented)
+	{
+		DecrementSharedConnectionCounter(connection->hostname, connection->port);
+		connection->sharedConnectionCounterIncremented = false;
+	}
+}
+
+
+/*
+ * ReleaseAllSharedConnectionSlots is called when the backend exits, and
+ * releases the connection slots of the connections that are still open.
+ */
+static void
+ReleaseAllSharedConnectionSlots(int code, Datum arg)
+{
+	HASH_SEQ_STATUS status;
+	ConnectionHashEntry *entry = NULL;
+
+	if (ConnectionHash == NULL)
+	{
+		return;
+	}
+
+	hash_seq_init(&status, ConnectionHash);
+	while ((entry = (ConnectionHashEntry *) hash_seq_search(&status)) != 0)
+	{
+		dlist_iter iter;
+
+		dlist_foreach(iter, entry->connections)
+		{
+			MultiConnection *connection =
+				dlist_container(MultiConnection, connectionNode, iter.cur);
+
+			ReleaseSharedConnectionSlot(connection);
+		}
+	}
+}
+
+
 /*
  * Close all remote connections if necessary anymore (i.e. not session
  * lifetime), or if in a failed state.
@@ -1048,6 +1137,12 @@ AfterXactHostConnectionHandling(ConnectionHashEntry *entry, bool isCommit)
 			/* unlink from list */
 			dlist_delete(iter.cur);
 
+			/* forget the statements prepared on the connection */
+			ResetConnectionStatementCache(connection);
+
+			/* allow other backends to use the connection slot */
+			ReleaseSharedConnectionSlot(connection);
+
 			pfree(connection);
 		}
 		else
@@ -206,6 +206,11 @@ MultiConnection *
 GetPlacementConnection(uint32 flags, ShardPlacement *placement, const char *userName)
 {
 	MultiConnection *connection = StartPlacementConnection(flags, placement, userName);
+	if (connection == NULL)
+	{
+		/* no OPTIONAL_CONNECTION could be established */
+		return NULL;
+	}
 
 	FinishConnectionEstablishment(connection);
 	return connection;
@@ -267,6 +272,11 @@ GetPlacementListConnection(uint32 flags, List *placementAccessList, const char *
 {
 	MultiConnection *connection = StartPlacementListConnection(flags, placementAccessList,
 															   userName);
+	if (connection == NULL)
+	{
+		/* no OPTIONAL_CONNECTION could be established */
+		return NULL;
+	}
 
 	FinishConnectionEstablishment(connection);
 	return connection;
@@ -277,7 +287,8 @@ GetPlacementListConnection(uint32 flags, List *placementAccessList, const char *
  * StartPlacementListConnection returns a connection to a remote node suitable for
  * a placement accesses (SELECT, DML, DDL) or throws an error if no suitable
  * connection can be established if would cause a self-deadlock or consistency
- * violation.
+ * violation. With OPTIONAL_CONNECTION, it returns NULL if a new connection is
+ * needed but the node reached the shared connection limit.
  */
 MultiConnection *
 StartPlacementListConnection(uint32 flags, List *placementAccessList,
@@ -307,6 +318,18 @@ StartPlacementListConnection(uint32 flags, List *placementAccessList,
 		 */
 		chosenConnection = StartNodeUserDatabaseConnection(flags, nodeName, nodePort,
 														   userName, NULL);
+		if (chosenConnection == NULL)
+		{
+			/* the node reached the shared connection limit for OPTIONAL_CONNECTION */
+			Assert(flags & OPTIONAL_CONNECTION);
+
+			if (freeUserName)
+			{
+				pfree(freeUserName);
+			}
+
+			return NULL;
+		}
 
 		if ((flags & CONNECTION_PER_PLACEMENT) &&
 			ConnectionAccessedDifferentPlacement(chosenConnection, placement))
@@ -327,6 +350,17 @@ StartPlacementListConnection(uint32 flags, List *placementAccessList,
 															   FORCE_NEW_CONNECTION,
 															   nodeName, nodePort,
 															   userName, NULL);
+			if (chosenConnection == NULL)
+			{
+				Assert(flags & OPTIONAL_CONNECTION);
+
+				if (freeUserName)
+				{
+					pfree(freeUserName);
+				}
+
+				return NULL;
+			}
 
 			Assert(!ConnectionAccessedDifferentPlacement(chosenConnection, placement));
 		}
@@ -914,6 +948,20 @@ ConnectionUsedForAnyPlacements(MultiConnection *connection)
 }
 
 
+/*
+ * AnyConnectionAccessedPlacements returns true if any of the connections
+ * has been assigned to a shard placement in the current transaction.
+ */
+bool
+AnyConnectionAccessedPlacements(void)
+{
+	/* this is initialized on PG_INIT */
+	Assert(ConnectionPlacementHash != NULL);
+
+	return hash_get_num_entries(ConnectionPlacementHash) > 0;
+}
+
+
 /*
  * AssociatePlacementWithShard records shard->placement relation in
  * ConnectionShardHash.
@@ -451,12 +451,17 @@ ExecuteOptionalRemoteCommand(MultiConnection *connection, const char *command,
  * send commands asynchronously without blocking (at the potential expense of
  * an additional memory allocation). The command string can only include a single
  * command since PQsendQueryParams() supports only that.
+ *
+ * When binaryResults is true, the results are requested in binary format,
+ * which the caller needs to decode using the receive functions of the result
+ * column types.
  */
 int
 SendRemoteCommandParams(MultiConnection *connection, const char *command,
 						int parameterCount, const Oid *parameterTypes,
-						const char *const *parameterValues)
+						const char *const *parameterValues, bool binaryResults)
 {
+	int resultFormat = binaryResults ? 1 : 0;
 	PGconn *pgConn = connection->pgConn;
 	int rc = 0;
 
@@ -474,7 +479,76 @@ SendRemoteCommandParams(MultiConnection *connection, const char *command,
 	Assert(PQisnonblocking(pgConn));
 
 	rc = PQsendQueryParams(pgConn, command, parameterCount, parameterTypes,
-						   parameterValues, NULL, NULL, 0);
+						   parameterValues, NULL, NULL, resultFormat);
+
+	return rc;
+}
+
+
+/*
+ * SendRemotePrepare is a PQsendPrepare wrapper that logs remote commands, and
+ * accepts a MultiConnection instead of a plain PGconn. It creates a named
+ * prepared statement for the given command on the remote node, which can
+ * subsequently be executed using SendRemotePreparedCommand.
+ */
+int
+SendRemotePrepare(MultiConnection *connection, const char *statementName,
+				  const char *command, int parameterCount, const Oid *parameterTypes)
+{
+	PGconn *pgConn = connection->pgConn;
+	int rc = 0;
+
+	LogRemoteCommand(connection, command);
+
+	/*
+	 * Don't try to send command if connection is entirely gone
+	 * (PQisnonblocking() would crash).
+	 */
+	if (!pgConn || PQstatus(pgConn) != CONNECTION_OK)
+	{
+		return 0;
+	}
+
+	Assert(PQisnonblocking(pgConn));
+
+	rc = PQsendPrepare(pgConn, statementName, command, parameterCount, parameterTypes);
+
+	return rc;
+}
+
+
+/*
+ * SendRemotePreparedCommand is a PQsendQueryPrepared wrapper that logs remote
+ * commands, and accepts a MultiConnection instead of a plain PGconn. It
+ * executes a statement that was previously prepared on the connection using
+ * SendRemotePrepare.
+ */
+int
+SendRemotePreparedCommand(MultiConnection *connection, const char *statementName,
+						  int parameterCount, const char *const *parameterValues,
+						  bool binaryResults)
+{
+	int resultFormat = binaryResults ? 1 : 0;
+	PGconn *pgConn = connection->pgConn;
+	StringInfo executeCommand = makeStringInfo();
+	int rc = 0;
+
+	appendStringInfo(executeCommand, "EXECUTE %s", statementName);
+	LogRemoteCommand(connection, executeCommand->data);
+
+	/*
+	 * Don't try to send command if connection is entirely gone
+	 * (PQisnonblocking() would crash).
+	 */
+	if (!pgConn || PQstatus(pgConn) != CONNECTION_OK)
+	{
+		return 0;
+	}
+
+	Assert(PQisnonblocking(pgConn));
+
+	rc = PQsendQueryPrepared(pgConn, statementName, parameterCount, parameterValues,
+							 NULL, NULL, resultFormat);
 
 	return rc;
 }
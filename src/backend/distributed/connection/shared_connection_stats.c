@@ -0,0 +1,306 @@
+/*-------------------------------------------------------------------------
+ *
+ * shared_connection_stats.c
+ *   Keeps track of the number of connections to remote nodes across
+ *   backends. The primary goal is to prevent the backends from opening
+ *   more connections to a worker than the worker can accept.
+ *
+ *   Each backend increments the counter of a node before it establishes a
+ *   connection to the node, and decrements it once the connection is
+ *   closed. The adaptive executor only opens connections to a node while
+ *   the counter is below the limit. A worker pool without connections keeps
+ *   trying to get a connection slot as part of the execution loop.
+ *
+ * Copyright (c) 2019, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "miscadmin.h"
+
+#include "distributed/connection_management.h"
+#include "distributed/shared_connection_stats.h"
+#include "distributed/worker_manager.h"
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/hsearch.h"
+
+
+/*
+ * ConnectionStatsSharedData holds the lock that protects the shared
+ * connection counters.
+ */
+typedef struct ConnectionStatsSharedData
+{
+	int sharedConnectionHashTrancheId;
+	char *sharedConnectionHashTrancheName;
+	LWLock sharedConnectionHashLock;
+} ConnectionStatsSharedData;
+
+
+/* key of the shared connection counters, connections are counted per node */
+typedef struct SharedConnStatsHashKey
+{
+	char hostname[MAX_NODE_LENGTH];
+	int32 port;
+} SharedConnStatsHashKey;
+
+
+/* entry of the shared connection counters */
+typedef struct SharedConnStatsHashEntry
+{
+	SharedConnStatsHashKey key;
+
+	int connectionCount;
+} SharedConnStatsHashEntry;
+
+
+/*
+ * Controls the maximum number of connections from all the backends of this
+ * node to any single worker. 0 means max_connections of this node, and -1
+ * disables the limit.
+ */
+int MaxSharedPoolSize = ADJUST_POOLSIZE_AUTOMATICALLY;
+
+
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+static ConnectionStatsSharedData *ConnectionStatsSharedState = NULL;
+static HTAB *SharedConnStatsHash = NULL;
+
+
+static void SharedConnectionStatsShmemInit(void);
+static size_t SharedConnectionStatsShmemSize(void);
+static bool IncrementSharedConnectionCounterInternal(const char *hostname, int port,
+													 bool force);
+static void InitializeSharedConnStatsHashKey(SharedConnStatsHashKey *key,
+											 const char *hostname, int port);
+
+
+/*
+ * InitializeSharedConnectionStats requests the necessary shared memory
+ * from Postgres and sets up the shared memory startup hook.
+ */
+void
+InitializeSharedConnectionStats(void)
+{
+	/* allocate shared memory */
+	if (!IsUnderPostmaster)
+	{
+		RequestAddinShmemSpace(SharedConnectionStatsShmemSize());
+	}
+
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = SharedConnectionStatsShmemInit;
+}
+
+
+/*
+ * GetMaxSharedPoolSize returns the maximum number of connections to a single
+ * worker across all backends, or DISABLE_CONNECTION_THROTTLING.
+ */
+int
+GetMaxSharedPoolSize(void)
+{
+	if (MaxSharedPoolSize == ADJUST_POOLSIZE_AUTOMATICALLY)
+	{
+		return MaxConnections;
+	}
+
+	return MaxSharedPoolSize;
+}
+
+
+/*
+ * TryToIncrementSharedConnectionCounter increments the connection counter of
+ * the given node and returns true, unless the node already reached the
+ * maximum number of shared connections, in which case it returns false.
+ */
+bool
+TryToIncrementSharedConnectionCounter(const char *hostname, int port)
+{
+	bool force = false;
+
+	return IncrementSharedConnectionCounterInternal(hostname, port, force);
+}
+
+
+/*
+ * IncrementSharedConnectionCounter increments the connection counter of the
+ * given node, regardless of the limit. It is used for the connections that
+ * the commands cannot do without.
+ */
+void
+IncrementSharedConnectionCounter(const char *hostname, int port)
+{
+	bool force = true;
+
+	IncrementSharedConnectionCounterInternal(hostname, port, force);
+}
+
+
+/*
+ * DecrementSharedConnectionCounter decrements the connection counter of the
+ * given node, such that other backends can use the connection slot.
+ */
+void
+DecrementSharedConnectionCounter(const char *hostname, int port)
+{
+	SharedConnStatsHashKey key;
+	SharedConnStatsHashEntry *connectionEntry = NULL;
+	bool entryFound = false;
+
+	if (ConnectionStatsSharedState == NULL)
+	{
+		return;
+	}
+
+	InitializeSharedConnStatsHashKey(&key, hostname, port);
+
+	LWLockAcquire(&ConnectionStatsSharedState->sharedConnectionHashLock, LW_EXCLUSIVE);
+
+	connectionEntry = hash_search(SharedConnStatsHash, &key, HASH_FIND, &entryFound);
+	if (entryFound && connectionEntry->connectionCount > 0)
+	{
+		connectionEntry->connectionCount -= 1;
+	}
+
+	LWLockRelease(&ConnectionStatsSharedState->sharedConnectionHashLock);
+}
+
+
+/*
+ * IncrementSharedConnectionCounterInternal increments the connection counter
+ * of the given node if the node is below the limit, or if force is set. The
+ * function returns whether the counter is incremented.
+ */
+static bool
+IncrementSharedConnectionCounterInternal(const char *hostname, int port, bool force)
+{
+	SharedConnStatsHashKey key;
+	SharedConnStatsHashEntry *connectionEntry = NULL;
+	bool entryFound = false;
+	bool counterIncremented = false;
+	int maxSharedPoolSize = GetMaxSharedPoolSize();
+
+	if (ConnectionStatsSharedState == NULL)
+	{
+		/* shared memory is not initialized, nothing to track */
+		return true;
+	}
+
+	InitializeSharedConnStatsHashKey(&key, hostname, port);
+
+	LWLockAcquire(&ConnectionStatsSharedState->sharedConnectionHashLock, LW_EXCLUSIVE);
+
+	connectionEntry = hash_search(SharedConnStatsHash, &key, HASH_ENTER_NULL,
+								  &entryFound);
+	if (connectionEntry == NULL)
+	{
+		/* we track up to citus.max_worker_nodes_tracked nodes, allow the rest */
+		LWLockRelease(&ConnectionStatsSharedState->sharedConnectionHashLock);
+
+		return true;
+	}
+
+	if (!entryFound)
+	{
+		connectionEntry->connectionCount = 0;
+	}
+
+	if (force || maxSharedPoolSize == DISABLE_CONNECTION_THROTTLING ||
+		connectionEntry->connectionCount < maxSharedPoolSize)
+	{
+		connectionEntry->connectionCount += 1;
+		counterIncremented = true;
+	}
+
+	LWLockRelease(&ConnectionStatsSharedState->sharedConnectionHashLock);
+
+	return counterIncremented;
+}
+
+
+/*
+ * InitializeSharedConnStatsHashKey fills the hash key of the given node.
+ */
+static void
+InitializeSharedConnStatsHashKey(SharedConnStatsHashKey *key, const char *hostname,
+								 int port)
+{
+	/* the hash uses binary keys, so zero out the padding */
+	memset(key, 0, sizeof(SharedConnStatsHashKey));
+
+	strlcpy(key->hostname, hostname, MAX_NODE_LENGTH);
+	key->port = port;
+}
+
+
+/*
+ * SharedConnectionStatsShmemInit is the callback that is to be called on
+ * shared memory startup hook. The function sets up the lock and the hash
+ * that keep the connection counters.
+ */
+static void
+SharedConnectionStatsShmemInit(void)
+{
+	bool alreadyInitialized = false;
+	HASHCTL info;
+
+	/* we may update the shmem, acquire lock exclusively */
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+	ConnectionStatsSharedState =
+		(ConnectionStatsSharedData *) ShmemInitStruct(
+			"Shared Connection Stats Data",
+			sizeof(ConnectionStatsSharedData),
+			&alreadyInitialized);
+
+	if (!alreadyInitialized)
+	{
+		ConnectionStatsSharedState->sharedConnectionHashTrancheId = LWLockNewTrancheId();
+		ConnectionStatsSharedState->sharedConnectionHashTrancheName =
+			"Shared Connection Tracking Hash Tranche";
+
+		LWLockInitialize(&ConnectionStatsSharedState->sharedConnectionHashLock,
+						 ConnectionStatsSharedState->sharedConnectionHashTrancheId);
+	}
+
+	/* tranche names are registered per process */
+	LWLockRegisterTranche(ConnectionStatsSharedState->sharedConnectionHashTrancheId,
+						  ConnectionStatsSharedState->sharedConnectionHashTrancheName);
+
+	memset(&info, 0, sizeof(info));
+	info.keysize = sizeof(SharedConnStatsHashKey);
+	info.entrysize = sizeof(SharedConnStatsHashEntry);
+
+	SharedConnStatsHash = ShmemInitHash("Shared Conn. Stats Hash",
+										MaxWorkerNodesTracked,
+										MaxWorkerNodesTracked,
+										&info, HASH_ELEM | HASH_BLOBS);
+
+	LWLockRelease(AddinShmemInitLock);
+
+	if (prev_shmem_startup_hook != NULL)
+	{
+		prev_shmem_startup_hook();
+	}
+}
+
+
+/*
+ * SharedConnectionStatsShmemSize returns the size that should be allocated
+ * on the shared memory for the shared connection counters.
+ */
+static size_t
+SharedConnectionStatsShmemSize(void)
+{
+	Size size = 0;
+
+	size = add_size(size, sizeof(ConnectionStatsSharedData));
+	size = add_size(size, hash_estimate_size(MaxWorkerNodesTracked,
+											 sizeof(SharedConnStatsHashEntry)));
+
+	return size;
+}
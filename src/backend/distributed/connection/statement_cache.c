@@ -0,0 +1,260 @@
+/*-------------------------------------------------------------------------
+ *
+ * statement_cache.c
+ *   Cache of the shard query statements prepared on worker connections.
+ *
+ * Executing the same parameterized shard query repeatedly (e.g., a prepared
+ * query that is executed with a generic plan, and whose parameters are not
+ * used to prune shards) requires the worker to parse and plan the query string
+ * from scratch on each execution. For short OLTP statements that is most of
+ * the latency on the worker. Instead, the executor can prepare the shard query
+ * once per connection, remember it in this cache, and execute the prepared
+ * statement afterwards.
+ *
+ * Queries that filter the distribution column by a parameter, which includes
+ * fast-path router queries, do not benefit: deferred shard pruning replaces
+ * their parameters with constants, so their shard queries are not cached.
+ *
+ * The cache is keyed by the connection and the query string. Since the
+ * prepared statements on the remote node would not notice that the shard
+ * queries changed their meaning (e.g., the result type of a column changed),
+ * the entire cache is invalidated whenever a DDL command is propagated, or
+ * when the relation cache of a distributed table is invalidated. Connections
+ * that still have statements of an earlier generation deallocate them before
+ * preparing new ones.
+ *
+ * Copyright (c) 2019, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include "access/hash.h"
+#include "distributed/connection_management.h"
+#include "distributed/hash_helpers.h"
+#include "distributed/statement_cache.h"
+#include "utils/hsearch.h"
+#include "utils/memutils.h"
+
+
+/* GUC, determining whether shard queries are prepared on the connections */
+bool EnableStatementCaching = false;
+
+/* incremented whenever the prepared statements might have become invalid */
+static uint64 StatementCacheGeneration = 0;
+
+/* (connection, queryString) -> CachedStatement */
+static HTAB *StatementCacheHash = NULL;
+
+
+static void InitializeStatementCacheHash(void);
+static uint32 CachedStatementKeyHash(const void *key, Size keysize);
+static int CachedStatementKeyCompare(const void *a, const void *b, Size keysize);
+
+
+/*
+ * GetCachedStatement returns the statement cache entry for the given query on
+ * the given connection. If the query is not yet cached, a new entry which is
+ * not yet prepared is returned and the caller is expected to prepare it.
+ *
+ * The function returns NULL if the query cannot be cached, either because the
+ * connection already prepared too many statements, or because the query was
+ * prepared with different parameter types.
+ */
+CachedStatement *
+GetCachedStatement(MultiConnection *connection, const char *queryString,
+				   int parameterCount, const Oid *parameterTypes)
+{
+	CachedStatementKey key;
+	CachedStatement *cachedStatement = NULL;
+	bool found = false;
+
+	if (StatementCacheHash == NULL)
+	{
+		InitializeStatementCacheHash();
+	}
+
+	Assert(!StatementCacheIsStale(connection));
+
+	if (connection->preparedStatementCount == 0)
+	{
+		/* nothing prepared yet, so the connection is up to date */
+		connection->preparedStatementGeneration = StatementCacheGeneration;
+	}
+
+	key.connection = connection;
+	key.queryString = (char *) queryString;
+
+	cachedStatement = hash_search(StatementCacheHash, &key, HASH_FIND, &found);
+	if (found)
+	{
+		Size parameterTypesSize = parameterCount * sizeof(Oid);
+
+		if (cachedStatement->parameterCount != parameterCount ||
+			(parameterCount > 0 &&
+			 memcmp(cachedStatement->parameterTypes, parameterTypes,
+					parameterTypesSize) != 0))
+		{
+			/* same query with different parameter types, do not use the cache */
+			return NULL;
+		}
+
+		return cachedStatement;
+	}
+
+	if (connection->preparedStatementCount >= MAX_CACHED_STATEMENTS_PER_CONNECTION)
+	{
+		return NULL;
+	}
+
+	/* copy the key into the connection context, the hash keeps a pointer to it */
+	key.queryString = MemoryContextStrdup(ConnectionContext, queryString);
+
+	cachedStatement = hash_search(StatementCacheHash, &key, HASH_ENTER, &found);
+	Assert(!found);
+
+	snprintf(cachedStatement->statementName, NAMEDATALEN, "citus_stmt_%u",
+			 connection->preparedStatementCount);
+
+	cachedStatement->parameterCount = parameterCount;
+	cachedStatement->parameterTypes = NULL;
+	if (parameterCount > 0)
+	{
+		Size parameterTypesSize = parameterCount * sizeof(Oid);
+
+		cachedStatement->parameterTypes = MemoryContextAlloc(ConnectionContext,
+															 parameterTypesSize);
+		memcpy(cachedStatement->parameterTypes, parameterTypes, parameterTypesSize);
+	}
+
+	cachedStatement->prepared = false;
+
+	connection->preparedStatementCount++;
+
+	return cachedStatement;
+}
+
+
+/*
+ * StatementCacheIsStale returns true if the connection has prepared
+ * statements that were invalidated since they were prepared. The caller
+ * should deallocate the statements on the connection and reset the
+ * connection's cache via ResetConnectionStatementCache before using the
+ * cache again.
+ */
+bool
+StatementCacheIsStale(MultiConnection *connection)
+{
+	return connection->preparedStatementCount > 0 &&
+		   connection->preparedStatementGeneration != StatementCacheGeneration;
+}
+
+
+/*
+ * ResetConnectionStatementCache removes all the cache entries of the given
+ * connection. It is called when the prepared statements are deallocated on
+ * the connection, and when the connection is closed.
+ */
+void
+ResetConnectionStatementCache(MultiConnection *connection)
+{
+	HASH_SEQ_STATUS status;
+	CachedStatement *cachedStatement = NULL;
+
+	connection->preparedStatementCount = 0;
+	connection->preparedStatementGeneration = StatementCacheGeneration;
+
+	if (StatementCacheHash == NULL)
+	{
+		return;
+	}
+
+	hash_seq_init(&status, StatementCacheHash);
+
+	while ((cachedStatement = (CachedStatement *) hash_seq_search(&status)) != NULL)
+	{
+		CachedStatementKey key = cachedStatement->key;
+
+		if (key.connection != connection)
+		{
+			continue;
+		}
+
+		if (cachedStatement->parameterTypes != NULL)
+		{
+			pfree(cachedStatement->parameterTypes);
+		}
+
+		/* deleting the current element is allowed during hash_seq_search */
+		hash_search(StatementCacheHash, &key, HASH_REMOVE, NULL);
+
+		pfree(key.queryString);
+	}
+}
+
+
+/*
+ * InvalidateStatementCache marks the statements that are prepared on all
+ * connections as invalid. The connections deallocate them lazily, the next
+ * time they prepare a statement.
+ */
+void
+InvalidateStatementCache(void)
+{
+	StatementCacheGeneration++;
+}
+
+
+/*
+ * InitializeStatementCacheHash creates the hash that keeps the statement
+ * cache entries of all connections.
+ */
+static void
+InitializeStatementCacheHash(void)
+{
+	HASHCTL info;
+	uint32 hashFlags = 0;
+
+	memset(&info, 0, sizeof(info));
+	info.keysize = sizeof(CachedStatementKey);
+	info.entrysize = sizeof(CachedStatement);
+	info.hash = CachedStatementKeyHash;
+	info.match = CachedStatementKeyCompare;
+	info.hcxt = ConnectionContext;
+	hashFlags = (HASH_ELEM | HASH_FUNCTION | HASH_CONTEXT | HASH_COMPARE);
+
+	StatementCacheHash = hash_create("citus statement cache (connection, query)",
+									 64, &info, hashFlags);
+}
+
+
+static uint32
+CachedStatementKeyHash(const void *key, Size keysize)
+{
+	CachedStatementKey *entry = (CachedStatementKey *) key;
+	uint32 hash = 0;
+
+	hash = DatumGetUInt32(hash_any((unsigned char *) &entry->connection,
+								   sizeof(MultiConnection *)));
+	hash = hash_combine(hash, DatumGetUInt32(hash_any(
+												 (unsigned char *) entry->queryString,
+												 strlen(entry->queryString))));
+
+	return hash;
+}
+
+
+static int
+CachedStatementKeyCompare(const void *a, const void *b, Size keysize)
+{
+	CachedStatementKey *ca = (CachedStatementKey *) a;
+	CachedStatementKey *cb = (CachedStatementKey *) b;
+
+	if (ca->connection != cb->connection)
+	{
+		return 1;
+	}
+
+	return strcmp(ca->queryString, cb->queryString);
+}
@@ -127,10 +127,13 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include "access/transam.h"
 #include "access/xact.h"
 #include "commands/dbcommands.h"
 #include "distributed/citus_custom_scan.h"
+#include "distributed/commands/multi_copy.h"
 #include "distributed/connection_management.h"
+#include "distributed/local_executor.h"
 #include "distributed/multi_client_executor.h"
 #include "distributed/multi_executor.h"
 #include "distributed/multi_physical_planner.h"
@@ -140,7 +143,9 @@
 #include "distributed/placement_connection.h"
 #include "distributed/relation_access_tracking.h"
 #include "distributed/remote_commands.h"
+#include "distributed/repartition_join_execution.h"
 #include "distributed/resource_lock.h"
+#include "distributed/statement_cache.h"
 #include "distributed/subplan_execution.h"
 #include "distributed/transaction_management.h"
 #include "distributed/worker_protocol.h"
@@ -149,6 +154,7 @@
 #include "storage/fd.h"
 #include "storage/latch.h"
 #include "utils/int8.h"
+#include "utils/lsyscache.h"
 #include "utils/memutils.h"
 #include "utils/timestamp.h"
 
@@ -173,6 +179,13 @@ typedef struct DistributedExecution
 	TupleDesc tupleDescriptor;
 	Tuplestorestate *tupleStore;
 
+	/*
+	 * Whether the workers send results in binary format, in which case the
+	 * rows are decoded with the receive functions of the result columns.
+	 */
+	bool binaryResults;
+	FmgrInfo *columnReceiveFunctions;
+	Oid *columnTypeIOParams;
 
 	/* list of workers involved in the execution */
 	List *workerList;
@@ -235,6 +248,13 @@ typedef struct DistributedExecution
 	 */
 	bool isTransaction;
 
+	/*
+	 * Flag to indicate that the tasks run outside of the distributed
+	 * transaction. Each command commits on its own and the connections
+	 * are not associated with the placements that the tasks access.
+	 */
+	bool outsideTransaction;
+
 	/* indicates whether distributed execution has failed */
 	bool failed;
 
@@ -338,6 +358,12 @@ typedef struct WorkerPool
 	/* last time we opened a connection */
 	TimestampTz lastConnectionOpenTime;
 
+	/*
+	 * Time at which the pool started waiting for a slot to open its first
+	 * connection under citus.max_shared_pool_size, 0 if it is not waiting.
+	 */
+	TimestampTz sharedPoolWaitStartTime;
+
 	/* maximum number of connections we are allowed to open at once */
 	uint32 maxNewConnectionsPerCycle;
 
@@ -382,6 +408,16 @@ typedef struct WorkerSession
 	/* task the worker should work on or NULL */
 	struct TaskPlacementExecution *currentTask;
 
+	/*
+	 * Set while the command in flight only prepares the current task's shard
+	 * query (or deallocates stale statements) and the actual command still
+	 * needs to be sent, see SendPlacementExecutionCommand.
+	 */
+	bool preparingStatement;
+
+	/* statement cache entry which is being prepared, if any */
+	struct CachedStatement *statementBeingPrepared;
+
 	/*
 	 * The number of commands sent to the worker over the session. Excludes
 	 * distributed transaction related commands such as BEGIN/COMMIT etc.
@@ -509,6 +545,12 @@ int MaxAdaptiveExecutorPoolSize = 16;
 /* GUC, number of ms to wait between opening connections to the same worker */
 int ExecutorSlowStartInterval = 10;
 
+/* GUC, determining whether results are requested in binary format if possible */
+bool EnableBinaryProtocol = false;
+
+/* number of ms after which a pool retries to get a shared connection slot */
+#define SHARED_POOL_RETRY_INTERVAL_MS 10
+
 
 /* local functions */
 static DistributedExecution * CreateDistributedExecution(RowModifyLevel modLevel,
@@ -518,6 +560,8 @@ static DistributedExecution * CreateDistributedExecution(RowModifyLevel modLevel
 														 TupleDesc tupleDescriptor,
 														 Tuplestorestate *tupleStore,
 														 int targetPoolSize);
+static bool CanUseBinaryResultFormat(DistributedExecution *execution);
+static void InitializeBinaryResultFunctions(DistributedExecution *execution);
 static void StartDistributedExecution(DistributedExecution *execution);
 static void RunDistributedExecution(DistributedExecution *execution);
 static bool ShouldRunTasksSequentially(List *taskList);
@@ -553,7 +597,12 @@ static TaskPlacementExecution * PopAssignedPlacementExecution(WorkerSession *ses
 static TaskPlacementExecution * PopUnassignedPlacementExecution(WorkerPool *workerPool);
 static bool StartPlacementExecutionOnSession(TaskPlacementExecution *placementExecution,
 											 WorkerSession *session);
-static List * PlacementAccessListForTask(Task *task, ShardPlacement *taskPlacement);
+static bool SendPlacementExecutionCommand(TaskPlacementExecution *placementExecution,
+										  WorkerSession *session);
+static bool QueryStringHasParameters(const char *queryString);
+static int SendCachedStatement(WorkerSession *session, const char *queryString,
+							   int parameterCount, const Oid *parameterTypes,
+							   const char **parameterValues, bool binaryResults);
 static void ConnectionStateMachine(WorkerSession *session);
 static void Activate2PCIfModifyingTransactionExpandsToNewNode(WorkerSession *session);
 static bool TransactionModifiedDistributedTable(DistributedExecution *execution);
@@ -561,6 +610,11 @@ static void TransactionStateMachine(WorkerSession *session);
 static void UpdateConnectionWaitFlags(WorkerSession *session, int waitFlags);
 static bool CheckConnectionReady(WorkerSession *session);
 static bool ReceiveResults(WorkerSession *session, bool storeRows);
+static void CheckBinaryResultColumnTypes(DistributedExecution *execution,
+										 PGresult *result);
+static void BinaryResultRowToDatums(DistributedExecution *execution, PGresult *result,
+									int rowIndex, Datum *columnValues,
+									bool *columnNulls);
 static void WorkerSessionFailed(WorkerSession *session);
 static void WorkerPoolFailed(WorkerPool *workerPool);
 static void PlacementExecutionDone(TaskPlacementExecution *placementExecution,
@@ -596,6 +650,10 @@ AdaptiveExecutor(CustomScanState *node)
 
 	Job *job = distributedPlan->workerJob;
 	List *taskList = job->taskList;
+	List *localTaskList = NIL;
+	List *remoteTaskList = NIL;
+	List *repartitionJobIdList = NIL;
+	uint64 rowsProcessed = 0;
 
 	/* we should only call this once before the scan finished */
 	Assert(!scanState->finishedRemoteScan);
@@ -609,6 +667,12 @@ AdaptiveExecutor(CustomScanState *node)
 
 	ExecuteSubPlans(distributedPlan);
 
+	if (job->dependedJobList != NIL)
+	{
+		/* repartition the data that the tasks read via map and merge tasks */
+		repartitionJobIdList = ExecuteDependedTasks(taskList, job);
+	}
+
 	scanState->tuplestorestate =
 		tuplestore_begin_heap(randomAccess, interTransactions, work_mem);
 	tupleStore = scanState->tuplestorestate;
@@ -618,14 +682,46 @@ AdaptiveExecutor(CustomScanState *node)
 		targetPoolSize = 1;
 	}
 
+	if (ShouldExecuteTasksLocally(taskList))
+	{
+		bool readOnlyPlan = !TaskListModifiesDatabase(distributedPlan->modLevel,
+													  taskList);
+
+		ExtractLocalAndRemoteTasks(readOnlyPlan, taskList, &localTaskList,
+								   &remoteTaskList);
+	}
+	else
+	{
+		remoteTaskList = taskList;
+	}
+
 	execution = CreateDistributedExecution(distributedPlan->modLevel, taskList,
 										   distributedPlan->hasReturning,
 										   paramListInfo, tupleDescriptor,
 										   tupleStore, targetPoolSize);
 
+	/*
+	 * Make sure that we acquire the appropriate locks and set up the
+	 * coordinated transaction for all the tasks, even if some of them
+	 * are executed locally.
+	 */
 	StartDistributedExecution(execution);
 
-	if (ShouldRunTasksSequentially(execution->tasksToExecute))
+	if (localTaskList != NIL)
+	{
+		rowsProcessed += ExecuteLocalTaskList(scanState, localTaskList);
+	}
+
+	/* the remaining tasks are executed over connections */
+	execution->tasksToExecute = remoteTaskList;
+	execution->totalTaskCount = list_length(remoteTaskList);
+	execution->unfinishedTaskCount = list_length(remoteTaskList);
+
+	if (remoteTaskList == NIL)
+	{
+		/* all tasks are executed locally */
+	}
+	else if (ShouldRunTasksSequentially(execution->tasksToExecute))
 	{
 		SequentialRunDistributedExecution(execution);
 	}
@@ -634,13 +730,21 @@ AdaptiveExecutor(CustomScanState *node)
 		RunDistributedExecution(execution);
 	}
 
+	rowsProcessed += execution->rowsProcessed;
+
 	if (distributedPlan->modLevel != ROW_MODIFY_READONLY)
 	{
-		executorState->es_processed = execution->rowsProcessed;
+		executorState->es_processed = rowsProcessed;
 	}
 
 	FinishDistributedExecution(execution);
 
+	if (repartitionJobIdList != NIL)
+	{
+		/* remove the intermediate files and tables of the repartitioning */
+		DoRepartitionCleanup(repartitionJobIdList);
+	}
+
 	if (SortReturning && distributedPlan->hasReturning)
 	{
 		SortTupleStore(scanState);
@@ -705,6 +809,16 @@ ExecuteTaskListExtended(RowModifyLevel modLevel, List *taskList,
 	DistributedExecution *execution = NULL;
 	ParamListInfo paramListInfo = NULL;
 
+	/*
+	 * The task list could access the placements that have been modified
+	 * locally, which would not be visible to (or could even be blocked by)
+	 * the connections we are about to use.
+	 */
+	if (LocalExecutionHappened && AnyTaskAccessesLocalNode(taskList))
+	{
+		ErrorIfLocalExecutionHappened();
+	}
+
 	if (MultiShardConnectionType == SEQUENTIAL_CONNECTION)
 	{
 		targetPoolSize = 1;
@@ -722,6 +836,49 @@ ExecuteTaskListExtended(RowModifyLevel modLevel, List *taskList,
 }
 
 
+/*
+ * ExecuteTaskListOutsideTransaction executes the given task list outside of
+ * the distributed transaction, such that the effects of each command are
+ * committed and visible to other connections once the function returns.
+ * Commands that run inside a transaction block on the workers would not be
+ * visible to the other connections of the transaction, so we use separate
+ * connections when the coordinated transaction has already started.
+ *
+ * The caller should make sure that the tasks do not need to see the
+ * uncommitted changes of the transaction.
+ */
+uint64
+ExecuteTaskListOutsideTransaction(RowModifyLevel modLevel, List *taskList,
+								  int targetPoolSize)
+{
+	DistributedExecution *execution = NULL;
+	ParamListInfo paramListInfo = NULL;
+	TupleDesc tupleDescriptor = NULL;
+	Tuplestorestate *tupleStore = NULL;
+	bool hasReturning = false;
+
+	if (MultiShardConnectionType == SEQUENTIAL_CONNECTION)
+	{
+		targetPoolSize = 1;
+	}
+
+	execution =
+		CreateDistributedExecution(modLevel, taskList, hasReturning, paramListInfo,
+								   tupleDescriptor, tupleStore, targetPoolSize);
+
+	execution->outsideTransaction = true;
+	execution->isTransaction = false;
+
+	/* there is nothing to fail over to, the commands are not retried */
+	execution->errorOnAnyFailure = true;
+
+	RunDistributedExecution(execution);
+	FinishDistributedExecution(execution);
+
+	return execution->rowsProcessed;
+}
+
+
 /*
  * CreateDistributedExecution creates a distributed execution data structure for
  * a distributed plan.
@@ -753,14 +910,81 @@ CreateDistributedExecution(RowModifyLevel modLevel, List *taskList, bool hasRetu
 	execution->rowsProcessed = 0;
 
 	execution->raiseInterrupts = true;
+	execution->outsideTransaction = false;
 
 	execution->connectionSetChanged = false;
 	execution->waitFlagsChanged = false;
 
+	if (CanUseBinaryResultFormat(execution))
+	{
+		InitializeBinaryResultFunctions(execution);
+	}
+
 	return execution;
 }
 
 
+/*
+ * CanUseBinaryResultFormat returns whether the workers can send the results
+ * of the execution in binary format. That is the case when the execution
+ * returns rows and each of the result columns can be sent and received in
+ * binary format, using the same rules as for binary COPY.
+ */
+static bool
+CanUseBinaryResultFormat(DistributedExecution *execution)
+{
+	TupleDesc tupleDescriptor = execution->tupleDescriptor;
+
+	if (!EnableBinaryProtocol || tupleDescriptor == NULL)
+	{
+		return false;
+	}
+
+	if (execution->modLevel != ROW_MODIFY_READONLY && !execution->hasReturning)
+	{
+		/* no rows to decode */
+		return false;
+	}
+
+	return CanUseBinaryCopyFormat(tupleDescriptor);
+}
+
+
+/*
+ * InitializeBinaryResultFunctions looks up the receive functions of the
+ * result columns once per execution, such that ReceiveResults can decode
+ * the binary rows without any catalog lookups.
+ */
+static void
+InitializeBinaryResultFunctions(DistributedExecution *execution)
+{
+	TupleDesc tupleDescriptor = execution->tupleDescriptor;
+	int columnCount = tupleDescriptor->natts;
+	int columnIndex = 0;
+
+	execution->columnReceiveFunctions =
+		(FmgrInfo *) palloc0(columnCount * sizeof(FmgrInfo));
+	execution->columnTypeIOParams = (Oid *) palloc0(columnCount * sizeof(Oid));
+
+	for (columnIndex = 0; columnIndex < columnCount; columnIndex++)
+	{
+		Form_pg_attribute attribute = TupleDescAttr(tupleDescriptor, columnIndex);
+		Oid receiveFunctionId = InvalidOid;
+
+		if (attribute->attisdropped)
+		{
+			continue;
+		}
+
+		getTypeBinaryInputInfo(attribute->atttypid, &receiveFunctionId,
+							   &execution->columnTypeIOParams[columnIndex]);
+		fmgr_info(receiveFunctionId, &execution->columnReceiveFunctions[columnIndex]);
+	}
+
+	execution->binaryResults = true;
+}
+
+
 /*
  * StartDistributedExecution sets up the coordinated transaction and 2PC for
  * the execution whenever necessary. It also keeps track of parallel relation
@@ -1098,7 +1322,8 @@ FinishDistributedExecution(DistributedExecution *execution)
 {
 	UnsetCitusNoticeLevel();
 
-	if (DistributedExecutionModifiesDatabase(execution))
+	if (!execution->outsideTransaction &&
+		DistributedExecutionModifiesDatabase(execution))
 	{
 		/* prevent copying shards in same transaction */
 		XactModificationLevel = XACT_MODIFICATION_DATA;
@@ -1249,8 +1474,9 @@ AssignTasksToConnections(DistributedExecution *execution)
 												sizeof(TaskPlacementExecution *));
 		shardCommandExecution->placementExecutionCount = placementExecutionCount;
 
-		shardCommandExecution->expectResults = hasReturning ||
-											   modLevel == ROW_MODIFY_READONLY;
+		shardCommandExecution->expectResults =
+			(hasReturning || modLevel == ROW_MODIFY_READONLY) &&
+			!task->partiallyLocalOrRemote;
 
 
 		foreach(taskPlacementCell, task->taskPlacementList)
@@ -1290,15 +1516,20 @@ AssignTasksToConnections(DistributedExecution *execution)
 
 			placementExecutionIndex++;
 
-			placementAccessList = PlacementAccessListForTask(task, taskPlacement);
+			if (!execution->outsideTransaction)
+			{
+				placementAccessList = PlacementAccessListForTask(task, taskPlacement);
+
+				/*
+				 * Determine whether the task has to be assigned to a particular
+				 * connection due to a preceding access to the placement in the
+				 * same transaction.
+				 */
+				connection = GetConnectionIfPlacementAccessedInXact(connectionFlags,
+																	placementAccessList,
+																	NULL);
+			}
 
-			/*
-			 * Determine whether the task has to be assigned to a particular connection
-			 * due to a preceding access to the placement in the same transaction.
-			 */
-			connection = GetConnectionIfPlacementAccessedInXact(connectionFlags,
-																placementAccessList,
-																NULL);
 			if (connection != NULL)
 			{
 				/*
@@ -1441,6 +1672,11 @@ ExecutionOrderForTask(RowModifyLevel modLevel, Task *task)
 		case MAP_TASK:
 		case MERGE_TASK:
 		case MAP_OUTPUT_FETCH_TASK:
+		{
+			/* the outputs of repartition tasks are only needed on one node */
+			return EXECUTION_ORDER_ANY;
+		}
+
 		case MERGE_FETCH_TASK:
 		default:
 		{
@@ -1791,6 +2027,7 @@ ManageWorkerPool(WorkerPool *workerPool)
 	int readyTaskCount = workerPool->readyTaskCount;
 	int newConnectionCount = 0;
 	int connectionIndex = 0;
+	int openedConnectionCount = 0;
 
 	/* we should always have more (or equal) active connections than idle connections */
 	Assert(activeConnectionCount >= idleConnectionCount);
@@ -1861,8 +2098,14 @@ ManageWorkerPool(WorkerPool *workerPool)
 				newConnectionCount = Min(newConnectionCount,
 										 workerPool->maxNewConnectionsPerCycle);
 
-				/* increase the open rate every cycle (like TCP slow start) */
-				workerPool->maxNewConnectionsPerCycle += 1;
+				/*
+				 * Increase the open rate every cycle (like TCP slow start), but not
+				 * while we could not open any connection.
+				 */
+				if (workerPool->sharedPoolWaitStartTime == 0)
+				{
+					workerPool->maxNewConnectionsPerCycle += 1;
+				}
 			}
 			else
 			{
@@ -1884,15 +2127,59 @@ ManageWorkerPool(WorkerPool *workerPool)
 	{
 		MultiConnection *connection = NULL;
 		WorkerSession *session = NULL;
-
-		/* experimental: just to see the perf benefits of caching connections */
 		int connectionFlags = 0;
 
+		bool firstConnection = (initiatedConnectionCount + connectionIndex == 0);
+
+		if (firstConnection && workerPool->sharedPoolWaitStartTime != 0 &&
+			TimestampDifferenceExceeds(workerPool->sharedPoolWaitStartTime,
+									   GetCurrentTimestamp(), NodeConnectionTimeout))
+		{
+			/*
+			 * Backends that wait for each other's connection slots could wait
+			 * forever, so we open the connection regardless of the limit after
+			 * citus.node_connection_timeout rather than failing.
+			 */
+			ereport(DEBUG1, (errmsg("could not get a shared connection slot for "
+									"%s:%d in %d ms, opening the connection anyway",
+									workerPool->nodeName, workerPool->nodePort,
+									NodeConnectionTimeout)));
+		}
+		else
+		{
+			/*
+			 * We do not open connections while the worker has too many of them.
+			 * Additional connections only speed up the execution, and the pool
+			 * retries to open its first connection in the next iterations of the
+			 * execution loop, such that other pools make progress meanwhile.
+			 */
+			connectionFlags |= OPTIONAL_CONNECTION;
+		}
+
+		if (execution->outsideTransaction && InCoordinatedTransaction())
+		{
+			/* cached connections might be in a transaction block */
+			connectionFlags |= FORCE_NEW_CONNECTION;
+		}
+
 		/* open a new connection to the worker */
 		connection = StartNodeUserDatabaseConnection(connectionFlags,
 													 workerPool->nodeName,
 													 workerPool->nodePort,
 													 NULL, NULL);
+		if (connection == NULL)
+		{
+			/* reached the shared connection limit, continue with what we have */
+			if (firstConnection && workerPool->sharedPoolWaitStartTime == 0)
+			{
+				workerPool->sharedPoolWaitStartTime = GetCurrentTimestamp();
+			}
+
+			break;
+		}
+
+		openedConnectionCount++;
+		workerPool->sharedPoolWaitStartTime = 0;
 
 		/*
 		 * Assign the initial state in the connection state machine. The connection
@@ -1914,6 +2201,11 @@ ManageWorkerPool(WorkerPool *workerPool)
 		UpdateConnectionWaitFlags(session, WL_SOCKET_READABLE | WL_SOCKET_WRITEABLE);
 	}
 
+	if (openedConnectionCount == 0)
+	{
+		return;
+	}
+
 	workerPool->lastConnectionOpenTime = GetCurrentTimestamp();
 	execution->connectionSetChanged = true;
 }
@@ -2069,6 +2361,20 @@ NextEventTimeout(DistributedExecution *execution)
 
 		initiatedConnectionCount = list_length(workerPool->sessionList);
 
+		/*
+		 * If the pool waits for a shared connection slot, we retry shortly. Other
+		 * backends do not wake us up when they close their connections.
+		 */
+		if (workerPool->sharedPoolWaitStartTime != 0)
+		{
+			if (SHARED_POOL_RETRY_INTERVAL_MS < eventTimeout)
+			{
+				eventTimeout = SHARED_POOL_RETRY_INTERVAL_MS;
+			}
+
+			continue;
+		}
+
 		/*
 		 * If there are connections to open we wait at most up to the end of the
 		 * current slow start interval.
@@ -2457,6 +2763,25 @@ TransactionStateMachine(WorkerSession *session)
 					break;
 				}
 
+				if (session->currentTask != NULL && session->preparingStatement)
+				{
+					TaskPlacementExecution *placementExecution = session->currentTask;
+
+					/* the statement is prepared, the actual command can be sent */
+					if (session->statementBeingPrepared != NULL)
+					{
+						session->statementBeingPrepared->prepared = true;
+					}
+
+					SendPlacementExecutionCommand(placementExecution, session);
+
+					UpdateConnectionWaitFlags(session,
+											  WL_SOCKET_READABLE | WL_SOCKET_WRITEABLE);
+
+					transaction->transactionState = REMOTE_TRANS_SENT_COMMAND;
+					break;
+				}
+
 				if (session->currentTask != NULL)
 				{
 					TaskPlacementExecution *placementExecution = session->currentTask;
@@ -2528,7 +2853,11 @@ TransactionStateMachine(WorkerSession *session)
 					break;
 				}
 
-				shardCommandExecution->gotResults = true;
+				if (!session->preparingStatement)
+				{
+					shardCommandExecution->gotResults = true;
+				}
+
 				transaction->transactionState = REMOTE_TRANS_CLEARING_RESULTS;
 				break;
 			}
@@ -2719,23 +3048,23 @@ StartPlacementExecutionOnSession(TaskPlacementExecution *placementExecution,
 								 WorkerSession *session)
 {
 	WorkerPool *workerPool = session->workerPool;
-	DistributedExecution *execution = workerPool->distributedExecution;
-	ParamListInfo paramListInfo = execution->paramListInfo;
 	MultiConnection *connection = session->connection;
 	ShardCommandExecution *shardCommandExecution =
 		placementExecution->shardCommandExecution;
 	Task *task = shardCommandExecution->task;
 	ShardPlacement *taskPlacement = placementExecution->shardPlacement;
-	List *placementAccessList = PlacementAccessListForTask(task, taskPlacement);
-	char *queryString = task->queryString;
-	int querySent = 0;
-	int singleRowMode = 0;
+	DistributedExecution *execution = workerPool->distributedExecution;
 
-	/*
-	 * Make sure that subsequent commands on the same placement
-	 * use the same connection.
-	 */
-	AssignPlacementListToConnection(placementAccessList, connection);
+	if (!execution->outsideTransaction)
+	{
+		List *placementAccessList = PlacementAccessListForTask(task, taskPlacement);
+
+		/*
+		 * Make sure that subsequent commands on the same placement
+		 * use the same connection.
+		 */
+		AssignPlacementListToConnection(placementAccessList, connection);
+	}
 
 	/* one more command is sent over the session */
 	session->commandsSent++;
@@ -2749,6 +3078,47 @@ StartPlacementExecutionOnSession(TaskPlacementExecution *placementExecution,
 	/* connection is going to be in use */
 	workerPool->idleConnectionCount--;
 
+	if (!SendPlacementExecutionCommand(placementExecution, session))
+	{
+		return false;
+	}
+
+	session->currentTask = placementExecution;
+	placementExecution->executionState = PLACEMENT_EXECUTION_RUNNING;
+
+	return true;
+}
+
+
+/*
+ * SendPlacementExecutionCommand sends the shard query of the placement
+ * execution over the session's connection. When statement caching is enabled,
+ * the command that is sent might only prepare the shard query on the
+ * connection, in which case session->preparingStatement is set and the
+ * function should be called again once the preparation is finished.
+ *
+ * The function returns false and marks the connection as lost if the command
+ * could not be sent.
+ */
+static bool
+SendPlacementExecutionCommand(TaskPlacementExecution *placementExecution,
+							  WorkerSession *session)
+{
+	WorkerPool *workerPool = session->workerPool;
+	DistributedExecution *execution = workerPool->distributedExecution;
+	ParamListInfo paramListInfo = execution->paramListInfo;
+	MultiConnection *connection = session->connection;
+	ShardCommandExecution *shardCommandExecution =
+		placementExecution->shardCommandExecution;
+	Task *task = shardCommandExecution->task;
+	char *queryString = task->queryString;
+	bool binaryResults = execution->binaryResults;
+	int querySent = 0;
+	int singleRowMode = 0;
+
+	session->preparingStatement = false;
+	session->statementBeingPrepared = NULL;
+
 	if (paramListInfo != NULL)
 	{
 		int parameterCount = paramListInfo->numParams;
@@ -2760,8 +3130,25 @@ StartPlacementExecutionOnSession(TaskPlacementExecution *placementExecution,
 
 		ExtractParametersFromParamListInfo(paramListInfo, &parameterTypes,
 										   &parameterValues);
-		querySent = SendRemoteCommandParams(connection, queryString, parameterCount,
-											parameterTypes, parameterValues);
+
+		if (EnableStatementCaching && QueryStringHasParameters(queryString))
+		{
+			querySent = SendCachedStatement(session, queryString, parameterCount,
+											parameterTypes, parameterValues,
+											binaryResults);
+		}
+		else
+		{
+			querySent = SendRemoteCommandParams(connection, queryString,
+												parameterCount, parameterTypes,
+												parameterValues, binaryResults);
+		}
+	}
+	else if (binaryResults)
+	{
+		/* the result format can only be specified in the extended protocol */
+		querySent = SendRemoteCommandParams(connection, queryString, 0, NULL, NULL,
+											binaryResults);
 	}
 	else
 	{
@@ -2774,6 +3161,12 @@ StartPlacementExecutionOnSession(TaskPlacementExecution *placementExecution,
 		return false;
 	}
 
+	if (session->preparingStatement)
+	{
+		/* single-row mode only applies to queries */
+		return true;
+	}
+
 	singleRowMode = PQsetSingleRowMode(connection->pgConn);
 	if (singleRowMode == 0)
 	{
@@ -2781,18 +3174,93 @@ StartPlacementExecutionOnSession(TaskPlacementExecution *placementExecution,
 		return false;
 	}
 
-	session->currentTask = placementExecution;
-	placementExecution->executionState = PLACEMENT_EXECUTION_RUNNING;
-
 	return true;
 }
 
 
+/*
+ * QueryStringHasParameters returns true if the query string contains a
+ * parameter reference. The planner replaces the parameters with constants
+ * unless a generic plan is used, in which case the shard query string is
+ * the same across executions and is worth preparing on the connection.
+ *
+ * Router queries that filter the distribution column by a parameter, such as
+ * fast-path queries, never qualify: shard pruning is deferred to execution
+ * and replaces all the parameters with their values, so their shard queries
+ * are sent as plain queries.
+ */
+static bool
+QueryStringHasParameters(const char *queryString)
+{
+	const char *parameterStart = strchr(queryString, '$');
+
+	while (parameterStart != NULL)
+	{
+		if (isdigit((unsigned char) parameterStart[1]))
+		{
+			return true;
+		}
+
+		parameterStart = strchr(parameterStart + 1, '$');
+	}
+
+	return false;
+}
+
+
+/*
+ * SendCachedStatement sends a parameterized shard query using a statement
+ * that is prepared on the connection. If the statement is not yet prepared,
+ * it only sends the command to prepare it and sets session->preparingStatement.
+ * Similarly, if the statements on the connection were invalidated (e.g., due
+ * to DDL), it first deallocates them.
+ *
+ * Queries that cannot be cached are sent without preparing them.
+ */
+static int
+SendCachedStatement(WorkerSession *session, const char *queryString,
+					int parameterCount, const Oid *parameterTypes,
+					const char **parameterValues, bool binaryResults)
+{
+	MultiConnection *connection = session->connection;
+	CachedStatement *cachedStatement = NULL;
+
+	if (StatementCacheIsStale(connection))
+	{
+		ResetConnectionStatementCache(connection);
+
+		session->preparingStatement = true;
+
+		return SendRemoteCommand(connection, "DEALLOCATE ALL");
+	}
+
+	cachedStatement = GetCachedStatement(connection, queryString, parameterCount,
+										 parameterTypes);
+	if (cachedStatement == NULL)
+	{
+		return SendRemoteCommandParams(connection, queryString, parameterCount,
+									   parameterTypes, parameterValues, binaryResults);
+	}
+
+	if (!cachedStatement->prepared)
+	{
+		session->preparingStatement = true;
+		session->statementBeingPrepared = cachedStatement;
+
+		return SendRemotePrepare(connection, cachedStatement->statementName,
+								 queryString, parameterCount, parameterTypes);
+	}
+
+	return SendRemotePreparedCommand(connection, cachedStatement->statementName,
+									 parameterCount, parameterValues, binaryResults);
+}
+
+
 /*
  * PlacementAccessListForTask returns a list of placement accesses for a given
  * task and task placement.
  */
-static List *
+List *
 PlacementAccessListForTask(Task *task, ShardPlacement *taskPlacement)
 {
 	List *placementAccessList = NIL;
@@ -2879,6 +3347,9 @@ ReceiveResults(WorkerSession *session, bool storeRows)
 	AttInMetadata *attributeInputMetadata = NULL;
 	uint32 expectedColumnCount = 0;
 	char **columnArray = NULL;
+	Datum *columnValues = NULL;
+	bool *columnNulls = NULL;
+	bool binaryResults = execution->binaryResults;
 	Tuplestorestate *tupleStore = execution->tupleStore;
 
 	MemoryContext ioContext = AllocSetContextCreate(CurrentMemoryContext,
@@ -2886,7 +3357,13 @@ ReceiveResults(WorkerSession *session, bool storeRows)
 													ALLOCSET_DEFAULT_MINSIZE,
 													ALLOCSET_DEFAULT_INITSIZE,
 													ALLOCSET_DEFAULT_MAXSIZE);
-	if (tupleDescriptor != NULL)
+	if (tupleDescriptor != NULL && binaryResults)
+	{
+		expectedColumnCount = tupleDescriptor->natts;
+		columnValues = (Datum *) palloc0(expectedColumnCount * sizeof(Datum));
+		columnNulls = (bool *) palloc0(expectedColumnCount * sizeof(bool));
+	}
+	else if (tupleDescriptor != NULL)
 	{
 		attributeInputMetadata = TupleDescGetAttInMetadata(tupleDescriptor);
 		expectedColumnCount = tupleDescriptor->natts;
@@ -2970,6 +3447,51 @@ ReceiveResults(WorkerSession *session, bool storeRows)
 								   columnCount, expectedColumnCount)));
 		}
 
+		if (binaryResults)
+		{
+			CheckBinaryResultColumnTypes(execution, result);
+
+			for (rowIndex = 0; rowIndex < rowsProcessed; rowIndex++)
+			{
+				MemoryContext oldContext = NULL;
+
+				if (SubPlanLevel > 0 && executionStats != NULL)
+				{
+					for (columnIndex = 0; columnIndex < columnCount; columnIndex++)
+					{
+						executionStats->totalIntermediateResultSize +=
+							PQgetlength(result, rowIndex, columnIndex);
+					}
+				}
+
+				/*
+				 * Decode the columns directly into datums in a temporary memory
+				 * context that we reset after each tuple, the tuple store copies
+				 * the values into its own memory.
+				 */
+				oldContext = MemoryContextSwitchTo(ioContext);
+
+				BinaryResultRowToDatums(execution, result, rowIndex, columnValues,
+										columnNulls);
+				tuplestore_putvalues(tupleStore, tupleDescriptor, columnValues,
+									 columnNulls);
+
+				MemoryContextSwitchTo(oldContext);
+				MemoryContextReset(ioContext);
+
+				execution->rowsProcessed++;
+			}
+
+			PQclear(result);
+
+			if (executionStats != NULL && CheckIfSizeLimitIsExceeded(executionStats))
+			{
+				ErrorSizeLimitIsExceeded();
+			}
+
+			continue;
+		}
+
 		for (rowIndex = 0; rowIndex < rowsProcessed; rowIndex++)
 		{
 			HeapTuple heapTuple = NULL;
@@ -3024,12 +3546,99 @@ ReceiveResults(WorkerSession *session, bool storeRows)
 		pfree(columnArray);
 	}
 
+	if (columnValues != NULL)
+	{
+		pfree(columnValues);
+		pfree(columnNulls);
+	}
+
 	MemoryContextDelete(ioContext);
 
 	return fetchDone;
 }
 
 
+/*
+ * CheckBinaryResultColumnTypes verifies that the worker sent the result in
+ * binary format and, for built-in types whose OIDs are the same on all nodes,
+ * that the worker's column types match the types we decode them as. Since
+ * binary representations are type-specific, decoding a value of another type
+ * would silently produce wrong results.
+ */
+static void
+CheckBinaryResultColumnTypes(DistributedExecution *execution, PGresult *result)
+{
+	TupleDesc tupleDescriptor = execution->tupleDescriptor;
+	int columnCount = PQnfields(result);
+	int columnIndex = 0;
+
+	for (columnIndex = 0; columnIndex < columnCount; columnIndex++)
+	{
+		Form_pg_attribute attribute = TupleDescAttr(tupleDescriptor, columnIndex);
+		Oid expectedTypeId = attribute->atttypid;
+		Oid resultTypeId = PQftype(result, columnIndex);
+
+		if (PQfformat(result, columnIndex) != 1)
+		{
+			ereport(ERROR, (errmsg("worker sent column %d in text format, expected "
+								   "binary format", columnIndex + 1)));
+		}
+
+		if (expectedTypeId < FirstNormalObjectId && resultTypeId != expectedTypeId)
+		{
+			ereport(ERROR, (errmsg("unexpected type %u for column %d from worker, "
+								   "expected %u", resultTypeId, columnIndex + 1,
+								   expectedTypeId),
+							errhint("Consider disabling "
+									"citus.enable_binary_protocol.")));
+		}
+	}
+}
+
+
+/*
+ * BinaryResultRowToDatums decodes the given row of a binary format result
+ * into the columnValues and columnNulls arrays using the receive functions
+ * of the result columns.
+ */
+static void
+BinaryResultRowToDatums(DistributedExecution *execution, PGresult *result, int rowIndex,
+						Datum *columnValues, bool *columnNulls)
+{
+	TupleDesc tupleDescriptor = execution->tupleDescriptor;
+	int columnCount = tupleDescriptor->natts;
+	int columnIndex = 0;
+
+	for (columnIndex = 0; columnIndex < columnCount; columnIndex++)
+	{
+		Form_pg_attribute attribute = TupleDescAttr(tupleDescriptor, columnIndex);
+		FmgrInfo *receiveFunction = &execution->columnReceiveFunctions[columnIndex];
+		Oid typeIOParam = execution->columnTypeIOParams[columnIndex];
+		int32 typeMod = attribute->atttypmod;
+		StringInfoData columnBuffer;
+
+		if (PQgetisnull(result, rowIndex, columnIndex))
+		{
+			/* receive functions of domains need to check constraints on NULL */
+			columnValues[columnIndex] = ReceiveFunctionCall(receiveFunction, NULL,
+															typeIOParam, typeMod);
+			columnNulls[columnIndex] = true;
+			continue;
+		}
+
+		/* libpq always null-terminates values, also in binary format */
+		columnBuffer.data = PQgetvalue(result, rowIndex, columnIndex);
+		columnBuffer.len = PQgetlength(result, rowIndex, columnIndex);
+		columnBuffer.maxlen = columnBuffer.len + 1;
+		columnBuffer.cursor = 0;
+
+		columnValues[columnIndex] = ReceiveFunctionCall(receiveFunction, &columnBuffer,
+														typeIOParam, typeMod);
+		columnNulls[columnIndex] = false;
+	}
+}
+
+
 /*
  * WorkerPoolFailed marks a worker pool and all the placement executions scheduled
  * on it as failed.
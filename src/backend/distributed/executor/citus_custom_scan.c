@@ -16,6 +16,7 @@
 #include "distributed/citus_custom_scan.h"
 #include "distributed/insert_select_executor.h"
 #include "distributed/insert_select_planner.h"
+#include "distributed/local_executor.h"
 #include "distributed/multi_server_executor.h"
 #include "distributed/multi_router_executor.h"
 #include "distributed/multi_router_planner.h"
@@ -38,6 +39,8 @@ static Node * DelayedErrorCreateScan(CustomScan *scan);
 
 /* functions that are common to different scans */
 static void CitusBeginScan(CustomScanState *node, EState *estate, int eflags);
+static void CitusDeferredPruningSelectBeginScan(CitusScanState *scanState,
+												EState *estate);
 static void CitusEndScan(CustomScanState *node);
 static void CitusReScan(CustomScanState *node);
 
@@ -163,6 +166,13 @@ CitusBeginScan(CustomScanState *node, EState *estate, int eflags)
 
 	scanState = (CitusScanState *) node;
 
+	/* only the adaptive executor is aware of local execution */
+	if (scanState->executorType != MULTI_EXECUTOR_ADAPTIVE &&
+		scanState->executorType != MULTI_EXECUTOR_COORDINATOR_INSERT_SELECT)
+	{
+		ErrorIfLocalExecutionHappened();
+	}
+
 #if PG_VERSION_NUM >= 120000
 	ExecInitResultSlot(&scanState->customScanState.ss.ps, &TTSOpsMinimalTuple);
 #endif
@@ -171,6 +181,12 @@ CitusBeginScan(CustomScanState *node, EState *estate, int eflags)
 	if (distributedPlan->modLevel == ROW_MODIFY_READONLY ||
 		distributedPlan->insertSelectSubquery != NULL)
 	{
+		if (distributedPlan->workerJob != NULL &&
+			distributedPlan->workerJob->deferredPruning)
+		{
+			CitusDeferredPruningSelectBeginScan(scanState, estate);
+		}
+
 		/* no more action required */
 		return;
 	}
@@ -179,6 +195,37 @@ CitusBeginScan(CustomScanState *node, EState *estate, int eflags)
 }
 
 
+/*
+ * CitusDeferredPruningSelectBeginScan builds the task list of a fast-path router
+ * SELECT whose shard pruning was deferred to the executor, since the
+ * distribution column is compared to a parameter.
+ */
+static void
+CitusDeferredPruningSelectBeginScan(CitusScanState *scanState, EState *estate)
+{
+	DistributedPlan *originalPlan = scanState->distributedPlan;
+	DistributedPlan *distributedPlan = NULL;
+	Job *workerJob = NULL;
+
+	/*
+	 * We must not change the distributed plan since it may be reused across
+	 * multiple executions of a prepared statement. Unlike modifications, the job
+	 * query is not changed during the execution, so shallow copies suffice.
+	 */
+	distributedPlan = palloc(sizeof(DistributedPlan));
+	memcpy(distributedPlan, originalPlan, sizeof(DistributedPlan));
+
+	workerJob = palloc(sizeof(Job));
+	memcpy(workerJob, originalPlan->workerJob, sizeof(Job));
+	distributedPlan->workerJob = workerJob;
+
+	workerJob->taskList = FastPathRouterTaskList(workerJob, distributedPlan->planId,
+												 estate->es_param_list_info);
+
+	scanState->distributedPlan = distributedPlan;
+}
+
+
 /*
  * CitusExecScan is called when a tuple is pulled from a custom scan.
  * On the first call, it executes the distributed query and writes the
@@ -0,0 +1,902 @@
+/*-------------------------------------------------------------------------
+ *
+ * copy_out_executor.c
+ *
+ * Execution of COPY distributed_table TO STDOUT. Instead of running a
+ * distributed SELECT, which materializes the whole table in a tuple store on
+ * the coordinator and encodes it again, we run COPY shard TO STDOUT on all
+ * the shards in parallel and forward the rows to the client as they arrive.
+ *
+ * Like the adaptive executor, we open up to citus.max_adaptive_executor_pool_size
+ * connections per worker node. The shards that do not get a connection of
+ * their own are exported one after the other over the connection that has
+ * the fewest shards assigned.
+ *
+ * Copyright (c) 2019, Citus Data, Inc.
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "libpq-fe.h"
+#include "miscadmin.h"
+#include "pgstat.h"
+
+#include "catalog/namespace.h"
+#include "catalog/pg_class.h"
+#include "commands/defrem.h"
+#include "distributed/commands/multi_copy.h"
+#include "distributed/connection_management.h"
+#include "distributed/copy_out_executor.h"
+#include "distributed/local_executor.h"
+#include "distributed/master_metadata_utility.h"
+#include "distributed/metadata_cache.h"
+#include "distributed/multi_executor.h"
+#include "distributed/placement_connection.h"
+#include "distributed/relation_access_tracking.h"
+#include "distributed/relay_utility.h"
+#include "distributed/remote_commands.h"
+#include "distributed/remote_transaction.h"
+#include "distributed/transaction_management.h"
+#include "libpq/libpq.h"
+#include "libpq/pqformat.h"
+#include "mb/pg_wchar.h"
+#include "storage/latch.h"
+#include "tcop/dest.h"
+#include "utils/builtins.h"
+#include "utils/int8.h"
+#include "utils/lsyscache.h"
+#include "utils/rel.h"
+#include "utils/rls.h"
+
+
+/*
+ * CopyOutConnectionState keeps track of the shard placements that are exported
+ * over a connection. The first placement in the list is the one whose COPY is
+ * in progress, and the connection is done once the list is empty.
+ */
+typedef struct CopyOutConnectionState
+{
+	MultiConnection *connection;
+	List *placementList;
+} CopyOutConnectionState;
+
+
+/* whether COPY distributed_table TO STDOUT streams the output of the shards */
+bool EnableStreamingCopyOut = true;
+
+
+static bool CopyOutOptionsSupported(List *optionList);
+static List * AssignShardPlacementsToConnections(List *shardIntervalList);
+static ShardPlacement * CopyOutShardPlacement(uint64 shardId,
+											  MultiConnection **connection);
+static CopyOutConnectionState * CopyOutConnectionStateForPlacement(
+	List **connectionStateList, ShardPlacement *placement,
+	MultiConnection *connection);
+static CopyOutConnectionState * FindCopyOutConnectionState(List *connectionStateList,
+														   MultiConnection *connection);
+static char * ShardCopyOutCommand(CopyStmt *copyStatement, uint64 shardId);
+static void AppendCopyOutOptions(StringInfo command, List *optionList);
+static int CopyOutColumnCount(Oid relationId, List *columnNameList);
+static void SendCopyOutStart(int columnCount);
+static void SendPlacementCopyOutCommand(CopyOutConnectionState *connectionState,
+										CopyStmt *copyStatement);
+static void FinishPlacementCopyOutStart(CopyOutConnectionState *connectionState);
+static bool ForwardCopyOutData(CopyOutConnectionState *connectionState,
+							   CopyStmt *copyStatement, uint64 *processedRowCount);
+static uint64 FinishPlacementCopyOut(CopyOutConnectionState *connectionState);
+static void WaitForCopyOutData(List *connectionStateList);
+static void ShutdownCopyOutConnections(List *connectionStateList);
+
+
+/*
+ * CanStreamCopyOut returns whether the given COPY ... TO statement on a
+ * distributed table can be executed by StreamCopyOutFromShards(). We only
+ * stream to the client in the formats in which the outputs of the shards can
+ * simply be concatenated. Other COPY statements are executed as a distributed
+ * SELECT.
+ */
+bool
+CanStreamCopyOut(CopyStmt *copyStatement)
+{
+	Oid relationId = InvalidOid;
+
+	if (!EnableStreamingCopyOut)
+	{
+		return false;
+	}
+
+	if (copyStatement->is_from || copyStatement->relation == NULL ||
+		copyStatement->filename != NULL)
+	{
+		return false;
+	}
+
+	/* we forward the data with the COPY protocol of protocol version 3 */
+	if (whereToSendOutput != DestRemote || PG_PROTOCOL_MAJOR(FrontendProtocol) < 3)
+	{
+		return false;
+	}
+
+	if (!CopyOutOptionsSupported(copyStatement->options))
+	{
+		return false;
+	}
+
+	/*
+	 * The shards of partitioned tables and foreign tables cannot be copied
+	 * from, so only stream regular tables.
+	 */
+	relationId = RangeVarGetRelid(copyStatement->relation, NoLock, false);
+	if (get_rel_relkind(relationId) != RELKIND_RELATION)
+	{
+		return false;
+	}
+
+	/* the shards do not apply the policies of the distributed table */
+	if (check_enable_rls(relationId, InvalidOid, true) == RLS_ENABLED)
+	{
+		return false;
+	}
+
+	/* connections to the local node cannot see the locally executed commands */
+	if (LocalExecutionHappened)
+	{
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * CopyOutOptionsSupported returns false for the options that make the COPY
+ * output of a shard more than a list of rows, namely the binary format, which
+ * adds a header and a trailer, and the header line of the csv format.
+ */
+static bool
+CopyOutOptionsSupported(List *optionList)
+{
+	ListCell *optionCell = NULL;
+
+	foreach(optionCell, optionList)
+	{
+		DefElem *option = (DefElem *) lfirst(optionCell);
+
+		if (strncmp(option->defname, "format", NAMEDATALEN) == 0 &&
+			strncmp(defGetString(option), "binary", NAMEDATALEN) == 0)
+		{
+			return false;
+		}
+
+		if (strncmp(option->defname, "header", NAMEDATALEN) == 0 &&
+			defGetBoolean(option))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+/*
+ * StreamCopyOutFromShards executes COPY distributed_table TO STDOUT by running
+ * COPY shard TO STDOUT on a placement of every shard, and by forwarding the
+ * rows to the client as they arrive from the workers. Nothing is materialized
+ * or decoded on the coordinator.
+ */
+void
+StreamCopyOutFromShards(CopyStmt *copyStatement, char *completionTag)
+{
+	Oid relationId = RangeVarGetRelid(copyStatement->relation, NoLock, false);
+	List *shardIntervalList = NIL;
+	List *connectionStateList = NIL;
+	ListCell *connectionStateCell = NULL;
+	uint64 processedRowCount = 0;
+	int columnCount = 0;
+
+	/* check permissions, we're bypassing postgres' normal checks */
+	CheckCopyPermissions(copyStatement);
+
+	columnCount = CopyOutColumnCount(relationId, copyStatement->attlist);
+	shardIntervalList = LoadShardIntervalList(relationId);
+
+	if (SelectOpensTransactionBlock && IsTransactionBlock())
+	{
+		BeginOrContinueCoordinatedTransaction();
+	}
+
+	connectionStateList = AssignShardPlacementsToConnections(shardIntervalList);
+
+	if (list_length(connectionStateList) > 1)
+	{
+		RecordParallelSelectAccess(relationId);
+	}
+	else
+	{
+		RecordRelationAccessIfReferenceTable(relationId, PLACEMENT_ACCESS_SELECT);
+	}
+
+	PG_TRY();
+	{
+		List *connectionList = NIL;
+
+		foreach(connectionStateCell, connectionStateList)
+		{
+			CopyOutConnectionState *connectionState = lfirst(connectionStateCell);
+
+			connectionList = lappend(connectionList, connectionState->connection);
+		}
+
+		FinishConnectionListEstablishment(connectionList);
+
+		foreach(connectionStateCell, connectionStateList)
+		{
+			CopyOutConnectionState *connectionState = lfirst(connectionStateCell);
+			MultiConnection *connection = connectionState->connection;
+
+			if (PQstatus(connection->pgConn) != CONNECTION_OK)
+			{
+				ReportConnectionError(connection, ERROR);
+			}
+		}
+
+		RemoteTransactionsBeginIfNecessary(connectionList);
+
+		/* start the COPY of the first placement on all connections in parallel */
+		foreach(connectionStateCell, connectionStateList)
+		{
+			CopyOutConnectionState *connectionState = lfirst(connectionStateCell);
+
+			SendPlacementCopyOutCommand(connectionState, copyStatement);
+		}
+
+		foreach(connectionStateCell, connectionStateList)
+		{
+			CopyOutConnectionState *connectionState = lfirst(connectionStateCell);
+
+			FinishPlacementCopyOutStart(connectionState);
+		}
+
+		SendCopyOutStart(columnCount);
+
+		while (true)
+		{
+			bool dataReceived = false;
+			bool copyInProgress = false;
+
+			foreach(connectionStateCell, connectionStateList)
+			{
+				CopyOutConnectionState *connectionState = lfirst(connectionStateCell);
+
+				if (ForwardCopyOutData(connectionState, copyStatement,
+									   &processedRowCount))
+				{
+					dataReceived = true;
+				}
+
+				if (connectionState->placementList != NIL)
+				{
+					copyInProgress = true;
+				}
+			}
+
+			if (!copyInProgress)
+			{
+				break;
+			}
+
+			if (!dataReceived)
+			{
+				WaitForCopyOutData(connectionStateList);
+			}
+		}
+
+		/* signal the end of the data to the client */
+		pq_putemptymessage('c');
+	}
+	PG_CATCH();
+	{
+		ShutdownCopyOutConnections(connectionStateList);
+
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	foreach(connectionStateCell, connectionStateList)
+	{
+		CopyOutConnectionState *connectionState = lfirst(connectionStateCell);
+
+		UnclaimConnection(connectionState->connection);
+	}
+
+	if (completionTag != NULL)
+	{
+		snprintf(completionTag, COMPLETION_TAG_BUFSIZE,
+				 "COPY " UINT64_FORMAT, processedRowCount);
+	}
+}
+
+
+/*
+ * AssignShardPlacementsToConnections picks a placement of each of the given
+ * shards and assigns it to a connection. The function returns the list of
+ * CopyOutConnectionStates, whose connections are claimed exclusively and may
+ * still be in the process of being established.
+ */
+static List *
+AssignShardPlacementsToConnections(List *shardIntervalList)
+{
+	List *connectionStateList = NIL;
+	ListCell *shardIntervalCell = NULL;
+
+	foreach(shardIntervalCell, shardIntervalList)
+	{
+		ShardInterval *shardInterval = (ShardInterval *) lfirst(shardIntervalCell);
+		MultiConnection *connection = NULL;
+		ShardPlacement *placement = CopyOutShardPlacement(shardInterval->shardId,
+														  &connection);
+		CopyOutConnectionState *connectionState =
+			CopyOutConnectionStateForPlacement(&connectionStateList, placement,
+											   connection);
+
+		connectionState->placementList = lappend(connectionState->placementList,
+												 placement);
+	}
+
+	return connectionStateList;
+}
+
+
+/*
+ * CopyOutShardPlacement returns the placement of the given shard to export. If
+ * a placement of the shard has been accessed over a connection in the current
+ * transaction, we have to read from that placement over that connection, which
+ * is then returned in connection. Otherwise, connection is set to NULL.
+ */
+static ShardPlacement *
+CopyOutShardPlacement(uint64 shardId, MultiConnection **connection)
+{
+	List *placementList = FinalizedShardPlacementList(shardId);
+	ListCell *placementCell = NULL;
+
+	if (placementList == NIL)
+	{
+		ereport(ERROR, (errmsg("could not find any healthy placement for shard "
+							   UINT64_FORMAT, shardId)));
+	}
+
+	foreach(placementCell, placementList)
+	{
+		ShardPlacement *placement = (ShardPlacement *) lfirst(placementCell);
+		ShardPlacementAccess *placementAccess =
+			CreatePlacementAccess(placement, PLACEMENT_ACCESS_SELECT);
+
+		*connection = GetConnectionIfPlacementAccessedInXact(0,
+															 list_make1(placementAccess),
+															 NULL);
+		if (*connection != NULL)
+		{
+			return placement;
+		}
+	}
+
+	return (ShardPlacement *) linitial(placementList);
+}
+
+
+/*
+ * CopyOutConnectionStateForPlacement returns the state of the connection over
+ * which the given placement is exported, and adds it to connectionStateList if
+ * it is a new connection. If connection is not NULL, the placement has to use
+ * that connection. Otherwise, we open a new connection to the node of the
+ * placement until the pool size is reached, and share the connection of the
+ * node with the fewest placements beyond that point.
+ */
+static CopyOutConnectionState *
+CopyOutConnectionStateForPlacement(List **connectionStateList, ShardPlacement *placement,
+								   MultiConnection *connection)
+{
+	CopyOutConnectionState *connectionState = NULL;
+	CopyOutConnectionState *leastUsedConnectionState = NULL;
+	ShardPlacementAccess *placementAccess =
+		CreatePlacementAccess(placement, PLACEMENT_ACCESS_SELECT);
+	int nodeConnectionCount = 0;
+	int poolSize = MaxAdaptiveExecutorPoolSize;
+	ListCell *connectionStateCell = NULL;
+
+	if (MultiShardConnectionType == SEQUENTIAL_CONNECTION)
+	{
+		poolSize = 1;
+	}
+
+	foreach(connectionStateCell, *connectionStateList)
+	{
+		CopyOutConnectionState *nodeConnectionState = lfirst(connectionStateCell);
+		MultiConnection *nodeConnection = nodeConnectionState->connection;
+
+		if (strncmp(nodeConnection->hostname, placement->nodeName,
+					MAX_NODE_LENGTH) != 0 ||
+			nodeConnection->port != placement->nodePort)
+		{
+			continue;
+		}
+
+		nodeConnectionCount++;
+
+		if (leastUsedConnectionState == NULL ||
+			list_length(nodeConnectionState->placementList) <
+			list_length(leastUsedConnectionState->placementList))
+		{
+			leastUsedConnectionState = nodeConnectionState;
+		}
+	}
+
+	if (connection == NULL && nodeConnectionCount < poolSize)
+	{
+		uint32 connectionFlags = CONNECTION_PER_PLACEMENT;
+
+		if (nodeConnectionCount > 0)
+		{
+			/* only open additional connections if the node can accept them */
+			connectionFlags |= OPTIONAL_CONNECTION;
+		}
+
+		connection = StartPlacementConnection(connectionFlags, placement, NULL);
+	}
+
+	if (connection == NULL)
+	{
+		/* we only share connections after opening at least one to the node */
+		Assert(leastUsedConnectionState != NULL);
+
+		connection = leastUsedConnectionState->connection;
+	}
+
+	AssignPlacementListToConnection(list_make1(placementAccess), connection);
+
+	connectionState = FindCopyOutConnectionState(*connectionStateList, connection);
+	if (connectionState == NULL)
+	{
+		connectionState = palloc0(sizeof(CopyOutConnectionState));
+		connectionState->connection = connection;
+		connectionState->placementList = NIL;
+
+		ClaimConnectionExclusively(connection);
+
+		*connectionStateList = lappend(*connectionStateList, connectionState);
+	}
+
+	return connectionState;
+}
+
+
+/*
+ * FindCopyOutConnectionState returns the state of the given connection in
+ * connectionStateList, or NULL if the connection is not in the list.
+ */
+static CopyOutConnectionState *
+FindCopyOutConnectionState(List *connectionStateList, MultiConnection *connection)
+{
+	ListCell *connectionStateCell = NULL;
+
+	foreach(connectionStateCell, connectionStateList)
+	{
+		CopyOutConnectionState *connectionState = lfirst(connectionStateCell);
+
+		if (connectionState->connection == connection)
+		{
+			return connectionState;
+		}
+	}
+
+	return NULL;
+}
+
+
+/*
+ * ShardCopyOutCommand returns the COPY shard TO STDOUT command to export the
+ * given shard with the columns and options of the given COPY statement.
+ */
+static char *
+ShardCopyOutCommand(CopyStmt *copyStatement, uint64 shardId)
+{
+	StringInfo command = makeStringInfo();
+	char *schemaName = copyStatement->relation->schemaname;
+	char *shardName = pstrdup(copyStatement->relation->relname);
+	ListCell *columnNameCell = NULL;
+
+	AppendShardIdToName(&shardName, shardId);
+
+	appendStringInfo(command, "COPY %s", quote_qualified_identifier(schemaName,
+																	 shardName));
+
+	if (copyStatement->attlist != NIL)
+	{
+		appendStringInfoString(command, " (");
+
+		foreach(columnNameCell, copyStatement->attlist)
+		{
+			char *columnName = strVal(lfirst(columnNameCell));
+
+			if (columnNameCell != list_head(copyStatement->attlist))
+			{
+				appendStringInfoString(command, ", ");
+			}
+
+			appendStringInfoString(command, quote_identifier(columnName));
+		}
+
+		appendStringInfoString(command, ")");
+	}
+
+	appendStringInfoString(command, " TO STDOUT");
+
+	AppendCopyOutOptions(command, copyStatement->options);
+
+	return command->data;
+}
+
+
+/*
+ * AppendCopyOutOptions appends the given COPY options to the command. The
+ * workers write the data in the encoding of the client, since the data is
+ * forwarded to the client without any conversion.
+ */
+static void
+AppendCopyOutOptions(StringInfo command, List *optionList)
+{
+	ListCell *optionCell = NULL;
+	bool hasEncoding = false;
+
+	appendStringInfoString(command, " WITH (");
+
+	foreach(optionCell, optionList)
+	{
+		DefElem *option = (DefElem *) lfirst(optionCell);
+		Node *argument = option->arg;
+
+		appendStringInfo(command, "%s", option->defname);
+
+		if (argument == NULL)
+		{
+			/* boolean option without a value */
+		}
+		else if (IsA(argument, Integer))
+		{
+			appendStringInfo(command, " %ld", intVal(argument));
+		}
+		else if (IsA(argument, A_Star))
+		{
+			appendStringInfoString(command, " *");
+		}
+		else if (IsA(argument, List))
+		{
+			ListCell *columnNameCell = NULL;
+
+			appendStringInfoString(command, " (");
+
+			foreach(columnNameCell, (List *) argument)
+			{
+				char *columnName = strVal(lfirst(columnNameCell));
+
+				if (columnNameCell != list_head((List *) argument))
+				{
+					appendStringInfoString(command, ", ");
+				}
+
+				appendStringInfoString(command, quote_identifier(columnName));
+			}
+
+			appendStringInfoString(command, ")");
+		}
+		else
+		{
+			appendStringInfo(command, " %s", quote_literal_cstr(defGetString(option)));
+		}
+
+		if (strncmp(option->defname, "encoding", NAMEDATALEN) == 0)
+		{
+			hasEncoding = true;
+		}
+
+		appendStringInfoString(command, ", ");
+	}
+
+	if (!hasEncoding)
+	{
+		appendStringInfo(command, "encoding %s, ",
+						 quote_literal_cstr(pg_get_client_encoding_name()));
+	}
+
+	/* replace the last separator */
+	command->len -= 2;
+	command->data[command->len] = '\0';
+
+	appendStringInfoString(command, ")");
+}
+
+
+/*
+ * CopyOutColumnCount returns the number of columns that COPY ... TO writes for
+ * the given relation and column list.
+ */
+static int
+CopyOutColumnCount(Oid relationId, List *columnNameList)
+{
+	Relation relation = NULL;
+	TupleDesc tupleDescriptor = NULL;
+	int columnCount = 0;
+	int columnIndex = 0;
+
+	if (columnNameList != NIL)
+	{
+		return list_length(columnNameList);
+	}
+
+	relation = heap_open(relationId, AccessShareLock);
+	tupleDescriptor = RelationGetDescr(relation);
+
+	for (columnIndex = 0; columnIndex < tupleDescriptor->natts; columnIndex++)
+	{
+		Form_pg_attribute column = TupleDescAttr(tupleDescriptor, columnIndex);
+
+		if (column->attisdropped)
+		{
+			continue;
+		}
+
+#if PG_VERSION_NUM >= 120000
+		if (column->attgenerated)
+		{
+			continue;
+		}
+#endif
+
+		columnCount++;
+	}
+
+	heap_close(relation, NoLock);
+
+	return columnCount;
+}
+
+
+/*
+ * SendCopyOutStart sends the CopyOutResponse message for a COPY in text format
+ * with the given number of columns to the client. After this message, the
+ * client expects the copy data.
+ */
+static void
+SendCopyOutStart(int columnCount)
+{
+	StringInfoData copyOutStart = { NULL, 0, 0, 0 };
+	const char copyFormat = 0; /* text copy format */
+	int columnIndex = 0;
+
+	pq_beginmessage(&copyOutStart, 'H');
+	pq_sendbyte(&copyOutStart, copyFormat);
+	pq_sendint(&copyOutStart, columnCount, 2);
+
+	for (columnIndex = 0; columnIndex < columnCount; columnIndex++)
+	{
+		pq_sendint(&copyOutStart, copyFormat, 2);
+	}
+
+	pq_endmessage(&copyOutStart);
+}
+
+
+/*
+ * SendPlacementCopyOutCommand sends the COPY command of the first placement
+ * of the given connection.
+ */
+static void
+SendPlacementCopyOutCommand(CopyOutConnectionState *connectionState,
+							CopyStmt *copyStatement)
+{
+	MultiConnection *connection = connectionState->connection;
+	ShardPlacement *placement =
+		(ShardPlacement *) linitial(connectionState->placementList);
+	char *copyCommand = ShardCopyOutCommand(copyStatement, placement->shardId);
+
+	if (!SendRemoteCommand(connection, copyCommand))
+	{
+		ReportConnectionError(connection, ERROR);
+	}
+}
+
+
+/*
+ * FinishPlacementCopyOutStart waits until the worker started the COPY of the
+ * first placement of the given connection.
+ */
+static void
+FinishPlacementCopyOutStart(CopyOutConnectionState *connectionState)
+{
+	MultiConnection *connection = connectionState->connection;
+	bool raiseInterrupts = true;
+	PGresult *result = GetRemoteCommandResult(connection, raiseInterrupts);
+
+	if (PQresultStatus(result) != PGRES_COPY_OUT)
+	{
+		ReportResultError(connection, result, ERROR);
+	}
+
+	PQclear(result);
+}
+
+
+/*
+ * ForwardCopyOutData forwards the rows that are available on the connection
+ * of the given state to the client, without waiting for more. Once the COPY of
+ * a placement is done, it starts the COPY of the next placement that is
+ * assigned to the connection. The function returns whether it made progress.
+ */
+static bool
+ForwardCopyOutData(CopyOutConnectionState *connectionState, CopyStmt *copyStatement,
+				   uint64 *processedRowCount)
+{
+	MultiConnection *connection = connectionState->connection;
+	PGconn *pgConn = connection->pgConn;
+	bool dataReceived = false;
+	const bool asynchronous = true;
+
+	if (connectionState->placementList == NIL)
+	{
+		return false;
+	}
+
+	if (PQconsumeInput(pgConn) == 0)
+	{
+		ReportConnectionError(connection, ERROR);
+	}
+
+	while (true)
+	{
+		char *receiveBuffer = NULL;
+		int receiveLength = PQgetCopyData(pgConn, &receiveBuffer, asynchronous);
+
+		if (receiveLength > 0)
+		{
+			/* the workers send a complete row in every message */
+			pq_putmessage('d', receiveBuffer, receiveLength);
+			PQfreemem(receiveBuffer);
+
+			dataReceived = true;
+		}
+		else if (receiveLength == 0)
+		{
+			/* no complete row is available yet */
+			break;
+		}
+		else if (receiveLength == -1)
+		{
+			*processedRowCount += FinishPlacementCopyOut(connectionState);
+
+			connectionState->placementList =
+				list_delete_first(connectionState->placementList);
+			if (connectionState->placementList != NIL)
+			{
+				SendPlacementCopyOutCommand(connectionState, copyStatement);
+				FinishPlacementCopyOutStart(connectionState);
+			}
+
+			dataReceived = true;
+			break;
+		}
+		else
+		{
+			ReportConnectionError(connection, ERROR);
+		}
+	}
+
+	CHECK_FOR_INTERRUPTS();
+
+	return dataReceived;
+}
+
+
+/*
+ * FinishPlacementCopyOut reads the result of a COPY command whose output has
+ * been consumed and returns the number of rows that it exported.
+ */
+static uint64
+FinishPlacementCopyOut(CopyOutConnectionState *connectionState)
+{
+	MultiConnection *connection = connectionState->connection;
+	bool raiseInterrupts = true;
+	PGresult *result = GetRemoteCommandResult(connection, raiseInterrupts);
+	int64 rowCount = 0;
+
+	if (PQresultStatus(result) != PGRES_COMMAND_OK)
+	{
+		ReportResultError(connection, result, ERROR);
+	}
+
+	scanint8(PQcmdTuples(result), false, &rowCount);
+
+	PQclear(result);
+	ForgetResults(connection);
+
+	return (uint64) rowCount;
+}
+
+
+/*
+ * WaitForCopyOutData waits until a connection with a COPY in progress becomes
+ * readable, or until the latch is set. It is only called when no connection
+ * had data to forward, so we build the wait event set on the fly.
+ */
+static void
+WaitForCopyOutData(List *connectionStateList)
+{
+	WaitEventSet *waitEventSet = NULL;
+	WaitEvent event;
+	ListCell *connectionStateCell = NULL;
+	int eventCount = 0;
+
+	/* additional 2 is for postmaster and latch */
+	int eventSetSize = list_length(connectionStateList) + 2;
+
+	waitEventSet = CreateWaitEventSet(CurrentMemoryContext, eventSetSize);
+
+	foreach(connectionStateCell, connectionStateList)
+	{
+		CopyOutConnectionState *connectionState = lfirst(connectionStateCell);
+		PGconn *pgConn = connectionState->connection->pgConn;
+
+		if (connectionState->placementList == NIL)
+		{
+			continue;
+		}
+
+		AddWaitEventToSet(waitEventSet, WL_SOCKET_READABLE, PQsocket(pgConn), NULL,
+						  NULL);
+	}
+
+	AddWaitEventToSet(waitEventSet, WL_POSTMASTER_DEATH, PGINVALID_SOCKET, NULL, NULL);
+	AddWaitEventToSet(waitEventSet, WL_LATCH_SET, PGINVALID_SOCKET, MyLatch, NULL);
+
+	eventCount = WaitEventSetWait(waitEventSet, -1, &event, 1, PG_WAIT_EXTENSION);
+
+	FreeWaitEventSet(waitEventSet);
+
+	if (eventCount > 0 && (event.events & WL_POSTMASTER_DEATH))
+	{
+		ereport(ERROR, (errmsg("postmaster was shut down, exiting")));
+	}
+
+	if (eventCount > 0 && (event.events & WL_LATCH_SET))
+	{
+		ResetLatch(MyLatch);
+	}
+
+	CHECK_FOR_INTERRUPTS();
+}
+
+
+/*
+ * ShutdownCopyOutConnections closes the connections on which a COPY is still
+ * in progress after an error, since they cannot be used for anything else
+ * until the whole output is consumed, and unclaims the other connections.
+ */
+static void
+ShutdownCopyOutConnections(List *connectionStateList)
+{
+	ListCell *connectionStateCell = NULL;
+
+	foreach(connectionStateCell, connectionStateList)
+	{
+		CopyOutConnectionState *connectionState = lfirst(connectionStateCell);
+		MultiConnection *connection = connectionState->connection;
+
+		if (connectionState->placementList != NIL && connection->pgConn != NULL &&
+			PQtransactionStatus(connection->pgConn) == PQTRANS_ACTIVE)
+		{
+			ShutdownConnection(connection);
+		}
+
+		UnclaimConnection(connection);
+	}
+}
@@ -7,6 +7,7 @@
  *
  *-------------------------------------------------------------------------
  */
+#include <arpa/inet.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
@@ -18,6 +19,8 @@
 
 #include "catalog/pg_enum.h"
 #include "commands/copy.h"
+#include "common/pg_lzcompress.h"
+#include "distributed/commands/hybrid_copy.h"
 #include "distributed/commands/multi_copy.h"
 #include "distributed/connection_management.h"
 #include "distributed/intermediate_results.h"
@@ -41,8 +44,52 @@
 #include "utils/syscache.h"
 
 
+/*
+ * Compressed intermediate results start with COMPRESSED_RESULT_MAGIC, followed
+ * by a sequence of blocks. Each block consists of a CompressedResultBlockHeader
+ * and the pglz-compressed COPY data of the block. Blocks that do not compress
+ * are stored as is, which is indicated by a stored length that is equal to the
+ * raw length.
+ */
+#define COMPRESSED_RESULT_MAGIC "CITUSLZ"
+#define COMPRESSED_RESULT_MAGIC_LENGTH 8
+#define COMPRESSED_RESULT_BLOCK_SIZE (64 * 1024)
+
+
+/* header of a block of a compressed intermediate result, in network byte order */
+typedef struct CompressedResultBlockHeader
+{
+	uint32 rawLength;
+	uint32 storedLength;
+} CompressedResultBlockHeader;
+
+
+/* state of reading a compressed intermediate result file */
+typedef struct CompressedResultReadState
+{
+	FILE *file;
+	char *fileName;
+
+	/* decompressed data of the current block */
+	char *blockData;
+	uint32 blockLength;
+	uint32 blockOffset;
+	uint32 blockCapacity;
+
+	/* compressed data of the current block */
+	char *storedData;
+	uint32 storedCapacity;
+} CompressedResultReadState;
+
+
+/* whether to compress the intermediate results that we write */
+bool CompressIntermediateResults = false;
+
 static bool CreatedResultsDirectory = false;
 
+/* the data source callback of COPY does not take arguments, so keep a pointer */
+static CompressedResultReadState *CurrentCompressedReadState = NULL;
+
 
 /* CopyDestReceiver can be used to stream results into a distributed table */
 typedef struct RemoteFileDestReceiver
@@ -69,6 +116,10 @@ typedef struct RemoteFileDestReceiver
 	bool writeLocalFile;
 	FileCompat fileCompat;
 
+	/* whether to compress the COPY data, and the data of the current block */
+	bool compressData;
+	StringInfo compressionBuffer;
+
 	/* state on how to copy out data types */
 	CopyOutState copyOutState;
 	FmgrInfo *columnOutputFunctions;
@@ -82,6 +133,10 @@ static void RemoteFileDestReceiverStartup(DestReceiver *dest, int operation,
 										  TupleDesc inputTupleDescriptor);
 static StringInfo ConstructCopyResultStatement(const char *resultId);
 static void WriteToLocalFile(StringInfo copyData, FileCompat *fileCompat);
+static void WriteCopyData(RemoteFileDestReceiver *resultDest, StringInfo copyData);
+static void SendCopyDataToDestinations(RemoteFileDestReceiver *resultDest,
+									   StringInfo dataBuffer);
+static void FlushCompressedBlock(RemoteFileDestReceiver *resultDest);
 static bool RemoteFileDestReceiverReceive(TupleTableSlot *slot, DestReceiver *dest);
 static void BroadcastCopyData(StringInfo dataBuffer, List *connectionList);
 static void SendCopyDataOverConnection(StringInfo dataBuffer,
@@ -92,6 +147,13 @@ static void RemoteFileDestReceiverDestroy(DestReceiver *destReceiver);
 static char * CreateIntermediateResultsDirectory(void);
 static char * IntermediateResultsDirectory(void);
 static char * QueryResultFileName(const char *resultId);
+static bool IsCompressedResultFile(const char *fileName);
+static bool IsHybridResultFile(const char *fileName);
+static void ReadCompressedResultFileIntoTupleStore(char *fileName, char *copyFormat,
+												   TupleDesc tupleDescriptor,
+												   Tuplestorestate *tupstore);
+static int ReadCompressedResultData(void *outbuf, int minread, int maxread);
+static bool ReadNextCompressedResultBlock(CompressedResultReadState *readState);
 
 
 /* exports for SQL callable functions */
@@ -167,7 +229,15 @@ create_intermediate_result(PG_FUNCTION_ARGS)
 	 * Intermediate results will be stored in a directory that is derived
 	 * from the distributed transaction ID.
 	 */
-	BeginOrContinueCoordinatedTransaction();
+	if (GetCurrentDistributedTransactionId()->transactionNumber == 0)
+	{
+		/*
+		 * On a worker that takes part in a distributed transaction, the ID
+		 * was already assigned by assign_distributed_transaction_id() and the
+		 * result should end up in the directory of that transaction.
+		 */
+		BeginOrContinueCoordinatedTransaction();
+	}
 
 	estate = CreateExecutorState();
 	resultDest = (RemoteFileDestReceiver *) CreateRemoteFileDestReceiver(resultIdString,
@@ -210,6 +280,7 @@ CreateRemoteFileDestReceiver(char *resultId, EState *executorState,
 	resultDest->initialNodeList = initialNodeList;
 	resultDest->memoryContext = CurrentMemoryContext;
 	resultDest->writeLocalFile = writeLocalFile;
+	resultDest->compressData = CompressIntermediateResults;
 
 	return (DestReceiver *) resultDest;
 }
@@ -245,12 +316,24 @@ RemoteFileDestReceiverStartup(DestReceiver *dest, int operation,
 	copyOutState->null_print = (char *) nullPrintCharacter;
 	copyOutState->null_print_client = (char *) nullPrintCharacter;
 	copyOutState->binary = CanUseBinaryCopyFormat(inputTupleDescriptor);
+	copyOutState->textColumns = HybridTextColumns(inputTupleDescriptor);
 	copyOutState->fe_msgbuf = makeStringInfo();
 	copyOutState->rowcontext = GetPerTupleMemoryContext(resultDest->executorState);
 	resultDest->copyOutState = copyOutState;
 
-	resultDest->columnOutputFunctions = ColumnOutputFunctions(inputTupleDescriptor,
-															  copyOutState->binary);
+	if (copyOutState->textColumns != NULL)
+	{
+		/* send most columns in binary format, see HybridTextColumnsForTypes() */
+		copyOutState->binary = true;
+		resultDest->columnOutputFunctions =
+			HybridColumnOutputFunctions(inputTupleDescriptor,
+										copyOutState->textColumns);
+	}
+	else
+	{
+		resultDest->columnOutputFunctions =
+			ColumnOutputFunctions(inputTupleDescriptor, copyOutState->binary);
+	}
 
 	if (resultDest->writeLocalFile)
 	{
@@ -324,20 +407,28 @@ RemoteFileDestReceiverStartup(DestReceiver *dest, int operation,
 		PQclear(result);
 	}
 
+	resultDest->connectionList = connectionList;
+
+	if (resultDest->compressData)
+	{
+		StringInfo magicBuffer = makeStringInfo();
+
+		/* the terminating zero byte of the magic is part of it */
+		appendBinaryStringInfo(magicBuffer, COMPRESSED_RESULT_MAGIC,
+							   COMPRESSED_RESULT_MAGIC_LENGTH);
+		SendCopyDataToDestinations(resultDest, magicBuffer);
+
+		resultDest->compressionBuffer = makeStringInfo();
+		enlargeStringInfo(resultDest->compressionBuffer, COMPRESSED_RESULT_BLOCK_SIZE);
+	}
+
 	if (copyOutState->binary)
 	{
 		/* send headers when using binary encoding */
 		resetStringInfo(copyOutState->fe_msgbuf);
 		AppendCopyBinaryHeaders(copyOutState);
-		BroadcastCopyData(copyOutState->fe_msgbuf, connectionList);
-
-		if (resultDest->writeLocalFile)
-		{
-			WriteToLocalFile(copyOutState->fe_msgbuf, &resultDest->fileCompat);
-		}
+		WriteCopyData(resultDest, copyOutState->fe_msgbuf);
 	}
-
-	resultDest->connectionList = connectionList;
 }
 
 
@@ -369,7 +460,6 @@ RemoteFileDestReceiverReceive(TupleTableSlot *slot, DestReceiver *dest)
 
 	TupleDesc tupleDescriptor = resultDest->tupleDescriptor;
 
-	List *connectionList = resultDest->connectionList;
 	CopyOutState copyOutState = resultDest->copyOutState;
 	FmgrInfo *columnOutputFunctions = resultDest->columnOutputFunctions;
 
@@ -392,14 +482,8 @@ RemoteFileDestReceiverReceive(TupleTableSlot *slot, DestReceiver *dest)
 	AppendCopyRowData(columnValues, columnNulls, tupleDescriptor,
 					  copyOutState, columnOutputFunctions, NULL);
 
-	/* send row to nodes */
-	BroadcastCopyData(copyData, connectionList);
-
-	/* write to local file (if applicable) */
-	if (resultDest->writeLocalFile)
-	{
-		WriteToLocalFile(copyOutState->fe_msgbuf, &resultDest->fileCompat);
-	}
+	/* send row to nodes and write to local file (if applicable) */
+	WriteCopyData(resultDest, copyData);
 
 	MemoryContextSwitchTo(oldContext);
 
@@ -428,6 +512,96 @@ WriteToLocalFile(StringInfo copyData, FileCompat *fileCompat)
 }
 
 
+/*
+ * WriteCopyData sends the given COPY data to all destinations of the
+ * RemoteFileDestReceiver. When compressing, the data is buffered until a full
+ * block is available.
+ */
+static void
+WriteCopyData(RemoteFileDestReceiver *resultDest, StringInfo copyData)
+{
+	StringInfo compressionBuffer = resultDest->compressionBuffer;
+
+	if (!resultDest->compressData)
+	{
+		SendCopyDataToDestinations(resultDest, copyData);
+		return;
+	}
+
+	appendBinaryStringInfo(compressionBuffer, copyData->data, copyData->len);
+
+	if (compressionBuffer->len >= COMPRESSED_RESULT_BLOCK_SIZE)
+	{
+		FlushCompressedBlock(resultDest);
+	}
+}
+
+
+/*
+ * SendCopyDataToDestinations sends the given buffer to all worker nodes and
+ * writes it to the local file, if applicable.
+ */
+static void
+SendCopyDataToDestinations(RemoteFileDestReceiver *resultDest, StringInfo dataBuffer)
+{
+	BroadcastCopyData(dataBuffer, resultDest->connectionList);
+
+	if (resultDest->writeLocalFile)
+	{
+		WriteToLocalFile(dataBuffer, &resultDest->fileCompat);
+	}
+}
+
+
+/*
+ * FlushCompressedBlock compresses the buffered COPY data into a block and
+ * sends the block to all destinations. If the data does not compress, the
+ * block stores the data as is.
+ */
+static void
+FlushCompressedBlock(RemoteFileDestReceiver *resultDest)
+{
+	StringInfo compressionBuffer = resultDest->compressionBuffer;
+	StringInfo blockBuffer = NULL;
+	CompressedResultBlockHeader blockHeader;
+	int32 rawLength = compressionBuffer->len;
+	int32 storedLength = 0;
+	char *storedData = NULL;
+
+	if (rawLength == 0)
+	{
+		return;
+	}
+
+	blockBuffer = makeStringInfo();
+	enlargeStringInfo(blockBuffer, sizeof(CompressedResultBlockHeader) +
+					  PGLZ_MAX_OUTPUT(rawLength));
+
+	storedData = blockBuffer->data + sizeof(CompressedResultBlockHeader);
+	storedLength = pglz_compress(compressionBuffer->data, rawLength, storedData,
+								 PGLZ_strategy_default);
+
+	/* pglz returns -1 if the data does not compress, store it as is */
+	if (storedLength < 0 || storedLength >= rawLength)
+	{
+		memcpy(storedData, compressionBuffer->data, rawLength);
+		storedLength = rawLength;
+	}
+
+	blockHeader.rawLength = htonl((uint32) rawLength);
+	blockHeader.storedLength = htonl((uint32) storedLength);
+	memcpy(blockBuffer->data, &blockHeader, sizeof(CompressedResultBlockHeader));
+	blockBuffer->len = sizeof(CompressedResultBlockHeader) + storedLength;
+
+	SendCopyDataToDestinations(resultDest, blockBuffer);
+
+	pfree(blockBuffer->data);
+	pfree(blockBuffer);
+
+	resetStringInfo(compressionBuffer);
+}
+
+
 /*
  * RemoteFileDestReceiverShutdown implements the rShutdown interface of
  * RemoteFileDestReceiver. It ends the COPY on all the open connections and closes
@@ -446,12 +620,13 @@ RemoteFileDestReceiverShutdown(DestReceiver *destReceiver)
 		/* send footers when using binary encoding */
 		resetStringInfo(copyOutState->fe_msgbuf);
 		AppendCopyBinaryFooters(copyOutState);
-		BroadcastCopyData(copyOutState->fe_msgbuf, connectionList);
+		WriteCopyData(resultDest, copyOutState->fe_msgbuf);
+	}
 
-		if (resultDest->writeLocalFile)
-		{
-			WriteToLocalFile(copyOutState->fe_msgbuf, &resultDest->fileCompat);
-		}
+	if (resultDest->compressData)
+	{
+		/* send the last, partial block */
+		FlushCompressedBlock(resultDest);
 	}
 
 	/* close the COPY input */
@@ -512,6 +687,12 @@ RemoteFileDestReceiverDestroy(DestReceiver *destReceiver)
 		pfree(resultDest->columnOutputFunctions);
 	}
 
+	if (resultDest->compressionBuffer)
+	{
+		pfree(resultDest->compressionBuffer->data);
+		pfree(resultDest->compressionBuffer);
+	}
+
 	pfree(resultDest);
 }
 
@@ -696,7 +877,8 @@ IntermediateResultSize(char *resultId)
  * SELECT * FROM read_intermediate_result('foo', 'csv') AS (a int, b int)
  *
  * The file is read from the directory returned by IntermediateResultsDirectory,
- * which includes the user ID.
+ * which includes the user ID. Files that are written with
+ * citus.compress_intermediate_results enabled are decompressed on the fly.
  *
  * read_intermediate_result is a volatile function because it cannot be
  * evaluated until execution time, but for distributed planning purposes we can
@@ -731,9 +913,262 @@ read_intermediate_result(PG_FUNCTION_ARGS)
 
 	tupstore = SetupTuplestore(fcinfo, &tupleDescriptor);
 
-	ReadFileIntoTupleStore(resultFileName, copyFormatLabel, tupleDescriptor, tupstore);
+	if (IsCompressedResultFile(resultFileName))
+	{
+		ReadCompressedResultFileIntoTupleStore(resultFileName, copyFormatLabel,
+											   tupleDescriptor, tupstore);
+	}
+	else
+	{
+		/* results of a mix of types are in the hybrid format, whichever is asked */
+		if (IsHybridResultFile(resultFileName))
+		{
+			copyFormatLabel = "binary";
+		}
+
+		ReadFileIntoTupleStore(resultFileName, copyFormatLabel, tupleDescriptor,
+							   tupstore);
+	}
 
 	tuplestore_donestoring(tupstore);
 
 	return (Datum) 0;
 }
+
+
+/*
+ * IsCompressedResultFile returns whether the given intermediate result file
+ * starts with the magic of compressed intermediate results.
+ */
+static bool
+IsCompressedResultFile(const char *fileName)
+{
+	char magic[COMPRESSED_RESULT_MAGIC_LENGTH];
+	size_t bytesRead = 0;
+
+	FILE *file = AllocateFile(fileName, PG_BINARY_R);
+	if (file == NULL)
+	{
+		ereport(ERROR, (errcode_for_file_access(),
+						errmsg("could not open file \"%s\": %m", fileName)));
+	}
+
+	bytesRead = fread(magic, 1, COMPRESSED_RESULT_MAGIC_LENGTH, file);
+
+	FreeFile(file);
+
+	return bytesRead == COMPRESSED_RESULT_MAGIC_LENGTH &&
+		   memcmp(magic, COMPRESSED_RESULT_MAGIC, COMPRESSED_RESULT_MAGIC_LENGTH) == 0;
+}
+
+
+/*
+ * IsHybridResultFile returns whether the given intermediate result file starts
+ * with a binary COPY header that marks the hybrid row format.
+ */
+static bool
+IsHybridResultFile(const char *fileName)
+{
+	char header[HYBRID_COPY_HEADER_LENGTH];
+	size_t bytesRead = 0;
+
+	FILE *file = AllocateFile(fileName, PG_BINARY_R);
+	if (file == NULL)
+	{
+		ereport(ERROR, (errcode_for_file_access(),
+						errmsg("could not open file \"%s\": %m", fileName)));
+	}
+
+	bytesRead = fread(header, 1, HYBRID_COPY_HEADER_LENGTH, file);
+
+	FreeFile(file);
+
+	return IsHybridCopyHeader(header, bytesRead);
+}
+
+
+/*
+ * ReadCompressedResultFileIntoTupleStore parses the records in a compressed
+ * intermediate result file and stores them in the tuple store. The blocks are
+ * decompressed one at a time as COPY asks for more data.
+ */
+static void
+ReadCompressedResultFileIntoTupleStore(char *fileName, char *copyFormat,
+									   TupleDesc tupleDescriptor,
+									   Tuplestorestate *tupstore)
+{
+	CompressedResultReadState *readState = palloc0(sizeof(CompressedResultReadState));
+	char magic[COMPRESSED_RESULT_MAGIC_LENGTH];
+
+	readState->fileName = fileName;
+	readState->file = AllocateFile(fileName, PG_BINARY_R);
+	if (readState->file == NULL)
+	{
+		ereport(ERROR, (errcode_for_file_access(),
+						errmsg("could not open file \"%s\": %m", fileName)));
+	}
+
+	/* skip the magic, IsCompressedResultFile already checked it */
+	if (fread(magic, 1, COMPRESSED_RESULT_MAGIC_LENGTH, readState->file) !=
+		COMPRESSED_RESULT_MAGIC_LENGTH)
+	{
+		ereport(ERROR, (errcode_for_file_access(),
+						errmsg("could not read file \"%s\": %m", fileName)));
+	}
+
+	CurrentCompressedReadState = readState;
+
+	/* the first block starts with the COPY header, check for the hybrid format */
+	if (ReadNextCompressedResultBlock(readState) &&
+		IsHybridCopyHeader(readState->blockData, readState->blockLength))
+	{
+		copyFormat = "binary";
+	}
+
+	ReadDataSourceIntoTupleStore(ReadCompressedResultData, copyFormat, tupleDescriptor,
+								 tupstore);
+
+	CurrentCompressedReadState = NULL;
+
+	FreeFile(readState->file);
+}
+
+
+/*
+ * ReadCompressedResultData is the data source callback of the COPY that reads
+ * a compressed intermediate result file. It copies at least minread and at
+ * most maxread bytes of decompressed data to outbuf, and returns the number of
+ * bytes copied. It returns fewer than minread bytes only at the end of the file.
+ */
+static int
+ReadCompressedResultData(void *outbuf, int minread, int maxread)
+{
+	CompressedResultReadState *readState = CurrentCompressedReadState;
+	char *outputBuffer = (char *) outbuf;
+	int bytesCopied = 0;
+
+	Assert(readState != NULL);
+
+	while (bytesCopied < minread)
+	{
+		uint32 bytesAvailable = 0;
+		uint32 bytesToCopy = 0;
+
+		if (readState->blockOffset == readState->blockLength &&
+			!ReadNextCompressedResultBlock(readState))
+		{
+			break;
+		}
+
+		bytesAvailable = readState->blockLength - readState->blockOffset;
+		bytesToCopy = Min(bytesAvailable, (uint32) (maxread - bytesCopied));
+
+		memcpy(outputBuffer + bytesCopied, readState->blockData + readState->blockOffset,
+			   bytesToCopy);
+
+		readState->blockOffset += bytesToCopy;
+		bytesCopied += bytesToCopy;
+	}
+
+	return bytesCopied;
+}
+
+
+/*
+ * ReadNextCompressedResultBlock reads and decompresses the next block of a
+ * compressed intermediate result file. The function returns false at the end
+ * of the file.
+ */
+static bool
+ReadNextCompressedResultBlock(CompressedResultReadState *readState)
+{
+	CompressedResultBlockHeader blockHeader;
+	uint32 rawLength = 0;
+	uint32 storedLength = 0;
+	size_t bytesRead = 0;
+
+	bytesRead = fread(&blockHeader, 1, sizeof(CompressedResultBlockHeader),
+					  readState->file);
+	if (bytesRead == 0 && feof(readState->file))
+	{
+		return false;
+	}
+	else if (bytesRead != sizeof(CompressedResultBlockHeader))
+	{
+		ereport(ERROR, (errcode(ERRCODE_DATA_CORRUPTED),
+						errmsg("compressed intermediate result file \"%s\" is "
+							   "corrupted", readState->fileName)));
+	}
+
+	rawLength = ntohl(blockHeader.rawLength);
+	storedLength = ntohl(blockHeader.storedLength);
+
+	if (storedLength > rawLength || rawLength > MaxAllocSize)
+	{
+		ereport(ERROR, (errcode(ERRCODE_DATA_CORRUPTED),
+						errmsg("compressed intermediate result file \"%s\" is "
+							   "corrupted", readState->fileName)));
+	}
+
+	if (rawLength > readState->blockCapacity)
+	{
+		if (readState->blockData != NULL)
+		{
+			pfree(readState->blockData);
+		}
+
+		readState->blockData = palloc(rawLength);
+		readState->blockCapacity = rawLength;
+	}
+
+	if (storedLength == rawLength)
+	{
+		/* the block is stored as is */
+		bytesRead = fread(readState->blockData, 1, rawLength, readState->file);
+		if (bytesRead != rawLength)
+		{
+			ereport(ERROR, (errcode(ERRCODE_DATA_CORRUPTED),
+							errmsg("compressed intermediate result file \"%s\" is "
+								   "corrupted", readState->fileName)));
+		}
+	}
+	else
+	{
+		int32 decompressedLength = 0;
+
+		if (storedLength > readState->storedCapacity)
+		{
+			if (readState->storedData != NULL)
+			{
+				pfree(readState->storedData);
+			}
+
+			readState->storedData = palloc(storedLength);
+			readState->storedCapacity = storedLength;
+		}
+
+		bytesRead = fread(readState->storedData, 1, storedLength, readState->file);
+		if (bytesRead != storedLength)
+		{
+			ereport(ERROR, (errcode(ERRCODE_DATA_CORRUPTED),
+							errmsg("compressed intermediate result file \"%s\" is "
+								   "corrupted", readState->fileName)));
+		}
+
+		decompressedLength = pglz_decompress_compat(readState->storedData,
+													storedLength,
+													readState->blockData,
+													rawLength);
+		if (decompressedLength < 0 || (uint32) decompressedLength != rawLength)
+		{
+			ereport(ERROR, (errcode(ERRCODE_DATA_CORRUPTED),
+							errmsg("compressed intermediate result file \"%s\" is "
+								   "corrupted", readState->fileName)));
+		}
+	}
+
+	readState->blockLength = rawLength;
+	readState->blockOffset = 0;
+
+	return true;
+}
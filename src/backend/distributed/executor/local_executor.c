@@ -0,0 +1,495 @@
+/*-------------------------------------------------------------------------
+ *
+ * local_executor.c
+ *
+ * The scope of the local execution is to execute the shard queries whose
+ * placements are on the node that the query is being executed, without
+ * going through a (loopback) connection to the same node.
+ *
+ * Such placements exist on the coordinator when it is added to the metadata
+ * (e.g., reference tables in a single node setup) and on the MX workers,
+ * which have the metadata and the shards. Executing the shard queries over a
+ * connection to the local node requires re-parsing and re-planning the shard
+ * query in another backend, and serializing the results back, which is pure
+ * overhead for short-running queries. Instead, we plan and execute the shard
+ * query in the current backend and write the results into the tuple store of
+ * the scan.
+ *
+ * Executing a shard query locally changes the semantics of the distributed
+ * transaction in a subtle way: any subsequent access to the same placement
+ * over a connection would not see the local modifications, and could even
+ * self-deadlock on the locks that the local execution holds. Similarly, any
+ * placement that has already been accessed over a connection cannot be
+ * accessed locally. To keep things simple, we follow the rules below:
+ *
+ *   - Local execution is only started for queries with a single task and
+ *     only when no connection has accessed any placements in the
+ *     transaction.
+ *   - Once a local execution happened, all the subsequent tasks that access
+ *     the local node are executed locally, and the rest are executed over
+ *     connections via the adaptive executor.
+ *   - Commands that cannot execute locally (e.g., COPY, the other executors,
+ *     or utility commands that use ExecuteTaskList()) error out if they need
+ *     to access the local node after a local execution has happened.
+ *
+ * The local accesses are recorded in relation access tracking the same way
+ * as sequential accesses over a single connection, such that the rules for
+ * foreign keys to reference tables are enforced.
+ *
+ * Copyright (c) 2019, Citus Data, Inc.
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "miscadmin.h"
+
+#include "distributed/citus_custom_scan.h"
+#include "distributed/local_executor.h"
+#include "distributed/metadata_cache.h"
+#include "distributed/multi_executor.h"
+#include "distributed/multi_physical_planner.h"
+#include "distributed/placement_connection.h"
+#include "distributed/relation_access_tracking.h"
+#include "distributed/relay_utility.h"
+#include "distributed/worker_protocol.h"
+#include "executor/executor.h"
+#include "executor/tstoreReceiver.h"
+#include "nodes/params.h"
+#include "tcop/tcopprot.h"
+#include "utils/snapmgr.h"
+
+
+/* controlled via a GUC */
+bool EnableLocalExecution = false;
+
+/* set when a shard query is executed locally in the current transaction */
+bool LocalExecutionHappened = false;
+
+
+static Query * ParseLocalTaskQuery(Task *task, ParamListInfo paramListInfo);
+static uint64 ExecuteLocalTaskPlan(CitusScanState *scanState, PlannedStmt *taskPlan,
+								   char *queryString, ParamListInfo paramListInfo);
+static void RecordLocalPlacementAccesses(Task *task);
+static void SplitLocalAndRemotePlacements(List *taskPlacementList,
+										  List **localTaskPlacementList,
+										  List **remoteTaskPlacementList);
+
+
+/*
+ * ExecuteLocalTaskList gets a CitusScanState node and a list of local tasks.
+ *
+ * The function goes over the task list and executes them locally. The
+ * returned tuples (if any) are stored in the tuple store of the scan
+ * state. The function returns the number of rows processed by the
+ * modifications.
+ */
+uint64
+ExecuteLocalTaskList(CitusScanState *scanState, List *taskList)
+{
+	EState *executorState = ScanStateGetExecutorState(scanState);
+	ParamListInfo paramListInfo = copyParamList(executorState->es_param_list_info);
+	int cursorOptions = 0;
+	ListCell *taskCell = NULL;
+	uint64 totalRowsProcessed = 0;
+
+	/*
+	 * Flag for the rest of the transaction, such that subsequent accesses to
+	 * the local node also happen locally.
+	 */
+	LocalExecutionHappened = true;
+
+	foreach(taskCell, taskList)
+	{
+		Task *task = (Task *) lfirst(taskCell);
+		Query *shardQuery = NULL;
+		PlannedStmt *localPlan = NULL;
+
+		shardQuery = ParseLocalTaskQuery(task, paramListInfo);
+		localPlan = pg_plan_query(shardQuery, cursorOptions, paramListInfo);
+
+		RecordLocalPlacementAccesses(task);
+
+		totalRowsProcessed += ExecuteLocalTaskPlan(scanState, localPlan,
+												   task->queryString, paramListInfo);
+	}
+
+	return totalRowsProcessed;
+}
+
+
+/*
+ * ParseLocalTaskQuery parses and analyzes the query string of the task. The
+ * parameter types are taken from the given parameter list, such that the
+ * query can refer to the parameters in the same way as the remote execution
+ * does.
+ */
+static Query *
+ParseLocalTaskQuery(Task *task, ParamListInfo paramListInfo)
+{
+	char *queryString = task->queryString;
+	RawStmt *rawStmt = (RawStmt *) ParseTreeRawStmt(queryString);
+	List *queryTreeList = NIL;
+	Oid *parameterTypes = NULL;
+	int parameterCount = 0;
+
+	if (paramListInfo != NULL)
+	{
+		int parameterIndex = 0;
+
+		parameterCount = paramListInfo->numParams;
+		parameterTypes = (Oid *) palloc0(parameterCount * sizeof(Oid));
+
+		for (parameterIndex = 0; parameterIndex < parameterCount; parameterIndex++)
+		{
+			ParamExternData *parameterData = &paramListInfo->params[parameterIndex];
+
+			parameterTypes[parameterIndex] = parameterData->ptype;
+		}
+	}
+
+	queryTreeList = pg_analyze_and_rewrite(rawStmt, queryString, parameterTypes,
+										   parameterCount, NULL);
+	if (list_length(queryTreeList) != 1)
+	{
+		ereport(ERROR, (errmsg("cannot execute query locally"),
+						errdetail("Shard query is rewritten into multiple "
+								  "queries.")));
+	}
+
+	return (Query *) linitial(queryTreeList);
+}
+
+
+/*
+ * ExecuteLocalTaskPlan gets a planned statement which can be executed locally.
+ * The function simply follows the steps to have a local execution, sets the
+ * tupleStore if necessary. The function returns the number of rows processed
+ * by the modification, if any.
+ */
+static uint64
+ExecuteLocalTaskPlan(CitusScanState *scanState, PlannedStmt *taskPlan,
+					 char *queryString, ParamListInfo paramListInfo)
+{
+	DestReceiver *tupleStoreDestReceiver = CreateDestReceiver(DestTuplestore);
+	ScanDirection scanDirection = ForwardScanDirection;
+	QueryEnvironment *queryEnv = NULL;
+	QueryDesc *queryDesc = NULL;
+	int eflags = 0;
+	uint64 totalRowsProcessed = 0;
+
+	/*
+	 * Use the tuple store of the scan state, which is shared across the
+	 * local and the remote task executions.
+	 */
+	SetTuplestoreDestReceiverParams(tupleStoreDestReceiver,
+									scanState->tuplestorestate,
+									CurrentMemoryContext, false);
+
+	queryDesc = CreateQueryDesc(taskPlan, queryString,
+								GetActiveSnapshot(), InvalidSnapshot,
+								tupleStoreDestReceiver, paramListInfo,
+								queryEnv, 0);
+
+	ExecutorStart(queryDesc, eflags);
+	ExecutorRun(queryDesc, scanDirection, 0L, true);
+
+	/* the caller sets es_processed of the distributed query */
+	if (taskPlan->commandType != CMD_SELECT)
+	{
+		totalRowsProcessed = queryDesc->estate->es_processed;
+	}
+
+	ExecutorFinish(queryDesc);
+	ExecutorEnd(queryDesc);
+
+	FreeQueryDesc(queryDesc);
+
+	tupleStoreDestReceiver->rDestroy(tupleStoreDestReceiver);
+
+	return totalRowsProcessed;
+}
+
+
+/*
+ * RecordLocalPlacementAccesses records the accesses of the task to the local
+ * placement in relation access tracking. Since a local execution is
+ * essentially a sequential access over a single "connection", it is recorded
+ * the same way as a placement access over a connection is recorded.
+ */
+static void
+RecordLocalPlacementAccesses(Task *task)
+{
+	ShardPlacement *localPlacement = NULL;
+	List *placementAccessList = NIL;
+	ListCell *placementAccessCell = NULL;
+
+	if (list_length(task->taskPlacementList) == 0)
+	{
+		return;
+	}
+
+	/* local tasks only have the local placement */
+	localPlacement = (ShardPlacement *) linitial(task->taskPlacementList);
+	placementAccessList = PlacementAccessListForTask(task, localPlacement);
+
+	foreach(placementAccessCell, placementAccessList)
+	{
+		ShardPlacementAccess *placementAccess =
+			(ShardPlacementAccess *) lfirst(placementAccessCell);
+		ShardPlacement *placement = placementAccess->placement;
+		Oid relationId = InvalidOid;
+
+		if (placement->shardId == INVALID_SHARD_ID)
+		{
+			/* dummy placement of a SELECT that is pruned down to zero shards */
+			continue;
+		}
+
+		relationId = RelationIdForShard(placement->shardId);
+		RecordRelationAccessIfReferenceTable(relationId, placementAccess->accessType);
+	}
+}
+
+
+/*
+ * ExtractLocalAndRemoteTasks gets a taskList and generates two task lists,
+ * namely localTaskList and remoteTaskList. The function goes over the input
+ * taskList and puts the tasks that are local to the node into localTaskList
+ * and the remaining to the remoteTaskList. Either of the lists could be NIL
+ * depending on the input taskList.
+ *
+ * One slightly different case is modifications to replicated tables
+ * (e.g., reference tables) where a single task ends in two separate tasks
+ * and the local task is added to localTaskList and the remaining ones to the
+ * remoteTaskList.
+ */
+void
+ExtractLocalAndRemoteTasks(bool readOnly, List *taskList, List **localTaskList,
+						   List **remoteTaskList)
+{
+	ListCell *taskCell = NULL;
+
+	*remoteTaskList = NIL;
+	*localTaskList = NIL;
+
+	foreach(taskCell, taskList)
+	{
+		Task *task = (Task *) lfirst(taskCell);
+		List *localTaskPlacementList = NIL;
+		List *remoteTaskPlacementList = NIL;
+
+		SplitLocalAndRemotePlacements(task->taskPlacementList,
+									  &localTaskPlacementList,
+									  &remoteTaskPlacementList);
+
+		/* either the local or the remote should be non-nil */
+		Assert(!(localTaskPlacementList == NIL && remoteTaskPlacementList == NIL));
+
+		if (list_length(task->taskPlacementList) == 1)
+		{
+			/*
+			 * At this point, the task has a single placement (e.g,. anchor shard
+			 * is distributed table's shard). So, it is either added to local or
+			 * remote taskList.
+			 */
+			if (localTaskPlacementList == NIL)
+			{
+				*remoteTaskList = lappend(*remoteTaskList, task);
+			}
+			else
+			{
+				*localTaskList = lappend(*localTaskList, task);
+			}
+		}
+		else
+		{
+			Task *localTask = NULL;
+			Task *remoteTask = NULL;
+
+			if (localTaskPlacementList == NIL)
+			{
+				*remoteTaskList = lappend(*remoteTaskList, task);
+
+				continue;
+			}
+
+			/*
+			 * At this point, we're dealing with reference tables or intermediate
+			 * results where the task has placements on both local and remote
+			 * nodes. We always prefer to use local placement, and require remote
+			 * placements only for modifications.
+			 */
+			localTask = copyObject(task);
+			localTask->partiallyLocalOrRemote = true;
+			localTask->taskPlacementList = localTaskPlacementList;
+			*localTaskList = lappend(*localTaskList, localTask);
+
+			if (readOnly)
+			{
+				/* read-only tasks should only be executed on the local machine */
+			}
+			else if (remoteTaskPlacementList != NIL)
+			{
+				remoteTask = copyObject(task);
+				remoteTask->partiallyLocalOrRemote = true;
+				remoteTask->taskPlacementList = remoteTaskPlacementList;
+
+				*remoteTaskList = lappend(*remoteTaskList, remoteTask);
+			}
+		}
+	}
+}
+
+
+/*
+ * SplitLocalAndRemotePlacements is a helper function which iterates over the
+ * input taskPlacementList and puts the placements into the corresponding
+ * list: the placements on the local group go to localTaskPlacementList, the
+ * rest to remoteTaskPlacementList.
+ */
+static void
+SplitLocalAndRemotePlacements(List *taskPlacementList, List **localTaskPlacementList,
+							  List **remoteTaskPlacementList)
+{
+	ListCell *placementCell = NULL;
+	int32 localGroupId = GetLocalGroupId();
+
+	*localTaskPlacementList = NIL;
+	*remoteTaskPlacementList = NIL;
+
+	foreach(placementCell, taskPlacementList)
+	{
+		ShardPlacement *taskPlacement =
+			(ShardPlacement *) lfirst(placementCell);
+
+		if (taskPlacement->groupId == localGroupId)
+		{
+			*localTaskPlacementList = lappend(*localTaskPlacementList, taskPlacement);
+		}
+		else
+		{
+			*remoteTaskPlacementList = lappend(*remoteTaskPlacementList, taskPlacement);
+		}
+	}
+}
+
+
+/*
+ * ShouldExecuteTasksLocally gets a task list and returns true if any of the
+ * tasks should be executed locally. This function does not guarantee that
+ * any task has to be executed locally.
+ */
+bool
+ShouldExecuteTasksLocally(List *taskList)
+{
+	bool singleTask = false;
+
+	if (!EnableLocalExecution)
+	{
+		return false;
+	}
+
+	if (LocalExecutionHappened)
+	{
+		/*
+		 * For various reasons, including the transaction visibility
+		 * rules (e.g., read-your-own-writes), we have to use local
+		 * execution again if it has already happened within this
+		 * transaction block.
+		 *
+		 * We might error out later in the execution if it is not suitable
+		 * to execute the tasks locally.
+		 */
+		return true;
+	}
+
+	singleTask = (list_length(taskList) == 1);
+	if (singleTask && TaskAccessesLocalNode((Task *) linitial(taskList)))
+	{
+		/*
+		 * This is the only case that we make a decision on using local
+		 * execution. If the task accesses the local node and no connection
+		 * has accessed any placement in this transaction, it is safe to
+		 * execute the task locally. Otherwise, the local execution might
+		 * not see the modifications done over the connections, or could
+		 * self-deadlock on the locks held by those connections.
+		 *
+		 * We don't use local execution for multi-task queries, since they
+		 * benefit from the parallelism of the remote execution.
+		 */
+		return !AnyConnectionAccessedPlacements();
+	}
+
+	return false;
+}
+
+
+/*
+ * AnyTaskAccessesLocalNode returns true if a task within the task list accesses
+ * to the local node.
+ */
+bool
+AnyTaskAccessesLocalNode(List *taskList)
+{
+	ListCell *taskCell = NULL;
+
+	foreach(taskCell, taskList)
+	{
+		Task *task = (Task *) lfirst(taskCell);
+
+		if (TaskAccessesLocalNode(task))
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+/*
+ * TaskAccessesLocalNode returns true if any placements of the task reside on the
+ * node that we're executing the query.
+ */
+bool
+TaskAccessesLocalNode(Task *task)
+{
+	ListCell *placementCell = NULL;
+	int32 localGroupId = GetLocalGroupId();
+
+	foreach(placementCell, task->taskPlacementList)
+	{
+		ShardPlacement *taskPlacement = (ShardPlacement *) lfirst(placementCell);
+
+		if (taskPlacement->groupId == localGroupId)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+/*
+ * ErrorIfLocalExecutionHappened() errors out if a local query has already been
+ * executed in the same transaction.
+ *
+ * This check is required because Citus currently hasn't implemented local
+ * execution infrastructure for all the commands/executors. As we implement
+ * local execution for the command/executor that this function call exists,
+ * we should simply remove the check.
+ */
+void
+ErrorIfLocalExecutionHappened(void)
+{
+	if (LocalExecutionHappened)
+	{
+		ereport(ERROR, (errmsg("cannot execute command because a local execution has "
+							   "already been done in the transaction"),
+						errhint("Try re-running the transaction with "
+								"\"SET LOCAL citus.enable_local_execution TO OFF;\""),
+						errdetail("Some parallel commands cannot be executed if a "
+								  "previous command has already been executed locally")));
+	}
+}
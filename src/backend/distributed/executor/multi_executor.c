@@ -16,6 +16,7 @@
 #include "catalog/dependency.h"
 #include "catalog/namespace.h"
 #include "distributed/citus_custom_scan.h"
+#include "distributed/commands/hybrid_copy.h"
 #include "distributed/commands/multi_copy.h"
 #include "distributed/commands/utility_hook.h"
 #include "distributed/insert_select_executor.h"
@@ -50,9 +51,14 @@ bool WritableStandbyCoordinator = false;
 
 
 /* local function forward declarations */
-static bool IsCitusPlan(Plan *plan);
-static bool IsCitusCustomScan(Plan *plan);
-static Relation StubRelation(TupleDesc tupleDescriptor);
+static void ReadCopyDataIntoTupleStore(char *fileName,
+									   copy_data_source_cb dataSourceCallback,
+									   char *copyFormat, TupleDesc tupleDescriptor,
+									   Tuplestorestate *tupstore);
+static void ReadHybridCopyDataIntoTupleStore(char *fileName,
+											 copy_data_source_cb dataSourceCallback,
+											 TupleDesc tupleDescriptor,
+											 Tuplestorestate *tupstore);
 static bool AlterTableConstraintCheck(QueryDesc *queryDesc);
 
 /*
@@ -167,7 +173,7 @@ CitusExecutorRun(QueryDesc *queryDesc,
  * IsCitusPlan returns whether a Plan contains a CustomScan generated by Citus
  * by recursively walking through the plan tree.
  */
-static bool
+bool
 IsCitusPlan(Plan *plan)
 {
 	if (plan == NULL)
@@ -197,7 +203,7 @@ IsCitusPlan(Plan *plan)
 /*
  * IsCitusCustomScan returns whether Plan node is a CustomScan generated by Citus.
  */
-static bool
+bool
 IsCitusCustomScan(Plan *plan)
 {
 	CustomScan *customScan = NULL;
@@ -319,30 +325,75 @@ void
 ReadFileIntoTupleStore(char *fileName, char *copyFormat, TupleDesc tupleDescriptor,
 					   Tuplestorestate *tupstore)
 {
-	CopyState copyState = NULL;
+	ReadCopyDataIntoTupleStore(fileName, NULL, copyFormat, tupleDescriptor, tupstore);
+}
 
-	/*
-	 * Trick BeginCopyFrom into using our tuple descriptor by pretending it belongs
-	 * to a relation.
-	 */
-	Relation stubRelation = StubRelation(tupleDescriptor);
 
-	EState *executorState = CreateExecutorState();
-	MemoryContext executorTupleContext = GetPerTupleMemoryContext(executorState);
-	ExprContext *executorExpressionContext = GetPerTupleExprContext(executorState);
+/*
+ * ReadDataSourceIntoTupleStore is like ReadFileIntoTupleStore, but reads the
+ * COPY-formatted data from the given data source callback.
+ */
+void
+ReadDataSourceIntoTupleStore(copy_data_source_cb dataSourceCallback, char *copyFormat,
+							 TupleDesc tupleDescriptor, Tuplestorestate *tupstore)
+{
+	ReadCopyDataIntoTupleStore(NULL, dataSourceCallback, copyFormat, tupleDescriptor,
+							   tupstore);
+}
+
+
+/*
+ * ReadCopyDataIntoTupleStore parses the records in COPY-formatted data that is
+ * read from the given file, or from the given data source callback if there is
+ * no file, and stores the records in a tuple store.
+ */
+static void
+ReadCopyDataIntoTupleStore(char *fileName, copy_data_source_cb dataSourceCallback,
+						   char *copyFormat, TupleDesc tupleDescriptor,
+						   Tuplestorestate *tupstore)
+{
+	CopyState copyState = NULL;
+	Relation stubRelation = NULL;
+
+	EState *executorState = NULL;
+	MemoryContext executorTupleContext = NULL;
+	ExprContext *executorExpressionContext = NULL;
 
 	int columnCount = tupleDescriptor->natts;
-	Datum *columnValues = palloc0(columnCount * sizeof(Datum));
-	bool *columnNulls = palloc0(columnCount * sizeof(bool));
+	Datum *columnValues = NULL;
+	bool *columnNulls = NULL;
 
 	DefElem *copyOption = NULL;
 	List *copyOptions = NIL;
 
 	int location = -1; /* "unknown" token location */
+
+	/* binary data of a mix of types may be in the hybrid row format */
+	if (strncmp(copyFormat, "binary", NAMEDATALEN) == 0 &&
+		HybridTextColumns(tupleDescriptor) != NULL)
+	{
+		ReadHybridCopyDataIntoTupleStore(fileName, dataSourceCallback,
+										 tupleDescriptor, tupstore);
+		return;
+	}
+
+	/*
+	 * Trick BeginCopyFrom into using our tuple descriptor by pretending it belongs
+	 * to a relation.
+	 */
+	stubRelation = StubRelation(tupleDescriptor);
+
+	executorState = CreateExecutorState();
+	executorTupleContext = GetPerTupleMemoryContext(executorState);
+	executorExpressionContext = GetPerTupleExprContext(executorState);
+
+	columnValues = palloc0(columnCount * sizeof(Datum));
+	columnNulls = palloc0(columnCount * sizeof(bool));
+
 	copyOption = makeDefElem("format", (Node *) makeString(copyFormat), location);
 	copyOptions = lappend(copyOptions, copyOption);
 
-	copyState = BeginCopyFrom(NULL, stubRelation, fileName, false, NULL,
+	copyState = BeginCopyFrom(NULL, stubRelation, fileName, false, dataSourceCallback,
 							  NULL, copyOptions);
 
 	while (true)
@@ -371,13 +422,56 @@ ReadFileIntoTupleStore(char *fileName, char *copyFormat, TupleDesc tupleDescript
 }
 
 
+/*
+ * ReadHybridCopyDataIntoTupleStore is like ReadCopyDataIntoTupleStore, but
+ * reads binary data that may be in Citus' hybrid row format.
+ */
+static void
+ReadHybridCopyDataIntoTupleStore(char *fileName, copy_data_source_cb dataSourceCallback,
+								 TupleDesc tupleDescriptor, Tuplestorestate *tupstore)
+{
+	EState *executorState = CreateExecutorState();
+	MemoryContext executorTupleContext = GetPerTupleMemoryContext(executorState);
+
+	int columnCount = tupleDescriptor->natts;
+	Datum *columnValues = palloc0(columnCount * sizeof(Datum));
+	bool *columnNulls = palloc0(columnCount * sizeof(bool));
+
+	HybridCopyState copyState = BeginHybridCopyFrom(fileName, dataSourceCallback,
+													tupleDescriptor);
+
+	while (true)
+	{
+		MemoryContext oldContext = NULL;
+		bool nextRowFound = false;
+
+		ResetPerTupleExprContext(executorState);
+		oldContext = MemoryContextSwitchTo(executorTupleContext);
+
+		nextRowFound = NextHybridCopyFrom(copyState, columnValues, columnNulls);
+		if (!nextRowFound)
+		{
+			MemoryContextSwitchTo(oldContext);
+			break;
+		}
+
+		tuplestore_putvalues(tupstore, tupleDescriptor, columnValues, columnNulls);
+		MemoryContextSwitchTo(oldContext);
+	}
+
+	EndHybridCopyFrom(copyState);
+	pfree(columnValues);
+	pfree(columnNulls);
+}
+
+
 /*
  * StubRelation creates a stub Relation from the given tuple descriptor.
  * To be able to use copy.c, we need a Relation descriptor. As there is no
  * relation corresponding to the data loaded from workers, we need to fake one.
  * We just need the bare minimal set of fields accessed by BeginCopyFrom().
  */
-static Relation
+Relation
 StubRelation(TupleDesc tupleDescriptor)
 {
 	Relation stubRelation = palloc0(sizeof(RelationData));
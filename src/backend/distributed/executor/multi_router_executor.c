@@ -552,6 +552,12 @@ CitusModifyBeginScan(CustomScanState *node, EState *estate, int eflags)
 
 		RebuildQueryStrings(jobQuery, taskList);
 	}
+	else if (workerJob->deferredPruning)
+	{
+		/* fast-path UPDATE/DELETE with a parameter on the distribution column */
+		taskList = FastPathRouterTaskList(workerJob, distributedPlan->planId,
+										  estate->es_param_list_info);
+	}
 
 	/* prevent concurrent placement changes */
 	AcquireMetadataLocks(taskList);
@@ -1716,7 +1722,7 @@ SendQueryInSingleRowMode(MultiConnection *connection, char *query,
 										   &parameterValues);
 
 		querySent = SendRemoteCommandParams(connection, query, parameterCount,
-											parameterTypes, parameterValues);
+											parameterTypes, parameterValues, false);
 	}
 	else
 	{
@@ -24,6 +24,7 @@
 #include "distributed/multi_physical_planner.h"
 #include "distributed/multi_resowner.h"
 #include "distributed/multi_server_executor.h"
+#include "distributed/repartition_join_execution.h"
 #include "distributed/subplan_execution.h"
 #include "distributed/worker_protocol.h"
 #include "utils/lsyscache.h"
@@ -149,6 +150,12 @@ JobExecutorType(DistributedPlan *distributedPlan)
 										"to enable repartitioning")));
 			}
 
+			/* the adaptive executor can run the repartition tasks itself */
+			if (executorType == MULTI_EXECUTOR_ADAPTIVE && EnableAdaptiveRepartitionJoins)
+			{
+				return MULTI_EXECUTOR_ADAPTIVE;
+			}
+
 			ereport(DEBUG1, (errmsg(
 								 "cannot use real time executor with repartition jobs"),
 							 errhint("Since you enabled citus.enable_repartition_joins "
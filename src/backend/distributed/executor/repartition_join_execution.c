@@ -0,0 +1,754 @@
+/*-------------------------------------------------------------------------
+ *
+ * repartition_join_execution.c
+ *
+ * Routines for executing the repartitioning steps of repartition joins in the
+ * adaptive executor, without the task tracker.
+ *
+ * The top-level tasks of a repartition join read the merge tables of one or
+ * two MapMerge jobs. These depend on merge tasks, which depend on the tasks
+ * that fetch the partition files of the map tasks, which in turn may depend
+ * on the merge tasks of earlier repartitions. We execute these dependencies
+ * in waves: every wave runs all the tasks whose dependencies have completed
+ * over the regular worker pools of the adaptive executor, and the next wave
+ * starts once the previous one finished. Hence, there is no need to poll for
+ * task statuses.
+ *
+ * The map and merge tasks produce files and tables that are read over other
+ * connections, so the tasks are executed outside of the distributed
+ * transaction and their results are removed once the query finishes. If the
+ * query fails or is cancelled, they are removed when the transaction ends.
+ *
+ * When citus.enable_streaming_shuffle is on, the merge tables are created
+ * before the map tasks run, and the fetch tasks stream the partition files
+ * straight into the merge tables instead of writing them to the disk of the
+ * merge node first. The merge tasks then have nothing left to do.
+ *
+ * Copyright (c) 2019, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "miscadmin.h"
+
+#include "distributed/citus_nodes.h"
+#include "distributed/connection_management.h"
+#include "distributed/local_executor.h"
+#include "distributed/metadata_cache.h"
+#include "distributed/multi_executor.h"
+#include "distributed/multi_physical_planner.h"
+#include "distributed/remote_commands.h"
+#include "distributed/repartition_join_execution.h"
+#include "distributed/transaction_management.h"
+#include "distributed/worker_manager.h"
+#include "utils/hsearch.h"
+#include "utils/memutils.h"
+
+
+/* TaskHashKey identifies a task in the task graph of a job */
+typedef struct TaskHashKey
+{
+	TaskType taskType;
+	uint64 jobId;
+	uint32 taskId;
+} TaskHashKey;
+
+
+/*
+ * TaskHashEntry keeps track of whether a task in the task graph has completed.
+ * Since copyObject() might have duplicated tasks that appear in the
+ * dependedTaskList of multiple tasks, we identify tasks by their key.
+ */
+typedef struct TaskHashEntry
+{
+	TaskHashKey key;
+	Task *task;
+	bool completed;
+
+	/* for merge tasks, whether fetch tasks stream into the merge table */
+	bool streamed;
+} TaskHashEntry;
+
+
+/* GUC, determining whether repartition joins use the adaptive executor */
+bool EnableAdaptiveRepartitionJoins = false;
+
+/* GUC, determining whether partition files are streamed into merge tables */
+bool EnableStreamingShuffle = true;
+
+/*
+ * Jobs of the current transaction whose results are not removed yet, and the
+ * nodes to remove them from. Both live in TopTransactionContext.
+ */
+static List *PendingCleanupJobIdList = NIL;
+static List *PendingCleanupNodeList = NIL;
+
+
+static void EnsureRepartitionJoinAllowed(void);
+static void UnregisterRepartitionCleanup(List *jobIdList);
+static List * DependedJobList(Job *topLevelJob);
+static List * JobIdList(List *jobList);
+static List * DependedTaskList(List *topLevelTaskList, HTAB *taskHash);
+static HTAB * TaskHashCreate(void);
+static TaskHashEntry * TaskHashLookup(HTAB *taskHash, Task *task, bool *found);
+static void CreateStreamedMergeTables(List *dependedTaskList, HTAB *taskHash,
+									  List *dependedJobList);
+static bool MergeJobStreamable(List *dependedJobList, uint64 jobId);
+static void ExecuteTasksInDependencyOrder(List *dependedTaskList, HTAB *taskHash);
+static bool DependedTasksCompleted(HTAB *taskHash, Task *task);
+static bool UpstreamMergeTaskStreamed(HTAB *taskHash, Task *mapFetchTask);
+static Task * ExecutableRepartitionTask(Task *task, bool streamOutput);
+static char * MapFetchTaskQueryString(Task *mapFetchTask, Task *mapTask,
+									  bool streamOutput);
+static void ExecuteCommandOnAllNodes(List *jobIdList, const char *commandFormat);
+static char * JobCommandString(List *jobIdList, const char *commandFormat);
+
+
+/*
+ * ExecuteDependedTasks executes the map, fetch and merge tasks that the given
+ * top-level tasks depend on, such that the top-level tasks can read the merge
+ * tables once the function returns. The function returns the identifiers of
+ * the jobs whose results should be removed via DoRepartitionCleanup after the
+ * top-level tasks are executed.
+ */
+List *
+ExecuteDependedTasks(List *topLevelTaskList, Job *topLevelJob)
+{
+	List *jobIdList = NIL;
+	List *dependedJobList = NIL;
+	List *dependedTaskList = NIL;
+	HTAB *taskHash = NULL;
+
+	EnsureRepartitionJoinAllowed();
+
+	taskHash = TaskHashCreate();
+	dependedTaskList = DependedTaskList(topLevelTaskList, taskHash);
+
+	/* the merge tasks create their tables in the schemas of their jobs */
+	dependedJobList = DependedJobList(topLevelJob);
+	jobIdList = JobIdList(dependedJobList);
+	RegisterRepartitionCleanup(jobIdList);
+	ExecuteCommandOnAllNodes(jobIdList, CREATE_JOB_SCHEMA_COMMAND);
+
+	if (EnableStreamingShuffle)
+	{
+		CreateStreamedMergeTables(dependedTaskList, taskHash, dependedJobList);
+	}
+
+	ExecuteTasksInDependencyOrder(dependedTaskList, taskHash);
+
+	return jobIdList;
+}
+
+
+/*
+ * RegisterRepartitionCleanup remembers the given jobs and the active primary
+ * nodes, such that CleanupPendingRepartitionJobs can remove the results of the
+ * jobs if the transaction ends before DoRepartitionCleanup is called.
+ */
+void
+RegisterRepartitionCleanup(List *jobIdList)
+{
+	MemoryContext oldContext = MemoryContextSwitchTo(TopTransactionContext);
+	ListCell *jobIdCell = NULL;
+
+	foreach(jobIdCell, jobIdList)
+	{
+		uint64 *jobIdPointer = (uint64 *) palloc0(sizeof(uint64));
+
+		(*jobIdPointer) = *((uint64 *) lfirst(jobIdCell));
+		PendingCleanupJobIdList = lappend(PendingCleanupJobIdList, jobIdPointer);
+	}
+
+	PendingCleanupNodeList = ActivePrimaryNodeList();
+
+	MemoryContextSwitchTo(oldContext);
+}
+
+
+/*
+ * DoRepartitionCleanup removes the partition files and the merge tables of
+ * the given jobs on all the nodes.
+ */
+void
+DoRepartitionCleanup(List *jobIdList)
+{
+	ExecuteCommandOnAllNodes(jobIdList, REPARTITION_CLEANUP_COMMAND);
+	UnregisterRepartitionCleanup(jobIdList);
+}
+
+
+/*
+ * CleanupPendingRepartitionJobs removes the partition files and the merge
+ * tables of the jobs in the current transaction that were not removed by
+ * DoRepartitionCleanup, because their query failed or was cancelled. It is
+ * called at the end of the transaction, which might be aborting, so it only
+ * uses new connections to the nodes that were active when the jobs started,
+ * and it does not error out when a node cannot be reached.
+ */
+void
+CleanupPendingRepartitionJobs(void)
+{
+	List *jobIdList = PendingCleanupJobIdList;
+	List *workerNodeList = PendingCleanupNodeList;
+	ListCell *workerNodeCell = NULL;
+	char *command = NULL;
+
+	/* do not try again if the cleanup errors out half-way */
+	PendingCleanupJobIdList = NIL;
+	PendingCleanupNodeList = NIL;
+
+	if (jobIdList == NIL)
+	{
+		return;
+	}
+
+	command = JobCommandString(jobIdList, REPARTITION_CLEANUP_COMMAND);
+
+	foreach(workerNodeCell, workerNodeList)
+	{
+		WorkerNode *workerNode = (WorkerNode *) lfirst(workerNodeCell);
+		MultiConnection *connection = GetNodeConnection(FORCE_NEW_CONNECTION,
+														workerNode->workerName,
+														workerNode->workerPort);
+		PGresult *result = NULL;
+
+		if (PQstatus(connection->pgConn) != CONNECTION_OK)
+		{
+			ReportConnectionError(connection, WARNING);
+		}
+		else if (ExecuteOptionalRemoteCommand(connection, command, &result) == 0)
+		{
+			PQclear(result);
+			ForgetResults(connection);
+		}
+
+		CloseConnection(connection);
+	}
+}
+
+
+/*
+ * EnsureRepartitionJoinAllowed errors out if the repartitioning steps cannot
+ * run in the current transaction. The map tasks run over separate connections
+ * and would not see the uncommitted changes of the transaction.
+ */
+static void
+EnsureRepartitionJoinAllowed(void)
+{
+	if (ReadFromSecondaries == USE_SECONDARY_NODES_ALWAYS)
+	{
+		ereport(ERROR, (errmsg("repartition joins are not allowed while "
+							   "citus.use_secondary_nodes is 'always'")));
+	}
+
+	if (XactModificationLevel > XACT_MODIFICATION_NONE)
+	{
+		ereport(ERROR, (errcode(ERRCODE_ACTIVE_SQL_TRANSACTION),
+						errmsg("cannot run a repartition join after a modification "
+							   "in the same transaction"),
+						errhint("Try re-running the transaction with "
+								"\"SET LOCAL citus.enable_adaptive_repartition_joins "
+								"TO off;\"")));
+	}
+
+	if (LocalExecutionHappened)
+	{
+		ErrorIfLocalExecutionHappened();
+	}
+}
+
+
+/*
+ * UnregisterRepartitionCleanup forgets the given jobs, whose results have been
+ * removed.
+ */
+static void
+UnregisterRepartitionCleanup(List *jobIdList)
+{
+	List *remainingJobIdList = NIL;
+	ListCell *pendingJobIdCell = NULL;
+	MemoryContext oldContext = MemoryContextSwitchTo(TopTransactionContext);
+
+	foreach(pendingJobIdCell, PendingCleanupJobIdList)
+	{
+		uint64 *pendingJobIdPointer = (uint64 *) lfirst(pendingJobIdCell);
+		ListCell *jobIdCell = NULL;
+		bool removed = false;
+
+		foreach(jobIdCell, jobIdList)
+		{
+			if (*((uint64 *) lfirst(jobIdCell)) == *pendingJobIdPointer)
+			{
+				removed = true;
+				break;
+			}
+		}
+
+		if (!removed)
+		{
+			remainingJobIdList = lappend(remainingJobIdList, pendingJobIdPointer);
+		}
+	}
+
+	PendingCleanupJobIdList = remainingJobIdList;
+
+	MemoryContextSwitchTo(oldContext);
+}
+
+
+/*
+ * DependedJobList walks over the jobs that the given top-level job depends on
+ * and returns them.
+ */
+static List *
+DependedJobList(Job *topLevelJob)
+{
+	List *dependedJobList = NIL;
+	List *jobQueue = list_copy(topLevelJob->dependedJobList);
+
+	while (jobQueue != NIL)
+	{
+		Job *currentJob = (Job *) linitial(jobQueue);
+		jobQueue = list_delete_first(jobQueue);
+
+		dependedJobList = lappend(dependedJobList, currentJob);
+
+		/* prevent dependedJobList being modified on list_concat() call */
+		jobQueue = list_concat(jobQueue, list_copy(currentJob->dependedJobList));
+	}
+
+	return dependedJobList;
+}
+
+
+/*
+ * JobIdList returns the identifiers of the given jobs.
+ */
+static List *
+JobIdList(List *jobList)
+{
+	List *jobIdList = NIL;
+	ListCell *jobCell = NULL;
+
+	foreach(jobCell, jobList)
+	{
+		Job *job = (Job *) lfirst(jobCell);
+		uint64 *jobIdPointer = (uint64 *) palloc0(sizeof(uint64));
+
+		(*jobIdPointer) = job->jobId;
+		jobIdList = lappend(jobIdList, jobIdPointer);
+	}
+
+	return jobIdList;
+}
+
+
+/*
+ * DependedTaskList walks over the task graph of the given top-level tasks
+ * using breadth-first search and returns the tasks that the top-level tasks
+ * depend on, directly or indirectly. Each task is returned once, and has an
+ * entry in the given task hash.
+ */
+static List *
+DependedTaskList(List *topLevelTaskList, HTAB *taskHash)
+{
+	List *dependedTaskList = NIL;
+	List *taskQueue = list_copy(topLevelTaskList);
+
+	while (taskQueue != NIL)
+	{
+		ListCell *dependedTaskCell = NULL;
+
+		Task *task = (Task *) linitial(taskQueue);
+		taskQueue = list_delete_first(taskQueue);
+
+		foreach(dependedTaskCell, task->dependedTaskList)
+		{
+			Task *dependedTask = (Task *) lfirst(dependedTaskCell);
+			bool found = false;
+
+			TaskHashLookup(taskHash, dependedTask, &found);
+			if (found)
+			{
+				continue;
+			}
+
+			dependedTaskList = lappend(dependedTaskList, dependedTask);
+			taskQueue = lappend(taskQueue, dependedTask);
+		}
+	}
+
+	return dependedTaskList;
+}
+
+
+/*
+ * TaskHashCreate creates the hash that keeps track of the completed tasks.
+ */
+static HTAB *
+TaskHashCreate(void)
+{
+	HASHCTL info;
+	int hashFlags = 0;
+
+	memset(&info, 0, sizeof(info));
+	info.keysize = sizeof(TaskHashKey);
+	info.entrysize = sizeof(TaskHashEntry);
+	info.hash = tag_hash;
+	info.hcxt = CurrentMemoryContext;
+	hashFlags = (HASH_ELEM | HASH_FUNCTION | HASH_CONTEXT);
+
+	return hash_create("Repartition Task Hash", 64, &info, hashFlags);
+}
+
+
+/*
+ * TaskHashLookup finds the entry of the given task in the task hash, and
+ * creates a new entry if the task is not in the hash yet.
+ */
+static TaskHashEntry *
+TaskHashLookup(HTAB *taskHash, Task *task, bool *found)
+{
+	TaskHashKey taskKey;
+	TaskHashEntry *taskEntry = NULL;
+
+	memset(&taskKey, 0, sizeof(TaskHashKey));
+	taskKey.taskType = task->taskType;
+	taskKey.jobId = task->jobId;
+	taskKey.taskId = task->taskId;
+
+	taskEntry = (TaskHashEntry *) hash_search(taskHash, &taskKey, HASH_ENTER, found);
+	if (!(*found))
+	{
+		taskEntry->task = task;
+		taskEntry->completed = false;
+	}
+
+	return taskEntry;
+}
+
+
+/*
+ * CreateStreamedMergeTables executes the merge tasks that only merge partition
+ * files into a table before any of the map tasks run, such that the fetch
+ * tasks can stream the partition files directly into these tables. The merge
+ * tasks that run a query over the merged files still wait for their files.
+ */
+static void
+CreateStreamedMergeTables(List *dependedTaskList, HTAB *taskHash,
+						  List *dependedJobList)
+{
+	List *mergeTaskList = NIL;
+	ListCell *taskCell = NULL;
+
+	foreach(taskCell, dependedTaskList)
+	{
+		Task *task = (Task *) lfirst(taskCell);
+		bool found = false;
+		TaskHashEntry *taskEntry = NULL;
+
+		if (task->taskType != MERGE_TASK ||
+			!MergeJobStreamable(dependedJobList, task->jobId))
+		{
+			continue;
+		}
+
+		taskEntry = TaskHashLookup(taskHash, task, &found);
+		taskEntry->streamed = true;
+
+		mergeTaskList = lappend(mergeTaskList, ExecutableRepartitionTask(task, false));
+	}
+
+	if (mergeTaskList != NIL)
+	{
+		ExecuteTaskListOutsideTransaction(ROW_MODIFY_NONE, mergeTaskList,
+										  MaxAdaptiveExecutorPoolSize);
+	}
+}
+
+
+/*
+ * MergeJobStreamable returns whether the merge tasks of the given job can
+ * create their tables before the partition files are fetched, which is the
+ * case when they do not run a reduce query over the merged files.
+ */
+static bool
+MergeJobStreamable(List *dependedJobList, uint64 jobId)
+{
+	ListCell *jobCell = NULL;
+
+	foreach(jobCell, dependedJobList)
+	{
+		MapMergeJob *mapMergeJob = (MapMergeJob *) lfirst(jobCell);
+
+		if (mapMergeJob->job.jobId == jobId)
+		{
+			return mapMergeJob->reduceQuery == NULL;
+		}
+	}
+
+	return false;
+}
+
+
+/*
+ * ExecuteTasksInDependencyOrder executes the given tasks in waves. Each wave
+ * executes the tasks whose dependencies completed in earlier waves, until all
+ * tasks are completed.
+ */
+static void
+ExecuteTasksInDependencyOrder(List *dependedTaskList, HTAB *taskHash)
+{
+	int remainingTaskCount = list_length(dependedTaskList);
+
+	while (remainingTaskCount > 0)
+	{
+		List *readyTaskList = NIL;
+		List *executableTaskList = NIL;
+		ListCell *taskCell = NULL;
+
+		foreach(taskCell, dependedTaskList)
+		{
+			Task *task = (Task *) lfirst(taskCell);
+			bool found = false;
+			TaskHashEntry *taskEntry = TaskHashLookup(taskHash, task, &found);
+
+			if (taskEntry->completed || !DependedTasksCompleted(taskHash, task))
+			{
+				continue;
+			}
+
+			readyTaskList = lappend(readyTaskList, taskEntry);
+
+			/*
+			 * The planner co-locates the merge tasks with the tasks that read
+			 * their output, so merge fetch tasks do not need to do anything.
+			 * Merge tasks whose tables were created upfront are done once all
+			 * partition files are streamed into their tables.
+			 */
+			if (task->taskType == MERGE_FETCH_TASK || taskEntry->streamed)
+			{
+				continue;
+			}
+
+			if (task->taskType == MAP_OUTPUT_FETCH_TASK)
+			{
+				bool streamOutput = UpstreamMergeTaskStreamed(taskHash, task);
+
+				executableTaskList = lappend(executableTaskList,
+											 ExecutableRepartitionTask(task,
+																	   streamOutput));
+			}
+			else
+			{
+				executableTaskList = lappend(executableTaskList,
+											 ExecutableRepartitionTask(task, false));
+			}
+		}
+
+		if (readyTaskList == NIL)
+		{
+			ereport(ERROR, (errmsg("could not resolve the dependencies of the "
+								   "repartition tasks")));
+		}
+
+		if (executableTaskList != NIL)
+		{
+			ExecuteTaskListOutsideTransaction(ROW_MODIFY_NONE, executableTaskList,
+											  MaxAdaptiveExecutorPoolSize);
+		}
+
+		foreach(taskCell, readyTaskList)
+		{
+			TaskHashEntry *taskEntry = (TaskHashEntry *) lfirst(taskCell);
+
+			taskEntry->completed = true;
+			remainingTaskCount--;
+		}
+	}
+}
+
+
+/*
+ * DependedTasksCompleted returns whether all the tasks that the given task
+ * depends on are completed.
+ */
+static bool
+DependedTasksCompleted(HTAB *taskHash, Task *task)
+{
+	ListCell *dependedTaskCell = NULL;
+
+	foreach(dependedTaskCell, task->dependedTaskList)
+	{
+		Task *dependedTask = (Task *) lfirst(dependedTaskCell);
+		bool found = false;
+		TaskHashEntry *taskEntry = TaskHashLookup(taskHash, dependedTask, &found);
+
+		if (!taskEntry->completed)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+/*
+ * UpstreamMergeTaskStreamed returns whether the merge task that the given map
+ * output fetch task fetches a partition file for already created its table.
+ */
+static bool
+UpstreamMergeTaskStreamed(HTAB *taskHash, Task *mapFetchTask)
+{
+	TaskHashKey taskKey;
+	TaskHashEntry *taskEntry = NULL;
+	bool found = false;
+
+	memset(&taskKey, 0, sizeof(TaskHashKey));
+	taskKey.taskType = MERGE_TASK;
+	taskKey.jobId = mapFetchTask->jobId;
+	taskKey.taskId = mapFetchTask->upstreamTaskId;
+
+	taskEntry = (TaskHashEntry *) hash_search(taskHash, &taskKey, HASH_FIND, &found);
+
+	return found && taskEntry->streamed;
+}
+
+
+/*
+ * ExecutableRepartitionTask returns a copy of the given task that can be
+ * executed by the adaptive executor. The copy only runs on the first placement
+ * of the task, since the tasks that depend on it expect its output there.
+ * Map output fetch tasks also get the command that fetches, or streams if
+ * streamOutput is set, the partition file from the node of the map task.
+ */
+static Task *
+ExecutableRepartitionTask(Task *task, bool streamOutput)
+{
+	Task *executableTask = (Task *) palloc0(sizeof(Task));
+	ShardPlacement *taskPlacement = NULL;
+
+	*executableTask = *task;
+
+	if (task->taskPlacementList == NIL)
+	{
+		ereport(ERROR, (errmsg("repartition task %u of job " UINT64_FORMAT
+							   " is not assigned to a node", task->taskId,
+							   task->jobId)));
+	}
+
+	taskPlacement = (ShardPlacement *) linitial(task->taskPlacementList);
+	executableTask->taskPlacementList = list_make1(taskPlacement);
+
+	if (task->taskType == MAP_OUTPUT_FETCH_TASK)
+	{
+		Task *mapTask = (Task *) linitial(task->dependedTaskList);
+
+		executableTask->queryString = MapFetchTaskQueryString(task, mapTask,
+															  streamOutput);
+	}
+
+	return executableTask;
+}
+
+
+/*
+ * MapFetchTaskQueryString returns the command that fetches the partition file
+ * of the given map task into the directory of the merge task that the given
+ * map output fetch task belongs to, or that streams the partition file into
+ * the table of the merge task if streamOutput is set.
+ */
+static char *
+MapFetchTaskQueryString(Task *mapFetchTask, Task *mapTask, bool streamOutput)
+{
+	StringInfo mapFetchQueryString = makeStringInfo();
+	uint32 partitionFileId = mapFetchTask->partitionId;
+	uint32 mergeTaskId = mapFetchTask->upstreamTaskId;
+	ShardPlacement *mapTaskPlacement =
+		(ShardPlacement *) linitial(mapTask->taskPlacementList);
+	const char *commandFormat = MAP_OUTPUT_FETCH_COMMAND;
+
+	Assert(mapFetchTask->taskType == MAP_OUTPUT_FETCH_TASK);
+	Assert(mapTask->taskType == MAP_TASK);
+
+	if (streamOutput)
+	{
+		commandFormat = MAP_OUTPUT_STREAM_COMMAND;
+	}
+
+	appendStringInfo(mapFetchQueryString, commandFormat,
+					 mapTask->jobId, mapTask->taskId, partitionFileId,
+					 mergeTaskId, /* fetch results to merge task */
+					 mapTaskPlacement->nodeName, mapTaskPlacement->nodePort);
+
+	return mapFetchQueryString->data;
+}
+
+
+/*
+ * ExecuteCommandOnAllNodes runs the command in the given format for each of
+ * the given jobs on all primary nodes, outside of the distributed transaction.
+ */
+static void
+ExecuteCommandOnAllNodes(List *jobIdList, const char *commandFormat)
+{
+	List *workerNodeList = ActivePrimaryNodeList();
+	List *taskList = NIL;
+	char *command = NULL;
+	ListCell *workerNodeCell = NULL;
+	uint32 taskId = 1;
+
+	if (jobIdList == NIL)
+	{
+		return;
+	}
+
+	command = JobCommandString(jobIdList, commandFormat);
+
+	foreach(workerNodeCell, workerNodeList)
+	{
+		WorkerNode *workerNode = (WorkerNode *) lfirst(workerNodeCell);
+		ShardPlacement *nodePlacement = CitusMakeNode(ShardPlacement);
+		Task *task = CitusMakeNode(Task);
+
+		nodePlacement->nodeName = workerNode->workerName;
+		nodePlacement->nodePort = workerNode->workerPort;
+		nodePlacement->nodeId = workerNode->nodeId;
+		nodePlacement->groupId = workerNode->groupId;
+
+		task->jobId = INVALID_JOB_ID;
+		task->taskId = taskId++;
+		task->taskType = DDL_TASK;
+		task->queryString = command;
+		task->taskPlacementList = list_make1(nodePlacement);
+
+		taskList = lappend(taskList, task);
+	}
+
+	ExecuteTaskListOutsideTransaction(ROW_MODIFY_NONE, taskList,
+									  MaxAdaptiveExecutorPoolSize);
+}
+
+
+/*
+ * JobCommandString returns the commands in the given format for each of the
+ * given jobs, as a single query string.
+ */
+static char *
+JobCommandString(List *jobIdList, const char *commandFormat)
+{
+	StringInfo command = makeStringInfo();
+	ListCell *jobIdCell = NULL;
+
+	foreach(jobIdCell, jobIdList)
+	{
+		uint64 jobId = *((uint64 *) lfirst(jobIdCell));
+
+		appendStringInfo(command, commandFormat, jobId);
+	}
+
+	return command->data;
+}
@@ -9,21 +9,44 @@
  */
 
 #include "postgres.h"
+#include "miscadmin.h"
 
+#include "access/tupdesc.h"
+#include "catalog/pg_type.h"
+#include "distributed/distributed_planner.h"
 #include "distributed/intermediate_results.h"
+#include "distributed/metadata_cache.h"
 #include "distributed/multi_executor.h"
+#include "distributed/multi_logical_planner.h"
 #include "distributed/multi_physical_planner.h"
+#include "distributed/multi_server_executor.h"
 #include "distributed/recursive_planning.h"
 #include "distributed/subplan_execution.h"
 #include "distributed/transaction_management.h"
 #include "distributed/worker_manager.h"
 #include "executor/executor.h"
+#include "utils/builtins.h"
+#include "utils/tuplestore.h"
 
 
 int MaxIntermediateResult = 1048576; /* maximum size in KB the intermediate result can grow to */
 /* when this is true, we enforce intermediate result size limit in all executors */
 int SubPlanLevel = 0;
 
+/* whether to create single-shard subplan results on the node that reads them */
+bool EnableDirectSubPlanRouting = true;
+
+
+static bool CreateSubPlanResultOnConsumerNode(DistributedPlan *distributedPlan,
+											  DistributedSubPlan *subPlan,
+											  char *resultId);
+static Task * SingleShardSubPlanTask(PlannedStmt *plannedStmt);
+static bool SubPlanResultConsumerGroupId(DistributedPlan *distributedPlan,
+										 DistributedSubPlan *producerSubPlan,
+										 int32 *consumerGroupId);
+static bool PlanMayReadIntermediateResults(PlannedStmt *plannedStmt);
+static bool DistributedPlanReadsIntermediateResults(DistributedPlan *distributedPlan);
+
 
 /*
  * ExecuteSubPlans executes a list of subplans from a distributed plan
@@ -65,6 +88,13 @@ ExecuteSubPlans(DistributedPlan *distributedPlan)
 
 		char *resultId = GenerateResultId(planId, subPlanId);
 
+		if (EnableDirectSubPlanRouting &&
+			CreateSubPlanResultOnConsumerNode(distributedPlan, subPlan, resultId))
+		{
+			/* the result is already on the only node that reads it */
+			continue;
+		}
+
 		SubPlanLevel++;
 		estate = CreateExecutorState();
 		copyDest = (DestReceiver *) CreateRemoteFileDestReceiver(resultId, estate,
@@ -77,3 +107,281 @@ ExecuteSubPlans(DistributedPlan *distributedPlan)
 		FreeExecutorState(estate);
 	}
 }
+
+
+/*
+ * CreateSubPlanResultOnConsumerNode creates the intermediate result of a
+ * subplan directly on the worker node that reads it, without sending the
+ * result through the coordinator. This is only possible if the subplan is a
+ * single-shard query that has a placement on the only node that reads the
+ * result. In that case, the node runs the shard query into the intermediate
+ * result via create_intermediate_result() and the function returns true.
+ * Otherwise, the function returns false and the subplan is executed as usual.
+ */
+static bool
+CreateSubPlanResultOnConsumerNode(DistributedPlan *distributedPlan,
+								  DistributedSubPlan *subPlan, char *resultId)
+{
+	Task *subPlanTask = NULL;
+	Task *resultTask = NULL;
+	ShardPlacement *consumerPlacement = NULL;
+	ListCell *placementCell = NULL;
+	int32 consumerGroupId = 0;
+	StringInfo resultQuery = NULL;
+	TupleDesc tupleDescriptor = NULL;
+	Tuplestorestate *tupleStore = NULL;
+	bool hasReturning = false;
+
+	/* the worker-side command runs through the adaptive executor */
+	if (TaskExecutorType != MULTI_EXECUTOR_ADAPTIVE)
+	{
+		return false;
+	}
+
+	subPlanTask = SingleShardSubPlanTask(subPlan->plan);
+	if (subPlanTask == NULL)
+	{
+		return false;
+	}
+
+	if (!SubPlanResultConsumerGroupId(distributedPlan, subPlan, &consumerGroupId))
+	{
+		return false;
+	}
+
+	/* tasks on the local node may be executed locally, keep it simple */
+	if (consumerGroupId == GetLocalGroupId())
+	{
+		return false;
+	}
+
+	foreach(placementCell, subPlanTask->taskPlacementList)
+	{
+		ShardPlacement *placement = (ShardPlacement *) lfirst(placementCell);
+
+		if (placement->groupId == consumerGroupId)
+		{
+			consumerPlacement = placement;
+			break;
+		}
+	}
+
+	if (consumerPlacement == NULL)
+	{
+		return false;
+	}
+
+	resultQuery = makeStringInfo();
+	appendStringInfo(resultQuery, "SELECT create_intermediate_result(%s, %s)",
+					 quote_literal_cstr(resultId),
+					 quote_literal_cstr(subPlanTask->queryString));
+
+	/* the task is part of a cached plan, so do not modify it */
+	resultTask = copyObject(subPlanTask);
+	resultTask->queryString = resultQuery->data;
+	resultTask->taskPlacementList = list_make1(consumerPlacement);
+
+	/* create_intermediate_result returns the number of rows in the result */
+#if PG_VERSION_NUM < 120000
+	tupleDescriptor = CreateTemplateTupleDesc(1, false);
+#else
+	tupleDescriptor = CreateTemplateTupleDesc(1);
+#endif
+	TupleDescInitEntry(tupleDescriptor, (AttrNumber) 1, "row_count", INT8OID, -1, 0);
+
+	tupleStore = tuplestore_begin_heap(false, false, work_mem);
+
+	ExecuteTaskListExtended(ROW_MODIFY_READONLY, list_make1(resultTask),
+							tupleDescriptor, tupleStore, hasReturning,
+							MaxAdaptiveExecutorPoolSize);
+
+	tuplestore_end(tupleStore);
+
+	return true;
+}
+
+
+/*
+ * SingleShardSubPlanTask returns the task of the given subplan if the subplan
+ * is a read-only query that is routed to a single shard and that does not read
+ * any intermediate results itself. Otherwise, the function returns NULL.
+ */
+static Task *
+SingleShardSubPlanTask(PlannedStmt *plannedStmt)
+{
+	Plan *planTree = plannedStmt->planTree;
+	DistributedPlan *distributedPlan = NULL;
+	Job *workerJob = NULL;
+	Task *task = NULL;
+
+	/* router plans consist of a single custom scan */
+	if (!IsCitusCustomScan(planTree))
+	{
+		return NULL;
+	}
+
+	distributedPlan = GetDistributedPlan((CustomScan *) planTree);
+	workerJob = distributedPlan->workerJob;
+
+	if (!distributedPlan->routerExecutable ||
+		distributedPlan->modLevel != ROW_MODIFY_READONLY ||
+		distributedPlan->subPlanList != NIL ||
+		DistributedPlanReadsIntermediateResults(distributedPlan))
+	{
+		return NULL;
+	}
+
+	if (workerJob == NULL || workerJob->deferredPruning ||
+		list_length(workerJob->taskList) != 1)
+	{
+		return NULL;
+	}
+
+	task = (Task *) linitial(workerJob->taskList);
+	if (task->taskType != ROUTER_TASK || task->queryString == NULL ||
+		task->relationRowLockList != NIL)
+	{
+		return NULL;
+	}
+
+	return task;
+}
+
+
+/*
+ * SubPlanResultConsumerGroupId determines the group ID of the node that reads
+ * the results of the subplans of the given distributed plan. The function
+ * returns false if the results may be read by multiple nodes, by the
+ * coordinator, or by the other subplans of the distributed plan, and true
+ * if all the tasks of the distributed plan run on the same node.
+ */
+static bool
+SubPlanResultConsumerGroupId(DistributedPlan *distributedPlan,
+							 DistributedSubPlan *producerSubPlan,
+							 int32 *consumerGroupId)
+{
+	Job *workerJob = distributedPlan->workerJob;
+	ListCell *subPlanCell = NULL;
+	ListCell *taskCell = NULL;
+	bool consumerFound = false;
+
+	/* the coordinator reads the results in the master query and INSERT..SELECT */
+	if ((distributedPlan->masterQuery != NULL &&
+		 ContainsReadIntermediateResultFunction((Node *) distributedPlan->masterQuery)) ||
+		distributedPlan->insertSelectSubquery != NULL)
+	{
+		return false;
+	}
+
+	foreach(subPlanCell, distributedPlan->subPlanList)
+	{
+		DistributedSubPlan *subPlan = (DistributedSubPlan *) lfirst(subPlanCell);
+
+		if (subPlan != producerSubPlan && PlanMayReadIntermediateResults(subPlan->plan))
+		{
+			return false;
+		}
+	}
+
+	if (workerJob == NULL || workerJob->deferredPruning ||
+		workerJob->dependedJobList != NIL)
+	{
+		return false;
+	}
+
+	foreach(taskCell, workerJob->taskList)
+	{
+		Task *task = (Task *) lfirst(taskCell);
+		ShardPlacement *placement = NULL;
+
+		/* reads fail over to other placements, which would not have the result */
+		if (list_length(task->taskPlacementList) != 1)
+		{
+			return false;
+		}
+
+		placement = (ShardPlacement *) linitial(task->taskPlacementList);
+		if (consumerFound && placement->groupId != *consumerGroupId)
+		{
+			return false;
+		}
+
+		*consumerGroupId = placement->groupId;
+		consumerFound = true;
+	}
+
+	return consumerFound;
+}
+
+
+/*
+ * PlanMayReadIntermediateResults returns whether the given plan, or any of
+ * its subplans, may read intermediate results.
+ */
+static bool
+PlanMayReadIntermediateResults(PlannedStmt *plannedStmt)
+{
+	Plan *planTree = plannedStmt->planTree;
+	DistributedPlan *distributedPlan = NULL;
+	ListCell *subPlanCell = NULL;
+
+	if (!IsCitusCustomScan(planTree))
+	{
+		/*
+		 * Queries that read intermediate results always go through the
+		 * distributed planner, so only Citus plans can read them. We do not
+		 * look into Citus plans that have local nodes on top.
+		 */
+		return IsCitusPlan(planTree);
+	}
+
+	distributedPlan = GetDistributedPlan((CustomScan *) planTree);
+	if (DistributedPlanReadsIntermediateResults(distributedPlan))
+	{
+		return true;
+	}
+
+	foreach(subPlanCell, distributedPlan->subPlanList)
+	{
+		DistributedSubPlan *subPlan = (DistributedSubPlan *) lfirst(subPlanCell);
+
+		if (PlanMayReadIntermediateResults(subPlan->plan))
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+/*
+ * DistributedPlanReadsIntermediateResults returns whether any of the queries
+ * of the given distributed plan reads intermediate results.
+ */
+static bool
+DistributedPlanReadsIntermediateResults(DistributedPlan *distributedPlan)
+{
+	Job *workerJob = distributedPlan->workerJob;
+
+	if (workerJob != NULL && workerJob->jobQuery != NULL &&
+		ContainsReadIntermediateResultFunction((Node *) workerJob->jobQuery))
+	{
+		return true;
+	}
+
+	if (distributedPlan->masterQuery != NULL &&
+		ContainsReadIntermediateResultFunction((Node *) distributedPlan->masterQuery))
+	{
+		return true;
+	}
+
+	if (distributedPlan->insertSelectSubquery != NULL &&
+		ContainsReadIntermediateResultFunction(
+			(Node *) distributedPlan->insertSelectSubquery))
+	{
+		return true;
+	}
+
+	return false;
+}
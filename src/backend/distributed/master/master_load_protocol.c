@@ -0,0 +1,413 @@
+/*-------------------------------------------------------------------------
+ *
+ * master_load_protocol.c
+ *
+ * Routines for loading files that are present on the worker nodes into the
+ * shards of a distributed table, without sending the data through the
+ * coordinator.
+ *
+ * Loading happens in two steps that resemble the map and fetch steps of a
+ * repartition job. First, every node reads its local files and writes the rows
+ * of each shard into a partition file, routing the rows with the shard
+ * intervals that the coordinator sends along. Second, every shard placement
+ * streams its partition files from all nodes into the shard. The first step
+ * runs outside of the distributed transaction, since it only writes files,
+ * while the second step modifies the shards within the transaction.
+ *
+ * Copyright (c) 2019, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+
+#include "access/htup_details.h"
+#include "catalog/pg_type.h"
+#include "distributed/citus_nodes.h"
+#include "distributed/listutils.h"
+#include "distributed/local_executor.h"
+#include "distributed/master_metadata_utility.h"
+#include "distributed/metadata_cache.h"
+#include "distributed/multi_executor.h"
+#include "distributed/multi_physical_planner.h"
+#include "distributed/pg_dist_partition.h"
+#include "distributed/relay_utility.h"
+#include "distributed/repartition_join_execution.h"
+#include "distributed/resource_lock.h"
+#include "distributed/worker_manager.h"
+#include "distributed/worker_protocol.h"
+#include "distributed/version_compat.h"
+#include "executor/tuptable.h"
+#include "utils/builtins.h"
+#include "utils/lsyscache.h"
+#include "utils/rel.h"
+#include "utils/tuplestore.h"
+
+
+#define PARTITION_LOCAL_FILES_COMMAND "SELECT worker_partition_local_files(" \
+	UINT64_FORMAT ", %u, %s, %s, %s, %s, %s, %s, %s, %s)"
+#define LOAD_PARTITION_FILES_COMMAND "SELECT worker_load_partition_files(" \
+	UINT64_FORMAT ", %u, %s, %s, %s)"
+
+
+static void EnsureLocalFileLoadSupported(DistTableCacheEntry *cacheEntry);
+static List * LocalFilePartitionTaskList(uint64 jobId, DistTableCacheEntry *cacheEntry,
+										 List *workerNodeList, char *filePattern,
+										 char *copyOptions);
+static List * PartitionFileLoadTaskList(uint64 jobId, DistTableCacheEntry *cacheEntry,
+										List *workerNodeList);
+static uint64 ExecuteLoadTaskList(List *loadTaskList);
+static char * TextArrayLiteral(List *stringList);
+
+
+/* exports for SQL callable functions */
+PG_FUNCTION_INFO_V1(master_load_local_files);
+
+
+/*
+ * master_load_local_files loads the files that match the given pattern on each
+ * of the nodes into the shards of the given hash, range or reference table,
+ * and returns the number of loaded rows. The files are read by COPY on the
+ * nodes with the given COPY options, for instance 'format csv, header true'.
+ * Since the rows are routed to the shards by the nodes that hold the files,
+ * the coordinator only sends commands and the load bandwidth scales with the
+ * number of nodes.
+ */
+Datum
+master_load_local_files(PG_FUNCTION_ARGS)
+{
+	Oid relationId = PG_GETARG_OID(0);
+	text *filePatternText = PG_GETARG_TEXT_P(1);
+	text *copyOptionsText = PG_GETARG_TEXT_P(2);
+
+	char *filePattern = text_to_cstring(filePatternText);
+	char *copyOptions = text_to_cstring(copyOptionsText);
+
+	DistTableCacheEntry *cacheEntry = NULL;
+	List *workerNodeList = NIL;
+	List *mapTaskList = NIL;
+	List *loadTaskList = NIL;
+	uint64 jobId = INVALID_JOB_ID;
+	uint64 loadedRowCount = 0;
+
+	CheckCitusVersion(ERROR);
+	EnsureCoordinator();
+
+	EnsureTablePermissions(relationId, ACL_INSERT);
+
+	cacheEntry = DistributedTableCacheEntry(relationId);
+	EnsureLocalFileLoadSupported(cacheEntry);
+
+	/* map tasks run on other connections and would not see our changes */
+	if (LocalExecutionHappened)
+	{
+		ErrorIfLocalExecutionHappened();
+	}
+
+	/* the n'th node gets map task id n, see worker_load_partition_files() */
+	workerNodeList = SortList(ActivePrimaryNodeList(), CompareWorkerNodes);
+	jobId = UniqueJobId();
+
+	mapTaskList = LocalFilePartitionTaskList(jobId, cacheEntry, workerNodeList,
+											 filePattern, copyOptions);
+	loadTaskList = PartitionFileLoadTaskList(jobId, cacheEntry, workerNodeList);
+
+	/* remove the partition files at transaction end if the load fails */
+	RegisterRepartitionCleanup(list_make1(&jobId));
+
+	ExecuteTaskListOutsideTransaction(ROW_MODIFY_NONE, mapTaskList,
+									  MaxAdaptiveExecutorPoolSize);
+
+	loadedRowCount = ExecuteLoadTaskList(loadTaskList);
+
+	/* the partition files are loaded, so we can remove them */
+	DoRepartitionCleanup(list_make1(&jobId));
+
+	PG_RETURN_INT64(loadedRowCount);
+}
+
+
+/*
+ * EnsureLocalFileLoadSupported errors out if the rows of local files cannot be
+ * routed to the shards of the given table. The shards of append distributed
+ * tables may overlap, and rows are appended to new shards instead.
+ */
+static void
+EnsureLocalFileLoadSupported(DistTableCacheEntry *cacheEntry)
+{
+	char *relationName = get_rel_name(cacheEntry->relationId);
+
+	if (cacheEntry->partitionMethod == DISTRIBUTE_BY_APPEND)
+	{
+		ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+						errmsg("cannot load local files into append distributed "
+							   "table \"%s\"", relationName),
+						errhint("Use COPY or master_append_table_to_shard() "
+								"instead.")));
+	}
+
+	if (cacheEntry->shardIntervalArrayLength == 0)
+	{
+		ereport(ERROR, (errmsg("could not find any shards for table \"%s\"",
+							   relationName)));
+	}
+
+	if (cacheEntry->partitionMethod == DISTRIBUTE_BY_RANGE &&
+		cacheEntry->hasUninitializedShardInterval)
+	{
+		ereport(ERROR, (errmsg("could not load local files into table \"%s\"",
+							   relationName),
+						errdetail("The table has shards without min/max values.")));
+	}
+}
+
+
+/*
+ * LocalFilePartitionTaskList returns a map task for each of the given nodes,
+ * which partitions the local files on the node by the shards of the table.
+ */
+static List *
+LocalFilePartitionTaskList(uint64 jobId, DistTableCacheEntry *cacheEntry,
+						   List *workerNodeList, char *filePattern, char *copyOptions)
+{
+	Oid relationId = cacheEntry->relationId;
+	Relation relation = heap_open(relationId, AccessShareLock);
+	TupleDesc tupleDescriptor = RelationGetDescr(relation);
+	List *columnNameList = NIL;
+	List *columnTypeList = NIL;
+	List *shardMinValueList = NIL;
+	List *shardMaxValueList = NIL;
+	char *partitionColumnName = "";
+	List *taskList = NIL;
+	ListCell *workerNodeCell = NULL;
+	int columnIndex = 0;
+	int shardIndex = 0;
+	uint32 taskId = 1;
+
+	/* the files contain the columns that COPY writes to the table */
+	for (columnIndex = 0; columnIndex < tupleDescriptor->natts; columnIndex++)
+	{
+		Form_pg_attribute column = TupleDescAttr(tupleDescriptor, columnIndex);
+
+		if (column->attisdropped)
+		{
+			continue;
+		}
+
+#if PG_VERSION_NUM >= 120000
+		if (column->attgenerated)
+		{
+			continue;
+		}
+#endif
+
+		columnNameList = lappend(columnNameList, pstrdup(NameStr(column->attname)));
+		columnTypeList = lappend(columnTypeList,
+								 format_type_with_typemod(column->atttypid,
+														  column->atttypmod));
+	}
+
+	heap_close(relation, NoLock);
+
+	if (cacheEntry->partitionMethod != DISTRIBUTE_BY_NONE)
+	{
+		Var *partitionColumn = cacheEntry->partitionColumn;
+
+		partitionColumnName = get_attname_internal(relationId, partitionColumn->varattno,
+												   false);
+
+		for (shardIndex = 0; shardIndex < cacheEntry->shardIntervalArrayLength;
+			 shardIndex++)
+		{
+			ShardInterval *shardInterval = cacheEntry->sortedShardIntervalArray[shardIndex];
+			Oid valueTypeId = shardInterval->valueTypeId;
+
+			shardMinValueList = lappend(shardMinValueList,
+										DatumToString(shardInterval->minValue,
+													  valueTypeId));
+			shardMaxValueList = lappend(shardMaxValueList,
+										DatumToString(shardInterval->maxValue,
+													  valueTypeId));
+		}
+	}
+
+	foreach(workerNodeCell, workerNodeList)
+	{
+		WorkerNode *workerNode = (WorkerNode *) lfirst(workerNodeCell);
+		ShardPlacement *nodePlacement = CitusMakeNode(ShardPlacement);
+		Task *task = CitusMakeNode(Task);
+		StringInfo taskQueryString = makeStringInfo();
+
+		appendStringInfo(taskQueryString, PARTITION_LOCAL_FILES_COMMAND, jobId, taskId,
+						 quote_literal_cstr(filePattern),
+						 quote_literal_cstr(copyOptions),
+						 TextArrayLiteral(columnNameList),
+						 TextArrayLiteral(columnTypeList),
+						 quote_literal_cstr(partitionColumnName),
+						 quote_literal_cstr(psprintf("%c", cacheEntry->partitionMethod)),
+						 TextArrayLiteral(shardMinValueList),
+						 TextArrayLiteral(shardMaxValueList));
+
+		nodePlacement->nodeName = workerNode->workerName;
+		nodePlacement->nodePort = workerNode->workerPort;
+		nodePlacement->nodeId = workerNode->nodeId;
+		nodePlacement->groupId = workerNode->groupId;
+
+		task->jobId = jobId;
+		task->taskId = taskId++;
+		task->taskType = MAP_TASK;
+		task->queryString = taskQueryString->data;
+		task->taskPlacementList = list_make1(nodePlacement);
+
+		taskList = lappend(taskList, task);
+	}
+
+	return taskList;
+}
+
+
+/*
+ * PartitionFileLoadTaskList returns a task for each shard of the table, which
+ * loads the partition files of the shard from all the given nodes into each
+ * of the placements of the shard.
+ */
+static List *
+PartitionFileLoadTaskList(uint64 jobId, DistTableCacheEntry *cacheEntry,
+						  List *workerNodeList)
+{
+	Oid relationId = cacheEntry->relationId;
+	char *schemaName = get_namespace_name(get_rel_namespace(relationId));
+	List *nodeNameList = NIL;
+	StringInfo nodePortArray = makeStringInfo();
+	List *taskList = NIL;
+	ListCell *workerNodeCell = NULL;
+	int shardIndex = 0;
+
+	appendStringInfoString(nodePortArray, "ARRAY[");
+
+	foreach(workerNodeCell, workerNodeList)
+	{
+		WorkerNode *workerNode = (WorkerNode *) lfirst(workerNodeCell);
+
+		if (workerNodeCell != list_head(workerNodeList))
+		{
+			appendStringInfoString(nodePortArray, ", ");
+		}
+
+		nodeNameList = lappend(nodeNameList, workerNode->workerName);
+		appendStringInfo(nodePortArray, "%d", workerNode->workerPort);
+	}
+
+	appendStringInfoString(nodePortArray, "]::integer[]");
+
+	for (shardIndex = 0; shardIndex < cacheEntry->shardIntervalArrayLength; shardIndex++)
+	{
+		ShardInterval *shardInterval = cacheEntry->sortedShardIntervalArray[shardIndex];
+		uint64 shardId = shardInterval->shardId;
+		char *shardName = get_rel_name(relationId);
+		StringInfo loadQueryString = makeStringInfo();
+		RelationShard *relationShard = CitusMakeNode(RelationShard);
+		Task *task = NULL;
+
+		AppendShardIdToName(&shardName, shardId);
+
+		appendStringInfo(loadQueryString, LOAD_PARTITION_FILES_COMMAND, jobId,
+						 shardIndex,
+						 quote_literal_cstr(quote_qualified_identifier(schemaName,
+																	   shardName)),
+						 TextArrayLiteral(nodeNameList), nodePortArray->data);
+
+		LockShardDistributionMetadata(shardId, ShareLock);
+
+		relationShard->relationId = relationId;
+		relationShard->shardId = shardId;
+
+		task = CreateBasicTask(jobId, shardIndex + 1, MODIFY_TASK, loadQueryString->data);
+		task->anchorShardId = shardId;
+		task->taskPlacementList = FinalizedShardPlacementList(shardId);
+		task->relationShardList = list_make1(relationShard);
+		task->replicationModel = cacheEntry->replicationModel;
+
+		taskList = lappend(taskList, task);
+	}
+
+	return taskList;
+}
+
+
+/*
+ * ExecuteLoadTaskList executes the given load tasks within the distributed
+ * transaction and returns the total number of rows they loaded.
+ */
+static uint64
+ExecuteLoadTaskList(List *loadTaskList)
+{
+	TupleDesc tupleDescriptor = NULL;
+	Tuplestorestate *tupleStore = NULL;
+	TupleTableSlot *slot = NULL;
+	bool hasReturning = true;
+	uint64 loadedRowCount = 0;
+
+	/* worker_load_partition_files returns the number of loaded rows */
+#if PG_VERSION_NUM < 120000
+	tupleDescriptor = CreateTemplateTupleDesc(1, false);
+#else
+	tupleDescriptor = CreateTemplateTupleDesc(1);
+#endif
+	TupleDescInitEntry(tupleDescriptor, (AttrNumber) 1, "row_count", INT8OID, -1, 0);
+
+	tupleStore = tuplestore_begin_heap(false, false, work_mem);
+
+	ExecuteTaskListExtended(ROW_MODIFY_COMMUTATIVE, loadTaskList, tupleDescriptor,
+							tupleStore, hasReturning, MaxAdaptiveExecutorPoolSize);
+
+	slot = MakeSingleTupleTableSlotCompat(tupleDescriptor, &TTSOpsMinimalTuple);
+
+	while (tuplestore_gettupleslot(tupleStore, true, false, slot))
+	{
+		bool isNull = false;
+		Datum rowCountDatum = slot_getattr(slot, 1, &isNull);
+
+		if (!isNull)
+		{
+			loadedRowCount += DatumGetInt64(rowCountDatum);
+		}
+	}
+
+	ExecDropSingleTupleTableSlot(slot);
+	tuplestore_end(tupleStore);
+
+	return loadedRowCount;
+}
+
+
+/*
+ * TextArrayLiteral returns a text array expression with the given strings as
+ * its elements.
+ */
+static char *
+TextArrayLiteral(List *stringList)
+{
+	StringInfo arrayLiteral = makeStringInfo();
+	ListCell *stringCell = NULL;
+
+	appendStringInfoString(arrayLiteral, "ARRAY[");
+
+	foreach(stringCell, stringList)
+	{
+		char *string = (char *) lfirst(stringCell);
+
+		if (stringCell != list_head(stringList))
+		{
+			appendStringInfoString(arrayLiteral, ", ");
+		}
+
+		appendStringInfoString(arrayLiteral, quote_literal_cstr(string));
+	}
+
+	appendStringInfoString(arrayLiteral, "]::text[]");
+
+	return arrayLiteral->data;
+}
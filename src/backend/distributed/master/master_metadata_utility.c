@@ -767,9 +767,8 @@ FinalizedShardPlacement(uint64 shardId, bool missingOk)
  * because it shares code with other routines in this file.
  */
 List *
-BuildShardPlacementList(ShardInterval *shardInterval)
+BuildShardPlacementList(int64 shardId)
 {
-	int64 shardId = shardInterval->shardId;
 	List *shardPlacementList = NIL;
 	Relation pgPlacement = NULL;
 	SysScanDesc scanDescriptor = NULL;
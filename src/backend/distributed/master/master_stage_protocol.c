@@ -935,8 +935,6 @@ UpdateShardStatistics(int64 shardId)
 {
 	ShardInterval *shardInterval = LoadShardInterval(shardId);
 	Oid relationId = shardInterval->relationId;
-	char storageType = shardInterval->storageType;
-	char partitionType = PartitionMethod(relationId);
 	char *shardQualifiedName = NULL;
 	List *shardPlacementList = NIL;
 	ListCell *shardPlacementCell = NULL;
@@ -983,11 +981,31 @@ UpdateShardStatistics(int64 shardId)
 						  errdetail("Setting shard statistics to NULL")));
 	}
 
+	SetShardStatistics(shardId, shardSize, minValue, maxValue);
+
+	return shardSize;
+}
+
+
+/*
+ * SetShardStatistics sets the size of the finalized placements of the given
+ * shard, and for append-partitioned tables the shard min/max values, to the
+ * given statistics.
+ */
+void
+SetShardStatistics(int64 shardId, uint64 shardSize, text *minValue, text *maxValue)
+{
+	ShardInterval *shardInterval = LoadShardInterval(shardId);
+	Oid relationId = shardInterval->relationId;
+	char storageType = shardInterval->storageType;
+	char partitionType = PartitionMethod(relationId);
+	List *shardPlacementList = FinalizedShardPlacementList(shardId);
+	ListCell *shardPlacementCell = NULL;
+
 	/* make sure we don't process cancel signals */
 	HOLD_INTERRUPTS();
 
 	/* update metadata for each shard placement we appended to */
-	shardPlacementCell = NULL;
 	foreach(shardPlacementCell, shardPlacementList)
 	{
 		ShardPlacement *placement = (ShardPlacement *) lfirst(shardPlacementCell);
@@ -1013,8 +1031,6 @@ UpdateShardStatistics(int64 shardId)
 	}
 
 	RESUME_INTERRUPTS();
-
-	return shardSize;
 }
 
 
@@ -0,0 +1,179 @@
+/*-------------------------------------------------------------------------
+ *
+ * fast_path_plan_cache.c
+ *   Per-shard cache of the tasks of fast-path router queries whose shard
+ *   pruning is deferred to the executor.
+ *
+ * A prepared fast-path router query that compares the distribution column to
+ * a parameter (e.g., SELECT ... FROM table WHERE key = $1) can be planned
+ * once as a generic plan. The shard is then only known in the executor, and
+ * without caching every execution would deparse the query for the shard and
+ * look up the shard placements. Since the shard query keeps the parameters,
+ * it is the same for every execution that hits the same shard, so we cache
+ * the task per (plan, shard) pair and only copy it on later executions.
+ *
+ * The cached tasks embed shard names and placements, so the entire cache is
+ * cleared whenever the metadata of a distributed table or of the nodes is
+ * invalidated.
+ *
+ * Copyright (c) 2019, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include "distributed/fast_path_plan_cache.h"
+#include "utils/catcache.h"
+#include "utils/hsearch.h"
+#include "utils/memutils.h"
+
+
+/* key of the fast-path task cache */
+typedef struct FastPathTaskCacheKey
+{
+	uint64 planId;
+	uint64 shardId;
+} FastPathTaskCacheKey;
+
+
+/* entry of the fast-path task cache */
+typedef struct FastPathTaskCacheEntry
+{
+	FastPathTaskCacheKey key;
+	Task *task;
+} FastPathTaskCacheEntry;
+
+
+/* GUC, determining whether fast-path queries defer pruning and cache tasks */
+bool EnableFastPathPlanCache = false;
+
+/* (planId, shardId) -> Task */
+static HTAB *FastPathTaskCacheHash = NULL;
+static MemoryContext FastPathTaskCacheContext = NULL;
+
+/* set to false by the invalidation callbacks, the cache is cleared lazily */
+static bool FastPathTaskCacheValid = true;
+
+
+static void InitializeFastPathTaskCache(void);
+
+
+/*
+ * GetCachedFastPathTask returns a copy of the task that is cached for the
+ * given plan and shard, or NULL if there is no such task.
+ */
+Task *
+GetCachedFastPathTask(uint64 planId, uint64 shardId)
+{
+	FastPathTaskCacheKey key;
+	FastPathTaskCacheEntry *cacheEntry = NULL;
+	bool found = false;
+
+	InitializeFastPathTaskCache();
+
+	memset(&key, 0, sizeof(key));
+	key.planId = planId;
+	key.shardId = shardId;
+
+	cacheEntry = hash_search(FastPathTaskCacheHash, &key, HASH_FIND, &found);
+	if (!found)
+	{
+		return NULL;
+	}
+
+	return copyObject(cacheEntry->task);
+}
+
+
+/*
+ * CacheFastPathTask stores a copy of the given task for the given plan and
+ * shard.
+ */
+void
+CacheFastPathTask(uint64 planId, uint64 shardId, Task *task)
+{
+	FastPathTaskCacheKey key;
+	FastPathTaskCacheEntry *cacheEntry = NULL;
+	MemoryContext oldContext = NULL;
+	bool found = false;
+
+	InitializeFastPathTaskCache();
+
+	if (hash_get_num_entries(FastPathTaskCacheHash) >= MAX_FAST_PATH_CACHED_TASKS)
+	{
+		/* prepared statements might have been deallocated, start over */
+		FastPathTaskCacheValid = false;
+		InitializeFastPathTaskCache();
+	}
+
+	memset(&key, 0, sizeof(key));
+	key.planId = planId;
+	key.shardId = shardId;
+
+	oldContext = MemoryContextSwitchTo(FastPathTaskCacheContext);
+
+	cacheEntry = hash_search(FastPathTaskCacheHash, &key, HASH_ENTER, &found);
+	if (!found)
+	{
+		cacheEntry->task = copyObject(task);
+	}
+
+	MemoryContextSwitchTo(oldContext);
+}
+
+
+/*
+ * InvalidateFastPathPlanCache marks the cached tasks as invalid. It is called
+ * from the relcache invalidation callbacks, so we only clear the cache the
+ * next time it is accessed.
+ */
+void
+InvalidateFastPathPlanCache(void)
+{
+	FastPathTaskCacheValid = false;
+}
+
+
+/*
+ * InitializeFastPathTaskCache creates the task cache if it does not exist yet,
+ * and clears it if it was invalidated.
+ */
+static void
+InitializeFastPathTaskCache(void)
+{
+	HASHCTL info;
+	uint32 hashFlags = 0;
+
+	if (FastPathTaskCacheHash != NULL && FastPathTaskCacheValid)
+	{
+		return;
+	}
+
+	if (FastPathTaskCacheContext == NULL)
+	{
+		if (CacheMemoryContext == NULL)
+		{
+			CreateCacheMemoryContext();
+		}
+
+		FastPathTaskCacheContext = AllocSetContextCreate(CacheMemoryContext,
+														 "FastPathTaskCacheContext",
+														 ALLOCSET_DEFAULT_SIZES);
+	}
+	else
+	{
+		/* releases the hash and all the cached tasks */
+		MemoryContextReset(FastPathTaskCacheContext);
+	}
+
+	memset(&info, 0, sizeof(info));
+	info.keysize = sizeof(FastPathTaskCacheKey);
+	info.entrysize = sizeof(FastPathTaskCacheEntry);
+	info.hash = tag_hash;
+	info.hcxt = FastPathTaskCacheContext;
+	hashFlags = (HASH_ELEM | HASH_FUNCTION | HASH_CONTEXT);
+
+	FastPathTaskCacheHash = hash_create("Fast-path task cache", 64, &info, hashFlags);
+	FastPathTaskCacheValid = true;
+}
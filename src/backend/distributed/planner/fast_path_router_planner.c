@@ -58,6 +58,7 @@ bool EnableFastPathRouterPlanner = true;
 static bool ColumnAppearsMultipleTimes(Node *quals, Var *distributionKey);
 static bool ConjunctionContainsColumnFilter(Node *node, Var *column);
 static bool DistKeyInSimpleOpExpression(Expr *clause, Var *distColumn);
+static bool ConjunctionContainsColumnParam(Node *node, Var *column);
 
 
 /*
@@ -421,3 +422,86 @@ DistKeyInSimpleOpExpression(Expr *clause, Var *distColumn)
 
 	return equal(distColumn, columnInExpr);
 }
+
+
+/*
+ * FastPathRouterQueryHasDistKeyParam returns true if the given fast-path
+ * router query compares the distribution column to an external parameter.
+ * That is only possible while planning a generic plan for a prepared
+ * statement, since FastPathPlanner() otherwise resolves the parameters.
+ */
+bool
+FastPathRouterQueryHasDistKeyParam(Query *query)
+{
+	Oid distributedTableId = ExtractFirstDistributedTableId(query);
+	Var *distributionKey = PartitionColumn(distributedTableId, 1);
+	Node *quals = query->jointree->quals;
+
+	/* reference tables do not have a distribution column */
+	if (!distributionKey)
+	{
+		return false;
+	}
+
+	if (quals != NULL && IsA(quals, List))
+	{
+		quals = (Node *) make_ands_explicit((List *) quals);
+	}
+
+	return ConjunctionContainsColumnParam(quals, distributionKey);
+}
+
+
+/*
+ * ConjunctionContainsColumnParam is the counterpart of
+ * ConjunctionContainsColumnFilter() which only returns true if the
+ * column is compared to a parameter.
+ */
+static bool
+ConjunctionContainsColumnParam(Node *node, Var *column)
+{
+	if (node == NULL)
+	{
+		return false;
+	}
+
+	if (IsA(node, OpExpr))
+	{
+		OpExpr *opExpr = (OpExpr *) node;
+		Node *leftOperand = NULL;
+		Node *rightOperand = NULL;
+
+		if (!DistKeyInSimpleOpExpression((Expr *) opExpr, column) ||
+			!OperatorImplementsEquality(opExpr->opno))
+		{
+			return false;
+		}
+
+		leftOperand = strip_implicit_coercions(get_leftop((Expr *) opExpr));
+		rightOperand = strip_implicit_coercions(get_rightop((Expr *) opExpr));
+
+		return IsA(leftOperand, Param) || IsA(rightOperand, Param);
+	}
+	else if (IsA(node, BoolExpr))
+	{
+		BoolExpr *boolExpr = (BoolExpr *) node;
+		ListCell *argumentCell = NULL;
+
+		if (boolExpr->boolop != AND_EXPR)
+		{
+			return false;
+		}
+
+		foreach(argumentCell, boolExpr->args)
+		{
+			Node *argumentNode = (Node *) lfirst(argumentCell);
+
+			if (ConjunctionContainsColumnParam(argumentNode, column))
+			{
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
@@ -24,6 +24,8 @@
 #include "distributed/citus_nodefuncs.h"
 #include "distributed/deparse_shard_query.h"
 #include "distributed/distribution_column.h"
+#include "distributed/distributed_planner.h"
+#include "distributed/fast_path_plan_cache.h"
 #include "distributed/errormessage.h"
 #include "distributed/insert_select_planner.h"
 #include "distributed/master_metadata_utility.h"
@@ -109,6 +111,9 @@ typedef struct WalkerState
 
 bool EnableRouterExecution = true;
 
+/* whether multi-row INSERTs into hash and range tables are routed in one pass */
+bool EnableBatchedInsertRouting = true;
+
 
 /* planner functions forward declarations */
 static void CreateSingleTaskRouterPlan(DistributedPlan *distributedPlan,
@@ -140,6 +145,11 @@ static Job * RouterJob(Query *originalQuery,
 static bool RelationPrunesToMultipleShards(List *relationShardList);
 static void NormalizeMultiRowInsertTargetList(Query *query);
 static List * BuildRoutesForInsert(Query *query, DeferredErrorMessage **planningError);
+static List * BuildRoutesForMultiRowInsert(Query *query, DistTableCacheEntry *cacheEntry,
+										   TargetEntry *partitionTargetEntry,
+										   DeferredErrorMessage **planningError);
+static DeferredErrorMessage * InsertShardCountError(DistTableCacheEntry *cacheEntry,
+													int prunedShardIntervalCount);
 static List * GroupInsertValuesByShardId(List *insertValuesList);
 static List * ExtractInsertValuesList(Query *query, Var *partitionColumn);
 static DeferredErrorMessage * MultiRouterPlannableQuery(Query *query);
@@ -147,6 +157,8 @@ static DeferredErrorMessage * ErrorIfQueryHasModifyingCTE(Query *queryTree);
 static RangeTblEntry * GetUpdateOrDeleteRTE(Query *query);
 static bool SelectsFromDistributedTable(List *rangeTableList, Query *query);
 static List * get_all_actual_clauses(List *restrictinfo_list);
+static int CompareModifyRoutesByShardId(const void *leftElement,
+										const void *rightElement);
 static int CompareInsertValuesByShardId(const void *leftElement,
 										const void *rightElement);
 static uint64 GetAnchorShardId(List *relationShardList);
@@ -1627,6 +1639,21 @@ RouterJob(Query *originalQuery, PlannerRestrictionContext *plannerRestrictionCon
 	/* check if this query requires master evaluation */
 	requiresMasterEvaluation = RequiresMasterEvaluation(originalQuery);
 
+	if (EnableFastPathPlanCache && !requiresMasterEvaluation &&
+		originalQuery->rowMarks == NIL && FastPathRouterQuery(originalQuery) &&
+		FastPathRouterQueryHasDistKeyParam(originalQuery))
+	{
+		/*
+		 * The distribution column is compared to a parameter, which happens when
+		 * planning a generic plan. Instead of forcing a custom plan, we defer the
+		 * shard pruning to the executor, see FastPathRouterTaskList().
+		 */
+		job = CreateJob(originalQuery);
+		job->deferredPruning = true;
+
+		return job;
+	}
+
 	(*planningError) = PlanRouterQuery(originalQuery, plannerRestrictionContext,
 									   &placementList, &shardId, &relationShardList,
 									   &prunedShardIntervalListList,
@@ -1698,6 +1725,122 @@ RouterJob(Query *originalQuery, PlannerRestrictionContext *plannerRestrictionCon
 }
 
 
+/*
+ * FastPathRouterTaskList returns the task list of a fast-path router query
+ * whose shard pruning was deferred to the executor because the distribution
+ * column is compared to a parameter (see RouterJob()). The parameters are
+ * kept in the shard query and sent to the worker along with the query, so the
+ * task only depends on the shard. We therefore cache the task for each shard
+ * of the plan, and only deparse the query and look up the placements the
+ * first time a shard is hit.
+ *
+ * The function sets the partition key value of the given job, which should
+ * be a copy that is only used by the current execution.
+ */
+List *
+FastPathRouterTaskList(Job *workerJob, uint64 planId, ParamListInfo boundParams)
+{
+	Query *jobQuery = workerJob->jobQuery;
+	Oid relationId = ExtractFirstDistributedTableId(jobQuery);
+	Node *quals = NULL;
+	List *prunedShardIntervalList = NIL;
+	Const *partitionValueConst = NULL;
+	ShardInterval *shardInterval = NULL;
+	Task *task = NULL;
+
+	Assert(workerJob->deferredPruning);
+
+	/* resolve the parameters in a copy of the filters to prune the shards */
+	quals = ResolveExternalParams(copyObject(jobQuery->jointree->quals),
+								  copyParamList(boundParams));
+	prunedShardIntervalList =
+		PruneShards(relationId, 1, make_ands_implicit((Expr *) quals),
+					&partitionValueConst);
+
+	if (prunedShardIntervalList == NIL)
+	{
+		DistTableCacheEntry *cacheEntry = DistributedTableCacheEntry(relationId);
+
+		/*
+		 * The parameter on the distribution column is NULL, so the filter does
+		 * not match any row on any shard. Modifications do not need to do
+		 * anything, and a SELECT returns the same (empty or aggregated) result
+		 * on any shard, so we send it to the first one.
+		 */
+		if (jobQuery->commandType != CMD_SELECT)
+		{
+			return NIL;
+		}
+
+		ErrorIfNoShardsExist(cacheEntry);
+
+		prunedShardIntervalList = list_make1(cacheEntry->sortedShardIntervalArray[0]);
+	}
+	else if (list_length(prunedShardIntervalList) > 1)
+	{
+		ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+						errmsg("could not prune the fast path query to a single shard"),
+						errhint("Consider setting citus.enable_fast_path_plan_cache "
+								"to off.")));
+	}
+
+	shardInterval = (ShardInterval *) linitial(prunedShardIntervalList);
+	workerJob->partitionKeyValue = partitionValueConst;
+
+	task = GetCachedFastPathTask(planId, shardInterval->shardId);
+	if (task == NULL)
+	{
+		Query *shardQuery = copyObject(jobQuery);
+		RelationShard *relationShard = CitusMakeNode(RelationShard);
+		List *relationShardList = NIL;
+		List *placementList = NIL;
+		List *taskList = NIL;
+
+		relationShard->relationId = shardInterval->relationId;
+		relationShard->shardId = shardInterval->shardId;
+		relationShardList = list_make1(relationShard);
+
+		placementList =
+			WorkersContainingAllShards(list_make1(list_make1(shardInterval)));
+		if (placementList == NIL)
+		{
+			ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+							errmsg("found no worker with all shard placements")));
+		}
+
+		UpdateRelationToShardNames((Node *) shardQuery, relationShardList);
+
+		if (shardQuery->commandType == CMD_SELECT)
+		{
+			taskList = SingleShardSelectTaskList(shardQuery, workerJob->jobId,
+												 relationShardList, placementList,
+												 shardInterval->shardId);
+		}
+		else
+		{
+			taskList = SingleShardModifyTaskList(shardQuery, workerJob->jobId,
+												 relationShardList, placementList,
+												 shardInterval->shardId);
+		}
+
+		task = (Task *) linitial(taskList);
+
+		CacheFastPathTask(planId, shardInterval->shardId, task);
+	}
+
+	task->jobId = workerJob->jobId;
+	workerJob->taskList = list_make1(task);
+
+	if (jobQuery->commandType == CMD_SELECT)
+	{
+		ReorderTaskPlacementsByTaskAssignmentPolicy(workerJob, TaskAssignmentPolicy,
+													task->taskPlacementList);
+	}
+
+	return workerJob->taskList;
+}
+
+
 /*
  * ReorderTaskPlacementsByTaskAssignmentPolicy applies selective reordering for supported
  * TaskAssignmentPolicyTypes.
@@ -2450,6 +2593,24 @@ BuildRoutesForInsert(Query *query, DeferredErrorMessage **planningError)
 
 	partitionColumn = PartitionColumn(distributedTableId, rangeTableId);
 
+	/*
+	 * Rows can only be routed in a single pass if every value falls within at
+	 * most one shard, which also rules out shards without min/max values.
+	 */
+	if (EnableBatchedInsertRouting && IsMultiRowInsert(query) &&
+		(partitionMethod == DISTRIBUTE_BY_HASH || partitionMethod == DISTRIBUTE_BY_RANGE)
+		&& !cacheEntry->hasOverlappingShardInterval)
+	{
+		TargetEntry *partitionTargetEntry = get_tle_by_resno(query->targetList,
+															 partitionColumn->varattno);
+
+		if (partitionTargetEntry != NULL && IsA(partitionTargetEntry->expr, Var))
+		{
+			return BuildRoutesForMultiRowInsert(query, cacheEntry, partitionTargetEntry,
+												planningError);
+		}
+	}
+
 	/* get full list of insert values and iterate over them to prune */
 	insertValuesList = ExtractInsertValuesList(query, partitionColumn);
 
@@ -2475,8 +2636,9 @@ BuildRoutesForInsert(Query *query, DeferredErrorMessage **planningError)
 								   "column")));
 		}
 
-		if (partitionMethod == DISTRIBUTE_BY_HASH || partitionMethod ==
-			DISTRIBUTE_BY_RANGE)
+		if (partitionMethod == DISTRIBUTE_BY_HASH ||
+			(partitionMethod == DISTRIBUTE_BY_RANGE &&
+			 !cacheEntry->hasOverlappingShardInterval))
 		{
 			Datum partitionValue = partitionValueConst->constvalue;
 			ShardInterval *shardInterval = NULL;
@@ -2512,54 +2674,169 @@ BuildRoutesForInsert(Query *query, DeferredErrorMessage **planningError)
 		prunedShardIntervalCount = list_length(prunedShardIntervalList);
 		if (prunedShardIntervalCount != 1)
 		{
-			char *partitionKeyString = cacheEntry->partitionKeyString;
-			char *partitionColumnName = ColumnNameToColumn(distributedTableId,
-														   partitionKeyString);
-			StringInfo errorMessage = makeStringInfo();
-			StringInfo errorHint = makeStringInfo();
-			const char *targetCountType = NULL;
+			(*planningError) = InsertShardCountError(cacheEntry,
+													 prunedShardIntervalCount);
 
-			if (prunedShardIntervalCount == 0)
-			{
-				targetCountType = "no";
-			}
-			else
-			{
-				targetCountType = "multiple";
-			}
+			return NIL;
+		}
+
+		targetShard = (ShardInterval *) linitial(prunedShardIntervalList);
+		insertValues->shardId = targetShard->shardId;
+	}
+
+	modifyRouteList = GroupInsertValuesByShardId(insertValuesList);
+
+	return modifyRouteList;
+}
 
-			if (prunedShardIntervalCount == 0)
-			{
-				appendStringInfo(errorHint, "Make sure you have created a shard which "
-											"can receive this partition column value.");
-			}
-			else
-			{
-				appendStringInfo(errorHint, "Make sure the value for partition column "
-											"\"%s\" falls into a single shard.",
-								 partitionColumnName);
-			}
 
-			appendStringInfo(errorMessage, "cannot run INSERT command which targets %s "
-										   "shards", targetCountType);
+/*
+ * BuildRoutesForMultiRowInsert returns the ModifyRoute objects for a multi-row
+ * INSERT into a hash or range distributed table without overlapping shards, in
+ * which the partition column is given by the Var in partitionTargetEntry.
+ * Similar to BuildRoutesForInsert, an empty list is returned if a partition
+ * column value still needs to be evaluated, and the planning error is set if a
+ * value falls within no shard.
+ *
+ * Rather than building an InsertValues object for every row, sorting them by
+ * shard id and then grouping them, the rows are appended to a list per shard
+ * index in a single pass over FindShardIntervalIndex(). Rows therefore keep
+ * their original order within a shard, and only the routes themselves need
+ * to be sorted by shard id to avoid unnecessary deadlocks.
+ */
+static List *
+BuildRoutesForMultiRowInsert(Query *query, DistTableCacheEntry *cacheEntry,
+							 TargetEntry *partitionTargetEntry,
+							 DeferredErrorMessage **planningError)
+{
+	Var *partitionVar = (Var *) partitionTargetEntry->expr;
+	RangeTblEntry *valuesRTE = rt_fetch(partitionVar->varno, query->rtable);
+	int shardCount = cacheEntry->shardIntervalArrayLength;
+	List **shardRowValuesLists = NULL;
+	List *modifyRouteList = NIL;
+	ListCell *valuesListCell = NULL;
+	int shardIndex = 0;
+
+	Assert(cacheEntry->partitionMethod == DISTRIBUTE_BY_HASH ||
+		   cacheEntry->partitionMethod == DISTRIBUTE_BY_RANGE);
+	Assert(!cacheEntry->hasOverlappingShardInterval);
 
-			(*planningError) = DeferredError(ERRCODE_FEATURE_NOT_SUPPORTED,
-											 errorMessage->data, NULL,
-											 errorHint->data);
+	shardRowValuesLists = (List **) palloc0(shardCount * sizeof(List *));
+
+	foreach(valuesListCell, valuesRTE->values_lists)
+	{
+		List *rowValues = (List *) lfirst(valuesListCell);
+		Expr *partitionValueExpr = list_nth(rowValues, partitionVar->varattno - 1);
+		Const *partitionValueConst = NULL;
+		Datum searchedValue = 0;
 
+		if (!IsA(partitionValueExpr, Const))
+		{
+			/* shard pruning not possible right now */
 			return NIL;
 		}
 
-		targetShard = (ShardInterval *) linitial(prunedShardIntervalList);
-		insertValues->shardId = targetShard->shardId;
+		partitionValueConst = (Const *) partitionValueExpr;
+		if (partitionValueConst->constisnull)
+		{
+			ereport(ERROR, (errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+							errmsg("cannot perform an INSERT with NULL in the partition "
+								   "column")));
+		}
+
+		searchedValue = partitionValueConst->constvalue;
+		if (cacheEntry->partitionMethod == DISTRIBUTE_BY_HASH)
+		{
+			searchedValue = FunctionCall1Coll(cacheEntry->hashFunction,
+											  cacheEntry->partitionColumn->varcollid,
+											  searchedValue);
+		}
+
+		shardIndex = FindShardIntervalIndex(searchedValue, cacheEntry);
+		if (shardIndex == INVALID_SHARD_INDEX)
+		{
+			(*planningError) = InsertShardCountError(cacheEntry, 0);
+
+			return NIL;
+		}
+
+		shardRowValuesLists[shardIndex] = lappend(shardRowValuesLists[shardIndex],
+												  rowValues);
 	}
 
-	modifyRouteList = GroupInsertValuesByShardId(insertValuesList);
+	for (shardIndex = 0; shardIndex < shardCount; shardIndex++)
+	{
+		ShardInterval *shardInterval = NULL;
+		ModifyRoute *modifyRoute = NULL;
+
+		if (shardRowValuesLists[shardIndex] == NIL)
+		{
+			continue;
+		}
+
+		shardInterval = cacheEntry->sortedShardIntervalArray[shardIndex];
+
+		modifyRoute = (ModifyRoute *) palloc(sizeof(ModifyRoute));
+		modifyRoute->shardId = shardInterval->shardId;
+		modifyRoute->rowValuesLists = shardRowValuesLists[shardIndex];
+
+		modifyRouteList = lappend(modifyRouteList, modifyRoute);
+	}
+
+	pfree(shardRowValuesLists);
+
+	/* shard ids usually follow the shard index, but nothing guarantees that */
+	modifyRouteList = SortList(modifyRouteList, CompareModifyRoutesByShardId);
 
 	return modifyRouteList;
 }
 
 
+/*
+ * InsertShardCountError returns the planning error for an INSERT row whose
+ * partition column value falls within the given number of shards, which is
+ * either 0 or more than 1.
+ */
+static DeferredErrorMessage *
+InsertShardCountError(DistTableCacheEntry *cacheEntry, int prunedShardIntervalCount)
+{
+	StringInfo errorMessage = makeStringInfo();
+	StringInfo errorHint = makeStringInfo();
+	const char *targetCountType = NULL;
+
+	if (prunedShardIntervalCount == 0)
+	{
+		targetCountType = "no";
+	}
+	else
+	{
+		targetCountType = "multiple";
+	}
+
+	if (prunedShardIntervalCount == 0)
+	{
+		appendStringInfo(errorHint, "Make sure you have created a shard which "
+									"can receive this partition column value.");
+	}
+	else
+	{
+		char *partitionKeyString = cacheEntry->partitionKeyString;
+		char *partitionColumnName = ColumnNameToColumn(cacheEntry->relationId,
+													   partitionKeyString);
+
+		appendStringInfo(errorHint, "Make sure the value for partition column "
+									"\"%s\" falls into a single shard.",
+						 partitionColumnName);
+	}
+
+	appendStringInfo(errorMessage, "cannot run INSERT command which targets %s "
+								   "shards", targetCountType);
+
+	return DeferredError(ERRCODE_FEATURE_NOT_SUPPORTED, errorMessage->data, NULL,
+						 errorHint->data);
+}
+
+
 /*
  * IsMultiRowInsert returns whether the given query is a multi-row INSERT.
  *
@@ -3162,6 +3439,31 @@ get_all_actual_clauses(List *restrictinfo_list)
 }
 
 
+/*
+ * CompareModifyRoutesByShardId is a comparator for sorting ModifyRoute objects
+ * by their shard id.
+ */
+static int
+CompareModifyRoutesByShardId(const void *leftElement, const void *rightElement)
+{
+	ModifyRoute *leftRoute = *((ModifyRoute **) leftElement);
+	ModifyRoute *rightRoute = *((ModifyRoute **) rightElement);
+
+	if (leftRoute->shardId > rightRoute->shardId)
+	{
+		return 1;
+	}
+	else if (leftRoute->shardId < rightRoute->shardId)
+	{
+		return -1;
+	}
+	else
+	{
+		return 0;
+	}
+}
+
+
 /*
  * CompareInsertValuesByShardId does what it says in the name. Used for sorting
  * InsertValues objects by their shard.
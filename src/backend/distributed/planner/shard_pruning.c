@@ -27,7 +27,9 @@
  *
  * 1) If there is a constant equality constraint on the partition column, and
  *    no overlapping shards exist, find the shard interval in which the
- *    constant falls
+ *    constant falls. For hash-partitioned tables, an IN list or = ANY(array)
+ *    constraint is handled the same way for all array elements at once,
+ *    rather than through one pruning instance per element
  *
  * 2) If there is a hash range constraint on the partition column, find the
  *    shard interval matching the range
@@ -35,8 +37,12 @@
  * 3) If there are range constraints (e.g. (a > 0 AND a < 10)) on the
  *    partition column, find the shard intervals that overlap with the range
  *
- * 4) If there are overlapping shards, exhaustively search all shards that are
- *    not excluded by constraints
+ * 4) If there are overlapping shards, find the shards that can overlap with
+ *    the range of the constraints by binary search over the shards' minimum
+ *    values and running maximum values, and check only those
+ *
+ * 5) Otherwise, exhaustively search all shards that are not excluded by
+ *    constraints
  *
  * Finally, the union of the shards found by each pruning instance is
  * returned.
@@ -103,6 +109,12 @@ typedef struct PruningInstance
 	 */
 	Const *hashedEqualConsts;
 
+	/*
+	 * Array of values the partition column is equal to one of, only used for
+	 * hash-partitioned tables. The array has the type of the partition column.
+	 */
+	Const *equalArrayConsts;
+
 	/*
 	 * Types of constraints not understood.  We could theoretically try more
 	 * expensive methods of pruning if any such restrictions are found.
@@ -178,6 +190,7 @@ typedef struct ClauseWalkerContext
 	 */
 	FunctionCall2InfoData compareValueFunctionCall;
 	FunctionCall2InfoData compareIntervalFunctionCall;
+	FunctionCall2InfoData hashFunctionCall;
 } ClauseWalkerContext;
 
 static void PrunableExpressions(Node *originalNode, ClauseWalkerContext *context);
@@ -205,6 +218,12 @@ static List * PruneOne(DistTableCacheEntry *cacheEntry, ClauseWalkerContext *con
 static List * PruneWithBoundaries(DistTableCacheEntry *cacheEntry,
 								  ClauseWalkerContext *context,
 								  PruningInstance *prune);
+static List * PruneWithEqualArray(DistTableCacheEntry *cacheEntry,
+								  ClauseWalkerContext *context,
+								  PruningInstance *prune);
+static List * PruneOverlappingWithBoundaries(DistTableCacheEntry *cacheEntry,
+											 ClauseWalkerContext *context,
+											 PruningInstance *prune);
 static List * ExhaustivePrune(DistTableCacheEntry *cacheEntry,
 							  ClauseWalkerContext *context,
 							  PruningInstance *prune);
@@ -298,6 +317,15 @@ PruneShards(Oid relationId, Index rangeTableId, List *whereClauseList,
 							   "a partition column comparator")));
 	}
 
+	if (cacheEntry->hashFunction)
+	{
+		/* initiate function call info once, IN lists hash many values with it */
+		InitFunctionCallInfoData(*(FunctionCallInfo) &
+								 context.hashFunctionCall,
+								 cacheEntry->hashFunction, 1,
+								 cacheEntry->partitionColumn->varcollid, NULL, NULL);
+	}
+
 	/* Figure out what we can prune on */
 	PrunableExpressions((Node *) whereClauseList, &context);
 
@@ -332,12 +360,19 @@ PruneShards(Oid relationId, Index rangeTableId, List *whereClauseList,
 		if (context.partitionMethod == DISTRIBUTE_BY_HASH)
 		{
 			if (!prune->evaluatesToFalse && !prune->equalConsts &&
-				!prune->hashedEqualConsts)
+				!prune->hashedEqualConsts && !prune->equalArrayConsts)
 			{
 				/* if hash-partitioned and no equals constraints, return all shards */
 				foundRestriction = false;
 				break;
 			}
+			else if (partitionValueConst != NULL && prune->equalConsts == NULL &&
+					 prune->equalArrayConsts != NULL)
+			{
+				/* found multiple partition column values */
+				foundPartitionColumnValue = true;
+				singlePartitionValueConst = NULL;
+			}
 			else if (partitionValueConst != NULL && prune->equalConsts != NULL)
 			{
 				if (!foundPartitionColumnValue)
@@ -663,6 +698,34 @@ AddSAOPartitionKeyRestrictionToInstance(ClauseWalkerContext *context,
 
 		/* get the necessary information from array type to iterate over it */
 		elementType = ARR_ELEMTYPE(array);
+
+		/*
+		 * For hash-partitioned tables, all elements are looked up at once in
+		 * PruneWithEqualArray() instead of building a pruning instance for
+		 * each of them, which gets expensive for long IN lists. Elements that
+		 * first need to be coerced to the partition column type are handled
+		 * one by one below.
+		 */
+		if (context->partitionMethod == DISTRIBUTE_BY_HASH &&
+			elementType == context->partitionColumn->vartype &&
+			ArrayGetNItems(ARR_NDIM(array), ARR_DIMS(array)) > 1)
+		{
+			if (!prune->addedToPruningInstances)
+			{
+				context->pruningInstances = lappend(context->pruningInstances, prune);
+				prune->addedToPruningInstances = true;
+			}
+
+			/* with multiple arrays, pruning on the first one yields a superset */
+			if (prune->equalArrayConsts == NULL)
+			{
+				prune->equalArrayConsts = (Const *) arrayArgument;
+			}
+
+			prune->hasValidConstraint = true;
+
+			return;
+		}
 		get_typlenbyvalalign(elementType,
 							 &typlen,
 							 &typbyval,
@@ -1097,6 +1160,15 @@ PruneOne(DistTableCacheEntry *cacheEntry, ClauseWalkerContext *context,
 		}
 	}
 
+	/*
+	 * Without a single value to look for, look up the shards of all the values
+	 * the partition column can be equal to.
+	 */
+	if (prune->equalArrayConsts && !shardInterval)
+	{
+		return PruneWithEqualArray(cacheEntry, context, prune);
+	}
+
 	/*
 	 * If previous pruning method yielded a single shard, and the table is not
 	 * hash partitioned, attempt range based pruning to exclude it further.
@@ -1129,9 +1201,6 @@ PruneOne(DistTableCacheEntry *cacheEntry, ClauseWalkerContext *context,
 	/*
 	 * Next method: binary search with fuzzy boundaries. Can't trivially do so
 	 * if shards have overlapping boundaries.
-	 *
-	 * TODO: If we kept shard intervals separately sorted by both upper and
-	 * lower boundaries, this should be possible?
 	 */
 	if (!cacheEntry->hasOverlappingShardInterval && (
 			prune->greaterConsts || prune->greaterEqualConsts ||
@@ -1140,6 +1209,18 @@ PruneOne(DistTableCacheEntry *cacheEntry, ClauseWalkerContext *context,
 		return PruneWithBoundaries(cacheEntry, context, prune);
 	}
 
+	/*
+	 * If shards overlap, binary search can still narrow down the shards that
+	 * need to be checked, as long as all of them have boundaries.
+	 */
+	if (cacheEntry->runningMaxShardIndexArray != NULL && (
+			prune->equalConsts ||
+			prune->greaterConsts || prune->greaterEqualConsts ||
+			prune->lessConsts || prune->lessEqualConsts))
+	{
+		return PruneOverlappingWithBoundaries(cacheEntry, context, prune);
+	}
+
 	/*
 	 * Brute force: Check each shard.
 	 */
@@ -1147,6 +1228,87 @@ PruneOne(DistTableCacheEntry *cacheEntry, ClauseWalkerContext *context,
 }
 
 
+/*
+ * PruneWithEqualArray returns the shards of a hash-partitioned table that
+ * contain any of the values in the equalArrayConsts array of the pruning
+ * instance. The values are hashed one after the other with a function call
+ * that is set up once, and each shard is added to the result the first time
+ * one of its values is found.
+ */
+static List *
+PruneWithEqualArray(DistTableCacheEntry *cacheEntry, ClauseWalkerContext *context,
+					PruningInstance *prune)
+{
+	FunctionCallInfo hashFunctionCall = (FunctionCallInfo) &context->hashFunctionCall;
+	ShardInterval **sortedShardIntervalArray = cacheEntry->sortedShardIntervalArray;
+	int shardCount = cacheEntry->shardIntervalArrayLength;
+	ArrayType *array = DatumGetArrayTypeP(prune->equalArrayConsts->constvalue);
+	Oid elementType = ARR_ELEMTYPE(array);
+	int16 typlen = 0;
+	bool typbyval = false;
+	char typalign = '\0';
+	Datum *elementArray = NULL;
+	bool *nullArray = NULL;
+	int elementCount = 0;
+	int elementIndex = 0;
+	bool *shardFound = NULL;
+	int foundShardCount = 0;
+	List *shardIntervalList = NIL;
+
+	Assert(context->partitionMethod == DISTRIBUTE_BY_HASH);
+
+	get_typlenbyvalalign(elementType, &typlen, &typbyval, &typalign);
+	deconstruct_array(array, elementType, typlen, typbyval, typalign,
+					  &elementArray, &nullArray, &elementCount);
+
+	shardFound = palloc0(shardCount * sizeof(bool));
+
+	for (elementIndex = 0; elementIndex < elementCount; elementIndex++)
+	{
+		Datum hashedValue = 0;
+		int shardIndex = INVALID_SHARD_INDEX;
+
+		/* the partition column is never equal to NULL */
+		if (nullArray[elementIndex])
+		{
+			continue;
+		}
+
+		fcSetArg(hashFunctionCall, 0, elementArray[elementIndex]);
+		hashFunctionCall->isnull = false;
+		hashedValue = FunctionCallInvoke(hashFunctionCall);
+
+		if (hashFunctionCall->isnull)
+		{
+			elog(ERROR, "function %u returned NULL", hashFunctionCall->flinfo->fn_oid);
+		}
+
+		shardIndex = FindShardIntervalIndex(hashedValue, cacheEntry);
+		if (shardIndex == INVALID_SHARD_INDEX || shardFound[shardIndex])
+		{
+			continue;
+		}
+
+		shardFound[shardIndex] = true;
+		shardIntervalList = lappend(shardIntervalList,
+									sortedShardIntervalArray[shardIndex]);
+
+		/* no need to look at the remaining values once all shards are found */
+		foundShardCount++;
+		if (foundShardCount == shardCount)
+		{
+			break;
+		}
+	}
+
+	pfree(shardFound);
+	pfree(elementArray);
+	pfree(nullArray);
+
+	return shardIntervalList;
+}
+
+
 /*
  * PerformCompare invokes comparator with prepared values, check for
  * unexpected NULL returns.
@@ -1452,6 +1614,114 @@ PruneWithBoundaries(DistTableCacheEntry *cacheEntry, ClauseWalkerContext *contex
 }
 
 
+/*
+ * PruneOverlappingWithBoundaries returns a list of shards matching the
+ * PruningInstance's constraints, for tables whose shards overlap.
+ *
+ * The shard intervals are sorted by minimum value, so the shards whose
+ * minimum value is above the upper bound of the constraints form a suffix of
+ * the array. The running maximum of the shards' maximum values never
+ * decreases, so the shards that end below the lower bound of the constraints
+ * and are not followed by any shard ending above it form a prefix. Both are
+ * found by binary search, and only the shards between them are checked one by
+ * one.
+ */
+static List *
+PruneOverlappingWithBoundaries(DistTableCacheEntry *cacheEntry,
+							   ClauseWalkerContext *context,
+							   PruningInstance *prune)
+{
+	List *remainingShardList = NIL;
+	int shardCount = cacheEntry->shardIntervalArrayLength;
+	ShardInterval **sortedShardIntervalArray = cacheEntry->sortedShardIntervalArray;
+	int *runningMaxShardIndexArray = cacheEntry->runningMaxShardIndexArray;
+	FunctionCallInfo compareFunctionCall = (FunctionCallInfo) &
+										   context->compareIntervalFunctionCall;
+	Const *lowerBoundConst = NULL;
+	Const *upperBoundConst = NULL;
+	int startIndex = 0;
+	int endIndex = shardCount;
+	int curIdx = 0;
+
+	/* any bound will do, ExhaustivePruneOne() applies all of them below */
+	if (prune->equalConsts)
+	{
+		lowerBoundConst = prune->equalConsts;
+		upperBoundConst = prune->equalConsts;
+	}
+	else
+	{
+		lowerBoundConst = prune->greaterEqualConsts ?
+						  prune->greaterEqualConsts : prune->greaterConsts;
+		upperBoundConst = prune->lessEqualConsts ?
+						  prune->lessEqualConsts : prune->lessConsts;
+	}
+
+	/* find the first shard that starts above the upper bound */
+	if (upperBoundConst != NULL)
+	{
+		int lowerIndex = 0;
+		int upperIndex = shardCount;
+
+		while (lowerIndex < upperIndex)
+		{
+			int middleIndex = lowerIndex + ((upperIndex - lowerIndex) / 2);
+			ShardInterval *middleInterval = sortedShardIntervalArray[middleIndex];
+
+			if (PerformValueCompare(compareFunctionCall, middleInterval->minValue,
+									upperBoundConst->constvalue) > 0)
+			{
+				upperIndex = middleIndex;
+			}
+			else
+			{
+				lowerIndex = middleIndex + 1;
+			}
+		}
+
+		endIndex = lowerIndex;
+	}
+
+	/* find the first shard that ends at or above the lower bound, or follows one */
+	if (lowerBoundConst != NULL)
+	{
+		int lowerIndex = 0;
+		int upperIndex = endIndex;
+
+		while (lowerIndex < upperIndex)
+		{
+			int middleIndex = lowerIndex + ((upperIndex - lowerIndex) / 2);
+			ShardInterval *runningMaxInterval =
+				sortedShardIntervalArray[runningMaxShardIndexArray[middleIndex]];
+
+			if (PerformValueCompare(compareFunctionCall, runningMaxInterval->maxValue,
+									lowerBoundConst->constvalue) < 0)
+			{
+				lowerIndex = middleIndex + 1;
+			}
+			else
+			{
+				upperIndex = middleIndex;
+			}
+		}
+
+		startIndex = lowerIndex;
+	}
+
+	for (curIdx = startIndex; curIdx < endIndex; curIdx++)
+	{
+		ShardInterval *curInterval = sortedShardIntervalArray[curIdx];
+
+		if (!ExhaustivePruneOne(curInterval, context, prune))
+		{
+			remainingShardList = lappend(remainingShardList, curInterval);
+		}
+	}
+
+	return remainingShardList;
+}
+
+
 /*
  * ExhaustivePrune returns a list of shards matching PruningInstances
  * constraints, by simply checking them for each individual shard.
@@ -0,0 +1,233 @@
+/*-------------------------------------------------------------------------
+ *
+ * copy_progress.c
+ *	  Routines for tracking the progress of rows that are copied into
+ *	  distributed tables, and for showing it in citus_copy_progress.
+ *
+ * CitusCopyDestReceiver keeps a CopyProgress in a progress monitor while it
+ * routes rows to the shards, both for COPY and for INSERT ... SELECT via the
+ * coordinator. The monitor holds the number of rows routed and, for every
+ * node, the number of shards, rows and bytes sent to it, such that skew
+ * and stalled workers are visible during long loads.
+ *
+ * Copyright (c) 2019, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "fmgr.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+
+#include "distributed/copy_progress.h"
+#include "distributed/metadata_cache.h"
+#include "distributed/multi_progress.h"
+#include "distributed/tuplestore.h"
+#include "distributed/worker_manager.h"
+#include "storage/dsm_impl.h"
+#include "utils/builtins.h"
+#include "utils/timestamp.h"
+#include "utils/tuplestore.h"
+
+
+#define CITUS_COPY_PROGRESS_COLUMNS 11
+
+
+/* whether COPY keeps its progress in a progress monitor */
+bool EnableCopyProgress = false;
+
+
+PG_FUNCTION_INFO_V1(citus_copy_progress);
+
+
+/*
+ * CreateCopyProgress creates a progress monitor for copying rows into the given
+ * distributed table, with an entry for each of the active primary nodes, and
+ * returns its CopyProgress. The function returns NULL if progress tracking is
+ * disabled or the monitor could not be created. It also returns NULL if the
+ * backend already has a progress monitor, such as the one of a COPY that runs
+ * the current one, since a backend reports the progress of a single command.
+ */
+CopyProgress *
+CreateCopyProgress(Oid relationId)
+{
+	List *workerNodeList = NIL;
+	ListCell *workerNodeCell = NULL;
+	ProgressMonitorData *monitor = NULL;
+	CopyProgress *copyProgress = NULL;
+	int nodeCount = 0;
+	int nodeIndex = 0;
+	Size progressSize = 0;
+
+	if (!EnableCopyProgress || HasCurrentProgressMonitor())
+	{
+		return NULL;
+	}
+
+#if PG_VERSION_NUM < 120000
+
+	/* progress monitors are kept in dynamic shared memory */
+	if (dynamic_shared_memory_type == DSM_IMPL_NONE)
+	{
+		return NULL;
+	}
+#endif
+
+	workerNodeList = ActivePrimaryNodeList();
+	nodeCount = list_length(workerNodeList);
+
+	progressSize = offsetof(CopyProgress, nodes) + nodeCount * sizeof(CopyNodeProgress);
+
+	monitor = CreateProgressMonitor(COPY_PROGRESS_MAGIC_NUMBER, 1, progressSize,
+									relationId);
+	if (monitor == NULL)
+	{
+		return NULL;
+	}
+
+	copyProgress = (CopyProgress *) monitor->steps;
+	memset(copyProgress, 0, progressSize);
+
+	copyProgress->relationId = relationId;
+	copyProgress->startTime = GetCurrentTimestamp();
+	copyProgress->nodeCount = nodeCount;
+
+	foreach(workerNodeCell, workerNodeList)
+	{
+		WorkerNode *workerNode = (WorkerNode *) lfirst(workerNodeCell);
+		CopyNodeProgress *nodeProgress = &copyProgress->nodes[nodeIndex++];
+
+		strlcpy(nodeProgress->nodeName, workerNode->workerName, WORKER_LENGTH);
+		nodeProgress->nodePort = workerNode->workerPort;
+	}
+
+	return copyProgress;
+}
+
+
+/*
+ * CopyProgressForNode returns the entry of the given node in the given copy
+ * progress, or NULL if there is none.
+ */
+CopyNodeProgress *
+CopyProgressForNode(CopyProgress *copyProgress, char *nodeName, int32 nodePort)
+{
+	int nodeIndex = 0;
+
+	if (copyProgress == NULL)
+	{
+		return NULL;
+	}
+
+	for (nodeIndex = 0; nodeIndex < copyProgress->nodeCount; nodeIndex++)
+	{
+		CopyNodeProgress *nodeProgress = &copyProgress->nodes[nodeIndex];
+
+		if (nodeProgress->nodePort == nodePort &&
+			strncmp(nodeProgress->nodeName, nodeName, WORKER_LENGTH) == 0)
+		{
+			return nodeProgress;
+		}
+	}
+
+	return NULL;
+}
+
+
+/*
+ * FinalizeCopyProgress removes the progress monitor of the given copy progress,
+ * if any. A COPY without a copy progress leaves the monitor of an enclosing
+ * command in place. If the copy fails instead, the monitor is removed when the
+ * transaction aborts.
+ */
+void
+FinalizeCopyProgress(CopyProgress *copyProgress)
+{
+	if (copyProgress != NULL)
+	{
+		FinalizeCurrentProgressMonitor();
+	}
+}
+
+
+/*
+ * citus_copy_progress returns a row for every node of every ongoing COPY into a
+ * distributed table, with the number of shards, rows and bytes that were sent
+ * to the node so far and the average number of bytes per second.
+ */
+Datum
+citus_copy_progress(PG_FUNCTION_ARGS)
+{
+	List *attachedDSMSegments = NIL;
+	List *monitorList = NIL;
+	ListCell *monitorCell = NULL;
+	TupleDesc tupleDescriptor = NULL;
+	Tuplestorestate *tupleStore = NULL;
+	TimestampTz currentTime = GetCurrentTimestamp();
+
+	CheckCitusVersion(ERROR);
+
+	tupleStore = SetupTuplestore(fcinfo, &tupleDescriptor);
+	monitorList = ProgressMonitorList(COPY_PROGRESS_MAGIC_NUMBER, &attachedDSMSegments);
+
+	foreach(monitorCell, monitorList)
+	{
+		ProgressMonitorData *monitor = (ProgressMonitorData *) lfirst(monitorCell);
+		CopyProgress *copyProgress = (CopyProgress *) monitor->steps;
+		long elapsedSeconds = 0;
+		int elapsedMicroseconds = 0;
+		double elapsedTime = 0.0;
+		int nodeIndex = 0;
+
+		TimestampDifference(copyProgress->startTime, currentTime, &elapsedSeconds,
+							&elapsedMicroseconds);
+		elapsedTime = elapsedSeconds + elapsedMicroseconds / 1000000.0;
+
+		for (nodeIndex = 0; nodeIndex < copyProgress->nodeCount; nodeIndex++)
+		{
+			CopyNodeProgress *nodeProgress = &copyProgress->nodes[nodeIndex];
+			Datum values[CITUS_COPY_PROGRESS_COLUMNS];
+			bool nulls[CITUS_COPY_PROGRESS_COLUMNS];
+
+			memset(values, 0, sizeof(values));
+			memset(nulls, 0, sizeof(nulls));
+
+			values[0] = Int32GetDatum(monitor->processId);
+			values[1] = ObjectIdGetDatum(copyProgress->relationId);
+			values[2] = TimestampTzGetDatum(copyProgress->startTime);
+			values[3] = Int64GetDatum(copyProgress->rowCount);
+			values[4] = CStringGetTextDatum(nodeProgress->nodeName);
+			values[5] = Int32GetDatum(nodeProgress->nodePort);
+			values[6] = Int64GetDatum(nodeProgress->shardCount);
+			values[7] = Int64GetDatum(nodeProgress->rowCount);
+			values[8] = Int64GetDatum(nodeProgress->byteCount);
+
+			if (elapsedTime > 0.0)
+			{
+				values[9] = Float8GetDatum(nodeProgress->byteCount / elapsedTime);
+			}
+			else
+			{
+				nulls[9] = true;
+			}
+
+			if (nodeProgress->lastSendTime != 0)
+			{
+				values[10] = TimestampTzGetDatum(nodeProgress->lastSendTime);
+			}
+			else
+			{
+				nulls[10] = true;
+			}
+
+			tuplestore_putvalues(tupleStore, tupleDescriptor, values, nulls);
+		}
+	}
+
+	tuplestore_donestoring(tupleStore);
+
+	DetachFromDSMSegments(attachedDSMSegments);
+
+	return (Datum) 0;
+}
@@ -56,7 +56,7 @@ CreateProgressMonitor(uint64 progressTypeMagicNumber, int stepCount, Size stepSi
 
 	if (dsmSegment == NULL)
 	{
-		ereport(WARNING,
+		ereport(DEBUG1,
 				(errmsg("could not create a dynamic shared memory segment to "
 						"keep track of progress of the current command")));
 		return NULL;
@@ -95,6 +95,23 @@ GetCurrentProgressMonitor(void)
 }
 
 
+/*
+ * HasCurrentProgressMonitor returns whether this backend currently has a progress
+ * monitor. The segment of a monitor that is not finalized is detached when the
+ * transaction aborts, after which the backend has no monitor anymore.
+ */
+bool
+HasCurrentProgressMonitor(void)
+{
+	if (currentProgressDSMHandle == DSM_HANDLE_INVALID)
+	{
+		return false;
+	}
+
+	return dsm_find_mapping(currentProgressDSMHandle) != NULL;
+}
+
+
 /*
  * FinalizeCurrentProgressMonitor releases the dynamic memory segment of the current
  * progress monitoring data structure and removes the process from
@@ -184,13 +201,20 @@ ProgressMonitorList(uint64 commandTypeMagicNumber, List **attachedDSMSegments)
 		{
 			Datum dsmHandleDatum = slot_getattr(tupleTableSlot, dsmHandleIndex, &isNull);
 			dsm_handle dsmHandle = DatumGetUInt64(dsmHandleDatum);
+			bool alreadyMapped = (dsm_find_mapping(dsmHandle) != NULL);
 			dsm_segment *attachedSegment = NULL;
 			ProgressMonitorData *monitor = MonitorDataFromDSMHandle(dsmHandle,
 																	&attachedSegment);
 
 			if (monitor != NULL)
 			{
-				*attachedDSMSegments = lappend(*attachedDSMSegments, attachedSegment);
+				/* the monitor of this backend stays mapped until it is finalized */
+				if (!alreadyMapped)
+				{
+					*attachedDSMSegments = lappend(*attachedDSMSegments,
+												   attachedSegment);
+				}
+
 				monitorList = lappend(monitorList, monitor);
 			}
 		}
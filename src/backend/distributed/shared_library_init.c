@@ -25,7 +25,12 @@
 #include "distributed/commands/multi_copy.h"
 #include "distributed/commands/utility_hook.h"
 #include "distributed/connection_management.h"
+#include "distributed/copy_out_executor.h"
+#include "distributed/copy_progress.h"
 #include "distributed/distributed_deadlock_detection.h"
+#include "distributed/fast_path_plan_cache.h"
+#include "distributed/intermediate_results.h"
+#include "distributed/local_executor.h"
 #include "distributed/maintenanced.h"
 #include "distributed/master_metadata_utility.h"
 #include "distributed/master_protocol.h"
@@ -44,7 +49,12 @@
 #include "distributed/query_pushdown_planning.h"
 #include "distributed/query_stats.h"
 #include "distributed/remote_commands.h"
+#include "distributed/repartition_join_execution.h"
+#include "distributed/shard_cache_invalidation.h"
+#include "distributed/shared_connection_stats.h"
 #include "distributed/shared_library_init.h"
+#include "distributed/shared_metadata_cache.h"
+#include "distributed/statement_cache.h"
 #include "distributed/statistics_collection.h"
 #include "distributed/subplan_execution.h"
 #include "distributed/task_tracker.h"
@@ -144,6 +154,13 @@ static const struct config_enum_entry multi_task_query_log_level_options[] = {
 	{ NULL, 0, false }
 };
 
+static const struct config_enum_entry copy_on_conflict_options[] = {
+	{ "error", COPY_ON_CONFLICT_ERROR, false },
+	{ "do_nothing", COPY_ON_CONFLICT_DO_NOTHING, false },
+	{ "do_update", COPY_ON_CONFLICT_DO_UPDATE, false },
+	{ NULL, 0, false }
+};
+
 static const struct config_enum_entry multi_shard_modify_connection_options[] = {
 	{ "parallel", PARALLEL_CONNECTION, false },
 	{ "sequential", SEQUENTIAL_CONNECTION, false },
@@ -235,6 +252,9 @@ _PG_init(void)
 	InitializeTransactionManagement();
 	InitializeBackendManagement();
 	InitializeConnectionManagement();
+	InitializeSharedConnectionStats();
+	InitializeSharedMetadataCache();
+	InitializeShardCacheInvalidation();
 	InitPlacementConnectionManagement();
 	InitializeCitusQueryStats();
 
@@ -420,6 +440,92 @@ RegisterCitusConfigVariables(void)
 		0,
 		NULL, NULL, NULL);
 
+	DefineCustomBoolVariable(
+		"citus.enable_copy_pass_through",
+		gettext_noop("Forwards the rows of COPY FROM in text or csv format to the "
+					 "workers without decoding them."),
+		gettext_noop("When enabled, COPY FROM only decodes the distribution column "
+					 "to route each row to its shard, and forwards the other fields "
+					 "as they are. This is faster for wide rows, but the values are "
+					 "only validated on the workers. Rows have to contain all the "
+					 "columns of the table."),
+		&EnableCopyPassThrough,
+		false,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"citus.copy_append_shard_count",
+		gettext_noop("Sets the number of shards that COPY into an append-distributed "
+					 "table fills concurrently."),
+		gettext_noop("COPY creates up to this many new shards and distributes blocks "
+					 "of rows across them in round-robin order, such that a bulk load "
+					 "is spread over multiple workers. Each of the shards is replaced "
+					 "by a new one when it grows beyond citus.shard_max_size. With "
+					 "a single shard, rows are sent one by one."),
+		&CopyAppendShardCount,
+		1, 1, 1024,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomBoolVariable(
+		"citus.enable_copy_progress",
+		gettext_noop("Tracks the progress of COPY into distributed tables."),
+		gettext_noop("When enabled, COPY and INSERT ... SELECT via the coordinator "
+					 "keep the number of rows and bytes that they sent to each node "
+					 "in dynamic shared memory, which the citus_copy_progress view "
+					 "shows. The backend is reported as running VACUUM in "
+					 "pg_stat_progress_vacuum meanwhile."),
+		&EnableCopyProgress,
+		false,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomEnumVariable(
+		"citus.copy_on_conflict",
+		gettext_noop("Sets what COPY FROM does with rows that conflict with existing "
+					 "rows of a distributed table."),
+		gettext_noop("With do_nothing or do_update, COPY FROM stages the rows of each "
+					 "shard on the workers and inserts them with ON CONFLICT DO NOTHING, "
+					 "or with ON CONFLICT DO UPDATE on the primary key. The default, "
+					 "error, copies the rows into the shards directly."),
+		&CopyOnConflict,
+		COPY_ON_CONFLICT_ERROR,
+		copy_on_conflict_options,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomBoolVariable(
+		"citus.enable_streaming_copy_out",
+		gettext_noop("Streams the output of COPY distributed_table TO STDOUT from "
+					 "the shards."),
+		gettext_noop("When enabled, COPY of a distributed table to the client in text "
+					 "or csv format runs COPY on all shards in parallel and forwards "
+					 "the rows as they arrive, instead of collecting the result of a "
+					 "distributed SELECT on the coordinator."),
+		&EnableStreamingCopyOut,
+		true,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomBoolVariable(
+		"citus.compress_intermediate_results",
+		gettext_noop("Compresses the intermediate results that are written."),
+		gettext_noop("When enabled, intermediate results are compressed in blocks "
+					 "before they are sent to the workers and written to disk. "
+					 "read_intermediate_result() decompresses them on the fly, "
+					 "regardless of this setting."),
+		&CompressIntermediateResults,
+		false,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
 	DefineCustomBoolVariable(
 		"citus.expire_cached_shards",
 		gettext_noop("This GUC variable has been deprecated."),
@@ -441,6 +547,21 @@ RegisterCitusConfigVariables(void)
 		GUC_NO_SHOW_ALL,
 		NULL, NULL, NULL);
 
+	DefineCustomBoolVariable(
+		"citus.enable_direct_subplan_routing",
+		gettext_noop("Creates the results of single-shard subplans on the node "
+					 "that reads them."),
+		gettext_noop("When enabled, the result of a subplan that reads a single "
+					 "shard is written directly on the worker node that holds the "
+					 "shard, if that node is the only one that reads the result, "
+					 "instead of pulling the result to the coordinator and sending "
+					 "it to all the worker nodes."),
+		&EnableDirectSubPlanRouting,
+		true,
+		PGC_USERSET,
+		GUC_NO_SHOW_ALL,
+		NULL, NULL, NULL);
+
 	DefineCustomBoolVariable(
 		"citus.enable_fast_path_router_planner",
 		gettext_noop("Enables fast path router planner"),
@@ -451,6 +572,20 @@ RegisterCitusConfigVariables(void)
 		GUC_NO_SHOW_ALL,
 		NULL, NULL, NULL);
 
+	DefineCustomBoolVariable(
+		"citus.enable_fast_path_plan_cache",
+		gettext_noop("Enables generic plans for fast path router queries"),
+		gettext_noop("When enabled, prepared fast path router queries that compare "
+					 "the distribution column to a parameter are planned once, and "
+					 "the shard is pruned in the executor. The task for each shard "
+					 "is cached, such that later executions skip deparsing the "
+					 "shard query and looking up the shard placements."),
+		&EnableFastPathPlanCache,
+		false,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
 	DefineCustomBoolVariable(
 		"citus.override_table_visibility",
 		gettext_noop("Enables replacing occurencens of pg_catalog.pg_table_visible() "
@@ -691,6 +826,19 @@ RegisterCitusConfigVariables(void)
 		GUC_NO_SHOW_ALL,
 		NULL, NULL, NULL);
 
+	DefineCustomBoolVariable(
+		"citus.enable_batched_insert_routing",
+		gettext_noop("Routes the rows of multi-row INSERTs to shards in a single pass"),
+		gettext_noop("When enabled, the rows of a multi-row INSERT into a hash or "
+					 "range distributed table are grouped by shard while their "
+					 "shards are looked up, instead of being sorted by shard "
+					 "afterwards."),
+		&EnableBatchedInsertRouting,
+		true,
+		PGC_USERSET,
+		GUC_NO_SHOW_ALL,
+		NULL, NULL, NULL);
+
 	DefineCustomIntVariable(
 		"citus.shard_count",
 		gettext_noop("Sets the number of shards for a new hash-partitioned table"
@@ -773,6 +921,53 @@ RegisterCitusConfigVariables(void)
 		0,
 		NULL, NULL, NULL);
 
+	DefineCustomBoolVariable(
+		"citus.enable_binary_protocol",
+		gettext_noop("Enables requesting results from workers in binary format"),
+		gettext_noop("When enabled, the adaptive executor requests query results "
+					 "in PostgreSQL's binary format if all result columns have "
+					 "binary send and receive functions, and decodes them "
+					 "directly instead of calling the text input functions of "
+					 "the column types."),
+		&EnableBinaryProtocol,
+		false,
+		PGC_USERSET,
+		GUC_NO_SHOW_ALL,
+		NULL, NULL, NULL);
+
+	DefineCustomBoolVariable(
+		"citus.enable_statement_caching",
+		gettext_noop("Prepares parameterized shard queries on the worker connections"),
+		gettext_noop("When enabled, the adaptive executor prepares a parameterized "
+					 "shard query once per connection and executes the prepared "
+					 "statement afterwards, such that the workers do not need to "
+					 "parse and plan the query on each execution. The prepared "
+					 "statements are invalidated when a DDL command is propagated. "
+					 "Queries that filter the distribution column by a parameter, "
+					 "such as fast-path router queries, are not prepared, since "
+					 "their parameters are replaced by constants during pruning. "
+					 "This cannot be used when the connections to the workers go "
+					 "through a connection pooler in transaction pooling mode."),
+		&EnableStatementCaching,
+		false,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomBoolVariable(
+		"citus.enable_local_execution",
+		gettext_noop("Enables queries on shards that are local to the current node "
+					 "to be planned and executed locally."),
+		gettext_noop("When enabled, the adaptive executor executes the shard queries "
+					 "whose placements are on the current node (e.g., on MX workers or "
+					 "on a coordinator that has shards) in the same backend, instead "
+					 "of sending them over a connection to the local node."),
+		&EnableLocalExecution,
+		false,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
 	DefineCustomIntVariable(
 		"citus.max_worker_nodes_tracked",
 		gettext_noop("Sets the maximum number of worker nodes that are tracked."),
@@ -828,6 +1023,37 @@ RegisterCitusConfigVariables(void)
 		0,
 		NULL, NULL, NULL);
 
+	DefineCustomIntVariable(
+		"citus.max_shared_pool_size",
+		gettext_noop("Sets the maximum number of connections allowed per worker node "
+					 "across all the backends from this node. Setting to -1 disables "
+					 "connections throttling. Setting to 0 makes it auto-adjust, meaning "
+					 "equal to max_connections on the coordinator."),
+		gettext_noop("As a rule of thumb, the value should be at most equal to the "
+					 "max_connections on the remote nodes. Once the limit is reached, "
+					 "the executor does not open additional connections to a worker "
+					 "and waits for a connection slot before opening the first one."),
+		&MaxSharedPoolSize,
+		0, -1, INT_MAX,
+		PGC_SIGHUP,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"citus.shared_metadata_cache_size",
+		gettext_noop("Sets the size of the shared memory that keeps the shard "
+					 "metadata of distributed tables for all backends."),
+		gettext_noop("Backends copy the shards and placements of a distributed "
+					 "table from shared memory rather than scanning pg_dist_shard "
+					 "and pg_dist_placement, once any backend read them. When "
+					 "the memory is full, the metadata of other tables is "
+					 "evicted. Setting to 0 disables sharing the metadata."),
+		&SharedMetadataCacheSize,
+		0, 0, MAX_KILOBYTES,
+		PGC_POSTMASTER,
+		GUC_UNIT_KB,
+		NULL, NULL, NULL);
+
 	DefineCustomIntVariable(
 		"citus.max_assign_task_batch_size",
 		gettext_noop("Sets the maximum number of tasks to assign per round."),
@@ -1008,6 +1234,31 @@ RegisterCitusConfigVariables(void)
 		0,
 		NULL, NULL, NULL);
 
+	DefineCustomBoolVariable(
+		"citus.enable_adaptive_repartition_joins",
+		gettext_noop("Allows the adaptive executor to execute repartition joins."),
+		gettext_noop("When enabled, the adaptive executor runs the map, fetch and "
+					 "merge tasks of repartition joins over its own connections, "
+					 "instead of switching to the task-tracker executor."),
+		&EnableAdaptiveRepartitionJoins,
+		false,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomBoolVariable(
+		"citus.enable_streaming_shuffle",
+		gettext_noop("Streams partition files into merge tables in repartition joins."),
+		gettext_noop("When enabled, repartition joins that are executed by the "
+					 "adaptive executor create their merge tables upfront, and copy "
+					 "the partition files from the mapping nodes directly into these "
+					 "tables instead of writing them to disk on the merging nodes."),
+		&EnableStreamingShuffle,
+		true,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
 	DefineCustomEnumVariable(
 		"citus.shard_placement_policy",
 		gettext_noop("Sets the policy to use when choosing nodes for shard placement."),
@@ -0,0 +1,223 @@
+/*-------------------------------------------------------------------------
+ *
+ * test/src/hash_partitioning.c
+ *
+ * This file contains functions to exercise and benchmark the hash
+ * partitioning functions that repartition jobs use on the workers.
+ *
+ * Copyright (c) 2019, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "fmgr.h"
+#include "funcapi.h"
+
+#include "access/htup_details.h"
+#include "catalog/pg_collation.h"
+#include "catalog/pg_type.h"
+#include "distributed/master_metadata_utility.h"
+#include "distributed/worker_protocol.h"
+#include "portability/instr_time.h"
+#include "utils/array.h"
+#include "utils/builtins.h"
+
+
+/* every NULL_VALUE_INTERVAL'th benchmark value is null */
+#define NULL_VALUE_INTERVAL 100
+
+
+static Datum * BenchmarkValueArray(Oid typeId, uint32 valueCount,
+								   bool **nullArray);
+static ArrayType * UniformHashRangeArray(uint32 partitionCount);
+
+
+PG_FUNCTION_INFO_V1(benchmark_hash_partitioning);
+
+
+/*
+ * benchmark_hash_partitioning assigns the given number of generated values of
+ * the given type to the given number of uniform hash partitions, once value at
+ * a time via HashPartitionId() and once in batches via HashPartitionIdBatch().
+ * The function errors out if the two disagree on a partition, and otherwise
+ * returns the number of values per second that each of them processed.
+ */
+Datum
+benchmark_hash_partitioning(PG_FUNCTION_ARGS)
+{
+	Oid typeId = PG_GETARG_OID(0);
+	int32 valueCount = PG_GETARG_INT32(1);
+	int32 partitionCount = PG_GETARG_INT32(2);
+
+	HashPartitionContext *partitionContext = NULL;
+	Datum *valueArray = NULL;
+	bool *nullArray = NULL;
+	uint32 *rowPartitionIdArray = NULL;
+	uint32 *batchPartitionIdArray = NULL;
+	uint32 valueIndex = 0;
+	instr_time rowStart;
+	instr_time rowDuration;
+	instr_time batchStart;
+	instr_time batchDuration;
+	double rowSeconds = 0.0;
+	double batchSeconds = 0.0;
+
+	TupleDesc tupleDescriptor = NULL;
+	HeapTuple resultTuple = NULL;
+	Datum resultValues[2];
+	bool resultNulls[2] = { false, false };
+
+	if (valueCount <= 0 || partitionCount <= 0)
+	{
+		ereport(ERROR, (errmsg("value count and partition count must be positive")));
+	}
+
+	if (get_call_result_type(fcinfo, NULL, &tupleDescriptor) != TYPEFUNC_COMPOSITE)
+	{
+		ereport(ERROR, (errmsg("return type must be a row type")));
+	}
+
+	partitionContext = CreateHashPartitionContext(UniformHashRangeArray(partitionCount),
+												  typeId, DEFAULT_COLLATION_OID);
+
+	valueArray = BenchmarkValueArray(typeId, valueCount, &nullArray);
+	rowPartitionIdArray = (uint32 *) palloc0(valueCount * sizeof(uint32));
+	batchPartitionIdArray = (uint32 *) palloc0(valueCount * sizeof(uint32));
+
+	INSTR_TIME_SET_CURRENT(rowStart);
+
+	for (valueIndex = 0; valueIndex < valueCount; valueIndex++)
+	{
+		if (nullArray[valueIndex])
+		{
+			rowPartitionIdArray[valueIndex] = 0;
+			continue;
+		}
+
+		rowPartitionIdArray[valueIndex] =
+			HashPartitionId(valueArray[valueIndex], partitionContext);
+	}
+
+	INSTR_TIME_SET_CURRENT(rowDuration);
+	INSTR_TIME_SUBTRACT(rowDuration, rowStart);
+
+	INSTR_TIME_SET_CURRENT(batchStart);
+
+	/* use the same batch size as the partitioning functions */
+	for (valueIndex = 0; valueIndex < valueCount; valueIndex += ROW_PREFETCH_COUNT)
+	{
+		uint32 batchSize = Min(ROW_PREFETCH_COUNT, valueCount - valueIndex);
+
+		HashPartitionIdBatch(&valueArray[valueIndex], &nullArray[valueIndex],
+							 &batchPartitionIdArray[valueIndex], batchSize,
+							 partitionContext);
+	}
+
+	INSTR_TIME_SET_CURRENT(batchDuration);
+	INSTR_TIME_SUBTRACT(batchDuration, batchStart);
+
+	for (valueIndex = 0; valueIndex < valueCount; valueIndex++)
+	{
+		if (rowPartitionIdArray[valueIndex] != batchPartitionIdArray[valueIndex])
+		{
+			ereport(ERROR, (errmsg("value %u is assigned to partition %u one at a "
+								   "time, but to partition %u in batches",
+								   valueIndex, rowPartitionIdArray[valueIndex],
+								   batchPartitionIdArray[valueIndex])));
+		}
+	}
+
+	/* avoid dividing by zero on coarse clocks */
+	rowSeconds = Max(INSTR_TIME_GET_DOUBLE(rowDuration), 1e-9);
+	batchSeconds = Max(INSTR_TIME_GET_DOUBLE(batchDuration), 1e-9);
+
+	resultValues[0] = Float8GetDatum(valueCount / rowSeconds);
+	resultValues[1] = Float8GetDatum(valueCount / batchSeconds);
+
+	tupleDescriptor = BlessTupleDesc(tupleDescriptor);
+	resultTuple = heap_form_tuple(tupleDescriptor, resultValues, resultNulls);
+
+	PG_RETURN_DATUM(HeapTupleGetDatum(resultTuple));
+}
+
+
+/*
+ * BenchmarkValueArray generates the given number of values of the given type,
+ * and sets every NULL_VALUE_INTERVAL'th of them to null.
+ */
+static Datum *
+BenchmarkValueArray(Oid typeId, uint32 valueCount, bool **nullArray)
+{
+	Datum *valueArray = (Datum *) palloc0(valueCount * sizeof(Datum));
+	uint32 valueIndex = 0;
+
+	(*nullArray) = (bool *) palloc0(valueCount * sizeof(bool));
+
+	for (valueIndex = 0; valueIndex < valueCount; valueIndex++)
+	{
+		if (valueIndex % NULL_VALUE_INTERVAL == NULL_VALUE_INTERVAL - 1)
+		{
+			(*nullArray)[valueIndex] = true;
+			continue;
+		}
+
+		switch (typeId)
+		{
+			case INT4OID:
+			{
+				valueArray[valueIndex] = Int32GetDatum((int32) valueIndex * 7919);
+				break;
+			}
+
+			case INT8OID:
+			{
+				int64 value = (int64) valueIndex * INT64CONST(1000000007);
+
+				valueArray[valueIndex] = Int64GetDatum(value);
+				break;
+			}
+
+			case TEXTOID:
+			{
+				char *value = psprintf("value_%u", valueIndex);
+
+				valueArray[valueIndex] = CStringGetTextDatum(value);
+				break;
+			}
+
+			default:
+			{
+				ereport(ERROR, (errmsg("cannot generate values of type %s",
+									   format_type_be(typeId)),
+								errhint("Use int, bigint or text.")));
+			}
+		}
+	}
+
+	return valueArray;
+}
+
+
+/*
+ * UniformHashRangeArray returns the minimum hash values of the given number
+ * of uniformly distributed hash partitions, in the form that
+ * worker_hash_partition_table() receives them.
+ */
+static ArrayType *
+UniformHashRangeArray(uint32 partitionCount)
+{
+	Datum *minValueArray = (Datum *) palloc0(partitionCount * sizeof(Datum));
+	uint64 hashTokenIncrement = HASH_TOKEN_COUNT / partitionCount;
+	uint32 partitionIndex = 0;
+
+	for (partitionIndex = 0; partitionIndex < partitionCount; partitionIndex++)
+	{
+		int64 minValue = INT32_MIN + (int64) (partitionIndex * hashTokenIncrement);
+
+		minValueArray[partitionIndex] = Int32GetDatum((int32) minValue);
+	}
+
+	return construct_array(minValueArray, partitionCount, INT4OID, sizeof(int32),
+						   true, 'i');
+}
@@ -0,0 +1,202 @@
+/*-------------------------------------------------------------------------
+ *
+ * test/src/insert_routing.c
+ *
+ * This file contains functions to benchmark the routing of multi-row
+ * INSERTs to shards.
+ *
+ * Copyright (c) 2019, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "fmgr.h"
+#include "funcapi.h"
+
+#include "access/htup_details.h"
+#include "distributed/errormessage.h"
+#include "distributed/metadata_cache.h"
+#include "distributed/multi_executor.h"
+#include "distributed/multi_physical_planner.h"
+#include "distributed/multi_router_planner.h"
+#include "nodes/pg_list.h"
+#include "parser/parsetree.h"
+#include "portability/instr_time.h"
+#include "utils/builtins.h"
+
+
+static List * TimedInsertTaskList(Query *query, bool batchedRouting,
+								  int32 iterationCount, double *seconds);
+static void ErrorIfTaskListsDiffer(List *rowTaskList, List *batchTaskList);
+
+
+PG_FUNCTION_INFO_V1(benchmark_insert_routing);
+
+
+/*
+ * benchmark_insert_routing routes the rows of the given multi-row INSERT into
+ * a distributed table to shards the given number of times, once by sorting
+ * the rows by shard and once in a single pass with batched insert routing.
+ * The function errors out if the two disagree on the rows of a shard, and
+ * otherwise returns the number of rows per second that each of them routed.
+ */
+Datum
+benchmark_insert_routing(PG_FUNCTION_ARGS)
+{
+	text *queryText = PG_GETARG_TEXT_P(0);
+	int32 iterationCount = PG_GETARG_INT32(1);
+	char *queryString = text_to_cstring(queryText);
+
+	Query *query = NULL;
+	RangeTblEntry *resultRTE = NULL;
+	RangeTblEntry *valuesRTE = NULL;
+	List *rowTaskList = NIL;
+	List *batchTaskList = NIL;
+	double rowCount = 0.0;
+	double rowSeconds = 0.0;
+	double batchSeconds = 0.0;
+
+	TupleDesc tupleDescriptor = NULL;
+	HeapTuple resultTuple = NULL;
+	Datum resultValues[2];
+	bool resultNulls[2] = { false, false };
+
+	if (iterationCount <= 0)
+	{
+		ereport(ERROR, (errmsg("iteration count must be positive")));
+	}
+
+	if (get_call_result_type(fcinfo, NULL, &tupleDescriptor) != TYPEFUNC_COMPOSITE)
+	{
+		ereport(ERROR, (errmsg("return type must be a row type")));
+	}
+
+	query = ParseQueryString(queryString);
+	if (query->commandType != CMD_INSERT || query->resultRelation == 0)
+	{
+		ereport(ERROR, (errmsg("query must be an INSERT")));
+	}
+
+	resultRTE = rt_fetch(query->resultRelation, query->rtable);
+	if (!IsDistributedTable(resultRTE->relid))
+	{
+		ereport(ERROR, (errmsg("query must insert into a distributed table")));
+	}
+
+	valuesRTE = ExtractDistributedInsertValuesRTE(query);
+	if (valuesRTE == NULL)
+	{
+		ereport(ERROR, (errmsg("query must be a multi-row INSERT")));
+	}
+
+	rowCount = (double) list_length(valuesRTE->values_lists) * iterationCount;
+
+	rowTaskList = TimedInsertTaskList(query, false, iterationCount, &rowSeconds);
+	batchTaskList = TimedInsertTaskList(query, true, iterationCount, &batchSeconds);
+
+	ErrorIfTaskListsDiffer(rowTaskList, batchTaskList);
+
+	/* avoid dividing by zero on coarse clocks */
+	rowSeconds = Max(rowSeconds, 1e-9);
+	batchSeconds = Max(batchSeconds, 1e-9);
+
+	resultValues[0] = Float8GetDatum(rowCount / rowSeconds);
+	resultValues[1] = Float8GetDatum(rowCount / batchSeconds);
+
+	tupleDescriptor = BlessTupleDesc(tupleDescriptor);
+	resultTuple = heap_form_tuple(tupleDescriptor, resultValues, resultNulls);
+
+	PG_RETURN_DATUM(HeapTupleGetDatum(resultTuple));
+}
+
+
+/*
+ * TimedInsertTaskList builds the INSERT tasks of the given query the given
+ * number of times, with batched insert routing enabled or disabled, sets
+ * seconds to the time that took, and returns the last task list.
+ */
+static List *
+TimedInsertTaskList(Query *query, bool batchedRouting, int32 iterationCount,
+					double *seconds)
+{
+	bool savedBatchedRouting = EnableBatchedInsertRouting;
+	List *taskList = NIL;
+	int32 iterationIndex = 0;
+	instr_time startTime;
+	instr_time duration;
+
+	EnableBatchedInsertRouting = batchedRouting;
+
+	PG_TRY();
+	{
+		INSTR_TIME_SET_CURRENT(startTime);
+
+		for (iterationIndex = 0; iterationIndex < iterationCount; iterationIndex++)
+		{
+			DeferredErrorMessage *planningError = NULL;
+
+			taskList = RouterInsertTaskList(query, &planningError);
+			if (planningError != NULL)
+			{
+				RaiseDeferredError(planningError, ERROR);
+			}
+		}
+
+		INSTR_TIME_SET_CURRENT(duration);
+		INSTR_TIME_SUBTRACT(duration, startTime);
+	}
+	PG_CATCH();
+	{
+		EnableBatchedInsertRouting = savedBatchedRouting;
+
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	EnableBatchedInsertRouting = savedBatchedRouting;
+
+	(*seconds) = INSTR_TIME_GET_DOUBLE(duration);
+
+	return taskList;
+}
+
+
+/*
+ * ErrorIfTaskListsDiffer errors out if the given INSERT task lists do not
+ * target the same shards in the same order with the same rows.
+ */
+static void
+ErrorIfTaskListsDiffer(List *rowTaskList, List *batchTaskList)
+{
+	ListCell *rowTaskCell = NULL;
+	ListCell *batchTaskCell = NULL;
+
+	if (list_length(rowTaskList) != list_length(batchTaskList))
+	{
+		ereport(ERROR, (errmsg("rows are routed to %d shards one at a time, but to "
+							   "%d shards in batches", list_length(rowTaskList),
+							   list_length(batchTaskList))));
+	}
+
+	forboth(rowTaskCell, rowTaskList, batchTaskCell, batchTaskList)
+	{
+		Task *rowTask = (Task *) lfirst(rowTaskCell);
+		Task *batchTask = (Task *) lfirst(batchTaskCell);
+
+		if (rowTask->anchorShardId != batchTask->anchorShardId)
+		{
+			ereport(ERROR, (errmsg("rows are routed to shard " UINT64_FORMAT " one at "
+								   "a time, but to shard " UINT64_FORMAT " in batches",
+								   rowTask->anchorShardId,
+								   batchTask->anchorShardId)));
+		}
+
+		if (!equal(rowTask->rowValuesLists, batchTask->rowValuesLists))
+		{
+			ereport(ERROR, (errmsg("shard " UINT64_FORMAT " receives different rows "
+								   "one at a time and in batches",
+								   rowTask->anchorShardId)));
+		}
+	}
+}
@@ -0,0 +1,447 @@
+/*-------------------------------------------------------------------------
+ *
+ * test/src/result_decoding.c
+ *
+ * This file contains functions to benchmark decoding the rows of query
+ * results in text format and in binary format, as the adaptive executor does
+ * for the results it receives from the workers.
+ *
+ * Copyright (c) 2019, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include <limits.h>
+
+#include "fmgr.h"
+#include "funcapi.h"
+
+#include "access/htup_details.h"
+#include "distributed/commands/multi_copy.h"
+#include "executor/spi.h"
+#include "portability/instr_time.h"
+#include "utils/builtins.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+
+
+/* text and binary representations of the rows of a query result */
+typedef struct EncodedResult
+{
+	TupleDesc tupleDescriptor;
+	int rowCount;
+	int columnCount;
+	char **textValues;
+	StringInfoData *binaryValues;
+	bool *nulls;
+} EncodedResult;
+
+
+static EncodedResult * EncodeQueryResult(char *queryString);
+static void ErrorIfDecodedRowsDiffer(EncodedResult *encodedResult);
+static double TimedTextDecoding(EncodedResult *encodedResult, int32 iterationCount);
+static double TimedBinaryDecoding(EncodedResult *encodedResult, int32 iterationCount);
+static void InitializeReceiveFunctions(TupleDesc tupleDescriptor,
+									   FmgrInfo *receiveFunctions,
+									   Oid *typeIOParams);
+static HeapTuple BuildTupleFromBinaryValues(EncodedResult *encodedResult,
+											int rowIndex, FmgrInfo *receiveFunctions,
+											Oid *typeIOParams, Datum *columnValues,
+											bool *columnNulls);
+
+
+PG_FUNCTION_INFO_V1(benchmark_result_decoding);
+
+
+/*
+ * benchmark_result_decoding runs the given query, encodes its rows in text
+ * format with the output functions and in binary format with the send
+ * functions of the result columns, and then decodes all the rows the given
+ * number of times in each format. Text rows are decoded with the input
+ * functions and binary rows with the receive functions, like the adaptive
+ * executor does with the results of the workers. The function errors out if
+ * the two formats decode into different values, and otherwise returns the
+ * number of rows per second decoded in each format.
+ */
+Datum
+benchmark_result_decoding(PG_FUNCTION_ARGS)
+{
+	text *queryText = PG_GETARG_TEXT_P(0);
+	int32 iterationCount = PG_GETARG_INT32(1);
+	char *queryString = text_to_cstring(queryText);
+
+	EncodedResult *encodedResult = NULL;
+	double rowCount = 0.0;
+	double textSeconds = 0.0;
+	double binarySeconds = 0.0;
+
+	TupleDesc tupleDescriptor = NULL;
+	HeapTuple resultTuple = NULL;
+	Datum resultValues[2];
+	bool resultNulls[2] = { false, false };
+
+	if (iterationCount <= 0)
+	{
+		ereport(ERROR, (errmsg("iteration count must be positive")));
+	}
+
+	if (get_call_result_type(fcinfo, NULL, &tupleDescriptor) != TYPEFUNC_COMPOSITE)
+	{
+		ereport(ERROR, (errmsg("return type must be a row type")));
+	}
+
+	encodedResult = EncodeQueryResult(queryString);
+
+	/* make sure we time correct decoding */
+	ErrorIfDecodedRowsDiffer(encodedResult);
+
+	textSeconds = TimedTextDecoding(encodedResult, iterationCount);
+	binarySeconds = TimedBinaryDecoding(encodedResult, iterationCount);
+
+	rowCount = (double) encodedResult->rowCount * iterationCount;
+
+	/* avoid dividing by zero on coarse clocks */
+	textSeconds = Max(textSeconds, 1e-9);
+	binarySeconds = Max(binarySeconds, 1e-9);
+
+	resultValues[0] = Float8GetDatum(rowCount / textSeconds);
+	resultValues[1] = Float8GetDatum(rowCount / binarySeconds);
+
+	tupleDescriptor = BlessTupleDesc(tupleDescriptor);
+	resultTuple = heap_form_tuple(tupleDescriptor, resultValues, resultNulls);
+
+	PG_RETURN_DATUM(HeapTupleGetDatum(resultTuple));
+}
+
+
+/*
+ * EncodeQueryResult runs the given query and returns the text and binary
+ * representations of its rows, allocated in the current memory context. The
+ * function errors out if the query returns no rows, or if its result cannot
+ * be sent in binary format.
+ */
+static EncodedResult *
+EncodeQueryResult(char *queryString)
+{
+	EncodedResult *encodedResult = palloc0(sizeof(EncodedResult));
+	MemoryContext callerContext = CurrentMemoryContext;
+	MemoryContext oldContext = NULL;
+	TupleDesc tupleDescriptor = NULL;
+	FmgrInfo *outputFunctions = NULL;
+	FmgrInfo *sendFunctions = NULL;
+	int rowCount = 0;
+	int columnCount = 0;
+	int rowIndex = 0;
+	int columnIndex = 0;
+	int spiResult = 0;
+
+	if (SPI_connect() != SPI_OK_CONNECT)
+	{
+		ereport(ERROR, (errmsg("could not connect to SPI manager")));
+	}
+
+	spiResult = SPI_execute(queryString, true, 0);
+	if (spiResult != SPI_OK_SELECT)
+	{
+		ereport(ERROR, (errmsg("query must be a SELECT")));
+	}
+
+	if (SPI_processed == 0)
+	{
+		ereport(ERROR, (errmsg("query must return rows")));
+	}
+
+	if (SPI_processed > INT_MAX)
+	{
+		ereport(ERROR, (errmsg("query must return fewer than %d rows", INT_MAX)));
+	}
+
+	if (!CanUseBinaryCopyFormat(SPI_tuptable->tupdesc))
+	{
+		ereport(ERROR, (errmsg("query result cannot be sent in binary format")));
+	}
+
+	/* the encoded rows outlive the SPI connection */
+	oldContext = MemoryContextSwitchTo(callerContext);
+
+	tupleDescriptor = CreateTupleDescCopy(SPI_tuptable->tupdesc);
+	rowCount = (int) SPI_processed;
+	columnCount = tupleDescriptor->natts;
+
+	outputFunctions = palloc0(columnCount * sizeof(FmgrInfo));
+	sendFunctions = palloc0(columnCount * sizeof(FmgrInfo));
+
+	for (columnIndex = 0; columnIndex < columnCount; columnIndex++)
+	{
+		Form_pg_attribute attribute = TupleDescAttr(tupleDescriptor, columnIndex);
+		Oid outputFunctionId = InvalidOid;
+		Oid sendFunctionId = InvalidOid;
+		bool typeIsVarlena = false;
+
+		getTypeOutputInfo(attribute->atttypid, &outputFunctionId, &typeIsVarlena);
+		getTypeBinaryOutputInfo(attribute->atttypid, &sendFunctionId, &typeIsVarlena);
+
+		fmgr_info(outputFunctionId, &outputFunctions[columnIndex]);
+		fmgr_info(sendFunctionId, &sendFunctions[columnIndex]);
+	}
+
+	encodedResult->tupleDescriptor = tupleDescriptor;
+	encodedResult->rowCount = rowCount;
+	encodedResult->columnCount = columnCount;
+	encodedResult->textValues = palloc0(rowCount * columnCount * sizeof(char *));
+	encodedResult->binaryValues = palloc0(rowCount * columnCount *
+										  sizeof(StringInfoData));
+	encodedResult->nulls = palloc0(rowCount * columnCount * sizeof(bool));
+
+	for (rowIndex = 0; rowIndex < rowCount; rowIndex++)
+	{
+		HeapTuple heapTuple = SPI_tuptable->vals[rowIndex];
+
+		for (columnIndex = 0; columnIndex < columnCount; columnIndex++)
+		{
+			int valueIndex = rowIndex * columnCount + columnIndex;
+			StringInfo binaryValue = &encodedResult->binaryValues[valueIndex];
+			bool isNull = false;
+			Datum value = heap_getattr(heapTuple, columnIndex + 1, tupleDescriptor,
+									   &isNull);
+			bytea *sentValue = NULL;
+
+			if (isNull)
+			{
+				encodedResult->nulls[valueIndex] = true;
+				continue;
+			}
+
+			encodedResult->textValues[valueIndex] =
+				OutputFunctionCall(&outputFunctions[columnIndex], value);
+
+			sentValue = SendFunctionCall(&sendFunctions[columnIndex], value);
+
+			initStringInfo(binaryValue);
+			appendBinaryStringInfo(binaryValue, VARDATA(sentValue),
+								   VARSIZE(sentValue) - VARHDRSZ);
+		}
+	}
+
+	MemoryContextSwitchTo(oldContext);
+
+	SPI_finish();
+
+	return encodedResult;
+}
+
+
+/*
+ * ErrorIfDecodedRowsDiffer decodes each row in text and in binary format, and
+ * errors out if the text representations of the decoded values differ.
+ */
+static void
+ErrorIfDecodedRowsDiffer(EncodedResult *encodedResult)
+{
+	TupleDesc tupleDescriptor = encodedResult->tupleDescriptor;
+	int columnCount = encodedResult->columnCount;
+	AttInMetadata *attributeInputMetadata = TupleDescGetAttInMetadata(tupleDescriptor);
+	FmgrInfo *receiveFunctions = palloc0(columnCount * sizeof(FmgrInfo));
+	Oid *typeIOParams = palloc0(columnCount * sizeof(Oid));
+	Datum *columnValues = palloc0(columnCount * sizeof(Datum));
+	bool *columnNulls = palloc0(columnCount * sizeof(bool));
+	int rowIndex = 0;
+
+	InitializeReceiveFunctions(tupleDescriptor, receiveFunctions, typeIOParams);
+
+	for (rowIndex = 0; rowIndex < encodedResult->rowCount; rowIndex++)
+	{
+		char **textRow = &encodedResult->textValues[rowIndex * columnCount];
+		HeapTuple textTuple = BuildTupleFromCStrings(attributeInputMetadata, textRow);
+		HeapTuple binaryTuple = BuildTupleFromBinaryValues(encodedResult, rowIndex,
+														   receiveFunctions,
+														   typeIOParams,
+														   columnValues,
+														   columnNulls);
+		int columnIndex = 0;
+
+		for (columnIndex = 0; columnIndex < columnCount; columnIndex++)
+		{
+			char *textValue = SPI_getvalue(textTuple, tupleDescriptor,
+										   columnIndex + 1);
+			char *binaryValue = SPI_getvalue(binaryTuple, tupleDescriptor,
+											 columnIndex + 1);
+
+			if ((textValue == NULL) != (binaryValue == NULL) ||
+				(textValue != NULL && strcmp(textValue, binaryValue) != 0))
+			{
+				ereport(ERROR, (errmsg("column %d of row %d decodes into %s in text "
+									   "format and into %s in binary format",
+									   columnIndex + 1, rowIndex + 1,
+									   textValue ? textValue : "NULL",
+									   binaryValue ? binaryValue : "NULL")));
+			}
+		}
+	}
+}
+
+
+/*
+ * TimedTextDecoding decodes the text representations of all the rows the given
+ * number of times with the input functions of the columns, and returns the
+ * number of seconds that took.
+ */
+static double
+TimedTextDecoding(EncodedResult *encodedResult, int32 iterationCount)
+{
+	int columnCount = encodedResult->columnCount;
+	AttInMetadata *attributeInputMetadata =
+		TupleDescGetAttInMetadata(encodedResult->tupleDescriptor);
+	MemoryContext decodingContext = AllocSetContextCreate(CurrentMemoryContext,
+														  "TextDecodingContext",
+														  ALLOCSET_DEFAULT_MINSIZE,
+														  ALLOCSET_DEFAULT_INITSIZE,
+														  ALLOCSET_DEFAULT_MAXSIZE);
+	MemoryContext oldContext = MemoryContextSwitchTo(decodingContext);
+	int32 iterationIndex = 0;
+	int rowIndex = 0;
+	instr_time startTime;
+	instr_time duration;
+
+	INSTR_TIME_SET_CURRENT(startTime);
+
+	for (iterationIndex = 0; iterationIndex < iterationCount; iterationIndex++)
+	{
+		for (rowIndex = 0; rowIndex < encodedResult->rowCount; rowIndex++)
+		{
+			char **textRow = &encodedResult->textValues[rowIndex * columnCount];
+
+			BuildTupleFromCStrings(attributeInputMetadata, textRow);
+			MemoryContextReset(decodingContext);
+		}
+	}
+
+	INSTR_TIME_SET_CURRENT(duration);
+	INSTR_TIME_SUBTRACT(duration, startTime);
+
+	MemoryContextSwitchTo(oldContext);
+	MemoryContextDelete(decodingContext);
+
+	return INSTR_TIME_GET_DOUBLE(duration);
+}
+
+
+/*
+ * TimedBinaryDecoding decodes the binary representations of all the rows the
+ * given number of times with the receive functions of the columns, and returns
+ * the number of seconds that took.
+ */
+static double
+TimedBinaryDecoding(EncodedResult *encodedResult, int32 iterationCount)
+{
+	int columnCount = encodedResult->columnCount;
+	FmgrInfo *receiveFunctions = palloc0(columnCount * sizeof(FmgrInfo));
+	Oid *typeIOParams = palloc0(columnCount * sizeof(Oid));
+	Datum *columnValues = palloc0(columnCount * sizeof(Datum));
+	bool *columnNulls = palloc0(columnCount * sizeof(bool));
+	MemoryContext decodingContext = AllocSetContextCreate(CurrentMemoryContext,
+														  "BinaryDecodingContext",
+														  ALLOCSET_DEFAULT_MINSIZE,
+														  ALLOCSET_DEFAULT_INITSIZE,
+														  ALLOCSET_DEFAULT_MAXSIZE);
+	MemoryContext oldContext = NULL;
+	int32 iterationIndex = 0;
+	int rowIndex = 0;
+	instr_time startTime;
+	instr_time duration;
+
+	InitializeReceiveFunctions(encodedResult->tupleDescriptor, receiveFunctions,
+							   typeIOParams);
+
+	oldContext = MemoryContextSwitchTo(decodingContext);
+
+	INSTR_TIME_SET_CURRENT(startTime);
+
+	for (iterationIndex = 0; iterationIndex < iterationCount; iterationIndex++)
+	{
+		for (rowIndex = 0; rowIndex < encodedResult->rowCount; rowIndex++)
+		{
+			BuildTupleFromBinaryValues(encodedResult, rowIndex, receiveFunctions,
+									   typeIOParams, columnValues, columnNulls);
+			MemoryContextReset(decodingContext);
+		}
+	}
+
+	INSTR_TIME_SET_CURRENT(duration);
+	INSTR_TIME_SUBTRACT(duration, startTime);
+
+	MemoryContextSwitchTo(oldContext);
+	MemoryContextDelete(decodingContext);
+
+	return INSTR_TIME_GET_DOUBLE(duration);
+}
+
+
+/*
+ * InitializeReceiveFunctions looks up the receive functions of the columns of
+ * the given tuple descriptor and the type parameters to pass to them.
+ */
+static void
+InitializeReceiveFunctions(TupleDesc tupleDescriptor, FmgrInfo *receiveFunctions,
+						   Oid *typeIOParams)
+{
+	int columnIndex = 0;
+
+	for (columnIndex = 0; columnIndex < tupleDescriptor->natts; columnIndex++)
+	{
+		Form_pg_attribute attribute = TupleDescAttr(tupleDescriptor, columnIndex);
+		Oid receiveFunctionId = InvalidOid;
+
+		getTypeBinaryInputInfo(attribute->atttypid, &receiveFunctionId,
+							   &typeIOParams[columnIndex]);
+		fmgr_info(receiveFunctionId, &receiveFunctions[columnIndex]);
+	}
+}
+
+
+/*
+ * BuildTupleFromBinaryValues decodes the binary representation of the given
+ * row with the given receive functions into columnValues and columnNulls, the
+ * same way the adaptive executor decodes binary results, and returns a tuple
+ * built from them.
+ */
+static HeapTuple
+BuildTupleFromBinaryValues(EncodedResult *encodedResult, int rowIndex,
+						   FmgrInfo *receiveFunctions, Oid *typeIOParams,
+						   Datum *columnValues, bool *columnNulls)
+{
+	TupleDesc tupleDescriptor = encodedResult->tupleDescriptor;
+	int columnCount = encodedResult->columnCount;
+	int columnIndex = 0;
+
+	for (columnIndex = 0; columnIndex < columnCount; columnIndex++)
+	{
+		Form_pg_attribute attribute = TupleDescAttr(tupleDescriptor, columnIndex);
+		FmgrInfo *receiveFunction = &receiveFunctions[columnIndex];
+		Oid typeIOParam = typeIOParams[columnIndex];
+		int32 typeMod = attribute->atttypmod;
+		int valueIndex = rowIndex * columnCount + columnIndex;
+		StringInfo binaryValue = &encodedResult->binaryValues[valueIndex];
+		StringInfoData columnBuffer;
+
+		if (encodedResult->nulls[valueIndex])
+		{
+			columnValues[columnIndex] = ReceiveFunctionCall(receiveFunction, NULL,
+															typeIOParam, typeMod);
+			columnNulls[columnIndex] = true;
+			continue;
+		}
+
+		/* receive functions advance the cursor, so read from a copy */
+		columnBuffer = *binaryValue;
+		columnBuffer.cursor = 0;
+
+		columnValues[columnIndex] = ReceiveFunctionCall(receiveFunction, &columnBuffer,
+														typeIOParam, typeMod);
+		columnNulls[columnIndex] = false;
+	}
+
+	return heap_form_tuple(tupleDescriptor, columnValues, columnNulls);
+}
@@ -0,0 +1,168 @@
+/*-------------------------------------------------------------------------
+ *
+ * test/src/shard_interval_lookup.c
+ *
+ * This file contains functions to benchmark finding the shard of a hash
+ * value in the shards of a hash distributed table.
+ *
+ * Copyright (c) 2019, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "fmgr.h"
+#include "funcapi.h"
+
+#include "access/htup_details.h"
+#include "distributed/metadata_cache.h"
+#include "distributed/shardinterval_utils.h"
+#include "portability/instr_time.h"
+
+
+/* number of different hash values that are looked up in each iteration */
+#define LOOKUP_VALUE_COUNT 1024
+
+
+static int32 * ShardHashValueArray(DistTableCacheEntry *cacheEntry,
+								   int *expectedShardIndexArray);
+
+
+PG_FUNCTION_INFO_V1(benchmark_find_shard_interval_index);
+
+
+/*
+ * benchmark_find_shard_interval_index looks up hash values that fall into the
+ * shards of the given hash distributed table with FindShardIntervalIndex()
+ * the given number of times. The function errors out if a hash value is not
+ * found in the shard that contains it, and otherwise returns whether the
+ * table has a uniform hash distribution along with the number of lookups per
+ * second.
+ */
+Datum
+benchmark_find_shard_interval_index(PG_FUNCTION_ARGS)
+{
+	Oid distributedTableId = PG_GETARG_OID(0);
+	int32 iterationCount = PG_GETARG_INT32(1);
+
+	DistTableCacheEntry *cacheEntry = NULL;
+	int32 *hashValueArray = NULL;
+	int *expectedShardIndexArray = NULL;
+	int32 iterationIndex = 0;
+	int valueIndex = 0;
+	double lookupCount = 0.0;
+	double seconds = 0.0;
+	instr_time startTime;
+	instr_time duration;
+
+	TupleDesc tupleDescriptor = NULL;
+	HeapTuple resultTuple = NULL;
+	Datum resultValues[2];
+	bool resultNulls[2] = { false, false };
+
+	if (iterationCount <= 0)
+	{
+		ereport(ERROR, (errmsg("iteration count must be positive")));
+	}
+
+	if (get_call_result_type(fcinfo, NULL, &tupleDescriptor) != TYPEFUNC_COMPOSITE)
+	{
+		ereport(ERROR, (errmsg("return type must be a row type")));
+	}
+
+	cacheEntry = DistributedTableCacheEntry(distributedTableId);
+	if (cacheEntry->partitionMethod != DISTRIBUTE_BY_HASH)
+	{
+		ereport(ERROR, (errmsg("table must be distributed by hash")));
+	}
+
+	if (cacheEntry->shardIntervalArrayLength == 0)
+	{
+		ereport(ERROR, (errmsg("table must have shards")));
+	}
+
+	expectedShardIndexArray = palloc0(LOOKUP_VALUE_COUNT * sizeof(int));
+	hashValueArray = ShardHashValueArray(cacheEntry, expectedShardIndexArray);
+
+	/* make sure we time correct lookups */
+	for (valueIndex = 0; valueIndex < LOOKUP_VALUE_COUNT; valueIndex++)
+	{
+		Datum hashValue = Int32GetDatum(hashValueArray[valueIndex]);
+		int shardIndex = FindShardIntervalIndex(hashValue, cacheEntry);
+
+		if (shardIndex != expectedShardIndexArray[valueIndex])
+		{
+			ereport(ERROR, (errmsg("hash value %d is found in shard index %d instead "
+								   "of %d", hashValueArray[valueIndex], shardIndex,
+								   expectedShardIndexArray[valueIndex])));
+		}
+	}
+
+	INSTR_TIME_SET_CURRENT(startTime);
+
+	for (iterationIndex = 0; iterationIndex < iterationCount; iterationIndex++)
+	{
+		for (valueIndex = 0; valueIndex < LOOKUP_VALUE_COUNT; valueIndex++)
+		{
+			FindShardIntervalIndex(Int32GetDatum(hashValueArray[valueIndex]),
+								   cacheEntry);
+		}
+	}
+
+	INSTR_TIME_SET_CURRENT(duration);
+	INSTR_TIME_SUBTRACT(duration, startTime);
+
+	lookupCount = (double) LOOKUP_VALUE_COUNT * iterationCount;
+
+	/* avoid dividing by zero on coarse clocks */
+	seconds = Max(INSTR_TIME_GET_DOUBLE(duration), 1e-9);
+
+	resultValues[0] = BoolGetDatum(cacheEntry->hasUniformHashDistribution);
+	resultValues[1] = Float8GetDatum(lookupCount / seconds);
+
+	tupleDescriptor = BlessTupleDesc(tupleDescriptor);
+	resultTuple = heap_form_tuple(tupleDescriptor, resultValues, resultNulls);
+
+	PG_RETURN_DATUM(HeapTupleGetDatum(resultTuple));
+}
+
+
+/*
+ * ShardHashValueArray returns LOOKUP_VALUE_COUNT hash values that are spread
+ * over the shards of the given hash distributed table in turn, and sets the
+ * index of the shard that contains each of them in expectedShardIndexArray.
+ */
+static int32 *
+ShardHashValueArray(DistTableCacheEntry *cacheEntry, int *expectedShardIndexArray)
+{
+	int shardCount = cacheEntry->shardIntervalArrayLength;
+	int32 *hashValueArray = palloc0(LOOKUP_VALUE_COUNT * sizeof(int32));
+	int valueIndex = 0;
+
+	for (valueIndex = 0; valueIndex < LOOKUP_VALUE_COUNT; valueIndex++)
+	{
+		int shardIndex = valueIndex % shardCount;
+		ShardInterval *shardInterval = cacheEntry->sortedShardIntervalArray[shardIndex];
+		int64 minValue = 0;
+		int64 maxValue = 0;
+		uint64 offset = 0;
+
+		if (!shardInterval->minValueExists || !shardInterval->maxValueExists)
+		{
+			ereport(ERROR, (errmsg("shard " UINT64_FORMAT " has no min/max values",
+								   shardInterval->shardId)));
+		}
+
+		minValue = DatumGetInt32(shardInterval->minValue);
+		maxValue = DatumGetInt32(shardInterval->maxValue);
+
+		/* scatter the values over the hash range of the shard */
+		offset = ((uint64) valueIndex * 2654435761U) %
+				 (uint64) (maxValue - minValue + 1);
+
+		hashValueArray[valueIndex] = (int32) (minValue + (int64) offset);
+		expectedShardIndexArray[valueIndex] = shardIndex;
+	}
+
+	return hashValueArray;
+}
@@ -23,9 +23,12 @@
 #include "distributed/connection_management.h"
 #include "distributed/hash_helpers.h"
 #include "distributed/intermediate_results.h"
+#include "distributed/local_executor.h"
 #include "distributed/multi_shard_transaction.h"
 #include "distributed/transaction_management.h"
 #include "distributed/placement_connection.h"
+#include "distributed/relation_access_tracking.h"
+#include "distributed/repartition_join_execution.h"
 #include "distributed/subplan_execution.h"
 #include "distributed/version_compat.h"
 #include "utils/hsearch.h"
@@ -222,12 +225,18 @@ CoordinatedTransactionCallback(XactEvent event, void *arg)
 				ResetPlacementConnectionManagement();
 				AfterXactConnectionHandling(true);
 			}
+			else if (LocalExecutionHappened)
+			{
+				/* local execution records relation accesses without connections */
+				ResetRelationAccessHash();
+			}
 
 			CurrentCoordinatedTransactionState = COORD_TRANS_NONE;
 			XactModificationLevel = XACT_MODIFICATION_NONE;
 			dlist_init(&InProgressTransactions);
 			activeSetStmts = NULL;
 			CoordinatedTransactionUses2PC = false;
+			LocalExecutionHappened = false;
 
 			UnSetDistributedTransactionId();
 
@@ -261,6 +270,10 @@ CoordinatedTransactionCallback(XactEvent event, void *arg)
 				AtEOXact_Files(false);
 				SwallowErrors(RemoveIntermediateResultsDirectory);
 			}
+
+			/* remove the results of repartition joins that did not finish */
+			SwallowErrors(CleanupPendingRepartitionJobs);
+
 			ResetShardPlacementTransactionState();
 
 			/* handles both already prepared and open transactions */
@@ -275,6 +288,11 @@ CoordinatedTransactionCallback(XactEvent event, void *arg)
 				ResetPlacementConnectionManagement();
 				AfterXactConnectionHandling(false);
 			}
+			else if (LocalExecutionHappened)
+			{
+				/* local execution records relation accesses without connections */
+				ResetRelationAccessHash();
+			}
 
 			CurrentCoordinatedTransactionState = COORD_TRANS_NONE;
 			XactModificationLevel = XACT_MODIFICATION_NONE;
@@ -282,6 +300,7 @@ CoordinatedTransactionCallback(XactEvent event, void *arg)
 			activeSetStmts = NULL;
 			CoordinatedTransactionUses2PC = false;
 			FunctionCallLevel = 0;
+			LocalExecutionHappened = false;
 
 			/*
 			 * We should reset SubPlanLevel in case a transaction is aborted,
@@ -333,6 +352,12 @@ CoordinatedTransactionCallback(XactEvent event, void *arg)
 			 */
 			RemoveIntermediateResultsDirectory();
 
+			/*
+			 * Repartition joins that failed within a subtransaction did not
+			 * remove their results.
+			 */
+			CleanupPendingRepartitionJobs();
+
 			/* nothing further to do if there's no managed remote xacts */
 			if (CurrentCoordinatedTransactionState == COORD_TRANS_NONE)
 			{
@@ -390,6 +415,8 @@ CoordinatedTransactionCallback(XactEvent event, void *arg)
 		case XACT_EVENT_PARALLEL_PRE_COMMIT:
 		case XACT_EVENT_PRE_PREPARE:
 		{
+			CleanupPendingRepartitionJobs();
+
 			if (CurrentCoordinatedTransactionState > COORD_TRANS_NONE)
 			{
 				ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
@@ -212,7 +212,7 @@ SendCommandToWorkersParams(TargetWorkerSet targetWorkerSet, char *command,
 		MultiConnection *connection = (MultiConnection *) lfirst(connectionCell);
 
 		int querySent = SendRemoteCommandParams(connection, command, parameterCount,
-												parameterTypes, parameterValues);
+												parameterTypes, parameterValues, false);
 		if (querySent == 0)
 		{
 			ReportConnectionError(connection, ERROR);
@@ -476,6 +476,7 @@ OutTask(OUTFUNC_ARGS)
 	WRITE_NODE_FIELD(relationShardList);
 	WRITE_NODE_FIELD(relationRowLockList);
 	WRITE_NODE_FIELD(rowValuesLists);
+	WRITE_BOOL_FIELD(partiallyLocalOrRemote);
 }
 
 
@@ -392,6 +392,7 @@ ReadTask(READFUNC_ARGS)
 	READ_NODE_FIELD(relationShardList);
 	READ_NODE_FIELD(relationRowLockList);
 	READ_NODE_FIELD(rowValuesLists);
+	READ_BOOL_FIELD(partiallyLocalOrRemote);
 
 	READ_DONE();
 }
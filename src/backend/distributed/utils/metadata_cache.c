@@ -20,6 +20,7 @@
 #include "access/sysattr.h"
 #include "catalog/indexing.h"
 #include "catalog/pg_am.h"
+#include "catalog/pg_collation.h"
 #include "catalog/pg_enum.h"
 #include "catalog/pg_extension.h"
 #include "catalog/pg_namespace.h"
@@ -31,6 +32,7 @@
 #include "distributed/colocation_utils.h"
 #include "distributed/connection_management.h"
 #include "distributed/citus_ruleutils.h"
+#include "distributed/fast_path_plan_cache.h"
 #include "distributed/function_utils.h"
 #include "distributed/foreign_key_relationship.h"
 #include "distributed/master_metadata_utility.h"
@@ -42,8 +44,11 @@
 #include "distributed/pg_dist_partition.h"
 #include "distributed/pg_dist_shard.h"
 #include "distributed/pg_dist_placement.h"
+#include "distributed/shard_cache_invalidation.h"
 #include "distributed/shared_library_init.h"
+#include "distributed/shared_metadata_cache.h"
 #include "distributed/shardinterval_utils.h"
+#include "distributed/statement_cache.h"
 #include "distributed/version_compat.h"
 #include "distributed/worker_manager.h"
 #include "distributed/worker_protocol.h"
@@ -179,7 +184,13 @@ static bool IsDistributedTableViaCatalog(Oid relationId);
 static ShardCacheEntry * LookupShardCacheEntry(int64 shardId);
 static DistTableCacheEntry * LookupDistTableCacheEntry(Oid relationId);
 static void BuildDistTableCacheEntry(DistTableCacheEntry *cacheEntry);
+static bool RefreshDistTableCacheEntry(DistTableCacheEntry *cacheEntry);
 static void BuildCachedShardList(DistTableCacheEntry *cacheEntry);
+static int32 * BuildShardMinHashValueArray(ShardInterval **sortedShardIntervalArray,
+										   int shardCount);
+static int * BuildRunningMaxShardIndexArray(ShardInterval **sortedShardIntervalArray,
+											int shardCount,
+											FmgrInfo *shardIntervalCompareFunction);
 static ShardInterval ** SortShardIntervalArray(ShardInterval **shardIntervalArray,
 											   int shardCount,
 											   FmgrInfo *
@@ -211,15 +222,22 @@ static List * LookupDistShardTuples(Oid relationId);
 static void GetPartitionTypeInputInfo(char *partitionKeyString, char partitionMethod,
 									  Oid *columnTypeId, int32 *columnTypeMod,
 									  Oid *intervalTypeId, int32 *intervalTypeMod);
-static ShardInterval * TupleToShardInterval(HeapTuple heapTuple,
-											TupleDesc tupleDescriptor, Oid intervalTypeId,
-											int32 intervalTypeMod);
+static CachedShardRow * LoadCachedShardRows(Oid relationId, int *shardCount,
+											 uint64 *invalidationSequence);
+static CachedShardRow * BuildCachedShardRows(Oid relationId, int *shardCount);
+static void TupleToCachedShardRow(HeapTuple heapTuple, TupleDesc tupleDescriptor,
+								  CachedShardRow *shardRow);
+static ShardInterval * CachedShardRowToShardInterval(Oid relationId,
+													 CachedShardRow *shardRow,
+													 Oid intervalTypeId,
+													 int32 intervalTypeMod);
 static void CachedRelationLookup(const char *relationName, Oid *cachedOid);
 static ShardPlacement * ResolveGroupShardPlacement(
 	GroupShardPlacement *groupShardPlacement, ShardCacheEntry *shardEntry);
 static WorkerNode * LookupNodeForGroup(int32 groupId);
 static Oid LookupEnumValueId(Oid typeId, char *valueName);
 static void InvalidateEntireDistCache(void);
+static void InvalidateRelcacheByRelid(Oid relationId);
 
 
 /* exports for SQL callable functions */
@@ -863,6 +881,13 @@ LookupDistTableCacheEntry(Oid relationId)
 			return cacheEntry;
 		}
 
+		/* reload only the placements that changed, if that is all that changed */
+		if (cacheEntry->shardsRefreshable && RefreshDistTableCacheEntry(cacheEntry))
+		{
+			cacheEntry->isValid = true;
+			return cacheEntry;
+		}
+
 		/* free the content of old, invalid, entries */
 		ResetDistTableCacheEntry(cacheEntry);
 	}
@@ -884,6 +909,7 @@ LookupDistTableCacheEntry(Oid relationId)
 
 	/* and finally mark as valid */
 	cacheEntry->isValid = true;
+	cacheEntry->shardsRefreshable = cacheEntry->isDistributedTable;
 
 	RESUME_INTERRUPTS();
 
@@ -907,6 +933,15 @@ BuildDistTableCacheEntry(DistTableCacheEntry *cacheEntry)
 	bool partitionKeyIsNull = false;
 	Datum datumArray[Natts_pg_dist_partition];
 	bool isNullArray[Natts_pg_dist_partition];
+	List *shardIdList = NIL;
+
+	/*
+	 * Find out up to which shard-level invalidation the entry will be up to
+	 * date before reading the catalogs, later invalidations are applied by
+	 * RefreshDistTableCacheEntry().
+	 */
+	ReadShardCacheInvalidations(cacheEntry->relationId,
+								&cacheEntry->shardInvalidationSequence, &shardIdList);
 
 	pgDistPartition = heap_open(DistPartitionRelationId(), AccessShareLock);
 	distPartitionTuple =
@@ -998,6 +1033,10 @@ BuildDistTableCacheEntry(DistTableCacheEntry *cacheEntry)
 		cacheEntry->hasUniformHashDistribution =
 			HasUniformHashDistribution(cacheEntry->sortedShardIntervalArray,
 									   cacheEntry->shardIntervalArrayLength);
+
+		cacheEntry->sortedShardMinHashValueArray =
+			BuildShardMinHashValueArray(cacheEntry->sortedShardIntervalArray,
+										cacheEntry->shardIntervalArrayLength);
 	}
 	else
 	{
@@ -1017,6 +1056,91 @@ BuildDistTableCacheEntry(DistTableCacheEntry *cacheEntry)
 }
 
 
+/*
+ * RefreshDistTableCacheEntry brings an invalid cache entry of a distributed
+ * table up to date by reloading the placements of the shards that changed
+ * since the entry was built or last refreshed. The function returns false
+ * without changing the entry if it needs to be rebuilt instead, that is if
+ * more than the placements of its shards changed.
+ */
+static bool
+RefreshDistTableCacheEntry(DistTableCacheEntry *cacheEntry)
+{
+	uint64 invalidationSequence = cacheEntry->shardInvalidationSequence;
+	List *shardIdList = NIL;
+	ListCell *shardIdCell = NULL;
+
+	if (!ReadShardCacheInvalidations(cacheEntry->relationId, &invalidationSequence,
+									 &shardIdList))
+	{
+		return false;
+	}
+
+	/* make sure we know all shards before changing any of them */
+	foreach(shardIdCell, shardIdList)
+	{
+		uint64 shardId = *((uint64 *) lfirst(shardIdCell));
+		ShardCacheEntry *shardEntry = NULL;
+		bool foundInCache = false;
+
+		shardEntry = hash_search(DistShardCacheHash, &shardId, HASH_FIND,
+								 &foundInCache);
+		if (!foundInCache || shardEntry->tableEntry != cacheEntry)
+		{
+			return false;
+		}
+	}
+
+	HOLD_INTERRUPTS();
+
+	foreach(shardIdCell, shardIdList)
+	{
+		uint64 shardId = *((uint64 *) lfirst(shardIdCell));
+		ShardCacheEntry *shardEntry = NULL;
+		bool foundInCache = false;
+		List *placementList = NIL;
+		ListCell *placementCell = NULL;
+		GroupShardPlacement *placementArray = NULL;
+		int placementOffset = 0;
+		int numberOfPlacements = 0;
+		int shardIndex = 0;
+
+		shardEntry = hash_search(DistShardCacheHash, &shardId, HASH_FIND,
+								 &foundInCache);
+		shardIndex = shardEntry->shardIndex;
+
+		placementList = BuildShardPlacementList(shardId);
+		numberOfPlacements = list_length(placementList);
+
+		placementArray = MemoryContextAllocZero(MetadataCacheMemoryContext,
+												numberOfPlacements *
+												sizeof(GroupShardPlacement));
+		foreach(placementCell, placementList)
+		{
+			GroupShardPlacement *srcPlacement =
+				(GroupShardPlacement *) lfirst(placementCell);
+
+			placementArray[placementOffset] = *srcPlacement;
+			placementOffset++;
+		}
+
+		if (cacheEntry->arrayOfPlacementArrays[shardIndex] != NULL)
+		{
+			pfree(cacheEntry->arrayOfPlacementArrays[shardIndex]);
+		}
+
+		cacheEntry->arrayOfPlacementArrays[shardIndex] = placementArray;
+		cacheEntry->arrayOfPlacementArrayLengths[shardIndex] = numberOfPlacements;
+	}
+
+	cacheEntry->shardInvalidationSequence = invalidationSequence;
+
+	RESUME_INTERRUPTS();
+
+	return true;
+}
+
+
 /*
  * BuildCachedShardList() is a helper routine for BuildDistTableCacheEntry()
  * building up the list of shards in a distributed relation.
@@ -1028,7 +1152,7 @@ BuildCachedShardList(DistTableCacheEntry *cacheEntry)
 	ShardInterval **sortedShardIntervalArray = NULL;
 	FmgrInfo *shardIntervalCompareFunction = NULL;
 	FmgrInfo *shardColumnCompareFunction = NULL;
-	List *distShardTupleList = NIL;
+	CachedShardRow *shardRowArray = NULL;
 	int shardIntervalArrayLength = 0;
 	int shardIndex = 0;
 	Oid columnTypeId = InvalidOid;
@@ -1043,13 +1167,11 @@ BuildCachedShardList(DistTableCacheEntry *cacheEntry)
 							  &intervalTypeId,
 							  &intervalTypeMod);
 
-	distShardTupleList = LookupDistShardTuples(cacheEntry->relationId);
-	shardIntervalArrayLength = list_length(distShardTupleList);
+	shardRowArray = LoadCachedShardRows(cacheEntry->relationId,
+										&shardIntervalArrayLength,
+										&cacheEntry->shardInvalidationSequence);
 	if (shardIntervalArrayLength > 0)
 	{
-		Relation distShardRelation = heap_open(DistShardRelationId(), AccessShareLock);
-		TupleDesc distShardTupleDesc = RelationGetDescr(distShardRelation);
-		ListCell *distShardTupleCell = NULL;
 		int arrayIndex = 0;
 
 		shardIntervalArray = MemoryContextAllocZero(MetadataCacheMemoryContext,
@@ -1065,28 +1187,24 @@ BuildCachedShardList(DistTableCacheEntry *cacheEntry)
 								   shardIntervalArrayLength *
 								   sizeof(int));
 
-		foreach(distShardTupleCell, distShardTupleList)
+		for (arrayIndex = 0; arrayIndex < shardIntervalArrayLength; arrayIndex++)
 		{
-			HeapTuple shardTuple = lfirst(distShardTupleCell);
-			ShardInterval *shardInterval = TupleToShardInterval(shardTuple,
-																distShardTupleDesc,
-																intervalTypeId,
-																intervalTypeMod);
+			ShardInterval *shardInterval =
+				CachedShardRowToShardInterval(cacheEntry->relationId,
+											  &shardRowArray[arrayIndex],
+											  intervalTypeId, intervalTypeMod);
 			ShardInterval *newShardInterval = NULL;
 			MemoryContext oldContext = MemoryContextSwitchTo(MetadataCacheMemoryContext);
 
 			newShardInterval = (ShardInterval *) palloc0(sizeof(ShardInterval));
 			CopyShardInterval(shardInterval, newShardInterval);
+
+			/* remember the row of the shard until the intervals are sorted */
+			newShardInterval->shardIndex = arrayIndex;
 			shardIntervalArray[arrayIndex] = newShardInterval;
 
 			MemoryContextSwitchTo(oldContext);
-
-			heap_freetuple(shardTuple);
-
-			arrayIndex++;
 		}
-
-		heap_close(distShardRelation, AccessShareLock);
 	}
 
 	/* look up value comparison function */
@@ -1181,6 +1299,16 @@ BuildCachedShardList(DistTableCacheEntry *cacheEntry)
 		{
 			ereport(ERROR, (errmsg("hash partitioned table has overlapping shards")));
 		}
+
+		/* allow pruning overlapping shards without checking each of them */
+		if (cacheEntry->hasOverlappingShardInterval &&
+			!cacheEntry->hasUninitializedShardInterval)
+		{
+			cacheEntry->runningMaxShardIndexArray =
+				BuildRunningMaxShardIndexArray(sortedShardIntervalArray,
+											   shardIntervalArrayLength,
+											   shardIntervalCompareFunction);
+		}
 	}
 
 	/*
@@ -1224,8 +1352,8 @@ BuildCachedShardList(DistTableCacheEntry *cacheEntry)
 		shardEntry->shardIndex = shardIndex;
 		shardEntry->tableEntry = cacheEntry;
 
-		/* build list of shard placements */
-		placementList = BuildShardPlacementList(shardInterval);
+		/* get the list of shard placements from the row of the shard */
+		placementList = shardRowArray[shardInterval->shardIndex].placementList;
 		numberOfPlacements = list_length(placementList);
 
 		/* and copy that list into the cache entry */
@@ -1253,6 +1381,83 @@ BuildCachedShardList(DistTableCacheEntry *cacheEntry)
 }
 
 
+/*
+ * BuildShardMinHashValueArray returns an array of the minimum hash values of
+ * the given sorted shard intervals of a hash distributed table, allocated in
+ * the metadata cache context.
+ */
+static int32 *
+BuildShardMinHashValueArray(ShardInterval **sortedShardIntervalArray, int shardCount)
+{
+	int32 *minHashValueArray = NULL;
+	int shardIndex = 0;
+
+	if (shardCount == 0)
+	{
+		return NULL;
+	}
+
+	minHashValueArray = MemoryContextAllocZero(MetadataCacheMemoryContext,
+											   shardCount * sizeof(int32));
+
+	for (shardIndex = 0; shardIndex < shardCount; shardIndex++)
+	{
+		ShardInterval *shardInterval = sortedShardIntervalArray[shardIndex];
+
+		minHashValueArray[shardIndex] = DatumGetInt32(shardInterval->minValue);
+	}
+
+	return minHashValueArray;
+}
+
+
+/*
+ * BuildRunningMaxShardIndexArray returns an array that holds, for each of the
+ * given shard intervals sorted by minimum value, the index of the interval
+ * with the largest maximum value up to that position. The array is allocated
+ * in the metadata cache context. All intervals need to have min/max values.
+ */
+static int *
+BuildRunningMaxShardIndexArray(ShardInterval **sortedShardIntervalArray, int shardCount,
+							   FmgrInfo *shardIntervalCompareFunction)
+{
+	int *runningMaxShardIndexArray = NULL;
+	int runningMaxShardIndex = 0;
+	int shardIndex = 0;
+
+	if (shardCount == 0)
+	{
+		return NULL;
+	}
+
+	runningMaxShardIndexArray = MemoryContextAllocZero(MetadataCacheMemoryContext,
+													   shardCount * sizeof(int));
+
+	for (shardIndex = 0; shardIndex < shardCount; shardIndex++)
+	{
+		ShardInterval *shardInterval = sortedShardIntervalArray[shardIndex];
+		ShardInterval *runningMaxInterval =
+			sortedShardIntervalArray[runningMaxShardIndex];
+		Datum comparisonDatum = 0;
+
+		Assert(shardInterval->minValueExists && shardInterval->maxValueExists);
+
+		comparisonDatum = FunctionCall2Coll(shardIntervalCompareFunction,
+											DEFAULT_COLLATION_OID,
+											shardInterval->maxValue,
+											runningMaxInterval->maxValue);
+		if (DatumGetInt32(comparisonDatum) > 0)
+		{
+			runningMaxShardIndex = shardIndex;
+		}
+
+		runningMaxShardIndexArray[shardIndex] = runningMaxShardIndex;
+	}
+
+	return runningMaxShardIndexArray;
+}
+
+
 /*
  * SortedShardIntervalArray sorts the input shardIntervalArray. Shard intervals with
  * no min/max values are placed at the end of the array.
@@ -3008,6 +3213,18 @@ ResetDistTableCacheEntry(DistTableCacheEntry *cacheEntry)
 		cacheEntry->hashFunction = NULL;
 	}
 
+	if (cacheEntry->sortedShardMinHashValueArray != NULL)
+	{
+		pfree(cacheEntry->sortedShardMinHashValueArray);
+		cacheEntry->sortedShardMinHashValueArray = NULL;
+	}
+
+	if (cacheEntry->runningMaxShardIndexArray != NULL)
+	{
+		pfree(cacheEntry->runningMaxShardIndexArray);
+		cacheEntry->runningMaxShardIndexArray = NULL;
+	}
+
 	if (cacheEntry->partitionColumn != NULL)
 	{
 		pfree(cacheEntry->partitionColumn);
@@ -3140,6 +3357,8 @@ InvalidateDistRelationCacheCallback(Datum argument, Oid relationId)
 	if (relationId == InvalidOid)
 	{
 		InvalidateEntireDistCache();
+		InvalidateStatementCache();
+		InvalidateFastPathPlanCache();
 	}
 	else
 	{
@@ -3152,9 +3371,16 @@ InvalidateDistRelationCacheCallback(Datum argument, Oid relationId)
 		if (foundInCache)
 		{
 			cacheEntry->isValid = false;
+
+			/* the statements and tasks cached for the shards might be outdated */
+			InvalidateStatementCache();
+			InvalidateFastPathPlanCache();
 		}
 	}
 
+	/* the shard rows that the backends share might be outdated as well */
+	InvalidateSharedShardRows(relationId);
+
 	/*
 	 * If pg_dist_partition is being invalidated drop all state
 	 * This happens pretty rarely, but most importantly happens during
@@ -3162,6 +3388,7 @@ InvalidateDistRelationCacheCallback(Datum argument, Oid relationId)
 	 */
 	if (relationId != InvalidOid && relationId == MetadataCache.distPartitionRelationId)
 	{
+		InvalidateEntireDistCache();
 		InvalidateMetadataSystemCache();
 	}
 }
@@ -3181,6 +3408,7 @@ InvalidateEntireDistCache(void)
 	while ((cacheEntry = (DistTableCacheEntry *) hash_seq_search(&status)) != NULL)
 	{
 		cacheEntry->isValid = false;
+		cacheEntry->shardsRefreshable = false;
 	}
 }
 
@@ -3295,6 +3523,9 @@ InvalidateNodeRelationCacheCallback(Datum argument, Oid relationId)
 	if (relationId == InvalidOid || relationId == MetadataCache.distNodeRelationId)
 	{
 		workerNodeHashValid = false;
+
+		/* cached fast-path tasks embed the placement node names */
+		InvalidateFastPathPlanCache();
 	}
 }
 
@@ -3494,33 +3725,92 @@ GetPartitionTypeInputInfo(char *partitionKeyString, char partitionMethod,
 
 
 /*
- * TupleToShardInterval transforms the specified dist_shard tuple into a new
- * ShardInterval using the provided descriptor and partition type information.
+ * LoadCachedShardRows returns the pg_dist_shard rows of the given distributed
+ * table along with their placements. The rows are copied from the shared
+ * metadata cache if another backend already read them, and otherwise read
+ * from the catalogs and shared with the other backends.
+ *
+ * invalidationSequence is the shard cache invalidation sequence that the
+ * caller reached before calling this function. Shared rows may have been read
+ * before some of those invalidations were committed, so the sequence is moved
+ * back to the one that the rows are up to date with, such that the changed
+ * shards are reloaded on the next refresh.
  */
-static ShardInterval *
-TupleToShardInterval(HeapTuple heapTuple, TupleDesc tupleDescriptor, Oid intervalTypeId,
-					 int32 intervalTypeMod)
+static CachedShardRow *
+LoadCachedShardRows(Oid relationId, int *shardCount, uint64 *invalidationSequence)
+{
+	CachedShardRow *shardRowArray = NULL;
+	uint64 snapshotVersion = 0;
+	uint64 sharedInvalidationSequence = 0;
+
+	if (ReadSharedShardRows(relationId, &shardRowArray, shardCount, &snapshotVersion,
+							&sharedInvalidationSequence))
+	{
+		*invalidationSequence = Min(*invalidationSequence, sharedInvalidationSequence);
+
+		return shardRowArray;
+	}
+
+	shardRowArray = BuildCachedShardRows(relationId, shardCount);
+
+	PublishSharedShardRows(relationId, snapshotVersion, *invalidationSequence,
+						   shardRowArray, *shardCount);
+
+	return shardRowArray;
+}
+
+
+/*
+ * BuildCachedShardRows reads the pg_dist_shard rows of the given distributed
+ * table and the placements of its shards from the catalogs.
+ */
+static CachedShardRow *
+BuildCachedShardRows(Oid relationId, int *shardCount)
+{
+	List *distShardTupleList = LookupDistShardTuples(relationId);
+	CachedShardRow *shardRowArray = NULL;
+
+	*shardCount = list_length(distShardTupleList);
+	if (*shardCount > 0)
+	{
+		Relation distShardRelation = heap_open(DistShardRelationId(), AccessShareLock);
+		TupleDesc distShardTupleDesc = RelationGetDescr(distShardRelation);
+		ListCell *distShardTupleCell = NULL;
+		int arrayIndex = 0;
+
+		shardRowArray = palloc0(*shardCount * sizeof(CachedShardRow));
+
+		foreach(distShardTupleCell, distShardTupleList)
+		{
+			HeapTuple shardTuple = lfirst(distShardTupleCell);
+
+			TupleToCachedShardRow(shardTuple, distShardTupleDesc,
+								  &shardRowArray[arrayIndex]);
+
+			heap_freetuple(shardTuple);
+
+			arrayIndex++;
+		}
+
+		heap_close(distShardRelation, AccessShareLock);
+	}
+
+	return shardRowArray;
+}
+
+
+/*
+ * TupleToCachedShardRow fills the given CachedShardRow from the specified
+ * dist_shard tuple, and looks up the placements of the shard.
+ */
+static void
+TupleToCachedShardRow(HeapTuple heapTuple, TupleDesc tupleDescriptor,
+					  CachedShardRow *shardRow)
 {
-	ShardInterval *shardInterval = NULL;
-	bool minValueNull = false;
-	bool maxValueNull = false;
-	Oid inputFunctionId = InvalidOid;
-	Oid typeIoParam = InvalidOid;
 	Datum datumArray[Natts_pg_dist_shard];
 	bool isNullArray[Natts_pg_dist_shard];
-	Datum minValueTextDatum = 0;
-	Datum maxValueTextDatum = 0;
-	Oid relationId = InvalidOid;
-	int64 shardId = InvalidOid;
-	char storageType = InvalidOid;
-	Datum minValue = 0;
-	Datum maxValue = 0;
-	bool minValueExists = false;
-	bool maxValueExists = false;
-	int16 intervalTypeLen = 0;
-	bool intervalByVal = false;
-	char intervalAlign = '0';
-	char intervalDelim = '0';
+	bool minValueNull = false;
+	bool maxValueNull = false;
 
 	/*
 	 * We use heap_deform_tuple() instead of heap_getattr() to expand tuple
@@ -3528,28 +3818,61 @@ TupleToShardInterval(HeapTuple heapTuple, TupleDesc tupleDescriptor, Oid interva
 	 */
 	heap_deform_tuple(heapTuple, tupleDescriptor, datumArray, isNullArray);
 
-	relationId = DatumGetObjectId(datumArray[Anum_pg_dist_shard_logicalrelid - 1]);
-	shardId = DatumGetInt64(datumArray[Anum_pg_dist_shard_shardid - 1]);
-	storageType = DatumGetChar(datumArray[Anum_pg_dist_shard_shardstorage - 1]);
-	minValueTextDatum = datumArray[Anum_pg_dist_shard_shardminvalue - 1];
-	maxValueTextDatum = datumArray[Anum_pg_dist_shard_shardmaxvalue - 1];
+	shardRow->shardId = DatumGetInt64(datumArray[Anum_pg_dist_shard_shardid - 1]);
+	shardRow->storageType =
+		DatumGetChar(datumArray[Anum_pg_dist_shard_shardstorage - 1]);
 
 	minValueNull = isNullArray[Anum_pg_dist_shard_shardminvalue - 1];
 	maxValueNull = isNullArray[Anum_pg_dist_shard_shardmaxvalue - 1];
 
 	if (!minValueNull && !maxValueNull)
 	{
-		char *minValueString = TextDatumGetCString(minValueTextDatum);
-		char *maxValueString = TextDatumGetCString(maxValueTextDatum);
+		Datum minValueTextDatum = datumArray[Anum_pg_dist_shard_shardminvalue - 1];
+		Datum maxValueTextDatum = datumArray[Anum_pg_dist_shard_shardmaxvalue - 1];
+
+		shardRow->minValue = TextDatumGetCString(minValueTextDatum);
+		shardRow->maxValue = TextDatumGetCString(maxValueTextDatum);
+	}
+	else
+	{
+		shardRow->minValue = NULL;
+		shardRow->maxValue = NULL;
+	}
+
+	shardRow->placementList = BuildShardPlacementList(shardRow->shardId);
+}
+
 
+/*
+ * CachedShardRowToShardInterval transforms the specified shard row into a new
+ * ShardInterval using the provided partition type information.
+ */
+static ShardInterval *
+CachedShardRowToShardInterval(Oid relationId, CachedShardRow *shardRow,
+							  Oid intervalTypeId, int32 intervalTypeMod)
+{
+	ShardInterval *shardInterval = NULL;
+	Oid inputFunctionId = InvalidOid;
+	Oid typeIoParam = InvalidOid;
+	Datum minValue = 0;
+	Datum maxValue = 0;
+	bool minValueExists = false;
+	bool maxValueExists = false;
+	int16 intervalTypeLen = 0;
+	bool intervalByVal = false;
+	char intervalAlign = '0';
+	char intervalDelim = '0';
+
+	if (shardRow->minValue != NULL && shardRow->maxValue != NULL)
+	{
 		/* TODO: move this up the call stack to avoid per-tuple invocation? */
 		get_type_io_data(intervalTypeId, IOFunc_input, &intervalTypeLen, &intervalByVal,
 						 &intervalAlign, &intervalDelim, &typeIoParam, &inputFunctionId);
 
 		/* finally convert min/max values to their actual types */
-		minValue = OidInputFunctionCall(inputFunctionId, minValueString,
+		minValue = OidInputFunctionCall(inputFunctionId, shardRow->minValue,
 										typeIoParam, intervalTypeMod);
-		maxValue = OidInputFunctionCall(inputFunctionId, maxValueString,
+		maxValue = OidInputFunctionCall(inputFunctionId, shardRow->maxValue,
 										typeIoParam, intervalTypeMod);
 
 		minValueExists = true;
@@ -3558,7 +3881,7 @@ TupleToShardInterval(HeapTuple heapTuple, TupleDesc tupleDescriptor, Oid interva
 
 	shardInterval = CitusMakeNode(ShardInterval);
 	shardInterval->relationId = relationId;
-	shardInterval->storageType = storageType;
+	shardInterval->storageType = shardRow->storageType;
 	shardInterval->valueTypeId = intervalTypeId;
 	shardInterval->valueTypeLen = intervalTypeLen;
 	shardInterval->valueByVal = intervalByVal;
@@ -3566,7 +3889,7 @@ TupleToShardInterval(HeapTuple heapTuple, TupleDesc tupleDescriptor, Oid interva
 	shardInterval->maxValueExists = maxValueExists;
 	shardInterval->minValue = minValue;
 	shardInterval->maxValue = maxValue;
-	shardInterval->shardId = shardId;
+	shardInterval->shardId = shardRow->shardId;
 
 	return shardInterval;
 }
@@ -3606,6 +3929,23 @@ CachedRelationLookup(const char *relationName, Oid *cachedOid)
  */
 void
 CitusInvalidateRelcacheByRelid(Oid relationId)
+{
+	/* backends have to rebuild the whole cache entry */
+	RecordShardCacheInvalidation(relationId, INVALID_SHARD_ID);
+
+	/* the transaction should not use the shard rows that other backends share */
+	MarkSharedShardRowsModified(relationId);
+
+	InvalidateRelcacheByRelid(relationId);
+}
+
+
+/*
+ * InvalidateRelcacheByRelid registers a relcache invalidation for the given
+ * relation, if it still exists.
+ */
+static void
+InvalidateRelcacheByRelid(Oid relationId)
 {
 	HeapTuple classTuple = SearchSysCache1(RELOID, ObjectIdGetDatum(relationId));
 
@@ -3649,7 +3989,12 @@ CitusInvalidateRelcacheByShardId(int64 shardId)
 	if (HeapTupleIsValid(heapTuple))
 	{
 		shardForm = (Form_pg_dist_shard) GETSTRUCT(heapTuple);
-		CitusInvalidateRelcacheByRelid(shardForm->logicalrelid);
+
+		/* backends only have to reload the placements of the shard */
+		RecordShardCacheInvalidation(shardForm->logicalrelid, shardId);
+		MarkSharedShardRowsModified(shardForm->logicalrelid);
+
+		InvalidateRelcacheByRelid(shardForm->logicalrelid);
 	}
 	else
 	{
@@ -0,0 +1,501 @@
+/*-------------------------------------------------------------------------
+ *
+ * shard_cache_invalidation.c
+ *   Tracks which shards of a distributed table had their placements changed,
+ *   such that backends can refresh the placements of those shards in their
+ *   metadata cache instead of rebuilding the cache entry of the table.
+ *
+ *   Relcache invalidations only tell the backends which relation changed.
+ *   Hence, the transactions that change the metadata also add a record of
+ *   the shard, or of the whole table, to a ring buffer in shared memory. The
+ *   records are added before the change commits and carry the transaction
+ *   id, such that backends can tell whether the change is visible yet:
+ *
+ *   - records of transactions that are still in progress, including prepared
+ *     transactions, are skipped, the invalidation of their commit follows
+ *   - records of committed or aborted transactions are applied
+ *   - records of the current transaction are applied, but also kept for the
+ *     invalidation of its commit or abort
+ *
+ *   A cache entry remembers up to which record it applied the invalidations,
+ *   stopping before the records it still has to look at again. If records
+ *   that a cache entry did not look at were overwritten, or if the table as a
+ *   whole was invalidated, the entry is rebuilt.
+ *
+ *   Records of running transactions are moved ahead rather than overwritten.
+ *   A transaction that adds many records invalidates all tables of its
+ *   database with a single record instead, such that no transaction can fill
+ *   the ring. If the ring is still full of records of running transactions,
+ *   the oldest record is overwritten, and cache entries are rebuilt until all
+ *   transactions that were running at that point finished.
+ *
+ * Copyright (c) 2019, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "miscadmin.h"
+
+#include "access/transam.h"
+#include "access/xact.h"
+#include "distributed/relay_utility.h"
+#include "distributed/shard_cache_invalidation.h"
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/proc.h"
+#include "storage/procarray.h"
+#include "storage/shmem.h"
+#include "utils/snapmgr.h"
+
+
+/* number of invalidation records that are kept in shared memory */
+#define SHARD_INVALIDATION_RECORD_COUNT 4096
+
+/*
+ * Number of records a transaction may add before it invalidates all tables
+ * of its database instead, such that a few large transactions cannot fill
+ * the ring with records that have to be kept until they finish.
+ */
+#define MAX_RECORDS_PER_TRANSACTION 64
+
+
+/* invalidation of a shard's placements, or of a whole table */
+typedef struct ShardInvalidationRecord
+{
+	/* position of the record in the sequence of all records, 0 if unused */
+	uint64 sequence;
+
+	Oid databaseId;
+
+	/* table whose metadata changed, InvalidOid for all tables of the database */
+	Oid relationId;
+
+	/* shard whose placements changed, INVALID_SHARD_ID for the whole table */
+	uint64 shardId;
+
+	/* top-level transaction that made the change */
+	TransactionId transactionId;
+} ShardInvalidationRecord;
+
+
+/*
+ * ShardInvalidationSharedData holds the ring buffer of invalidation records
+ * and the lock that protects it.
+ */
+typedef struct ShardInvalidationSharedData
+{
+	int trancheId;
+	char *trancheName;
+	LWLock lock;
+
+	/* sequence of the next record */
+	uint64 nextSequence;
+
+	/*
+	 * Sequence of the last record that overwrote a record of a running
+	 * transaction, 0 if none did, and a transaction id that all transactions
+	 * that were running at that point precede.
+	 */
+	uint64 overflowSequence;
+	TransactionId overflowTransactionId;
+
+	ShardInvalidationRecord records[SHARD_INVALIDATION_RECORD_COUNT];
+} ShardInvalidationSharedData;
+
+
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+static ShardInvalidationSharedData *ShardInvalidationSharedState = NULL;
+
+/* tables the current transaction invalidated as a whole */
+static List *InvalidatedRelationList = NIL;
+
+/* number of records the current transaction added */
+static int RecordCountInTransaction = 0;
+
+/* whether the current transaction invalidated all tables of the database */
+static bool DatabaseInvalidatedInTransaction = false;
+
+/* transaction that the above state belongs to */
+static LocalTransactionId InvalidationStateTransactionId = InvalidLocalTransactionId;
+
+/* last overflow of the ring whose transactions are known to have finished */
+static uint64 FinishedOverflowSequence = 0;
+
+
+static void ShardCacheInvalidationShmemInit(void);
+static size_t ShardCacheInvalidationShmemSize(void);
+static void ResetTransactionInvalidationState(void);
+static bool OverflowTransactionsFinished(uint64 overflowSequence,
+										 TransactionId overflowTransactionId);
+
+
+/*
+ * InitializeShardCacheInvalidation requests the necessary shared memory from
+ * Postgres and sets up the shared memory startup hook.
+ */
+void
+InitializeShardCacheInvalidation(void)
+{
+	/* allocate shared memory */
+	if (!IsUnderPostmaster)
+	{
+		RequestAddinShmemSpace(ShardCacheInvalidationShmemSize());
+	}
+
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = ShardCacheInvalidationShmemInit;
+}
+
+
+/*
+ * RecordShardCacheInvalidation records that the current transaction changed
+ * the placements of the given shard of a distributed table, or the metadata
+ * of the table as a whole if shardId is INVALID_SHARD_ID.
+ */
+void
+RecordShardCacheInvalidation(Oid relationId, uint64 shardId)
+{
+	ShardInvalidationRecord *record = NULL;
+	uint64 sequence = 0;
+	int slotCount = 0;
+
+	if (ShardInvalidationSharedState == NULL)
+	{
+		return;
+	}
+
+	ResetTransactionInvalidationState();
+
+	/* the whole table is rebuilt anyway, do not fill the ring with its changes */
+	if (DatabaseInvalidatedInTransaction ||
+		list_member_oid(InvalidatedRelationList, relationId))
+	{
+		return;
+	}
+
+	if (RecordCountInTransaction >= MAX_RECORDS_PER_TRANSACTION)
+	{
+		/* transactions that change many tables or shards invalidate all tables */
+		relationId = InvalidOid;
+		shardId = INVALID_SHARD_ID;
+
+		DatabaseInvalidatedInTransaction = true;
+	}
+	else if (shardId == INVALID_SHARD_ID)
+	{
+		MemoryContext oldContext = MemoryContextSwitchTo(TopTransactionContext);
+		InvalidatedRelationList = lappend_oid(InvalidatedRelationList, relationId);
+		MemoryContextSwitchTo(oldContext);
+	}
+
+	RecordCountInTransaction++;
+
+	LWLockAcquire(&ShardInvalidationSharedState->lock, LW_EXCLUSIVE);
+
+	/*
+	 * Backends may still be waiting for the transactions of the oldest records
+	 * to finish, so records of running transactions are moved to the head of
+	 * the ring instead of being overwritten. Their slot simply gets the next
+	 * sequence, backends that skipped the record before will see that it is
+	 * gone and rebuild the cache entry.
+	 */
+	for (slotCount = 0; slotCount < SHARD_INVALIDATION_RECORD_COUNT; slotCount++)
+	{
+		sequence = ShardInvalidationSharedState->nextSequence++;
+		record = &ShardInvalidationSharedState->records[sequence %
+														SHARD_INVALIDATION_RECORD_COUNT];
+
+		if (record->sequence == 0 || !TransactionIdIsValid(record->transactionId) ||
+			!TransactionIdIsInProgress(record->transactionId))
+		{
+			break;
+		}
+
+		record->sequence = sequence;
+		record = NULL;
+	}
+
+	if (record == NULL)
+	{
+		/*
+		 * All records belong to running transactions. Overwrite the oldest one
+		 * and let backends rebuild their cache entries instead of refreshing
+		 * them until all of those transactions finished.
+		 */
+		sequence = ShardInvalidationSharedState->nextSequence++;
+		record = &ShardInvalidationSharedState->records[sequence %
+														SHARD_INVALIDATION_RECORD_COUNT];
+
+		ShardInvalidationSharedState->overflowSequence = sequence;
+		ShardInvalidationSharedState->overflowTransactionId = ReadNewTransactionId();
+	}
+
+	record->sequence = sequence;
+	record->databaseId = MyDatabaseId;
+	record->relationId = relationId;
+	record->shardId = shardId;
+	record->transactionId = GetTopTransactionIdIfAny();
+
+	LWLockRelease(&ShardInvalidationSharedState->lock);
+}
+
+
+/*
+ * ReadShardCacheInvalidations finds the shards of the given distributed table
+ * whose placements changed after the invalidation record that the given
+ * sequence points to, adds their shard ids to shardIdList, and advances the
+ * sequence past the records that need not be looked at again.
+ *
+ * The function returns false if the cache entry of the table should be
+ * rebuilt instead, because the table or all tables of the database were
+ * invalidated as a whole, or because some of the records were overwritten
+ * already. The sequence is advanced in that case as well, such that it can be
+ * used for the rebuilt entry.
+ *
+ * The caller's catalog scans should happen after calling this function, so
+ * they see the changes of the records that it considered committed.
+ */
+bool
+ReadShardCacheInvalidations(Oid relationId, uint64 *invalidationSequence,
+							List **shardIdList)
+{
+	List *recordList = NIL;
+	ListCell *recordCell = NULL;
+	uint64 firstSequence = 0;
+	uint64 nextSequence = 0;
+	uint64 overflowSequence = 0;
+	TransactionId overflowTransactionId = InvalidTransactionId;
+	uint64 sequence = 0;
+	bool canRefresh = true;
+
+	*shardIdList = NIL;
+
+	if (ShardInvalidationSharedState == NULL)
+	{
+		return false;
+	}
+
+	/* copy the records of the table, so we do not hold the lock for long */
+	LWLockAcquire(&ShardInvalidationSharedState->lock, LW_SHARED);
+
+	nextSequence = ShardInvalidationSharedState->nextSequence;
+	overflowSequence = ShardInvalidationSharedState->overflowSequence;
+	overflowTransactionId = ShardInvalidationSharedState->overflowTransactionId;
+
+	if (nextSequence > SHARD_INVALIDATION_RECORD_COUNT)
+	{
+		firstSequence = nextSequence - SHARD_INVALIDATION_RECORD_COUNT;
+	}
+	else
+	{
+		firstSequence = 1;
+	}
+
+	if (*invalidationSequence + 1 < firstSequence ||
+		*invalidationSequence < overflowSequence)
+	{
+		/* records we have not seen were overwritten */
+		canRefresh = false;
+	}
+
+	for (sequence = Max(*invalidationSequence + 1, firstSequence);
+		 sequence < nextSequence; sequence++)
+	{
+		ShardInvalidationRecord *record =
+			&ShardInvalidationSharedState->records[sequence %
+												   SHARD_INVALIDATION_RECORD_COUNT];
+
+		if (record->databaseId == MyDatabaseId &&
+			(record->relationId == relationId || record->relationId == InvalidOid))
+		{
+			ShardInvalidationRecord *recordCopy =
+				palloc0(sizeof(ShardInvalidationRecord));
+
+			*recordCopy = *record;
+			recordList = lappend(recordList, recordCopy);
+		}
+	}
+
+	LWLockRelease(&ShardInvalidationSharedState->lock);
+
+	/* unless a record is kept for later, we are done with all of them */
+	*invalidationSequence = nextSequence - 1;
+
+	foreach(recordCell, recordList)
+	{
+		ShardInvalidationRecord *record = (ShardInvalidationRecord *) lfirst(recordCell);
+		TransactionId transactionId = record->transactionId;
+		bool keepRecord = false;
+		bool applyRecord = false;
+
+		if (!TransactionIdIsValid(transactionId))
+		{
+			applyRecord = true;
+		}
+		else if (TransactionIdIsCurrentTransactionId(transactionId))
+		{
+			/* we see our own changes, but need to see them again once we abort */
+			applyRecord = true;
+			keepRecord = true;
+		}
+		else if (TransactionIdIsInProgress(transactionId))
+		{
+			/* the change is not visible yet */
+			keepRecord = true;
+		}
+		else
+		{
+			/* the transaction committed or aborted, its change is settled */
+			applyRecord = true;
+		}
+
+		if (keepRecord && record->sequence <= *invalidationSequence)
+		{
+			*invalidationSequence = record->sequence - 1;
+		}
+
+		if (!applyRecord)
+		{
+			continue;
+		}
+
+		if (record->shardId == INVALID_SHARD_ID)
+		{
+			canRefresh = false;
+		}
+		else if (canRefresh)
+		{
+			uint64 *shardIdPointer = (uint64 *) palloc0(sizeof(uint64));
+
+			*shardIdPointer = record->shardId;
+			*shardIdList = lappend(*shardIdList, shardIdPointer);
+		}
+	}
+
+	list_free_deep(recordList);
+
+	/*
+	 * While transactions whose records were overwritten may still be running,
+	 * we cannot tell whether their changes are visible, so make sure the entry
+	 * is rebuilt once more after they finish.
+	 */
+	if (overflowSequence != 0 && *invalidationSequence >= overflowSequence &&
+		!OverflowTransactionsFinished(overflowSequence, overflowTransactionId))
+	{
+		*invalidationSequence = overflowSequence - 1;
+	}
+
+	/*
+	 * Make sure the catalog scans of the caller do not use a catalog snapshot
+	 * that was taken before we checked which transactions committed.
+	 */
+	InvalidateCatalogSnapshot();
+
+	return canRefresh;
+}
+
+
+/*
+ * ResetTransactionInvalidationState forgets which invalidations an earlier
+ * transaction recorded. The state is allocated in the memory of the
+ * transaction that recorded them.
+ */
+static void
+ResetTransactionInvalidationState(void)
+{
+	if (InvalidationStateTransactionId != MyProc->lxid)
+	{
+		InvalidatedRelationList = NIL;
+		RecordCountInTransaction = 0;
+		DatabaseInvalidatedInTransaction = false;
+		InvalidationStateTransactionId = MyProc->lxid;
+	}
+}
+
+
+/*
+ * OverflowTransactionsFinished returns whether all transactions whose records
+ * were overwritten when the ring overflowed at the given sequence finished,
+ * that is whether all transactions that precede overflowTransactionId did.
+ */
+static bool
+OverflowTransactionsFinished(uint64 overflowSequence,
+							 TransactionId overflowTransactionId)
+{
+	TransactionId oldestActiveTransactionId = InvalidTransactionId;
+
+	if (overflowSequence == FinishedOverflowSequence)
+	{
+		return true;
+	}
+
+	oldestActiveTransactionId = GetOldestActiveTransactionId();
+	if (TransactionIdPrecedes(oldestActiveTransactionId, overflowTransactionId))
+	{
+		return false;
+	}
+
+	FinishedOverflowSequence = overflowSequence;
+
+	return true;
+}
+
+
+/*
+ * ShardCacheInvalidationShmemInit is the callback that is to be called on
+ * shared memory startup hook. The function sets up the ring buffer of the
+ * invalidation records.
+ */
+static void
+ShardCacheInvalidationShmemInit(void)
+{
+	bool alreadyInitialized = false;
+
+	/* we may update the shmem, acquire lock exclusively */
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+	ShardInvalidationSharedState =
+		(ShardInvalidationSharedData *) ShmemInitStruct(
+			"Shard Cache Invalidation Data",
+			sizeof(ShardInvalidationSharedData),
+			&alreadyInitialized);
+
+	if (!alreadyInitialized)
+	{
+		memset(ShardInvalidationSharedState, 0, sizeof(ShardInvalidationSharedData));
+
+		ShardInvalidationSharedState->trancheId = LWLockNewTrancheId();
+		ShardInvalidationSharedState->trancheName = "Shard Cache Invalidation Tranche";
+		ShardInvalidationSharedState->nextSequence = 1;
+
+		LWLockInitialize(&ShardInvalidationSharedState->lock,
+						 ShardInvalidationSharedState->trancheId);
+	}
+
+	/* tranche names are registered per process */
+	LWLockRegisterTranche(ShardInvalidationSharedState->trancheId,
+						  ShardInvalidationSharedState->trancheName);
+
+	LWLockRelease(AddinShmemInitLock);
+
+	if (prev_shmem_startup_hook != NULL)
+	{
+		prev_shmem_startup_hook();
+	}
+}
+
+
+/*
+ * ShardCacheInvalidationShmemSize returns the size that should be allocated
+ * on the shared memory for the invalidation records.
+ */
+static size_t
+ShardCacheInvalidationShmemSize(void)
+{
+	Size size = 0;
+
+	size = add_size(size, sizeof(ShardInvalidationSharedData));
+
+	return size;
+}
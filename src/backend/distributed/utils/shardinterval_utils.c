@@ -26,6 +26,10 @@
 #include "utils/memutils.h"
 
 
+static int SearchShardMinHashValueArray(int32 hashValue,
+										DistTableCacheEntry *cacheEntry);
+
+
 /*
  * LowestShardIntervalById returns the shard interval with the lowest shard
  * ID from a list of shard intervals.
@@ -302,10 +306,10 @@ FindShardIntervalIndex(Datum searchedValue, DistTableCacheEntry *cacheEntry)
 	{
 		if (useBinarySearch)
 		{
-			Assert(compareFunction != NULL);
+			Assert(cacheEntry->sortedShardMinHashValueArray != NULL);
 
-			shardIndex = SearchCachedShardInterval(searchedValue, shardIntervalCache,
-												   shardCount, compareFunction);
+			shardIndex = SearchShardMinHashValueArray(DatumGetInt32(searchedValue),
+													  cacheEntry);
 
 			/* we should always return a valid shard index for hash partitioned tables */
 			if (shardIndex == INVALID_SHARD_INDEX)
@@ -410,6 +414,48 @@ SearchCachedShardInterval(Datum partitionColumnValue, ShardInterval **shardInter
 }
 
 
+/*
+ * SearchShardMinHashValueArray finds the index of the shard interval of a hash
+ * distributed table which covers the given hash value, or returns
+ * INVALID_SHARD_INDEX if there is none. Unlike SearchCachedShardInterval(),
+ * it compares plain integers: the binary search over the minimum hash values
+ * of the shards only narrows down the range, which lets the compiler avoid
+ * unpredictable branches, and the maximum value of the resulting shard is
+ * checked once at the end.
+ */
+static int
+SearchShardMinHashValueArray(int32 hashValue, DistTableCacheEntry *cacheEntry)
+{
+	int32 *minHashValueArray = cacheEntry->sortedShardMinHashValueArray;
+	int shardCount = cacheEntry->shardIntervalArrayLength;
+	int lowerBoundIndex = 0;
+	int remainingCount = shardCount;
+	ShardInterval *shardInterval = NULL;
+
+	/* find the last shard whose minimum value is not larger than the hash value */
+	while (remainingCount > 1)
+	{
+		int halfCount = remainingCount / 2;
+
+		if (minHashValueArray[lowerBoundIndex + halfCount] <= hashValue)
+		{
+			lowerBoundIndex += halfCount;
+		}
+
+		remainingCount -= halfCount;
+	}
+
+	shardInterval = cacheEntry->sortedShardIntervalArray[lowerBoundIndex];
+	if (hashValue < minHashValueArray[lowerBoundIndex] ||
+		hashValue > DatumGetInt32(shardInterval->maxValue))
+	{
+		return INVALID_SHARD_INDEX;
+	}
+
+	return lowerBoundIndex;
+}
+
+
 /*
  * SingleReplicatedTable checks whether all shards of a distributed table, do not have
  * more than one replica. If even one shard has more than one replica, this function
@@ -0,0 +1,924 @@
+/*-------------------------------------------------------------------------
+ *
+ * shared_metadata_cache.c
+ *   Keeps the pg_dist_shard and pg_dist_placement rows of distributed tables
+ *   in shared memory, such that backends can build their metadata cache
+ *   entries without scanning the catalogs. Without it, every new backend
+ *   scans pg_dist_placement once per shard on its first query of a table,
+ *   which takes long for tables with many shards.
+ *
+ *   The rows of a table are kept in a dynamic shared memory area that is
+ *   created in the main shared memory segment, together with a version.
+ *   The relcache invalidation callback of each backend drops the rows of
+ *   the table, and with them the version. A backend that did not find the
+ *   rows reads the version before it scans the catalogs, and only shares the
+ *   rows it read if the version did not change in the meantime. A backend
+ *   that has processed an invalidation therefore never uses rows that were
+ *   read before the change that caused it.
+ *
+ *   The rows also carry the shard cache invalidation sequence that the
+ *   backend which read them had reached before its catalog scans. Backends
+ *   that copy the rows refresh their cache entry from that point on, since
+ *   the rows may miss changes whose invalidation records they consumed.
+ *
+ *   The transaction that changes the metadata cannot rely on the callbacks
+ *   alone, since it invalidates its own cache before the change is visible
+ *   to others. It does not use the shared rows of the tables it modified,
+ *   and drops them once more after it commits. Prepared transactions are an
+ *   exception, see SharedMetadataCacheXactCallback().
+ *
+ * Copyright (c) 2019, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "miscadmin.h"
+
+#include "access/xact.h"
+#include "distributed/citus_nodes.h"
+#include "distributed/master_metadata_utility.h"
+#include "distributed/metadata_cache.h"
+#include "distributed/shared_metadata_cache.h"
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/dsa.h"
+#include "utils/hsearch.h"
+#include "utils/memutils.h"
+#include "utils/snapmgr.h"
+
+
+/* maximum number of distributed tables whose rows are kept in shared memory */
+#define SHARED_METADATA_CACHE_RELATIONS 4096
+
+
+/*
+ * SharedMetadataCacheData holds the lock that protects the shared rows, and
+ * is followed by the dynamic shared memory area that contains them.
+ */
+typedef struct SharedMetadataCacheData
+{
+	int trancheId;
+	char *trancheName;
+	LWLock lock;
+
+	/* last version assigned to the rows of a table */
+	uint64 lastSnapshotVersion;
+} SharedMetadataCacheData;
+
+
+/* key of the shared rows, relation ids are only unique within a database */
+typedef struct SharedShardRowsHashKey
+{
+	Oid databaseId;
+	Oid relationId;
+} SharedShardRowsHashKey;
+
+
+/* entry of the shared rows of a distributed table */
+typedef struct SharedShardRowsHashEntry
+{
+	SharedShardRowsHashKey key;
+
+	/* version of the rows, unique across tables and never reused */
+	uint64 snapshotVersion;
+
+	/* shard cache invalidation sequence that the rows are up to date with */
+	uint64 invalidationSequence;
+
+	/* SharedShardRowsHeader of the rows, InvalidDsaPointer if not yet shared */
+	dsa_pointer shardRows;
+} SharedShardRowsHashEntry;
+
+
+/*
+ * SharedShardRowsHeader starts the shared rows of a table. It is followed by
+ * the shard rows, the placements of all shards and the min/max values.
+ */
+typedef struct SharedShardRowsHeader
+{
+	/* pg_dist_shard of the extension that the rows were read from */
+	Oid distShardRelationId;
+
+	int shardCount;
+	int placementCount;
+	Size placementOffset;
+	Size valueOffset;
+} SharedShardRowsHeader;
+
+
+/* shard row of a table in shared memory */
+typedef struct SharedShardRow
+{
+	int64 shardId;
+	char storageType;
+
+	/* offsets of the min/max values, -1 if the shard has none */
+	int32 minValueOffset;
+	int32 maxValueOffset;
+
+	/* range of the placements of the shard */
+	int32 placementIndex;
+	int32 placementCount;
+} SharedShardRow;
+
+
+/* placement row of a shard in shared memory */
+typedef struct SharedShardPlacement
+{
+	uint64 placementId;
+	uint64 shardId;
+	uint64 shardLength;
+	RelayFileState shardState;
+	int32 groupId;
+} SharedShardPlacement;
+
+
+/*
+ * Sets the size of the shared memory that keeps the shard metadata of
+ * distributed tables, in kilobytes. 0 disables sharing the metadata.
+ */
+int SharedMetadataCacheSize = 0;
+
+
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+static SharedMetadataCacheData *SharedMetadataCacheState = NULL;
+static HTAB *SharedShardRowsHash = NULL;
+static dsa_area *SharedMetadataArea = NULL;
+
+/* distributed tables whose metadata the current transaction modified */
+static List *ModifiedRelationList = NIL;
+
+
+static void SharedMetadataCacheShmemInit(void);
+static size_t SharedMetadataCacheShmemSize(void);
+static size_t SharedMetadataAreaSize(void);
+static void * SharedMetadataAreaPlace(void);
+static dsa_area * GetSharedMetadataArea(void);
+static void SharedMetadataCacheXactCallback(XactEvent event, void *arg);
+static void InitializeSharedShardRowsHashKey(SharedShardRowsHashKey *key,
+											 Oid relationId);
+static bool CopySharedShardRows(SharedShardRowsHashEntry *shardRowsEntry,
+								Oid distShardRelationId,
+								CachedShardRow **shardRowArray, int *shardCount);
+static char * SerializeShardRows(CachedShardRow *shardRowArray, int shardCount,
+								 Oid distShardRelationId, Size *serializedSize);
+static dsa_pointer AllocateSharedShardRows(SharedShardRowsHashKey *key, Size size);
+static void RemoveSharedShardRowsEntry(SharedShardRowsHashEntry *shardRowsEntry);
+
+
+/*
+ * InitializeSharedMetadataCache requests the necessary shared memory from
+ * Postgres and sets up the shared memory startup hook, unless sharing the
+ * metadata is disabled.
+ */
+void
+InitializeSharedMetadataCache(void)
+{
+	if (SharedMetadataCacheSize == 0)
+	{
+		return;
+	}
+
+	/* allocate shared memory */
+	if (!IsUnderPostmaster)
+	{
+		RequestAddinShmemSpace(SharedMetadataCacheShmemSize());
+	}
+
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = SharedMetadataCacheShmemInit;
+
+	RegisterXactCallback(SharedMetadataCacheXactCallback, NULL);
+}
+
+
+/*
+ * ReadSharedShardRows copies the shared shard rows of the given distributed
+ * table into the current memory context, sets invalidationSequence to the
+ * shard cache invalidation sequence that they are up to date with and returns
+ * true, or returns false if the rows are not shared.
+ *
+ * If the rows are not shared, snapshotVersion is set to the version that the
+ * caller should pass to PublishSharedShardRows() after it read the rows from
+ * the catalogs, or to 0 if the caller should not share the rows it reads.
+ */
+bool
+ReadSharedShardRows(Oid relationId, CachedShardRow **shardRowArray, int *shardCount,
+					uint64 *snapshotVersion, uint64 *invalidationSequence)
+{
+	SharedShardRowsHashKey key;
+	SharedShardRowsHashEntry *shardRowsEntry = NULL;
+	Oid distShardRelationId = InvalidOid;
+	bool entryFound = false;
+	bool rowsFound = false;
+
+	*shardRowArray = NULL;
+	*shardCount = 0;
+	*snapshotVersion = 0;
+
+	if (SharedMetadataCacheState == NULL)
+	{
+		return false;
+	}
+
+	/* the shared rows do not contain the changes of the current transaction */
+	if (list_member_oid(ModifiedRelationList, relationId))
+	{
+		return false;
+	}
+
+	/* look up the catalog before taking the lock, it may accept invalidations */
+	distShardRelationId = DistShardRelationId();
+
+	GetSharedMetadataArea();
+	InitializeSharedShardRowsHashKey(&key, relationId);
+
+	LWLockAcquire(&SharedMetadataCacheState->lock, LW_SHARED);
+
+	shardRowsEntry = hash_search(SharedShardRowsHash, &key, HASH_FIND, &entryFound);
+	if (entryFound)
+	{
+		rowsFound = CopySharedShardRows(shardRowsEntry, distShardRelationId,
+										shardRowArray, shardCount);
+		*invalidationSequence = shardRowsEntry->invalidationSequence;
+	}
+
+	LWLockRelease(&SharedMetadataCacheState->lock);
+
+	if (rowsFound)
+	{
+		return true;
+	}
+
+	LWLockAcquire(&SharedMetadataCacheState->lock, LW_EXCLUSIVE);
+
+	shardRowsEntry = hash_search(SharedShardRowsHash, &key, HASH_FIND, &entryFound);
+	if (!entryFound)
+	{
+		/*
+		 * A shared hash keeps taking memory from the rest of the shared memory
+		 * when it has more entries than it was sized for, so we check the
+		 * number of tables ourselves.
+		 */
+		if (hash_get_num_entries(SharedShardRowsHash) < SHARED_METADATA_CACHE_RELATIONS)
+		{
+			shardRowsEntry = hash_search(SharedShardRowsHash, &key, HASH_ENTER_NULL,
+										 &entryFound);
+		}
+
+		if (shardRowsEntry == NULL)
+		{
+			/* too many tables, the caller reads the rows without sharing them */
+			LWLockRelease(&SharedMetadataCacheState->lock);
+
+			return false;
+		}
+
+		shardRowsEntry->snapshotVersion =
+			++SharedMetadataCacheState->lastSnapshotVersion;
+		shardRowsEntry->invalidationSequence = 0;
+		shardRowsEntry->shardRows = InvalidDsaPointer;
+	}
+
+	/* another backend may have shared the rows in the meantime */
+	rowsFound = CopySharedShardRows(shardRowsEntry, distShardRelationId,
+									shardRowArray, shardCount);
+	*invalidationSequence = shardRowsEntry->invalidationSequence;
+	if (!rowsFound && DsaPointerIsValid(shardRowsEntry->shardRows))
+	{
+		/* the rows are left over from an earlier installation of the extension */
+		dsa_free(SharedMetadataArea, shardRowsEntry->shardRows);
+
+		shardRowsEntry->snapshotVersion =
+			++SharedMetadataCacheState->lastSnapshotVersion;
+		shardRowsEntry->shardRows = InvalidDsaPointer;
+	}
+
+	if (!rowsFound)
+	{
+		*snapshotVersion = shardRowsEntry->snapshotVersion;
+	}
+
+	LWLockRelease(&SharedMetadataCacheState->lock);
+
+	if (!rowsFound)
+	{
+		/*
+		 * The catalog scans of the caller should not use a catalog snapshot
+		 * that was taken before we read the version, otherwise the rows it
+		 * shares might miss changes that were committed before that.
+		 */
+		InvalidateCatalogSnapshot();
+	}
+
+	return rowsFound;
+}
+
+
+/*
+ * PublishSharedShardRows shares the given shard rows of a distributed table,
+ * which the caller read from the catalogs after ReadSharedShardRows() set
+ * snapshotVersion. invalidationSequence is the shard cache invalidation
+ * sequence that the caller reached before reading the catalogs. The rows are
+ * only shared if they were not invalidated in the meantime.
+ */
+void
+PublishSharedShardRows(Oid relationId, uint64 snapshotVersion,
+					   uint64 invalidationSequence,
+					   CachedShardRow *shardRowArray, int shardCount)
+{
+	SharedShardRowsHashKey key;
+	SharedShardRowsHashEntry *shardRowsEntry = NULL;
+	char *serializedRows = NULL;
+	Size serializedSize = 0;
+	bool entryFound = false;
+
+	if (SharedMetadataCacheState == NULL || snapshotVersion == 0)
+	{
+		return;
+	}
+
+	serializedRows = SerializeShardRows(shardRowArray, shardCount,
+										DistShardRelationId(), &serializedSize);
+
+	GetSharedMetadataArea();
+	InitializeSharedShardRowsHashKey(&key, relationId);
+
+	LWLockAcquire(&SharedMetadataCacheState->lock, LW_EXCLUSIVE);
+
+	shardRowsEntry = hash_search(SharedShardRowsHash, &key, HASH_FIND, &entryFound);
+	if (entryFound && shardRowsEntry->snapshotVersion == snapshotVersion &&
+		!DsaPointerIsValid(shardRowsEntry->shardRows))
+	{
+		dsa_pointer shardRows = AllocateSharedShardRows(&key, serializedSize);
+
+		if (DsaPointerIsValid(shardRows))
+		{
+			memcpy(dsa_get_address(SharedMetadataArea, shardRows), serializedRows,
+				   serializedSize);
+
+			shardRowsEntry->shardRows = shardRows;
+			shardRowsEntry->invalidationSequence = invalidationSequence;
+		}
+	}
+
+	LWLockRelease(&SharedMetadataCacheState->lock);
+
+	pfree(serializedRows);
+}
+
+
+/*
+ * InvalidateSharedShardRows drops the shared shard rows of the given
+ * distributed table, or of all tables in the current database if relationId
+ * is InvalidOid.
+ */
+void
+InvalidateSharedShardRows(Oid relationId)
+{
+	SharedShardRowsHashKey key;
+	SharedShardRowsHashEntry *shardRowsEntry = NULL;
+	bool entryFound = false;
+
+	if (SharedMetadataCacheState == NULL)
+	{
+		return;
+	}
+
+	GetSharedMetadataArea();
+
+	if (relationId == InvalidOid)
+	{
+		HASH_SEQ_STATUS status;
+		bool databaseHasRows = false;
+
+		/* as below, only take the exclusive lock if there is anything to drop */
+		LWLockAcquire(&SharedMetadataCacheState->lock, LW_SHARED);
+
+		hash_seq_init(&status, SharedShardRowsHash);
+
+		while ((shardRowsEntry = hash_seq_search(&status)) != NULL)
+		{
+			if (shardRowsEntry->key.databaseId == MyDatabaseId)
+			{
+				databaseHasRows = true;
+				hash_seq_term(&status);
+				break;
+			}
+		}
+
+		LWLockRelease(&SharedMetadataCacheState->lock);
+
+		if (!databaseHasRows)
+		{
+			return;
+		}
+
+		LWLockAcquire(&SharedMetadataCacheState->lock, LW_EXCLUSIVE);
+
+		hash_seq_init(&status, SharedShardRowsHash);
+
+		while ((shardRowsEntry = hash_seq_search(&status)) != NULL)
+		{
+			if (shardRowsEntry->key.databaseId == MyDatabaseId)
+			{
+				RemoveSharedShardRowsEntry(shardRowsEntry);
+			}
+		}
+
+		LWLockRelease(&SharedMetadataCacheState->lock);
+
+		return;
+	}
+
+	InitializeSharedShardRowsHashKey(&key, relationId);
+
+	/* most invalidations are for other relations, avoid the exclusive lock */
+	LWLockAcquire(&SharedMetadataCacheState->lock, LW_SHARED);
+	hash_search(SharedShardRowsHash, &key, HASH_FIND, &entryFound);
+	LWLockRelease(&SharedMetadataCacheState->lock);
+
+	if (!entryFound)
+	{
+		return;
+	}
+
+	LWLockAcquire(&SharedMetadataCacheState->lock, LW_EXCLUSIVE);
+
+	shardRowsEntry = hash_search(SharedShardRowsHash, &key, HASH_FIND, &entryFound);
+	if (entryFound)
+	{
+		RemoveSharedShardRowsEntry(shardRowsEntry);
+	}
+
+	LWLockRelease(&SharedMetadataCacheState->lock);
+}
+
+
+/*
+ * MarkSharedShardRowsModified records that the current transaction modified
+ * the metadata of the given distributed table. The transaction reads the rows
+ * of the table from the catalogs until it ends, and drops the shared rows of
+ * the table once it commits.
+ */
+void
+MarkSharedShardRowsModified(Oid relationId)
+{
+	MemoryContext oldContext = NULL;
+
+	if (SharedMetadataCacheState == NULL)
+	{
+		return;
+	}
+
+	if (list_member_oid(ModifiedRelationList, relationId))
+	{
+		return;
+	}
+
+	/* attach now, the commit callback should not need to allocate memory */
+	GetSharedMetadataArea();
+
+	oldContext = MemoryContextSwitchTo(TopTransactionContext);
+	ModifiedRelationList = lappend_oid(ModifiedRelationList, relationId);
+	MemoryContextSwitchTo(oldContext);
+}
+
+
+/*
+ * SharedMetadataCacheXactCallback drops the shared rows of the tables that
+ * the transaction modified once the changes are visible to other backends.
+ * Backends that read the catalogs before the commit might have shared rows
+ * that miss the changes, and they might do so before any backend processed
+ * the invalidations of the transaction.
+ *
+ * A prepared transaction is committed by COMMIT PREPARED, possibly in another
+ * backend, which does not know what the transaction modified. Dropping the
+ * rows on PREPARE would not help, since backends may share rows without the
+ * changes until they are committed. Rows that miss the changes can therefore
+ * be copied after COMMIT PREPARED until the backends process the invalidations
+ * of the transaction. Their relcache callbacks then drop the rows, and the
+ * cache entries are built again.
+ */
+static void
+SharedMetadataCacheXactCallback(XactEvent event, void *arg)
+{
+	switch (event)
+	{
+		case XACT_EVENT_COMMIT:
+		{
+			ListCell *relationIdCell = NULL;
+
+			foreach(relationIdCell, ModifiedRelationList)
+			{
+				InvalidateSharedShardRows(lfirst_oid(relationIdCell));
+			}
+
+			ModifiedRelationList = NIL;
+			break;
+		}
+
+		case XACT_EVENT_ABORT:
+		case XACT_EVENT_PREPARE:
+		{
+			/* the list is allocated in the transaction's memory context */
+			ModifiedRelationList = NIL;
+			break;
+		}
+
+		default:
+		{
+			break;
+		}
+	}
+}
+
+
+/*
+ * CopySharedShardRows copies the shared rows of the given entry into the
+ * current memory context and returns true, or returns false if the entry has
+ * no rows or if they were read from an earlier installation of the extension.
+ * The caller should hold the lock.
+ */
+static bool
+CopySharedShardRows(SharedShardRowsHashEntry *shardRowsEntry, Oid distShardRelationId,
+					CachedShardRow **shardRowArray, int *shardCount)
+{
+	char *sharedData = NULL;
+	SharedShardRowsHeader *header = NULL;
+	SharedShardRow *sharedRowArray = NULL;
+	SharedShardPlacement *sharedPlacementArray = NULL;
+	char *valueData = NULL;
+	CachedShardRow *rowArray = NULL;
+	int shardIndex = 0;
+
+	if (!DsaPointerIsValid(shardRowsEntry->shardRows))
+	{
+		return false;
+	}
+
+	sharedData = dsa_get_address(SharedMetadataArea, shardRowsEntry->shardRows);
+	header = (SharedShardRowsHeader *) sharedData;
+
+	if (header->distShardRelationId != distShardRelationId)
+	{
+		return false;
+	}
+
+	sharedRowArray = (SharedShardRow *) (sharedData +
+										 MAXALIGN(sizeof(SharedShardRowsHeader)));
+	sharedPlacementArray = (SharedShardPlacement *) (sharedData +
+													 header->placementOffset);
+	valueData = sharedData + header->valueOffset;
+
+	rowArray = palloc0(Max(header->shardCount, 1) * sizeof(CachedShardRow));
+
+	for (shardIndex = 0; shardIndex < header->shardCount; shardIndex++)
+	{
+		SharedShardRow *sharedRow = &sharedRowArray[shardIndex];
+		CachedShardRow *shardRow = &rowArray[shardIndex];
+		int placementIndex = 0;
+
+		shardRow->shardId = sharedRow->shardId;
+		shardRow->storageType = sharedRow->storageType;
+
+		if (sharedRow->minValueOffset >= 0)
+		{
+			shardRow->minValue = pstrdup(valueData + sharedRow->minValueOffset);
+			shardRow->maxValue = pstrdup(valueData + sharedRow->maxValueOffset);
+		}
+
+		for (placementIndex = 0; placementIndex < sharedRow->placementCount;
+			 placementIndex++)
+		{
+			SharedShardPlacement *sharedPlacement =
+				&sharedPlacementArray[sharedRow->placementIndex + placementIndex];
+			GroupShardPlacement *placement = CitusMakeNode(GroupShardPlacement);
+
+			placement->placementId = sharedPlacement->placementId;
+			placement->shardId = sharedPlacement->shardId;
+			placement->shardLength = sharedPlacement->shardLength;
+			placement->shardState = sharedPlacement->shardState;
+			placement->groupId = sharedPlacement->groupId;
+
+			shardRow->placementList = lappend(shardRow->placementList, placement);
+		}
+	}
+
+	*shardRowArray = rowArray;
+	*shardCount = header->shardCount;
+
+	return true;
+}
+
+
+/*
+ * SerializeShardRows writes the given shard rows into a single buffer in the
+ * layout of the shared rows, and sets serializedSize to its size.
+ */
+static char *
+SerializeShardRows(CachedShardRow *shardRowArray, int shardCount,
+				   Oid distShardRelationId, Size *serializedSize)
+{
+	SharedShardRowsHeader *header = NULL;
+	SharedShardRow *sharedRowArray = NULL;
+	SharedShardPlacement *sharedPlacementArray = NULL;
+	char *serializedRows = NULL;
+	char *valueData = NULL;
+	Size valueSize = 0;
+	Size valueOffset = 0;
+	int placementCount = 0;
+	int placementIndex = 0;
+	int shardIndex = 0;
+
+	for (shardIndex = 0; shardIndex < shardCount; shardIndex++)
+	{
+		CachedShardRow *shardRow = &shardRowArray[shardIndex];
+
+		if (shardRow->minValue != NULL)
+		{
+			valueSize += strlen(shardRow->minValue) + 1;
+			valueSize += strlen(shardRow->maxValue) + 1;
+		}
+
+		placementCount += list_length(shardRow->placementList);
+	}
+
+	*serializedSize = MAXALIGN(sizeof(SharedShardRowsHeader));
+	*serializedSize += MAXALIGN(shardCount * sizeof(SharedShardRow));
+	*serializedSize += MAXALIGN(placementCount * sizeof(SharedShardPlacement));
+	*serializedSize += valueSize;
+
+	serializedRows = palloc0(*serializedSize);
+
+	header = (SharedShardRowsHeader *) serializedRows;
+	header->distShardRelationId = distShardRelationId;
+	header->shardCount = shardCount;
+	header->placementCount = placementCount;
+	header->placementOffset = MAXALIGN(sizeof(SharedShardRowsHeader)) +
+							  MAXALIGN(shardCount * sizeof(SharedShardRow));
+	header->valueOffset = header->placementOffset +
+						  MAXALIGN(placementCount * sizeof(SharedShardPlacement));
+
+	sharedRowArray = (SharedShardRow *) (serializedRows +
+										 MAXALIGN(sizeof(SharedShardRowsHeader)));
+	sharedPlacementArray = (SharedShardPlacement *) (serializedRows +
+													 header->placementOffset);
+	valueData = serializedRows + header->valueOffset;
+
+	for (shardIndex = 0; shardIndex < shardCount; shardIndex++)
+	{
+		CachedShardRow *shardRow = &shardRowArray[shardIndex];
+		SharedShardRow *sharedRow = &sharedRowArray[shardIndex];
+		ListCell *placementCell = NULL;
+
+		sharedRow->shardId = shardRow->shardId;
+		sharedRow->storageType = shardRow->storageType;
+		sharedRow->minValueOffset = -1;
+		sharedRow->maxValueOffset = -1;
+
+		if (shardRow->minValue != NULL)
+		{
+			Size minValueSize = strlen(shardRow->minValue) + 1;
+			Size maxValueSize = strlen(shardRow->maxValue) + 1;
+
+			memcpy(valueData + valueOffset, shardRow->minValue, minValueSize);
+			sharedRow->minValueOffset = valueOffset;
+			valueOffset += minValueSize;
+
+			memcpy(valueData + valueOffset, shardRow->maxValue, maxValueSize);
+			sharedRow->maxValueOffset = valueOffset;
+			valueOffset += maxValueSize;
+		}
+
+		sharedRow->placementIndex = placementIndex;
+		sharedRow->placementCount = list_length(shardRow->placementList);
+
+		foreach(placementCell, shardRow->placementList)
+		{
+			GroupShardPlacement *placement = lfirst(placementCell);
+			SharedShardPlacement *sharedPlacement =
+				&sharedPlacementArray[placementIndex];
+
+			sharedPlacement->placementId = placement->placementId;
+			sharedPlacement->shardId = placement->shardId;
+			sharedPlacement->shardLength = placement->shardLength;
+			sharedPlacement->shardState = placement->shardState;
+			sharedPlacement->groupId = placement->groupId;
+
+			placementIndex++;
+		}
+	}
+
+	return serializedRows;
+}
+
+
+/*
+ * AllocateSharedShardRows allocates memory of the given size in the shared
+ * area. If the area is full, it drops the rows of other tables until the
+ * allocation succeeds. The function returns InvalidDsaPointer if the rows do
+ * not fit even then. The caller should hold the lock exclusively.
+ */
+static dsa_pointer
+AllocateSharedShardRows(SharedShardRowsHashKey *key, Size size)
+{
+	SharedShardRowsHashEntry *shardRowsEntry = NULL;
+	HASH_SEQ_STATUS status;
+	int allocationFlags = DSA_ALLOC_NO_OOM | DSA_ALLOC_HUGE;
+	dsa_pointer shardRows = dsa_allocate_extended(SharedMetadataArea, size,
+												  allocationFlags);
+
+	if (DsaPointerIsValid(shardRows))
+	{
+		return shardRows;
+	}
+
+	hash_seq_init(&status, SharedShardRowsHash);
+
+	while ((shardRowsEntry = hash_seq_search(&status)) != NULL)
+	{
+		if (memcmp(&shardRowsEntry->key, key, sizeof(SharedShardRowsHashKey)) == 0 ||
+			!DsaPointerIsValid(shardRowsEntry->shardRows))
+		{
+			continue;
+		}
+
+		RemoveSharedShardRowsEntry(shardRowsEntry);
+
+		shardRows = dsa_allocate_extended(SharedMetadataArea, size, allocationFlags);
+		if (DsaPointerIsValid(shardRows))
+		{
+			hash_seq_term(&status);
+			break;
+		}
+	}
+
+	return shardRows;
+}
+
+
+/*
+ * RemoveSharedShardRowsEntry frees the shared rows of the given entry and
+ * removes the entry. Since versions are never reused, backends that read the
+ * version of the entry will not share their rows anymore. The caller should
+ * hold the lock exclusively.
+ */
+static void
+RemoveSharedShardRowsEntry(SharedShardRowsHashEntry *shardRowsEntry)
+{
+	bool entryFound = false;
+
+	if (DsaPointerIsValid(shardRowsEntry->shardRows))
+	{
+		dsa_free(SharedMetadataArea, shardRowsEntry->shardRows);
+	}
+
+	hash_search(SharedShardRowsHash, &shardRowsEntry->key, HASH_REMOVE, &entryFound);
+}
+
+
+/*
+ * InitializeSharedShardRowsHashKey fills the hash key of the given relation
+ * in the current database.
+ */
+static void
+InitializeSharedShardRowsHashKey(SharedShardRowsHashKey *key, Oid relationId)
+{
+	/* the hash uses binary keys, so zero out the padding */
+	memset(key, 0, sizeof(SharedShardRowsHashKey));
+
+	key->databaseId = MyDatabaseId;
+	key->relationId = relationId;
+}
+
+
+/*
+ * GetSharedMetadataArea attaches to the shared area that keeps the rows, if
+ * the backend did not do so yet, and returns it.
+ */
+static dsa_area *
+GetSharedMetadataArea(void)
+{
+	if (SharedMetadataArea == NULL)
+	{
+		MemoryContext oldContext = MemoryContextSwitchTo(TopMemoryContext);
+		void *areaPlace = SharedMetadataAreaPlace();
+
+		SharedMetadataArea = dsa_attach_in_place(areaPlace, NULL);
+		dsa_pin_mapping(SharedMetadataArea);
+
+		on_shmem_exit(dsa_on_shmem_exit_release_in_place, PointerGetDatum(areaPlace));
+
+		MemoryContextSwitchTo(oldContext);
+	}
+
+	return SharedMetadataArea;
+}
+
+
+/*
+ * SharedMetadataCacheShmemInit is the callback that is to be called on shared
+ * memory startup hook. The function sets up the lock, the hash of the tables
+ * and the area that keeps their rows.
+ */
+static void
+SharedMetadataCacheShmemInit(void)
+{
+	bool alreadyInitialized = false;
+	HASHCTL info;
+
+	/* we may update the shmem, acquire lock exclusively */
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+	SharedMetadataCacheState =
+		(SharedMetadataCacheData *) ShmemInitStruct(
+			"Shared Metadata Cache Data",
+			MAXALIGN(sizeof(SharedMetadataCacheData)) + SharedMetadataAreaSize(),
+			&alreadyInitialized);
+
+	if (!alreadyInitialized)
+	{
+		dsa_area *area = NULL;
+
+		SharedMetadataCacheState->trancheId = LWLockNewTrancheId();
+		SharedMetadataCacheState->trancheName = "Shared Metadata Cache Tranche";
+		SharedMetadataCacheState->lastSnapshotVersion = 0;
+
+		LWLockInitialize(&SharedMetadataCacheState->lock,
+						 SharedMetadataCacheState->trancheId);
+
+		area = dsa_create_in_place(SharedMetadataAreaPlace(), SharedMetadataAreaSize(),
+								   SharedMetadataCacheState->trancheId, NULL);
+
+		/* never grow beyond the reserved memory, so we do not need DSM segments */
+		dsa_set_size_limit(area, SharedMetadataAreaSize());
+		dsa_pin(area);
+		dsa_detach(area);
+	}
+
+	/* tranche names are registered per process */
+	LWLockRegisterTranche(SharedMetadataCacheState->trancheId,
+						  SharedMetadataCacheState->trancheName);
+
+	memset(&info, 0, sizeof(info));
+	info.keysize = sizeof(SharedShardRowsHashKey);
+	info.entrysize = sizeof(SharedShardRowsHashEntry);
+
+	SharedShardRowsHash = ShmemInitHash("Shared Shard Rows Hash",
+										SHARED_METADATA_CACHE_RELATIONS,
+										SHARED_METADATA_CACHE_RELATIONS,
+										&info, HASH_ELEM | HASH_BLOBS);
+
+	LWLockRelease(AddinShmemInitLock);
+
+	if (prev_shmem_startup_hook != NULL)
+	{
+		prev_shmem_startup_hook();
+	}
+}
+
+
+/*
+ * SharedMetadataCacheShmemSize returns the size that should be allocated on
+ * the shared memory for the shared metadata cache.
+ */
+static size_t
+SharedMetadataCacheShmemSize(void)
+{
+	Size size = 0;
+
+	size = add_size(size, MAXALIGN(sizeof(SharedMetadataCacheData)));
+	size = add_size(size, SharedMetadataAreaSize());
+	size = add_size(size, hash_estimate_size(SHARED_METADATA_CACHE_RELATIONS,
+											 sizeof(SharedShardRowsHashEntry)));
+
+	return size;
+}
+
+
+/*
+ * SharedMetadataAreaSize returns the size of the area that keeps the rows,
+ * which is at least the size that a shared area requires.
+ */
+static size_t
+SharedMetadataAreaSize(void)
+{
+	Size areaSize = (Size) SharedMetadataCacheSize * 1024;
+
+	return Max(areaSize, dsa_minimum_size());
+}
+
+
+/*
+ * SharedMetadataAreaPlace returns the address of the area that keeps the
+ * rows, which follows SharedMetadataCacheData in shared memory.
+ */
+static void *
+SharedMetadataAreaPlace(void)
+{
+	return ((char *) SharedMetadataCacheState) +
+		   MAXALIGN(sizeof(SharedMetadataCacheData));
+}
@@ -53,6 +53,8 @@ PG_FUNCTION_INFO_V1(task_tracker_assign_task);
 PG_FUNCTION_INFO_V1(task_tracker_task_status);
 PG_FUNCTION_INFO_V1(task_tracker_cleanup_job);
 PG_FUNCTION_INFO_V1(task_tracker_conninfo_cache_invalidate);
+PG_FUNCTION_INFO_V1(worker_create_schema);
+PG_FUNCTION_INFO_V1(worker_repartition_cleanup);
 
 
 /*
@@ -249,6 +251,80 @@ task_tracker_cleanup_job(PG_FUNCTION_ARGS)
 }
 
 
+/*
+ * worker_create_schema creates the schema of the given job if it does not
+ * already exist. The adaptive executor calls this function on all nodes before
+ * it runs the merge tasks of a repartition join, which create their tables in
+ * the job schema.
+ */
+Datum
+worker_create_schema(PG_FUNCTION_ARGS)
+{
+	uint64 jobId = PG_GETARG_INT64(0);
+
+	StringInfo jobSchemaName = JobSchemaName(jobId);
+	bool schemaExists = false;
+
+	CheckCitusVersion(ERROR);
+
+	/* see the comment in task_tracker_assign_task for the lock handling */
+	LockJobResource(jobId, AccessExclusiveLock);
+	schemaExists = JobSchemaExists(jobSchemaName);
+	if (!schemaExists)
+	{
+		CreateJobSchema(jobSchemaName);
+	}
+	else
+	{
+		Oid schemaId = get_namespace_oid(jobSchemaName->data, false);
+
+		EnsureSchemaOwner(schemaId);
+
+		UnlockJobResource(jobId, AccessExclusiveLock);
+	}
+
+	PG_RETURN_VOID();
+}
+
+
+/*
+ * worker_repartition_cleanup removes the job directory and the job schema of
+ * a repartition join that was executed without the task tracker, and hence
+ * has no tasks in the shared hash.
+ */
+Datum
+worker_repartition_cleanup(PG_FUNCTION_ARGS)
+{
+	uint64 jobId = PG_GETARG_INT64(0);
+
+	StringInfo jobDirectoryName = NULL;
+	StringInfo jobSchemaName = NULL;
+	bool schemaExists = false;
+
+	CheckCitusVersion(ERROR);
+
+	jobSchemaName = JobSchemaName(jobId);
+
+	LockJobResource(jobId, AccessExclusiveLock);
+
+	schemaExists = JobSchemaExists(jobSchemaName);
+	if (schemaExists)
+	{
+		Oid schemaId = get_namespace_oid(jobSchemaName->data, false);
+
+		EnsureSchemaOwner(schemaId);
+	}
+
+	jobDirectoryName = JobDirectoryName(jobId);
+	CitusRemoveDirectory(jobDirectoryName);
+
+	RemoveJobSchema(jobSchemaName);
+	UnlockJobResource(jobId, AccessExclusiveLock);
+
+	PG_RETURN_VOID();
+}
+
+
 /*
  * task_tracker_conninfo_cache_invalidate is a trigger function that signals to
  * the task tracker to refresh its conn params cache after a authinfo change.
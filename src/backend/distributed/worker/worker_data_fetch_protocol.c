@@ -19,6 +19,9 @@
 #include <unistd.h>
 #include <sys/stat.h>
 
+#if PG_VERSION_NUM >= 120000
+#include "access/table.h"
+#endif
 #include "access/xact.h"
 #include "catalog/dependency.h"
 #include "catalog/namespace.h"
@@ -27,8 +30,10 @@
 #include "commands/extension.h"
 #include "commands/sequence.h"
 #include "distributed/citus_ruleutils.h"
+#include "distributed/commands/hybrid_copy.h"
 #include "distributed/commands/utility_hook.h"
 #include "distributed/connection_management.h"
+#include "distributed/master_metadata_utility.h"
 #include "distributed/master_protocol.h"
 #include "distributed/metadata_cache.h"
 #include "distributed/multi_client_executor.h"
@@ -43,16 +48,52 @@
 #include "distributed/worker_protocol.h"
 #include "distributed/version_compat.h"
 #include "nodes/makefuncs.h"
+#include "pgstat.h"
+#include "storage/latch.h"
 #include "storage/lmgr.h"
 #include "tcop/tcopprot.h"
 #include "tcop/utility.h"
 #include "utils/builtins.h"
 #include "utils/lsyscache.h"
 #include "utils/regproc.h"
+#include "utils/rel.h"
 #include "utils/varlena.h"
 
 
+/*
+ * PartitionStreamState keeps the state of the partition file that is being
+ * streamed into a merge table. COPY's data source callback does not take an
+ * argument, so the state is kept in a static variable.
+ */
+typedef struct PartitionStreamState
+{
+	MultiConnection *connection;
+	char *buffer;
+	int bufferLength;
+	int bufferOffset;
+	bool copyDone;
+} PartitionStreamState;
+
+
+static PartitionStreamState *CurrentPartitionStream = NULL;
+
+
 /* Local functions forward declarations */
+static void FetchPartitionFileIntoTaskDirectory(uint64 jobId, uint32 partitionTaskId,
+												uint32 partitionFileId,
+												uint32 upstreamTaskId,
+												const char *nodeName,
+												uint32 nodePort);
+static Oid MergeTableRelationId(uint64 jobId, uint32 mergeTaskId);
+static uint64 StreamPartitionFileIntoTable(const char *nodeName, uint32 nodePort,
+										   StringInfo remoteFilename, Oid relationId,
+										   bool mergeTable);
+static void StartPartitionFileTransmit(MultiConnection *connection,
+									   StringInfo remoteFilename);
+static uint64 CopyPartitionStreamIntoTable(MultiConnection *connection,
+										   Oid relationId, bool mergeTable);
+static int ReadPartitionStreamData(void *outbuf, int minread, int maxread);
+static bool ReceivePartitionStreamBuffer(PartitionStreamState *streamState);
 static void FetchRegularFileAsSuperUser(const char *nodeName, uint32 nodePort,
 										StringInfo remoteFilename,
 										StringInfo localFilename);
@@ -69,6 +110,8 @@ static void SetDefElemArg(AlterSeqStmt *statement, const char *name, Node *arg);
 
 /* exports for SQL callable functions */
 PG_FUNCTION_INFO_V1(worker_fetch_partition_file);
+PG_FUNCTION_INFO_V1(worker_stream_partition_file);
+PG_FUNCTION_INFO_V1(worker_load_partition_files);
 PG_FUNCTION_INFO_V1(worker_apply_shard_ddl_command);
 PG_FUNCTION_INFO_V1(worker_apply_inter_shard_ddl_command);
 PG_FUNCTION_INFO_V1(worker_apply_sequence_command);
@@ -100,6 +143,124 @@ worker_fetch_partition_file(PG_FUNCTION_ARGS)
 	uint32 nodePort = PG_GETARG_UINT32(5);
 	char *nodeName = NULL;
 
+	CheckCitusVersion(ERROR);
+
+	nodeName = text_to_cstring(nodeNameText);
+
+	FetchPartitionFileIntoTaskDirectory(jobId, partitionTaskId, partitionFileId,
+										upstreamTaskId, nodeName, nodePort);
+
+	PG_RETURN_VOID();
+}
+
+
+/*
+ * worker_stream_partition_file takes the same arguments as
+ * worker_fetch_partition_file, and streams the partition file from the remote
+ * node directly into the table of the upstream merge task, without writing it
+ * to local disk first. The merge task must have created its table before, so
+ * the function errors out if the table does not exist.
+ */
+Datum
+worker_stream_partition_file(PG_FUNCTION_ARGS)
+{
+	uint64 jobId = PG_GETARG_INT64(0);
+	uint32 partitionTaskId = PG_GETARG_UINT32(1);
+	uint32 partitionFileId = PG_GETARG_UINT32(2);
+	uint32 upstreamTaskId = PG_GETARG_UINT32(3);
+	text *nodeNameText = PG_GETARG_TEXT_P(4);
+	uint32 nodePort = PG_GETARG_UINT32(5);
+	char *nodeName = NULL;
+	Oid relationId = InvalidOid;
+
+	/* remote filename is <jobId>/<partitionTaskId>/<partitionFileId> */
+	StringInfo remoteDirectoryName = TaskDirectoryName(jobId, partitionTaskId);
+	StringInfo remoteFilename = PartitionFilename(remoteDirectoryName, partitionFileId);
+
+	CheckCitusVersion(ERROR);
+
+	nodeName = text_to_cstring(nodeNameText);
+
+	relationId = MergeTableRelationId(jobId, upstreamTaskId);
+	if (!OidIsValid(relationId))
+	{
+		ereport(ERROR, (errmsg("could not stream partition file into merge task %u "
+							   "of job " UINT64_FORMAT, upstreamTaskId, jobId),
+						errdetail("The table of the merge task does not exist.")));
+	}
+
+	/* the merge table is created by the same user that runs the fetches */
+	EnsureTableOwner(relationId);
+
+	StreamPartitionFileIntoTable(nodeName, nodePort, remoteFilename, relationId, true);
+
+	PG_RETURN_VOID();
+}
+
+
+/*
+ * worker_load_partition_files streams the partition file with the given id
+ * from each of the given nodes into the given table, and returns the number of
+ * loaded rows. The partition files are written by the map tasks of
+ * master_load_local_files(), where the task on the n'th node has task id n.
+ * Since the rows are loaded in the transaction of the caller, the function
+ * can load into shard placements within a distributed transaction.
+ */
+Datum
+worker_load_partition_files(PG_FUNCTION_ARGS)
+{
+	uint64 jobId = PG_GETARG_INT64(0);
+	uint32 partitionFileId = PG_GETARG_UINT32(1);
+	Oid relationId = PG_GETARG_OID(2);
+	ArrayType *nodeNameObject = PG_GETARG_ARRAYTYPE_P(3);
+	ArrayType *nodePortObject = PG_GETARG_ARRAYTYPE_P(4);
+
+	Datum *nodeNameArray = DeconstructArrayObject(nodeNameObject);
+	Datum *nodePortArray = DeconstructArrayObject(nodePortObject);
+	int32 nodeNameCount = ArrayObjectCount(nodeNameObject);
+	int32 nodePortCount = ArrayObjectCount(nodePortObject);
+	int32 nodeIndex = 0;
+	uint64 loadedRowCount = 0;
+
+	CheckCitusVersion(ERROR);
+
+	if (nodeNameCount != nodePortCount)
+	{
+		ereport(ERROR, (errmsg("node name array size: %d and node port array size: %d"
+							   " do not match", nodeNameCount, nodePortCount)));
+	}
+
+	EnsureTablePermissions(relationId, ACL_INSERT);
+
+	for (nodeIndex = 0; nodeIndex < nodeNameCount; nodeIndex++)
+	{
+		char *nodeName = TextDatumGetCString(nodeNameArray[nodeIndex]);
+		uint32 nodePort = DatumGetInt32(nodePortArray[nodeIndex]);
+		uint32 partitionTaskId = nodeIndex + 1;
+
+		/* remote filename is <jobId>/<partitionTaskId>/<partitionFileId> */
+		StringInfo remoteDirectoryName = TaskDirectoryName(jobId, partitionTaskId);
+		StringInfo remoteFilename = PartitionFilename(remoteDirectoryName,
+													  partitionFileId);
+
+		loadedRowCount += StreamPartitionFileIntoTable(nodeName, nodePort,
+													   remoteFilename, relationId,
+													   false);
+	}
+
+	PG_RETURN_INT64(loadedRowCount);
+}
+
+
+/*
+ * FetchPartitionFileIntoTaskDirectory fetches a partition file from the remote
+ * node directly into the upstream task's directory.
+ */
+static void
+FetchPartitionFileIntoTaskDirectory(uint64 jobId, uint32 partitionTaskId,
+									uint32 partitionFileId, uint32 upstreamTaskId,
+									const char *nodeName, uint32 nodePort)
+{
 	/* remote filename is <jobId>/<partitionTaskId>/<partitionFileId> */
 	StringInfo remoteDirectoryName = TaskDirectoryName(jobId, partitionTaskId);
 	StringInfo remoteFilename = PartitionFilename(remoteDirectoryName, partitionFileId);
@@ -113,20 +274,304 @@ worker_fetch_partition_file(PG_FUNCTION_ARGS)
 	 * task directory does not exist. We then lock and create the directory.
 	 */
 	bool taskDirectoryExists = DirectoryExists(taskDirectoryName);
-
-	CheckCitusVersion(ERROR);
-
 	if (!taskDirectoryExists)
 	{
 		InitTaskDirectory(jobId, upstreamTaskId);
 	}
 
-	nodeName = text_to_cstring(nodeNameText);
-
 	/* we've made sure the file names are sanitized, safe to fetch as superuser */
 	FetchRegularFileAsSuperUser(nodeName, nodePort, remoteFilename, taskFilename);
+}
 
-	PG_RETURN_VOID();
+
+/*
+ * MergeTableRelationId returns the relation id of the table of the given merge
+ * task, or InvalidOid if the merge task did not create its table yet.
+ */
+static Oid
+MergeTableRelationId(uint64 jobId, uint32 mergeTaskId)
+{
+	StringInfo jobSchemaName = JobSchemaName(jobId);
+	StringInfo taskTableName = TaskTableName(mergeTaskId);
+	bool missingOK = true;
+
+	Oid schemaId = get_namespace_oid(jobSchemaName->data, missingOK);
+	if (!OidIsValid(schemaId))
+	{
+		return InvalidOid;
+	}
+
+	return get_relname_relid(taskTableName->data, schemaId);
+}
+
+
+/*
+ * StreamPartitionFileIntoTable connects to the given node as superuser to get
+ * file access, copies the contents of the given partition file into the given
+ * table as they arrive over the connection, and returns the number of copied
+ * rows. Callers must make sure that the file name is sanitized. mergeTable
+ * tells whether the table is the merge table of a repartition job.
+ */
+static uint64
+StreamPartitionFileIntoTable(const char *nodeName, uint32 nodePort,
+							 StringInfo remoteFilename, Oid relationId, bool mergeTable)
+{
+	char *nodeUser = CitusExtensionOwnerName();
+	uint32 connectionFlags = FORCE_NEW_CONNECTION;
+	uint64 copiedRowCount = 0;
+
+	MultiConnection *connection =
+		GetNodeUserDatabaseConnection(connectionFlags, nodeName, nodePort, nodeUser,
+									  NULL);
+
+	PG_TRY();
+	{
+		StartPartitionFileTransmit(connection, remoteFilename);
+		copiedRowCount = CopyPartitionStreamIntoTable(connection, relationId,
+													  mergeTable);
+	}
+	PG_CATCH();
+	{
+		/* the connection might be in the middle of a copy, do not reuse it */
+		CurrentPartitionStream = NULL;
+		CloseConnection(connection);
+
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	CloseConnection(connection);
+
+	ereport(DEBUG2, (errmsg("streamed " UINT64_FORMAT " rows of remote file \"%s\" "
+							"into table \"%s\"", copiedRowCount,
+							remoteFilename->data, get_rel_name(relationId))));
+
+	return copiedRowCount;
+}
+
+
+/*
+ * StartPartitionFileTransmit sends the command that transmits the given file
+ * over the given connection, and waits until the remote node starts the copy.
+ */
+static void
+StartPartitionFileTransmit(MultiConnection *connection, StringInfo remoteFilename)
+{
+	StringInfo transmitCommand = makeStringInfo();
+	char *userName = CurrentUserName();
+	bool raiseInterrupts = true;
+	PGresult *result = NULL;
+
+	if (PQstatus(connection->pgConn) != CONNECTION_OK)
+	{
+		ReportConnectionError(connection, ERROR);
+	}
+
+	appendStringInfo(transmitCommand, TRANSMIT_WITH_USER_COMMAND, remoteFilename->data,
+					 quote_literal_cstr(userName));
+
+	if (!SendRemoteCommand(connection, transmitCommand->data))
+	{
+		ReportConnectionError(connection, ERROR);
+	}
+
+	result = GetRemoteCommandResult(connection, raiseInterrupts);
+	if (PQresultStatus(result) != PGRES_COPY_OUT)
+	{
+		ReportResultError(connection, result, ERROR);
+	}
+
+	PQclear(result);
+}
+
+
+/*
+ * CopyPartitionStreamIntoTable copies the data that the remote node sends
+ * over the given connection into the given table, in the format that the
+ * partition files are written in, and returns the number of copied rows.
+ * Partition files for merge tables with a mix of column types that can and
+ * cannot use the binary format are in the hybrid row format.
+ */
+static uint64
+CopyPartitionStreamIntoTable(MultiConnection *connection, Oid relationId,
+							 bool mergeTable)
+{
+	PartitionStreamState streamState;
+	Relation relation = NULL;
+	CopyState copyState = NULL;
+	List *copyOptions = NIL;
+	uint64 copiedRowCount = 0;
+
+	memset(&streamState, 0, sizeof(PartitionStreamState));
+	streamState.connection = connection;
+
+	if (BinaryWorkerCopyFormat)
+	{
+		DefElem *copyOption = makeDefElem("format", (Node *) makeString("binary"), -1);
+		copyOptions = list_make1(copyOption);
+	}
+
+	relation = heap_open(relationId, RowExclusiveLock);
+
+	CurrentPartitionStream = &streamState;
+
+	if (mergeTable && BinaryWorkerCopyFormat &&
+		HybridTextColumns(RelationGetDescr(relation)) != NULL)
+	{
+		copiedRowCount = CopyHybridDataIntoRelation(relation, NULL,
+													ReadPartitionStreamData);
+	}
+	else
+	{
+		copyState = BeginCopyFrom(NULL, relation, NULL, false, ReadPartitionStreamData,
+								  NIL, copyOptions);
+		copiedRowCount = CopyFrom(copyState);
+		EndCopyFrom(copyState);
+	}
+
+	CurrentPartitionStream = NULL;
+
+	heap_close(relation, NoLock);
+
+	/* the remote node reports the end of the copy after the last row */
+	if (!streamState.copyDone)
+	{
+		ereport(ERROR, (errmsg("could not read the end of the partition file "
+							   "from %s:%d", connection->hostname,
+							   connection->port)));
+	}
+
+	CommandCounterIncrement();
+
+	return copiedRowCount;
+}
+
+
+/*
+ * ReadPartitionStreamData is the data source callback of COPY for partition
+ * files that are streamed into a merge table. The function reads at least
+ * minread and at most maxread bytes into outbuf, unless the remote node
+ * finished the copy, and returns the number of bytes read.
+ */
+static int
+ReadPartitionStreamData(void *outbuf, int minread, int maxread)
+{
+	PartitionStreamState *streamState = CurrentPartitionStream;
+	int bytesRead = 0;
+
+	Assert(streamState != NULL);
+
+	while (bytesRead < minread)
+	{
+		int bytesAvailable = streamState->bufferLength - streamState->bufferOffset;
+		int bytesToCopy = 0;
+
+		if (bytesAvailable == 0)
+		{
+			if (!ReceivePartitionStreamBuffer(streamState))
+			{
+				break;
+			}
+
+			continue;
+		}
+
+		bytesToCopy = Min(bytesAvailable, maxread - bytesRead);
+		memcpy((char *) outbuf + bytesRead,
+			   streamState->buffer + streamState->bufferOffset, bytesToCopy);
+
+		streamState->bufferOffset += bytesToCopy;
+		bytesRead += bytesToCopy;
+	}
+
+	return bytesRead;
+}
+
+
+/*
+ * ReceivePartitionStreamBuffer receives the next copy data message from the
+ * remote node into the buffer of the given stream, waiting for the message
+ * if necessary. The function returns false once the remote node finished the
+ * copy.
+ */
+static bool
+ReceivePartitionStreamBuffer(PartitionStreamState *streamState)
+{
+	MultiConnection *connection = streamState->connection;
+	PGconn *pgConn = connection->pgConn;
+	const int asynchronous = 1;
+
+	if (streamState->copyDone)
+	{
+		return false;
+	}
+
+	if (streamState->buffer != NULL)
+	{
+		PQfreemem(streamState->buffer);
+		streamState->buffer = NULL;
+		streamState->bufferLength = 0;
+		streamState->bufferOffset = 0;
+	}
+
+	while (true)
+	{
+		char *receiveBuffer = NULL;
+		int receiveLength = PQgetCopyData(pgConn, &receiveBuffer, asynchronous);
+		int waitFlags = WL_LATCH_SET | WL_SOCKET_READABLE | WL_POSTMASTER_DEATH;
+		int rc = 0;
+
+		if (receiveLength > 0)
+		{
+			streamState->buffer = receiveBuffer;
+			streamState->bufferLength = receiveLength;
+			streamState->bufferOffset = 0;
+
+			return true;
+		}
+		else if (receiveLength == -1)
+		{
+			/* received copy done message */
+			bool raiseInterrupts = true;
+			PGresult *result = GetRemoteCommandResult(connection, raiseInterrupts);
+
+			if (PQresultStatus(result) != PGRES_COMMAND_OK)
+			{
+				ReportResultError(connection, result, ERROR);
+			}
+
+			PQclear(result);
+			ForgetResults(connection);
+
+			streamState->copyDone = true;
+
+			return false;
+		}
+		else if (receiveLength == -2)
+		{
+			ReportConnectionError(connection, ERROR);
+		}
+
+		/* we cannot read more data without blocking, wait for the socket */
+		rc = WaitLatchOrSocket(MyLatch, waitFlags, PQsocket(pgConn), -1,
+							   PG_WAIT_EXTENSION);
+
+		if (rc & WL_POSTMASTER_DEATH)
+		{
+			ereport(ERROR, (errmsg("postmaster was shut down, exiting")));
+		}
+
+		if (rc & WL_LATCH_SET)
+		{
+			ResetLatch(MyLatch);
+			CHECK_FOR_INTERRUPTS();
+		}
+
+		if (PQconsumeInput(pgConn) == 0)
+		{
+			ReportConnectionError(connection, ERROR);
+		}
+	}
 }
 
 
@@ -28,6 +28,8 @@
 #include "commands/copy.h"
 #include "commands/tablecmds.h"
 #include "common/string.h"
+#include "distributed/commands/hybrid_copy.h"
+#include "distributed/commands/multi_copy.h"
 #include "distributed/metadata_cache.h"
 #include "distributed/worker_protocol.h"
 #include "distributed/version_compat.h"
@@ -37,6 +39,7 @@
 #include "storage/lmgr.h"
 #include "utils/acl.h"
 #include "utils/builtins.h"
+#include "utils/rel.h"
 #include "utils/snapmgr.h"
 #include "utils/syscache.h"
 
@@ -130,6 +133,16 @@ worker_merge_files_into_table(PG_FUNCTION_ARGS)
 
 	CreateTaskTable(jobSchemaName, taskTableName, columnNameList, columnTypeList);
 
+	/*
+	 * When partition files are streamed into the task table, the table is
+	 * created before any files are fetched, and there might be no task
+	 * directory yet.
+	 */
+	if (!DirectoryExists(taskDirectoryName))
+	{
+		PG_RETURN_VOID();
+	}
+
 	/* need superuser to copy from files */
 	GetUserIdAndSecContext(&savedUserId, &savedSecurityContext);
 	SetUserIdAndSecContext(CitusExtensionOwner(), SECURITY_LOCAL_USERID_CHANGE);
@@ -536,6 +549,7 @@ CopyTaskFilesFromDirectory(StringInfo schemaName, StringInfo relationName,
 	struct dirent *directoryEntry = NULL;
 	uint64 copiedRowTotal = 0;
 	StringInfo expectedFileSuffix = makeStringInfo();
+	Relation hybridRelation = NULL;
 
 	DIR *directory = AllocateDir(directoryName);
 	if (directory == NULL)
@@ -546,6 +560,34 @@ CopyTaskFilesFromDirectory(StringInfo schemaName, StringInfo relationName,
 
 	appendStringInfo(expectedFileSuffix, ".%u", userId);
 
+	/*
+	 * Partition files of tables that mix types which can and cannot use the binary
+	 * format are in the hybrid row format, which COPY cannot read.
+	 */
+	if (BinaryWorkerCopyFormat)
+	{
+		RangeVar *mergeRelationVar = makeRangeVar(schemaName->data, relationName->data,
+												  -1);
+		Relation mergeRelation = heap_openrv(mergeRelationVar, RowExclusiveLock);
+
+		if (HybridTextColumns(RelationGetDescr(mergeRelation)) != NULL)
+		{
+			AclResult aclResult = pg_class_aclcheck(RelationGetRelid(mergeRelation),
+													GetUserId(), ACL_INSERT);
+			if (aclResult != ACLCHECK_OK)
+			{
+				aclcheck_error(aclResult, ACLCHECK_OBJECT_TABLE,
+							   RelationGetRelationName(mergeRelation));
+			}
+
+			hybridRelation = mergeRelation;
+		}
+		else
+		{
+			heap_close(mergeRelation, NoLock);
+		}
+	}
+
 	directoryEntry = ReadDir(directory, directoryName);
 	for (; directoryEntry != NULL; directoryEntry = ReadDir(directory, directoryName))
 	{
@@ -579,6 +621,14 @@ CopyTaskFilesFromDirectory(StringInfo schemaName, StringInfo relationName,
 		fullFilename = makeStringInfo();
 		appendStringInfo(fullFilename, "%s/%s", directoryName, baseFilename);
 
+		if (hybridRelation != NULL)
+		{
+			copiedRowTotal += CopyHybridDataIntoRelation(hybridRelation,
+														 fullFilename->data, NULL);
+			CommandCounterIncrement();
+			continue;
+		}
+
 		/* build relation object and copy statement */
 		relation = makeRangeVar(schemaName->data, relationName->data, -1);
 		copyStatement = CopyStatement(relation, fullFilename->data);
@@ -605,6 +655,11 @@ CopyTaskFilesFromDirectory(StringInfo schemaName, StringInfo relationName,
 	ereport(DEBUG2, (errmsg("copied " UINT64_FORMAT " rows into table: \"%s.%s\"",
 							copiedRowTotal, schemaName->data, relationName->data)));
 
+	if (hybridRelation != NULL)
+	{
+		heap_close(hybridRelation, NoLock);
+	}
+
 	FreeDir(directory);
 }
 
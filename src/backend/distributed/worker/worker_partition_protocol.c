@@ -20,6 +20,7 @@
 #include "pgstat.h"
 
 #include <arpa/inet.h>
+#include <glob.h>
 #include <netinet/in.h>
 #include <sys/stat.h>
 #include <math.h>
@@ -30,19 +31,27 @@
 #include "access/htup_details.h"
 #include "access/nbtree.h"
 #include "catalog/pg_am.h"
+#include "catalog/pg_authid.h"
 #include "catalog/pg_collation.h"
 #include "catalog/pg_type.h"
 #include "commands/copy.h"
 #include "commands/defrem.h"
+#include "commands/tablecmds.h"
 #include "distributed/commands/multi_copy.h"
+#include "distributed/metadata_cache.h"
+#include "distributed/multi_executor.h"
 #include "distributed/multi_physical_planner.h"
+#include "distributed/pg_dist_partition.h"
 #include "distributed/resource_lock.h"
+#include "distributed/shardinterval_utils.h"
 #include "distributed/transmit.h"
 #include "distributed/worker_protocol.h"
 #include "distributed/version_compat.h"
+#include "executor/executor.h"
 #include "executor/spi.h"
 #include "mb/pg_wchar.h"
 #include "storage/lmgr.h"
+#include "utils/acl.h"
 #include "utils/builtins.h"
 #include "utils/lsyscache.h"
 #include "utils/memutils.h"
@@ -56,6 +65,25 @@ int PartitionBufferSize = 16384; /* total partitioning buffer size in KB */
 static uint32 FileBufferSizeInBytes = 0; /* file buffer size to init later */
 
 
+/*
+ * LocalFilePartitionContext keeps the shard intervals of a distributed table,
+ * as sent by the coordinator, to route the rows of local files to the shards.
+ * For hash partitioned tables, the intervals hold hash values. Reference
+ * tables have a single partition.
+ */
+typedef struct LocalFilePartitionContext
+{
+	char partitionMethod;
+	int partitionColumnIndex;
+	Oid collation;
+	FmgrInfo *hashFunction;
+	FmgrInfo *comparisonFunction;
+	ShardInterval **shardIntervalArray;
+	uint32 partitionCount;
+	bool hasUniformHashDistribution;
+} LocalFilePartitionContext;
+
+
 /* Local functions forward declarations */
 static ShardInterval ** SyntheticShardIntervalArrayForShardMinValues(
 	Datum *shardMinValues,
@@ -69,24 +97,44 @@ static void FileOutputStreamWrite(FileOutputStream *file, StringInfo dataToWrite
 static void FileOutputStreamFlush(FileOutputStream *file);
 static void FilterAndPartitionTable(const char *filterQuery,
 									const char *columnName, Oid columnType,
-									uint32 (*PartitionIdFunction)(Datum, const void *),
+									PartitionIdBatchFunction partitionIdFunction,
 									const void *partitionIdContext,
 									FileOutputStream *partitionFileArray,
 									uint32 fileCount);
 static int ColumnIndex(TupleDesc rowDescriptor, const char *columnName);
 static CopyOutState InitRowOutputState(void);
 static void ClearRowOutputState(CopyOutState copyState);
-static void OutputBinaryHeaders(FileOutputStream *partitionFileArray, uint32 fileCount);
+static void OutputBinaryHeaders(FileOutputStream *partitionFileArray, uint32 fileCount,
+								bool *textColumns);
 static void OutputBinaryFooters(FileOutputStream *partitionFileArray, uint32 fileCount);
 static uint32 RangePartitionId(Datum partitionValue, const void *context);
-static uint32 HashPartitionId(Datum partitionValue, const void *context);
+static void RangePartitionIdBatch(Datum *partitionValueArray, bool *partitionNullArray,
+								  uint32 *partitionIdArray, uint32 valueCount,
+								  const void *context);
+static void HashValueBatch(HashPartitionContext *hashPartitionContext,
+						   Datum *partitionValueArray, bool *partitionNullArray,
+						   Datum *hashValueArray, uint32 valueCount);
 static StringInfo UserPartitionFilename(StringInfo directoryName, uint32 partitionId);
 static bool FileIsLink(char *filename, struct stat filestat);
+static void EnsureServerFileReadAllowed(void);
+static List * LocalFileList(const char *filePattern);
+static List * CopyOptionList(const char *copyOptions);
+static List * TextArrayToCStringList(ArrayType *arrayObject);
+static LocalFilePartitionContext * CreateLocalFilePartitionContext(
+	TupleDesc tupleDescriptor, const char *partitionColumnName, char partitionMethod,
+	ArrayType *shardMinValueObject, ArrayType *shardMaxValueObject);
+static uint64 PartitionLocalFiles(List *fileList, List *copyOptionList,
+								  TupleDesc tupleDescriptor,
+								  LocalFilePartitionContext *partitionContext,
+								  FileOutputStream *partitionFileArray);
+static uint32 LocalFilePartitionId(LocalFilePartitionContext *partitionContext,
+								   Datum *valueArray, bool *isNullArray);
 
 
 /* exports for SQL callable functions */
 PG_FUNCTION_INFO_V1(worker_range_partition_table);
 PG_FUNCTION_INFO_V1(worker_hash_partition_table);
+PG_FUNCTION_INFO_V1(worker_partition_local_files);
 
 
 /*
@@ -97,7 +145,7 @@ PG_FUNCTION_INFO_V1(worker_hash_partition_table);
  * behavior.
  *
  * This function applies range partitioning through the use of a function
- * pointer and a range context object; for details, see RangePartitionId().
+ * pointer and a range context object; for details, see RangePartitionIdBatch().
  */
 Datum
 worker_range_partition_table(PG_FUNCTION_ARGS)
@@ -156,7 +204,7 @@ worker_range_partition_table(PG_FUNCTION_ARGS)
 
 	/* call the partitioning function that does the actual work */
 	FilterAndPartitionTable(filterQuery, partitionColumn, partitionColumnType,
-							&RangePartitionId, (const void *) partitionContext,
+							&RangePartitionIdBatch, (const void *) partitionContext,
 							partitionFileArray, fileCount);
 
 	/* close partition files and atomically rename (commit) them */
@@ -176,7 +224,7 @@ worker_range_partition_table(PG_FUNCTION_ARGS)
  * behavior.
  *
  * This function applies hash partitioning through the use of a function pointer
- * and a hash context object; for details, see HashPartitionId().
+ * and a hash context object; for details, see HashPartitionIdBatch().
  */
 Datum
 worker_hash_partition_table(PG_FUNCTION_ARGS)
@@ -192,44 +240,109 @@ worker_hash_partition_table(PG_FUNCTION_ARGS)
 	const char *partitionColumn = text_to_cstring(partitionColumnText);
 
 	HashPartitionContext *partitionContext = NULL;
-	FmgrInfo *hashFunction = NULL;
-	Datum *hashRangeArray = DeconstructArrayObject(hashRangeObject);
-	int32 partitionCount = ArrayObjectCount(hashRangeObject);
 	StringInfo taskDirectory = NULL;
 	StringInfo taskAttemptDirectory = NULL;
 	FileOutputStream *partitionFileArray = NULL;
 	uint32 fileCount = 0;
 
-	uint32 (*hashPartitionIdFunction)(Datum, const void *);
-
 	CheckCitusVersion(ERROR);
 
-	partitionContext = palloc0(sizeof(HashPartitionContext));
-	partitionContext->syntheticShardIntervalArray =
-		SyntheticShardIntervalArrayForShardMinValues(hashRangeArray, partitionCount);
-	partitionContext->hasUniformHashDistribution =
-		HasUniformHashDistribution(partitionContext->syntheticShardIntervalArray,
-								   partitionCount);
+	partitionContext = CreateHashPartitionContext(hashRangeObject, partitionColumnType,
+												  PG_GET_COLLATION());
 
-	hashPartitionIdFunction = &HashPartitionId;
+	/* we create as many files as the number of split points */
+	fileCount = partitionContext->partitionCount;
 
-	/* use column's type information to get the hashing function */
-	hashFunction = GetFunctionInfo(partitionColumnType, HASH_AM_OID, HASHSTANDARD_PROC);
+	/* init directories and files to write the partitioned data to */
+	taskDirectory = InitTaskDirectory(jobId, taskId);
+	taskAttemptDirectory = InitTaskAttemptDirectory(jobId, taskId);
 
-	/* we create as many files as the number of split points */
-	fileCount = partitionCount;
+	partitionFileArray = OpenPartitionFiles(taskAttemptDirectory, fileCount);
+	FileBufferSizeInBytes = FileBufferSize(PartitionBufferSize, fileCount);
 
-	partitionContext->hashFunction = hashFunction;
-	partitionContext->partitionCount = partitionCount;
-	partitionContext->collation = PG_GET_COLLATION();
+	/* call the partitioning function that does the actual work */
+	FilterAndPartitionTable(filterQuery, partitionColumn, partitionColumnType,
+							&HashPartitionIdBatch, (const void *) partitionContext,
+							partitionFileArray, fileCount);
 
-	/* we'll use binary search, we need the comparison function */
-	if (!partitionContext->hasUniformHashDistribution)
+	/* close partition files and atomically rename (commit) them */
+	ClosePartitionFiles(partitionFileArray, fileCount);
+	CitusRemoveDirectory(taskDirectory);
+	RenameDirectory(taskAttemptDirectory, taskDirectory);
+
+	PG_RETURN_VOID();
+}
+
+
+/*
+ * worker_partition_local_files reads the files on local disk that match the
+ * given pattern in the given COPY format, and routes their rows to the shards
+ * of a distributed table using the shard intervals that the coordinator sent.
+ * The rows of each shard are written to a partition file of the given task,
+ * which the nodes that hold the placements of the shard then load via
+ * worker_load_partition_files(). Like the other partitioning functions, the
+ * function renames the task directory once all files are written, and
+ * returns the number of rows it partitioned.
+ */
+Datum
+worker_partition_local_files(PG_FUNCTION_ARGS)
+{
+	uint64 jobId = PG_GETARG_INT64(0);
+	uint32 taskId = PG_GETARG_UINT32(1);
+	text *filePatternText = PG_GETARG_TEXT_P(2);
+	text *copyOptionsText = PG_GETARG_TEXT_P(3);
+	ArrayType *columnNameObject = PG_GETARG_ARRAYTYPE_P(4);
+	ArrayType *columnTypeObject = PG_GETARG_ARRAYTYPE_P(5);
+	text *partitionColumnText = PG_GETARG_TEXT_P(6);
+	char partitionMethod = PG_GETARG_CHAR(7);
+	ArrayType *shardMinValueObject = PG_GETARG_ARRAYTYPE_P(8);
+	ArrayType *shardMaxValueObject = PG_GETARG_ARRAYTYPE_P(9);
+
+	const char *filePattern = text_to_cstring(filePatternText);
+	const char *copyOptions = text_to_cstring(copyOptionsText);
+	const char *partitionColumn = text_to_cstring(partitionColumnText);
+
+	List *fileList = NIL;
+	List *copyOptionList = NIL;
+	List *columnNameList = NIL;
+	List *columnTypeList = NIL;
+	TupleDesc tupleDescriptor = NULL;
+	LocalFilePartitionContext *partitionContext = NULL;
+	StringInfo taskDirectory = NULL;
+	StringInfo taskAttemptDirectory = NULL;
+	FileOutputStream *partitionFileArray = NULL;
+	uint32 fileCount = 0;
+	uint64 partitionedRowCount = 0;
+
+	CheckCitusVersion(ERROR);
+
+	EnsureServerFileReadAllowed();
+
+	columnNameList = TextArrayToCStringList(columnNameObject);
+	columnTypeList = TextArrayToCStringList(columnTypeObject);
+	if (list_length(columnNameList) != list_length(columnTypeList))
 	{
-		partitionContext->comparisonFunction =
-			GetFunctionInfo(partitionColumnType, BTREE_AM_OID, BTORDER_PROC);
+		ereport(ERROR, (errmsg("column name array size: %d and type array size: %d"
+							   " do not match", list_length(columnNameList),
+							   list_length(columnTypeList))));
 	}
 
+	/* the files have the columns of the distributed table */
+	tupleDescriptor = BuildDescForRelation(ColumnDefinitionList(columnNameList,
+																 columnTypeList));
+
+	partitionContext = CreateLocalFilePartitionContext(tupleDescriptor, partitionColumn,
+													   partitionMethod,
+													   shardMinValueObject,
+													   shardMaxValueObject);
+
+	/* parse the options before we create any files */
+	copyOptionList = CopyOptionList(copyOptions);
+	fileList = LocalFileList(filePattern);
+
+	/* we create a file for every shard, even if no rows go there */
+	fileCount = partitionContext->partitionCount;
+
 	/* init directories and files to write the partitioned data to */
 	taskDirectory = InitTaskDirectory(jobId, taskId);
 	taskAttemptDirectory = InitTaskAttemptDirectory(jobId, taskId);
@@ -237,17 +350,51 @@ worker_hash_partition_table(PG_FUNCTION_ARGS)
 	partitionFileArray = OpenPartitionFiles(taskAttemptDirectory, fileCount);
 	FileBufferSizeInBytes = FileBufferSize(PartitionBufferSize, fileCount);
 
-	/* call the partitioning function that does the actual work */
-	FilterAndPartitionTable(filterQuery, partitionColumn, partitionColumnType,
-							hashPartitionIdFunction, (const void *) partitionContext,
-							partitionFileArray, fileCount);
+	partitionedRowCount = PartitionLocalFiles(fileList, copyOptionList, tupleDescriptor,
+											  partitionContext, partitionFileArray);
 
 	/* close partition files and atomically rename (commit) them */
 	ClosePartitionFiles(partitionFileArray, fileCount);
 	CitusRemoveDirectory(taskDirectory);
 	RenameDirectory(taskAttemptDirectory, taskDirectory);
 
-	PG_RETURN_VOID();
+	PG_RETURN_INT64(partitionedRowCount);
+}
+
+
+/*
+ * CreateHashPartitionContext creates the context that hash partitioning uses
+ * to map the values of the partition column to the given hash ranges.
+ */
+HashPartitionContext *
+CreateHashPartitionContext(ArrayType *hashRangeObject, Oid partitionColumnType,
+						   Oid collation)
+{
+	HashPartitionContext *partitionContext = palloc0(sizeof(HashPartitionContext));
+	Datum *hashRangeArray = DeconstructArrayObject(hashRangeObject);
+	int32 partitionCount = ArrayObjectCount(hashRangeObject);
+
+	partitionContext->syntheticShardIntervalArray =
+		SyntheticShardIntervalArrayForShardMinValues(hashRangeArray, partitionCount);
+	partitionContext->hasUniformHashDistribution =
+		HasUniformHashDistribution(partitionContext->syntheticShardIntervalArray,
+								   partitionCount);
+
+	/* use column's type information to get the hashing function */
+	partitionContext->hashFunction =
+		GetFunctionInfo(partitionColumnType, HASH_AM_OID, HASHSTANDARD_PROC);
+	partitionContext->partitionCount = partitionCount;
+	partitionContext->collation = collation;
+	partitionContext->partitionColumnType = partitionColumnType;
+
+	/* we'll use binary search, we need the comparison function */
+	if (!partitionContext->hasUniformHashDistribution)
+	{
+		partitionContext->comparisonFunction =
+			GetFunctionInfo(partitionColumnType, BTREE_AM_OID, BTORDER_PROC);
+	}
+
+	return partitionContext;
 }
 
 
@@ -868,15 +1015,16 @@ FileOutputStreamFlush(FileOutputStream *file)
 
 /*
  * FilterAndPartitionTable executes a given SQL query, and iterates over query
- * results in a read-only fashion. For each resulting row, the function applies
- * the partitioning function and determines the partition identifier. Then, the
- * function chooses the partition file corresponding to this identifier, and
- * serializes the row into this file using the copy command's text format.
+ * results in a read-only fashion. For each batch of resulting rows, the
+ * function applies the partitioning function to the partition keys of the
+ * whole batch and determines their partition identifiers. Then, for each row,
+ * the function chooses the partition file corresponding to its identifier,
+ * and serializes the row into this file using the copy command's text format.
  */
 static void
 FilterAndPartitionTable(const char *filterQuery,
 						const char *partitionColumnName, Oid partitionColumnType,
-						uint32 (*PartitionIdFunction)(Datum, const void *),
+						PartitionIdBatchFunction partitionIdFunction,
 						const void *partitionIdContext,
 						FileOutputStream *partitionFileArray,
 						uint32 fileCount)
@@ -891,6 +1039,9 @@ FilterAndPartitionTable(const char *filterQuery,
 	uint32 columnCount = 0;
 	Datum *valueArray = NULL;
 	bool *isNullArray = NULL;
+	Datum *partitionKeyArray = NULL;
+	bool *partitionKeyNullArray = NULL;
+	uint32 *partitionIdArray = NULL;
 
 	const char *noPortalName = NULL;
 	const bool readOnly = true;
@@ -933,53 +1084,77 @@ FilterAndPartitionTable(const char *filterQuery,
 								   partitionColumnTypeId, partitionColumnType)));
 		}
 
-		columnOutputFunctions = ColumnOutputFunctions(rowDescriptor,
-													  rowOutputState->binary);
+		/*
+		 * The merge tables read partition files in the hybrid row format, so
+		 * only the columns that cannot use the binary format are sent as text.
+		 */
+		if (rowOutputState->binary)
+		{
+			rowOutputState->textColumns = HybridTextColumns(rowDescriptor);
+		}
+
+		if (rowOutputState->textColumns != NULL)
+		{
+			columnOutputFunctions =
+				HybridColumnOutputFunctions(rowDescriptor, rowOutputState->textColumns);
+		}
+		else
+		{
+			columnOutputFunctions = ColumnOutputFunctions(rowDescriptor,
+														  rowOutputState->binary);
+		}
 	}
 
 	if (BinaryWorkerCopyFormat)
 	{
-		OutputBinaryHeaders(partitionFileArray, fileCount);
+		OutputBinaryHeaders(partitionFileArray, fileCount, rowOutputState->textColumns);
 	}
 
 	columnCount = (uint32) SPI_tuptable->tupdesc->natts;
 	valueArray = (Datum *) palloc0(columnCount * sizeof(Datum));
 	isNullArray = (bool *) palloc0(columnCount * sizeof(bool));
 
+	partitionKeyArray = (Datum *) palloc0(prefetchCount * sizeof(Datum));
+	partitionKeyNullArray = (bool *) palloc0(prefetchCount * sizeof(bool));
+	partitionIdArray = (uint32 *) palloc0(prefetchCount * sizeof(uint32));
+
 	while (SPI_processed > 0)
 	{
-		int rowIndex = 0;
+		TupleDesc rowDescriptor = SPI_tuptable->tupdesc;
+		uint32 rowCount = (uint32) SPI_processed;
+		uint32 rowIndex = 0;
+
+		Assert(rowCount <= prefetchCount);
 
-		for (rowIndex = 0; rowIndex < SPI_processed; rowIndex++)
+		/* gather the partition keys of the batch */
+		for (rowIndex = 0; rowIndex < rowCount; rowIndex++)
+		{
+			HeapTuple row = SPI_tuptable->vals[rowIndex];
+
+			partitionKeyArray[rowIndex] =
+				SPI_getbinval(row, rowDescriptor, partitionColumnIndex,
+							  &partitionKeyNullArray[rowIndex]);
+		}
+
+		/*
+		 * We compute the buckets of all partition keys at once. Tuples with a
+		 * null key go into the 0th bucket. Note that the 0th bucket may hold
+		 * other tuples as well, such as tuples whose partition keys hash to
+		 * the value 0.
+		 */
+		partitionIdFunction(partitionKeyArray, partitionKeyNullArray, partitionIdArray,
+							rowCount, partitionIdContext);
+
+		for (rowIndex = 0; rowIndex < rowCount; rowIndex++)
 		{
 			HeapTuple row = SPI_tuptable->vals[rowIndex];
-			TupleDesc rowDescriptor = SPI_tuptable->tupdesc;
 			FileOutputStream *partitionFile = NULL;
 			StringInfo rowText = NULL;
-			Datum partitionKey = 0;
-			bool partitionKeyNull = false;
-			uint32 partitionId = 0;
+			uint32 partitionId = partitionIdArray[rowIndex];
 
-			partitionKey = SPI_getbinval(row, rowDescriptor,
-										 partitionColumnIndex, &partitionKeyNull);
-
-			/*
-			 * If we have a partition key, we compute its bucket. Else if we have
-			 * a null key, we then put this tuple into the 0th bucket. Note that
-			 * the 0th bucket may hold other tuples as well, such as tuples whose
-			 * partition keys hash to the value 0.
-			 */
-			if (!partitionKeyNull)
+			if (partitionId == INVALID_SHARD_INDEX)
 			{
-				partitionId = (*PartitionIdFunction)(partitionKey, partitionIdContext);
-				if (partitionId == INVALID_SHARD_INDEX)
-				{
-					ereport(ERROR, (errmsg("invalid distribution column value")));
-				}
-			}
-			else
-			{
-				partitionId = 0;
+				ereport(ERROR, (errmsg("invalid distribution column value")));
 			}
 
 			/* deconstruct the tuple; this is faster than repeated heap_getattr */
@@ -1004,6 +1179,9 @@ FilterAndPartitionTable(const char *filterQuery,
 
 	pfree(valueArray);
 	pfree(isNullArray);
+	pfree(partitionKeyArray);
+	pfree(partitionKeyNullArray);
+	pfree(partitionIdArray);
 
 	SPI_cursor_close(queryPortal);
 
@@ -1023,6 +1201,391 @@ FilterAndPartitionTable(const char *filterQuery,
 }
 
 
+/*
+ * EnsureServerFileReadAllowed errors out if the current user is not allowed to
+ * read files on the server via COPY.
+ */
+static void
+EnsureServerFileReadAllowed(void)
+{
+#if PG_VERSION_NUM >= 110000
+	if (!is_member_of_role(GetUserId(), DEFAULT_ROLE_READ_SERVER_FILES))
+	{
+		ereport(ERROR, (errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+						errmsg("must be superuser or a member of the "
+							   "pg_read_server_files role to load files on the "
+							   "server")));
+	}
+#else
+	if (!superuser())
+	{
+		ereport(ERROR, (errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+						errmsg("must be superuser to load files on the server")));
+	}
+#endif
+}
+
+
+/*
+ * LocalFileList returns the names of the files that match the given pattern,
+ * in sorted order. Relative patterns are relative to the data directory.
+ */
+static List *
+LocalFileList(const char *filePattern)
+{
+	List *fileList = NIL;
+	glob_t globResult;
+	int globStatus = 0;
+	size_t fileIndex = 0;
+
+	memset(&globResult, 0, sizeof(globResult));
+
+	globStatus = glob(filePattern, GLOB_ERR, NULL, &globResult);
+	if (globStatus == GLOB_NOMATCH)
+	{
+		globfree(&globResult);
+		return NIL;
+	}
+	else if (globStatus != 0)
+	{
+		globfree(&globResult);
+		ereport(ERROR, (errcode_for_file_access(),
+						errmsg("could not expand file pattern \"%s\": %m",
+							   filePattern)));
+	}
+
+	for (fileIndex = 0; fileIndex < globResult.gl_pathc; fileIndex++)
+	{
+		fileList = lappend(fileList, pstrdup(globResult.gl_pathv[fileIndex]));
+	}
+
+	globfree(&globResult);
+
+	return fileList;
+}
+
+
+/*
+ * CopyOptionList parses the given options of a COPY command, as they appear
+ * within the parentheses of its WITH clause, and returns them as a list of
+ * DefElems.
+ */
+static List *
+CopyOptionList(const char *copyOptions)
+{
+	StringInfo copyCommand = makeStringInfo();
+	CopyStmt *copyStatement = NULL;
+
+	if (copyOptions[0] == '\0')
+	{
+		return NIL;
+	}
+
+	appendStringInfo(copyCommand, "COPY pg_catalog.pg_class FROM STDIN WITH (%s)",
+					 copyOptions);
+
+	copyStatement = (CopyStmt *) ParseTreeNode(copyCommand->data);
+	if (!IsA(copyStatement, CopyStmt))
+	{
+		ereport(ERROR, (errmsg("invalid COPY options \"%s\"", copyOptions)));
+	}
+
+	return copyStatement->options;
+}
+
+
+/*
+ * TextArrayToCStringList returns the elements of the given text array as a
+ * list of C strings.
+ */
+static List *
+TextArrayToCStringList(ArrayType *arrayObject)
+{
+	List *cstringList = NIL;
+	Datum *datumArray = DeconstructArrayObject(arrayObject);
+	int32 arraySize = ArrayObjectCount(arrayObject);
+	int32 arrayIndex = 0;
+
+	for (arrayIndex = 0; arrayIndex < arraySize; arrayIndex++)
+	{
+		cstringList = lappend(cstringList, TextDatumGetCString(datumArray[arrayIndex]));
+	}
+
+	return cstringList;
+}
+
+
+/*
+ * CreateLocalFilePartitionContext creates the context that routes the rows of
+ * local files with the given tuple descriptor to shards. The shard intervals
+ * come as the text representation of their minimum and maximum values, in the
+ * order of the sorted shard intervals on the coordinator.
+ */
+static LocalFilePartitionContext *
+CreateLocalFilePartitionContext(TupleDesc tupleDescriptor,
+								const char *partitionColumnName, char partitionMethod,
+								ArrayType *shardMinValueObject,
+								ArrayType *shardMaxValueObject)
+{
+	LocalFilePartitionContext *partitionContext =
+		palloc0(sizeof(LocalFilePartitionContext));
+	List *shardMinValueList = TextArrayToCStringList(shardMinValueObject);
+	List *shardMaxValueList = TextArrayToCStringList(shardMaxValueObject);
+	Form_pg_attribute partitionColumn = NULL;
+	Oid intervalTypeId = InvalidOid;
+	Oid inputFunctionId = InvalidOid;
+	Oid typeIoParam = InvalidOid;
+	ListCell *minValueCell = NULL;
+	ListCell *maxValueCell = NULL;
+	int columnIndex = 0;
+	uint32 shardIndex = 0;
+
+	partitionContext->partitionMethod = partitionMethod;
+
+	if (partitionMethod == DISTRIBUTE_BY_NONE)
+	{
+		/* reference tables have a single shard */
+		partitionContext->partitionCount = 1;
+
+		return partitionContext;
+	}
+
+	if (partitionMethod != DISTRIBUTE_BY_HASH && partitionMethod != DISTRIBUTE_BY_RANGE)
+	{
+		ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+						errmsg("cannot partition local files by partition method "
+							   "\"%c\"", partitionMethod)));
+	}
+
+	if (list_length(shardMinValueList) != list_length(shardMaxValueList) ||
+		shardMinValueList == NIL)
+	{
+		ereport(ERROR, (errmsg("shard min value array size: %d and max value array "
+							   "size: %d do not match or are empty",
+							   list_length(shardMinValueList),
+							   list_length(shardMaxValueList))));
+	}
+
+	partitionContext->partitionColumnIndex = -1;
+	for (columnIndex = 0; columnIndex < tupleDescriptor->natts; columnIndex++)
+	{
+		Form_pg_attribute column = TupleDescAttr(tupleDescriptor, columnIndex);
+
+		if (strncmp(NameStr(column->attname), partitionColumnName, NAMEDATALEN) == 0)
+		{
+			partitionContext->partitionColumnIndex = columnIndex;
+			partitionColumn = column;
+			break;
+		}
+	}
+
+	if (partitionColumn == NULL)
+	{
+		ereport(ERROR, (errcode(ERRCODE_UNDEFINED_COLUMN),
+						errmsg("could not find column name \"%s\"",
+							   partitionColumnName)));
+	}
+
+	partitionContext->collation = partitionColumn->attcollation;
+	partitionContext->partitionCount = list_length(shardMinValueList);
+	partitionContext->shardIntervalArray =
+		palloc0(partitionContext->partitionCount * sizeof(ShardInterval *));
+
+	/* hash partitioned tables have intervals of hash values */
+	intervalTypeId = partitionColumn->atttypid;
+	if (partitionMethod == DISTRIBUTE_BY_HASH)
+	{
+		intervalTypeId = INT4OID;
+		partitionContext->hashFunction =
+			GetFunctionInfo(partitionColumn->atttypid, HASH_AM_OID, HASHSTANDARD_PROC);
+	}
+
+	partitionContext->comparisonFunction =
+		GetFunctionInfo(intervalTypeId, BTREE_AM_OID, BTORDER_PROC);
+
+	getTypeInputInfo(intervalTypeId, &inputFunctionId, &typeIoParam);
+
+	forboth(minValueCell, shardMinValueList, maxValueCell, shardMaxValueList)
+	{
+		char *minValueString = (char *) lfirst(minValueCell);
+		char *maxValueString = (char *) lfirst(maxValueCell);
+		ShardInterval *shardInterval = CitusMakeNode(ShardInterval);
+
+		shardInterval->valueTypeId = intervalTypeId;
+		shardInterval->minValueExists = true;
+		shardInterval->minValue = OidInputFunctionCall(inputFunctionId, minValueString,
+													   typeIoParam, -1);
+		shardInterval->maxValueExists = true;
+		shardInterval->maxValue = OidInputFunctionCall(inputFunctionId, maxValueString,
+													   typeIoParam, -1);
+
+		partitionContext->shardIntervalArray[shardIndex++] = shardInterval;
+	}
+
+	if (partitionMethod == DISTRIBUTE_BY_HASH)
+	{
+		partitionContext->hasUniformHashDistribution =
+			HasUniformHashDistribution(partitionContext->shardIntervalArray,
+									   partitionContext->partitionCount);
+	}
+
+	return partitionContext;
+}
+
+
+/*
+ * PartitionLocalFiles reads the rows of the given files with the given COPY
+ * options, and writes each row to the partition file of the shard that the
+ * row belongs to. The function returns the number of rows it read.
+ */
+static uint64
+PartitionLocalFiles(List *fileList, List *copyOptionList, TupleDesc tupleDescriptor,
+					LocalFilePartitionContext *partitionContext,
+					FileOutputStream *partitionFileArray)
+{
+	Relation stubRelation = StubRelation(tupleDescriptor);
+	EState *executorState = CreateExecutorState();
+	MemoryContext executorTupleContext = GetPerTupleMemoryContext(executorState);
+	ExprContext *executorExpressionContext = GetPerTupleExprContext(executorState);
+	CopyOutState rowOutputState = InitRowOutputState();
+	FmgrInfo *columnOutputFunctions = ColumnOutputFunctions(tupleDescriptor,
+															rowOutputState->binary);
+	int columnCount = tupleDescriptor->natts;
+	Datum *valueArray = (Datum *) palloc0(columnCount * sizeof(Datum));
+	bool *isNullArray = (bool *) palloc0(columnCount * sizeof(bool));
+	uint32 fileCount = partitionContext->partitionCount;
+	uint64 partitionedRowCount = 0;
+	ListCell *fileCell = NULL;
+
+	if (BinaryWorkerCopyFormat)
+	{
+		/* shards load these files with COPY, which cannot read hybrid rows */
+		OutputBinaryHeaders(partitionFileArray, fileCount, NULL);
+	}
+
+	foreach(fileCell, fileList)
+	{
+		char *fileName = (char *) lfirst(fileCell);
+		CopyState copyState = BeginCopyFrom(NULL, stubRelation, fileName, false, NULL,
+											NIL, copyOptionList);
+
+		while (true)
+		{
+			MemoryContext oldContext = NULL;
+			StringInfo rowText = NULL;
+			uint32 partitionId = 0;
+			bool nextRowFound = false;
+
+			ResetPerTupleExprContext(executorState);
+			oldContext = MemoryContextSwitchTo(executorTupleContext);
+
+			nextRowFound = NextCopyFromCompat(copyState, executorExpressionContext,
+											  valueArray, isNullArray);
+			if (!nextRowFound)
+			{
+				MemoryContextSwitchTo(oldContext);
+				break;
+			}
+
+			partitionId = LocalFilePartitionId(partitionContext, valueArray,
+											   isNullArray);
+
+			AppendCopyRowData(valueArray, isNullArray, tupleDescriptor,
+							  rowOutputState, columnOutputFunctions, NULL);
+
+			rowText = rowOutputState->fe_msgbuf;
+			FileOutputStreamWrite(&partitionFileArray[partitionId], rowText);
+
+			resetStringInfo(rowText);
+			MemoryContextReset(rowOutputState->rowcontext);
+			MemoryContextSwitchTo(oldContext);
+
+			partitionedRowCount++;
+		}
+
+		EndCopyFrom(copyState);
+	}
+
+	if (BinaryWorkerCopyFormat)
+	{
+		OutputBinaryFooters(partitionFileArray, fileCount);
+	}
+
+	pfree(valueArray);
+	pfree(isNullArray);
+
+	ClearRowOutputState(rowOutputState);
+	FreeExecutorState(executorState);
+
+	return partitionedRowCount;
+}
+
+
+/*
+ * LocalFilePartitionId returns the index of the shard interval that the row
+ * with the given values belongs to, following the same approach as
+ * FindShardInterval() does on the coordinator.
+ */
+static uint32
+LocalFilePartitionId(LocalFilePartitionContext *partitionContext, Datum *valueArray,
+					 bool *isNullArray)
+{
+	int partitionColumnIndex = partitionContext->partitionColumnIndex;
+	Datum searchedValue = 0;
+	int shardIndex = INVALID_SHARD_INDEX;
+
+	if (partitionContext->partitionMethod == DISTRIBUTE_BY_NONE)
+	{
+		return 0;
+	}
+
+	if (isNullArray[partitionColumnIndex])
+	{
+		ereport(ERROR, (errcode(ERRCODE_NOT_NULL_VIOLATION),
+						errmsg("the partition column value cannot be NULL")));
+	}
+
+	searchedValue = valueArray[partitionColumnIndex];
+
+	if (partitionContext->partitionMethod == DISTRIBUTE_BY_HASH)
+	{
+		searchedValue = FunctionCall1Coll(partitionContext->hashFunction,
+										  partitionContext->collation, searchedValue);
+	}
+
+	if (partitionContext->partitionMethod == DISTRIBUTE_BY_HASH &&
+		partitionContext->hasUniformHashDistribution)
+	{
+		uint32 partitionCount = partitionContext->partitionCount;
+		uint64 hashTokenIncrement = HASH_TOKEN_COUNT / partitionCount;
+		int64 hashedValue = DatumGetInt32(searchedValue);
+
+		shardIndex = (int) ((uint64) (hashedValue - INT32_MIN) / hashTokenIncrement);
+
+		/* the last shard covers the remainder of the hash range */
+		if (shardIndex == (int) partitionCount)
+		{
+			shardIndex = (int) partitionCount - 1;
+		}
+	}
+	else
+	{
+		shardIndex = SearchCachedShardInterval(searchedValue,
+											   partitionContext->shardIntervalArray,
+											   partitionContext->partitionCount,
+											   partitionContext->comparisonFunction);
+	}
+
+	if (shardIndex == INVALID_SHARD_INDEX)
+	{
+		ereport(ERROR, (errcode(ERRCODE_DATA_EXCEPTION),
+						errmsg("could not find shard for partition column value")));
+	}
+
+	return (uint32) shardIndex;
+}
+
+
 /*
  * Determines the column number for the given column name. The column number
  * count starts at 1.
@@ -1129,10 +1692,12 @@ ClearRowOutputState(CopyOutState rowOutputState)
 
 /*
  * Write the header of postgres' binary serialization format to each partition file.
- * This function is used when binary_worker_copy_format is enabled.
+ * This function is used when binary_worker_copy_format is enabled. If textColumns
+ * is not NULL, the header marks the files as being in the hybrid row format.
  */
 static void
-OutputBinaryHeaders(FileOutputStream *partitionFileArray, uint32 fileCount)
+OutputBinaryHeaders(FileOutputStream *partitionFileArray, uint32 fileCount,
+					bool *textColumns)
 {
 	uint32 fileIndex = 0;
 	for (fileIndex = 0; fileIndex < fileCount; fileIndex++)
@@ -1144,6 +1709,7 @@ OutputBinaryHeaders(FileOutputStream *partitionFileArray, uint32 fileCount)
 
 		memset(headerOutputState, 0, sizeof(CopyOutStateData));
 		headerOutputState->fe_msgbuf = makeStringInfo();
+		headerOutputState->textColumns = textColumns;
 
 		AppendCopyBinaryHeaders(headerOutputState);
 
@@ -1250,13 +1816,37 @@ RangePartitionId(Datum partitionValue, const void *context)
 }
 
 
+/*
+ * RangePartitionIdBatch applies RangePartitionId to the given batch of values,
+ * and puts null values into the 0th bucket.
+ */
+static void
+RangePartitionIdBatch(Datum *partitionValueArray, bool *partitionNullArray,
+					  uint32 *partitionIdArray, uint32 valueCount, const void *context)
+{
+	uint32 valueIndex = 0;
+
+	for (valueIndex = 0; valueIndex < valueCount; valueIndex++)
+	{
+		if (partitionNullArray[valueIndex])
+		{
+			partitionIdArray[valueIndex] = 0;
+			continue;
+		}
+
+		partitionIdArray[valueIndex] =
+			RangePartitionId(partitionValueArray[valueIndex], context);
+	}
+}
+
+
 /*
  * HashPartitionId determines the partition number for the given data value
  * using hash partitioning. More specifically, the function returns zero if the
  * given data value is null. If not, the function follows the exact same approach
  * as Citus distributed planner uses.
  */
-static uint32
+uint32
 HashPartitionId(Datum partitionValue, const void *context)
 {
 	HashPartitionContext *hashPartitionContext = (HashPartitionContext *) context;
@@ -1292,3 +1882,184 @@ HashPartitionId(Datum partitionValue, const void *context)
 
 	return hashPartitionId;
 }
+
+
+/*
+ * HashPartitionIdBatch determines the partition numbers of the given batch of
+ * values using hash partitioning. It assigns the same partitions as
+ * HashPartitionId, but first hashes the whole batch, which avoids a function
+ * call through fmgr per value for the most common partition column types, and
+ * then maps the hash values to partitions in a tight loop.
+ */
+void
+HashPartitionIdBatch(Datum *partitionValueArray, bool *partitionNullArray,
+					 uint32 *partitionIdArray, uint32 valueCount, const void *context)
+{
+	HashPartitionContext *hashPartitionContext = (HashPartitionContext *) context;
+	uint32 partitionCount = hashPartitionContext->partitionCount;
+	Datum *hashValueArray = (Datum *) palloc(valueCount * sizeof(Datum));
+	uint32 valueIndex = 0;
+
+	HashValueBatch(hashPartitionContext, partitionValueArray, partitionNullArray,
+				   hashValueArray, valueCount);
+
+	if (hashPartitionContext->hasUniformHashDistribution)
+	{
+		uint64 hashTokenIncrement = HASH_TOKEN_COUNT / partitionCount;
+
+		for (valueIndex = 0; valueIndex < valueCount; valueIndex++)
+		{
+			Datum hashDatum = hashValueArray[valueIndex];
+			int32 hashResult = DatumGetInt32(hashDatum);
+
+			if (partitionNullArray[valueIndex] || hashDatum == 0)
+			{
+				partitionIdArray[valueIndex] = 0;
+				continue;
+			}
+
+			partitionIdArray[valueIndex] =
+				(uint32) (hashResult - INT32_MIN) / hashTokenIncrement;
+		}
+	}
+	else
+	{
+		ShardInterval **syntheticShardIntervalArray =
+			hashPartitionContext->syntheticShardIntervalArray;
+		FmgrInfo *comparisonFunction = hashPartitionContext->comparisonFunction;
+
+		for (valueIndex = 0; valueIndex < valueCount; valueIndex++)
+		{
+			Datum hashDatum = hashValueArray[valueIndex];
+
+			if (partitionNullArray[valueIndex] || hashDatum == 0)
+			{
+				partitionIdArray[valueIndex] = 0;
+				continue;
+			}
+
+			partitionIdArray[valueIndex] =
+				SearchCachedShardInterval(hashDatum, syntheticShardIntervalArray,
+										  partitionCount, comparisonFunction);
+		}
+	}
+
+	pfree(hashValueArray);
+}
+
+
+/*
+ * HashValueBatch hashes the non-null values in the given batch. For int4, int8
+ * and text columns, the function computes the same hash values as the types'
+ * hash functions inline, otherwise it calls the hash function of the type.
+ */
+static void
+HashValueBatch(HashPartitionContext *hashPartitionContext, Datum *partitionValueArray,
+			   bool *partitionNullArray, Datum *hashValueArray, uint32 valueCount)
+{
+	Oid collation = hashPartitionContext->collation;
+	uint32 valueIndex = 0;
+
+	switch (hashPartitionContext->partitionColumnType)
+	{
+		case INT4OID:
+		{
+			/* same as hashint4() */
+			for (valueIndex = 0; valueIndex < valueCount; valueIndex++)
+			{
+				int32 value = DatumGetInt32(partitionValueArray[valueIndex]);
+
+				if (partitionNullArray[valueIndex])
+				{
+					hashValueArray[valueIndex] = 0;
+					continue;
+				}
+
+				hashValueArray[valueIndex] = hash_uint32((uint32) value);
+			}
+
+			return;
+		}
+
+		case INT8OID:
+		{
+			/* same as hashint8(), which keeps int4 and int8 hashes compatible */
+			for (valueIndex = 0; valueIndex < valueCount; valueIndex++)
+			{
+				int64 value = 0;
+				uint32 lowHalf = 0;
+				uint32 highHalf = 0;
+
+				if (partitionNullArray[valueIndex])
+				{
+					hashValueArray[valueIndex] = 0;
+					continue;
+				}
+
+				value = DatumGetInt64(partitionValueArray[valueIndex]);
+				lowHalf = (uint32) value;
+				highHalf = (uint32) (value >> 32);
+				lowHalf ^= (value >= 0) ? highHalf : ~highHalf;
+
+				hashValueArray[valueIndex] = hash_uint32(lowHalf);
+			}
+
+			return;
+		}
+
+		case TEXTOID:
+		{
+			/*
+			 * hashtext() hashes the bytes of the string, unless the collation
+			 * is nondeterministic, which the default and C collations are not.
+			 */
+			if (collation != DEFAULT_COLLATION_OID && collation != C_COLLATION_OID)
+			{
+				break;
+			}
+
+			for (valueIndex = 0; valueIndex < valueCount; valueIndex++)
+			{
+				Datum valueDatum = partitionValueArray[valueIndex];
+				text *value = NULL;
+
+				if (partitionNullArray[valueIndex])
+				{
+					hashValueArray[valueIndex] = 0;
+					continue;
+				}
+
+				value = DatumGetTextPP(valueDatum);
+
+				hashValueArray[valueIndex] =
+					hash_any((unsigned char *) VARDATA_ANY(value),
+							 VARSIZE_ANY_EXHDR(value));
+
+				if ((Pointer) value != DatumGetPointer(valueDatum))
+				{
+					pfree(value);
+				}
+			}
+
+			return;
+		}
+
+		default:
+		{
+			break;
+		}
+	}
+
+	for (valueIndex = 0; valueIndex < valueCount; valueIndex++)
+	{
+		if (partitionNullArray[valueIndex])
+		{
+			hashValueArray[valueIndex] = 0;
+			continue;
+		}
+
+		hashValueArray[valueIndex] =
+			FunctionCall1Coll(hashPartitionContext->hashFunction, collation,
+							  partitionValueArray[valueIndex]);
+	}
+}
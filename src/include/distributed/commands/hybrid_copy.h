@@ -0,0 +1,39 @@
+/*-------------------------------------------------------------------------
+ *
+ * hybrid_copy.h
+ *	  Declarations for reading data in Citus' hybrid row format.
+ *
+ * Copyright (c) 2019, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef HYBRID_COPY_H
+#define HYBRID_COPY_H
+
+
+#include "access/tupdesc.h"
+#include "commands/copy.h"
+#include "utils/relcache.h"
+
+
+/* length of the part of the binary COPY header that marks the hybrid format */
+#define HYBRID_COPY_HEADER_LENGTH 15
+
+
+/* state of reading hybrid row format data, opaque outside of hybrid_copy.c */
+typedef struct HybridCopyStateData *HybridCopyState;
+
+
+extern bool IsHybridCopyHeader(const char *data, int length);
+extern HybridCopyState BeginHybridCopyFrom(char *fileName,
+										   copy_data_source_cb dataSourceCallback,
+										   TupleDesc tupleDescriptor);
+extern bool NextHybridCopyFrom(HybridCopyState copyState, Datum *columnValues,
+							   bool *columnNulls);
+extern void EndHybridCopyFrom(HybridCopyState copyState);
+extern uint64 CopyHybridDataIntoRelation(Relation relation, char *fileName,
+										 copy_data_source_cb dataSourceCallback);
+
+
+#endif /* HYBRID_COPY_H */
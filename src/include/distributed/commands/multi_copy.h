@@ -13,6 +13,7 @@
 #define MULTI_COPY_H
 
 
+#include "distributed/copy_progress.h"
 #include "distributed/master_metadata_utility.h"
 #include "distributed/metadata_cache.h"
 #include "nodes/execnodes.h"
@@ -23,6 +24,22 @@
 
 #define INVALID_PARTITION_COLUMN_INDEX -1
 
+/*
+ * Flag in the header of a binary COPY that marks Citus' hybrid row format, in
+ * which the columns that cannot use the binary format are sent as text. The
+ * flag is one of the critical flags, such that postgres refuses to read it.
+ */
+#define HYBRID_COPY_FORMAT_FLAG (1 << 30)
+
+
+/* what COPY FROM does with rows that conflict with existing rows */
+typedef enum CopyOnConflictAction
+{
+	COPY_ON_CONFLICT_ERROR = 0,
+	COPY_ON_CONFLICT_DO_NOTHING = 1,
+	COPY_ON_CONFLICT_DO_UPDATE = 2
+} CopyOnConflictAction;
+
 
 /*
  * A smaller version of copy.c's CopyStateData, trimmed to the elements
@@ -39,6 +56,7 @@ typedef struct CopyOutStateData
 	char *null_print;           /* NULL marker string (server encoding!) */
 	char *null_print_client;            /* same converted to file encoding */
 	char *delim;                /* column delimiter (must be 1 byte) */
+	bool *textColumns;          /* columns sent as text in binary format, or NULL */
 
 	MemoryContext rowcontext;   /* per-row evaluation context */
 } CopyOutStateData;
@@ -118,9 +136,30 @@ typedef struct CitusCopyDestReceiver
 
 	/* copy into intermediate result */
 	char *intermediateResultIdPrefix;
+
+	/* forward raw text fields of COPY FROM, see CanUseCopyPassThrough() */
+	bool passThrough;
+
+	/*
+	 * If set, rows are staged in an intermediate result per placement and
+	 * inserted into the shard with this ON CONFLICT clause, see
+	 * UpsertCopiedRows().
+	 */
+	char *upsertConflictClause;
+	char *upsertColumnList;
+	char *upsertColumnDefinitionList;
+
+	/* progress shown in citus_copy_progress, NULL if not tracked */
+	CopyProgress *copyProgress;
 } CitusCopyDestReceiver;
 
 
+/* managed via guc.c */
+extern bool EnableCopyPassThrough;
+extern int CopyOnConflict;
+extern int CopyAppendShardCount;
+
+
 /* function declarations for copying into a distributed table */
 extern CitusCopyDestReceiver * CreateCitusCopyDestReceiver(Oid relationId,
 														   List *columnNameList,
@@ -131,6 +170,10 @@ extern CitusCopyDestReceiver * CreateCitusCopyDestReceiver(Oid relationId,
 extern FmgrInfo * ColumnOutputFunctions(TupleDesc rowDescriptor, bool binaryFormat);
 extern bool CanUseBinaryCopyFormat(TupleDesc tupleDescription);
 extern bool CanUseBinaryCopyFormatForType(Oid typeId);
+extern bool * HybridTextColumns(TupleDesc tupleDescriptor);
+extern bool * HybridTextColumnsForTypes(uint32 columnCount, Oid *typeIdArray);
+extern FmgrInfo * HybridColumnOutputFunctions(TupleDesc rowDescriptor,
+											  bool *textColumns);
 extern void AppendCopyRowData(Datum *valueArray, bool *isNullArray,
 							  TupleDesc rowDescriptor,
 							  CopyOutState rowOutputState,
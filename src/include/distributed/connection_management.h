@@ -44,7 +44,13 @@ enum MultiConnectionMode
 	FOR_DML = 1 << 2,
 
 	/* open a connection per (co-located set of) placement(s) */
-	CONNECTION_PER_PLACEMENT = 1 << 3
+	CONNECTION_PER_PLACEMENT = 1 << 3,
+
+	/*
+	 * Only establish a new connection if the node is below the shared
+	 * connection limit (see shared_connection_stats.c), otherwise return NULL.
+	 */
+	OPTIONAL_CONNECTION = 1 << 4
 };
 
 typedef enum MultiConnectionState
@@ -102,6 +108,15 @@ typedef struct MultiConnection
 
 	/* number of bytes sent to PQputCopyData() since last flush */
 	uint64 copyBytesWrittenSinceLastFlush;
+
+	/* number of statements prepared on the connection, see statement_cache.c */
+	uint32 preparedStatementCount;
+
+	/* statement cache generation that the prepared statements belong to */
+	uint64 preparedStatementGeneration;
+
+	/* whether the connection is counted in the shared connection counters */
+	bool sharedConnectionCounterIncremented;
 } MultiConnection;
 
 
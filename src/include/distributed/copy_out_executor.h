@@ -0,0 +1,26 @@
+/*-------------------------------------------------------------------------
+ *
+ * copy_out_executor.h
+ *	  Execution of COPY distributed_table TO STDOUT by streaming the COPY
+ *	  output of the shards to the client.
+ *
+ * Copyright (c) 2019, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef COPY_OUT_EXECUTOR_H
+#define COPY_OUT_EXECUTOR_H
+
+#include "nodes/parsenodes.h"
+
+
+/* managed via guc.c */
+extern bool EnableStreamingCopyOut;
+
+
+extern bool CanStreamCopyOut(CopyStmt *copyStatement);
+extern void StreamCopyOutFromShards(CopyStmt *copyStatement, char *completionTag);
+
+
+#endif /* COPY_OUT_EXECUTOR_H */
@@ -0,0 +1,69 @@
+/*-------------------------------------------------------------------------
+ *
+ * copy_progress.h
+ *	  Declarations for tracking the progress of rows that are copied into
+ *	  distributed tables.
+ *
+ * Copyright (c) 2019, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef COPY_PROGRESS_H
+#define COPY_PROGRESS_H
+
+
+#include "datatype/timestamp.h"
+#include "distributed/worker_manager.h"
+
+
+/* identifies the progress monitors of COPY in pg_stat_get_progress_info() */
+#define COPY_PROGRESS_MAGIC_NUMBER 0x436F707950726F67
+
+
+/* rows and bytes that a COPY sent to a single node */
+typedef struct CopyNodeProgress
+{
+	char nodeName[WORKER_LENGTH];
+	int32 nodePort;
+
+	/* number of shard placements on the node that received rows */
+	uint64 shardCount;
+
+	uint64 rowCount;
+	uint64 byteCount;
+
+	/* last time a batch of rows was sent to the node, 0 if never */
+	TimestampTz lastSendTime;
+} CopyNodeProgress;
+
+
+/*
+ * CopyProgress is kept in the progress monitor of a COPY into a distributed
+ * table, or of an INSERT ... SELECT that copies the rows of the SELECT, such
+ * that other backends can read it through citus_copy_progress.
+ */
+typedef struct CopyProgress
+{
+	Oid relationId;
+	TimestampTz startTime;
+
+	/* number of rows routed to shards */
+	uint64 rowCount;
+
+	int nodeCount;
+	CopyNodeProgress nodes[FLEXIBLE_ARRAY_MEMBER];
+} CopyProgress;
+
+
+/* managed via guc.c */
+extern bool EnableCopyProgress;
+
+
+extern CopyProgress * CreateCopyProgress(Oid relationId);
+extern CopyNodeProgress * CopyProgressForNode(CopyProgress *copyProgress,
+											  char *nodeName, int32 nodePort);
+extern void FinalizeCopyProgress(CopyProgress *copyProgress);
+
+
+#endif /* COPY_PROGRESS_H */
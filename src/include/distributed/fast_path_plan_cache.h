@@ -0,0 +1,31 @@
+/*-------------------------------------------------------------------------
+ *
+ * fast_path_plan_cache.h
+ *	  Per-shard cache of the tasks of fast-path router queries whose shard
+ *	  pruning is deferred to the executor.
+ *
+ * Copyright (c) 2019, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef FAST_PATH_PLAN_CACHE_H
+#define FAST_PATH_PLAN_CACHE_H
+
+#include "distributed/multi_physical_planner.h"
+
+
+/* the cache is cleared once it holds this many tasks */
+#define MAX_FAST_PATH_CACHED_TASKS 8192
+
+
+/* managed via guc.c */
+extern bool EnableFastPathPlanCache;
+
+
+extern Task * GetCachedFastPathTask(uint64 planId, uint64 shardId);
+extern void CacheFastPathTask(uint64 planId, uint64 shardId, Task *task);
+extern void InvalidateFastPathPlanCache(void);
+
+
+#endif /* FAST_PATH_PLAN_CACHE_H */
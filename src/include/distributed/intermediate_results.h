@@ -21,6 +21,10 @@
 #include "utils/palloc.h"
 
 
+/* managed via guc.c */
+extern bool CompressIntermediateResults;
+
+
 extern DestReceiver * CreateRemoteFileDestReceiver(char *resultId, EState *executorState,
 												   List *initialNodeList, bool
 												   writeLocalFile);
@@ -0,0 +1,29 @@
+/*-------------------------------------------------------------------------
+ *
+ * local_executor.h
+ *	Functions and global variables to control local query execution.
+ *
+ * Copyright (c) 2019, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef LOCAL_EXECUTOR_H
+#define LOCAL_EXECUTOR_H
+
+#include "distributed/citus_custom_scan.h"
+
+/* managed via guc.c */
+extern bool EnableLocalExecution;
+
+extern bool LocalExecutionHappened;
+
+extern uint64 ExecuteLocalTaskList(CitusScanState *scanState, List *taskList);
+extern void ExtractLocalAndRemoteTasks(bool readOnlyPlan, List *taskList,
+									   List **localTaskList, List **remoteTaskList);
+extern bool ShouldExecuteTasksLocally(List *taskList);
+extern void ErrorIfLocalExecutionHappened(void);
+extern bool AnyTaskAccessesLocalNode(List *taskList);
+extern bool TaskAccessesLocalNode(Task *task);
+
+#endif /* LOCAL_EXECUTOR_H */
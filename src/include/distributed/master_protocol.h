@@ -119,6 +119,8 @@ extern List * InsertShardPlacementRows(Oid relationId, int64 shardId,
 									   List *workerNodeList, int workerStartIndex,
 									   int replicationFactor);
 extern uint64 UpdateShardStatistics(int64 shardId);
+extern void SetShardStatistics(int64 shardId, uint64 shardSize, text *minValue,
+							   text *maxValue);
 extern void CreateShardsWithRoundRobinPolicy(Oid distributedTableId, int32 shardCount,
 											 int32 replicationFactor,
 											 bool useExclusiveConnections);
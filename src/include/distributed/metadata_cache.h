@@ -58,6 +58,22 @@ typedef struct
 	int shardIntervalArrayLength;
 	ShardInterval **sortedShardIntervalArray;
 
+	/*
+	 * Minimum hash values of the sorted shard intervals, to find the shard of
+	 * a hash value without calling the comparator. NULL if the table is not
+	 * distributed by hash.
+	 */
+	int32 *sortedShardMinHashValueArray;
+
+	/*
+	 * For append and range distributed tables with overlapping shards, the
+	 * index of the shard with the largest maximum value among the sorted shard
+	 * intervals up to each position. Since the shard intervals are sorted by
+	 * minimum value, this allows finding the shards that may overlap with a
+	 * range by binary search. NULL if the shards do not overlap.
+	 */
+	int *runningMaxShardIndexArray;
+
 	/* comparator for partition column's type, NULL if DISTRIBUTE_BY_NONE */
 	FmgrInfo *shardColumnCompareFunction;
 
@@ -85,6 +101,14 @@ typedef struct
 	/* pg_dist_placement metadata */
 	GroupShardPlacement **arrayOfPlacementArrays;
 	int *arrayOfPlacementArrayLengths;
+
+	/*
+	 * Can an invalid entry be brought up to date by reloading the placements
+	 * of the shards that changed, rather than being rebuilt? The shard-level
+	 * invalidations up to shardInvalidationSequence have been applied.
+	 */
+	bool shardsRefreshable;
+	uint64 shardInvalidationSequence;
 } DistTableCacheEntry;
 
 
@@ -10,6 +10,7 @@
 #ifndef MULTI_EXECUTOR_H
 #define MULTI_EXECUTOR_H
 
+#include "commands/copy.h"
 #include "executor/execdesc.h"
 #include "nodes/parsenodes.h"
 #include "nodes/execnodes.h"
@@ -32,24 +33,34 @@ extern bool WritableStandbyCoordinator;
 extern bool ForceMaxQueryParallelization;
 extern int MaxAdaptiveExecutorPoolSize;
 extern int ExecutorSlowStartInterval;
+extern bool EnableBinaryProtocol;
 
 
 extern void CitusExecutorStart(QueryDesc *queryDesc, int eflags);
 extern void CitusExecutorRun(QueryDesc *queryDesc, ScanDirection direction, uint64 count,
 							 bool execute_once);
+extern bool IsCitusPlan(Plan *plan);
+extern bool IsCitusCustomScan(Plan *plan);
 extern TupleTableSlot * AdaptiveExecutor(CustomScanState *node);
 extern uint64 ExecuteTaskListExtended(RowModifyLevel modLevel, List *taskList,
 									  TupleDesc tupleDescriptor,
 									  Tuplestorestate *tupleStore,
 									  bool hasReturning, int targetPoolSize);
+extern uint64 ExecuteTaskListOutsideTransaction(RowModifyLevel modLevel, List *taskList,
+												int targetPoolSize);
 extern void ExecuteUtilityTaskListWithoutResults(List *taskList);
 extern uint64 ExecuteTaskList(RowModifyLevel modLevel, List *taskList, int
 							  targetPoolSize);
+extern List * PlacementAccessListForTask(Task *task, ShardPlacement *taskPlacement);
 extern TupleTableSlot * CitusExecScan(CustomScanState *node);
 extern TupleTableSlot * ReturnTupleFromTuplestore(CitusScanState *scanState);
 extern void LoadTuplesIntoTupleStore(CitusScanState *citusScanState, Job *workerJob);
 extern void ReadFileIntoTupleStore(char *fileName, char *copyFormat, TupleDesc
 								   tupleDescriptor, Tuplestorestate *tupstore);
+extern void ReadDataSourceIntoTupleStore(copy_data_source_cb dataSourceCallback,
+										 char *copyFormat, TupleDesc tupleDescriptor,
+										 Tuplestorestate *tupstore);
+extern Relation StubRelation(TupleDesc tupleDescriptor);
 extern Query * ParseQueryString(const char *queryString);
 extern void ExecuteQueryStringIntoDestReceiver(const char *queryString, ParamListInfo
 											   params,
@@ -213,6 +213,13 @@ typedef struct Task
 	List *relationShardList;
 
 	List *rowValuesLists;          /* rows to use when building multi-row INSERT */
+
+	/*
+	 * In case of replicated tables (e.g., reference tables), a single task
+	 * might be split into a local and a remote task. The local execution
+	 * returns the results, so the remote task should not return any.
+	 */
+	bool partiallyLocalOrRemote;
 } Task;
 
 
@@ -29,6 +29,7 @@ extern ProgressMonitorData * CreateProgressMonitor(uint64 progressTypeMagicNumbe
 												   int stepCount, Size stepSize,
 												   Oid relationId);
 extern ProgressMonitorData * GetCurrentProgressMonitor(void);
+extern bool HasCurrentProgressMonitor(void);
 extern void FinalizeCurrentProgressMonitor(void);
 extern List * ProgressMonitorList(uint64 commandTypeMagicNumber,
 								  List **attachedDSMSegmentList);
@@ -25,6 +25,7 @@
 #define CITUS_TABLE_ALIAS "citus_table_alias"
 
 extern bool EnableRouterExecution;
+extern bool EnableBatchedInsertRouting;
 extern bool EnableFastPathRouterPlanner;
 
 extern DistributedPlan * CreateRouterPlan(Query *originalQuery, Query *query,
@@ -43,6 +44,8 @@ extern DeferredErrorMessage * PlanRouterQuery(Query *originalQuery,
 											  bool *multiShardModifyQuery,
 											  Const **partitionValueConst);
 extern List * RouterInsertTaskList(Query *query, DeferredErrorMessage **planningError);
+extern List * FastPathRouterTaskList(Job *workerJob, uint64 planId,
+									 ParamListInfo boundParams);
 extern Const * ExtractInsertPartitionKeyValue(Query *query);
 extern List * TargetShardIntervalsForRestrictInfo(RelationRestrictionContext *
 												  restrictionContext,
@@ -78,5 +81,6 @@ extern List * WorkersContainingAllShards(List *prunedShardIntervalsList);
 extern PlannedStmt * FastPathPlanner(Query *originalQuery, Query *parse, ParamListInfo
 									 boundParams);
 extern bool FastPathRouterQuery(Query *query);
+extern bool FastPathRouterQueryHasDistKeyParam(Query *query);
 
 #endif /* MULTI_ROUTER_PLANNER_H */
@@ -70,5 +70,6 @@ extern void InitPlacementConnectionManagement(void);
 
 extern bool ConnectionModifiedPlacement(MultiConnection *connection);
 extern bool ConnectionUsedForAnyPlacements(MultiConnection *connection);
+extern bool AnyConnectionAccessedPlacements(void);
 
 #endif /* PLACEMENT_CONNECTION_H */
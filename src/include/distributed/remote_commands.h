@@ -49,7 +49,15 @@ extern int ExecuteOptionalRemoteCommand(MultiConnection *connection,
 extern int SendRemoteCommand(MultiConnection *connection, const char *command);
 extern int SendRemoteCommandParams(MultiConnection *connection, const char *command,
 								   int parameterCount, const Oid *parameterTypes,
-								   const char *const *parameterValues);
+								   const char *const *parameterValues,
+								   bool binaryResults);
+extern int SendRemotePrepare(MultiConnection *connection, const char *statementName,
+							 const char *command, int parameterCount,
+							 const Oid *parameterTypes);
+extern int SendRemotePreparedCommand(MultiConnection *connection,
+									 const char *statementName, int parameterCount,
+									 const char *const *parameterValues,
+									 bool binaryResults);
 extern List * ReadFirstColumnAsText(struct pg_result *queryResult);
 extern struct pg_result * GetRemoteCommandResult(MultiConnection *connection,
 												 bool raiseInterrupts);
@@ -0,0 +1,36 @@
+/*-------------------------------------------------------------------------
+ *
+ * repartition_join_execution.h
+ *	  Execution of the map, fetch and merge tasks of repartition joins by the
+ *	  adaptive executor.
+ *
+ * Copyright (c) 2019, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef REPARTITION_JOIN_EXECUTION_H
+#define REPARTITION_JOIN_EXECUTION_H
+
+#include "distributed/multi_physical_planner.h"
+
+
+#define CREATE_JOB_SCHEMA_COMMAND "SELECT worker_create_schema(" UINT64_FORMAT ");"
+#define REPARTITION_CLEANUP_COMMAND "SELECT worker_repartition_cleanup(" UINT64_FORMAT \
+	");"
+#define MAP_OUTPUT_STREAM_COMMAND "SELECT worker_stream_partition_file \
+ (" UINT64_FORMAT ", %u, %u, %u, '%s', %u)"
+
+
+/* managed via guc.c */
+extern bool EnableAdaptiveRepartitionJoins;
+extern bool EnableStreamingShuffle;
+
+
+extern List * ExecuteDependedTasks(List *topLevelTaskList, Job *topLevelJob);
+extern void RegisterRepartitionCleanup(List *jobIdList);
+extern void DoRepartitionCleanup(List *jobIdList);
+extern void CleanupPendingRepartitionJobs(void);
+
+
+#endif /* REPARTITION_JOIN_EXECUTION_H */
@@ -0,0 +1,23 @@
+/*-------------------------------------------------------------------------
+ *
+ * shard_cache_invalidation.h
+ *	  Shard-level invalidations of the distributed table metadata cache.
+ *
+ * Copyright (c) 2019, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef SHARD_CACHE_INVALIDATION_H
+#define SHARD_CACHE_INVALIDATION_H
+
+#include "nodes/pg_list.h"
+
+
+extern void InitializeShardCacheInvalidation(void);
+extern void RecordShardCacheInvalidation(Oid relationId, uint64 shardId);
+extern bool ReadShardCacheInvalidations(Oid relationId, uint64 *invalidationSequence,
+										List **shardIdList);
+
+
+#endif /* SHARD_CACHE_INVALIDATION_H */
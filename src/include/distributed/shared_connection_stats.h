@@ -0,0 +1,32 @@
+/*-------------------------------------------------------------------------
+ *
+ * shared_connection_stats.h
+ *   Central management of the connections and their life-cycle
+ *
+ * Copyright (c) 2019, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef SHARED_CONNECTION_STATS_H
+#define SHARED_CONNECTION_STATS_H
+
+/* use max_connections of the local node as the shared pool size */
+#define ADJUST_POOLSIZE_AUTOMATICALLY 0
+
+/* do not limit the number of connections across backends */
+#define DISABLE_CONNECTION_THROTTLING -1
+
+
+/* managed via guc.c */
+extern int MaxSharedPoolSize;
+
+
+extern void InitializeSharedConnectionStats(void);
+extern int GetMaxSharedPoolSize(void);
+extern bool TryToIncrementSharedConnectionCounter(const char *hostname, int port);
+extern void IncrementSharedConnectionCounter(const char *hostname, int port);
+extern void DecrementSharedConnectionCounter(const char *hostname, int port);
+
+
+#endif /* SHARED_CONNECTION_STATS_H */
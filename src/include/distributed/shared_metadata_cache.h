@@ -0,0 +1,49 @@
+/*-------------------------------------------------------------------------
+ *
+ * shared_metadata_cache.h
+ *	  Shard metadata of distributed tables shared across backends.
+ *
+ * Copyright (c) 2019, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef SHARED_METADATA_CACHE_H
+#define SHARED_METADATA_CACHE_H
+
+#include "nodes/pg_list.h"
+
+
+/*
+ * CachedShardRow holds the pg_dist_shard row of a shard and the list of its
+ * GroupShardPlacements from pg_dist_placement, which is what backends need to
+ * build the shard intervals of a distributed table. The min/max values are
+ * kept in their text representation, since the input functions of the
+ * interval type can only be called by the backend itself.
+ */
+typedef struct CachedShardRow
+{
+	int64 shardId;
+	char storageType;
+	char *minValue;             /* NULL if the shard has no min/max values */
+	char *maxValue;
+	List *placementList;
+} CachedShardRow;
+
+
+/* managed via guc.c */
+extern int SharedMetadataCacheSize;
+
+
+extern void InitializeSharedMetadataCache(void);
+extern bool ReadSharedShardRows(Oid relationId, CachedShardRow **shardRowArray,
+								int *shardCount, uint64 *snapshotVersion,
+								uint64 *invalidationSequence);
+extern void PublishSharedShardRows(Oid relationId, uint64 snapshotVersion,
+								   uint64 invalidationSequence,
+								   CachedShardRow *shardRowArray, int shardCount);
+extern void InvalidateSharedShardRows(Oid relationId);
+extern void MarkSharedShardRowsModified(Oid relationId);
+
+
+#endif /* SHARED_METADATA_CACHE_H */
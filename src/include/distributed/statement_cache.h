@@ -0,0 +1,65 @@
+/*-------------------------------------------------------------------------
+ *
+ * statement_cache.h
+ *	  Cache of the shard query statements prepared on worker connections.
+ *
+ * Copyright (c) 2019, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef STATEMENT_CACHE_H
+#define STATEMENT_CACHE_H
+
+#include "distributed/connection_management.h"
+
+
+/* maximum number of statements that are prepared on a single connection */
+#define MAX_CACHED_STATEMENTS_PER_CONNECTION 1024
+
+
+/*
+ * CachedStatementKey identifies a shard query that is prepared on a
+ * connection.
+ */
+typedef struct CachedStatementKey
+{
+	MultiConnection *connection;
+	char *queryString;
+} CachedStatementKey;
+
+
+/*
+ * CachedStatement describes a shard query that is prepared, or being
+ * prepared, on a connection.
+ */
+typedef struct CachedStatement
+{
+	CachedStatementKey key;
+
+	/* name of the prepared statement on the remote node */
+	char statementName[NAMEDATALEN];
+
+	/* parameter types used when preparing the statement */
+	int parameterCount;
+	Oid *parameterTypes;
+
+	/* whether the remote node acknowledged the preparation */
+	bool prepared;
+} CachedStatement;
+
+
+/* managed via guc.c */
+extern bool EnableStatementCaching;
+
+
+extern CachedStatement * GetCachedStatement(MultiConnection *connection,
+											const char *queryString,
+											int parameterCount,
+											const Oid *parameterTypes);
+extern bool StatementCacheIsStale(MultiConnection *connection);
+extern void ResetConnectionStatementCache(MultiConnection *connection);
+extern void InvalidateStatementCache(void);
+
+
+#endif /* STATEMENT_CACHE_H */
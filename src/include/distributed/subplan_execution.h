@@ -16,6 +16,7 @@
 
 extern int MaxIntermediateResult;
 extern int SubPlanLevel;
+extern bool EnableDirectSubPlanRouting;
 
 extern void ExecuteSubPlans(DistributedPlan *distributedPlan);
 
@@ -256,6 +256,8 @@ RangeVarGetRelidInternal(const RangeVar *relation, LOCKMODE lockmode, uint32 fla
 #define GetSysCacheOid2Compat GetSysCacheOid2
 #define GetSysCacheOid3Compat GetSysCacheOid3
 #define GetSysCacheOid4Compat GetSysCacheOid4
+#define pglz_decompress_compat(source, slen, dest, rawsize) \
+	pglz_decompress(source, slen, dest, rawsize, true)
 
 #define fcSetArg(fc, n, argval) \
 	(((fc)->args[n].isnull = false), ((fc)->args[n].value = (argval)))
@@ -323,6 +325,8 @@ FileCompatFromFileStart(File fileDesc)
 	GetSysCacheOid3(cacheId, key1, key2, key3)
 #define GetSysCacheOid4Compat(cacheId, oidcol, key1, key2, key3, key4) \
 	GetSysCacheOid4(cacheId, key1, key2, key3, key4)
+#define pglz_decompress_compat(source, slen, dest, rawsize) \
+	pglz_decompress(source, slen, dest, rawsize)
 
 #define LOCAL_FCINFO(name, nargs) \
 	FunctionCallInfoData name ## data; \
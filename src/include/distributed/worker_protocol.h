@@ -82,9 +82,21 @@ typedef struct HashPartitionContext
 	uint32 partitionCount;
 	Oid collation;
 	bool hasUniformHashDistribution;
+	Oid partitionColumnType;
 } HashPartitionContext;
 
 
+/*
+ * PartitionIdBatchFunction determines the partition numbers of a batch of
+ * partition column values. Null values always go to the 0th partition.
+ */
+typedef void (*PartitionIdBatchFunction)(Datum *partitionValueArray,
+										 bool *partitionNullArray,
+										 uint32 *partitionIdArray,
+										 uint32 valueCount,
+										 const void *partitionIdContext);
+
+
 /*
  * FileOutputStream helps buffer write operations to a file; these writes are
  * then regularly flushed to the underlying file. This structure differs from
@@ -122,6 +134,13 @@ extern void RemoveJobSchema(StringInfo schemaName);
 extern Datum * DeconstructArrayObject(ArrayType *arrayObject);
 extern int32 ArrayObjectCount(ArrayType *arrayObject);
 extern FmgrInfo * GetFunctionInfo(Oid typeId, Oid accessMethodId, int16 procedureId);
+extern HashPartitionContext * CreateHashPartitionContext(ArrayType *hashRangeObject,
+														 Oid partitionColumnType,
+														 Oid collation);
+extern uint32 HashPartitionId(Datum partitionValue, const void *context);
+extern void HashPartitionIdBatch(Datum *partitionValueArray, bool *partitionNullArray,
+								 uint32 *partitionIdArray, uint32 valueCount,
+								 const void *context);
 extern uint64 ExtractShardIdFromTableName(const char *tableName, bool missingOk);
 extern List * TableDDLCommandList(const char *nodeName, uint32 nodePort,
 								  const char *tableName);
@@ -0,0 +1,70 @@
+--
+-- ADAPTIVE_REPARTITION_JOIN
+--
+-- Tests repartition joins that are executed by the adaptive executor,
+-- without switching to the task-tracker executor.
+--
+CREATE SCHEMA adaptive_repartition_join;
+SET search_path TO adaptive_repartition_join;
+
+SET citus.shard_count TO 4;
+SET citus.shard_replication_factor TO 1;
+SET citus.next_shard_id TO 4170000;
+SET citus.task_executor_type TO 'adaptive';
+
+CREATE TABLE left_table (a int, b int);
+SELECT create_distributed_table('left_table', 'a');
+INSERT INTO left_table SELECT i, i % 10 FROM generate_series(1, 100) i;
+
+CREATE TABLE right_table (c int, d int);
+SELECT create_distributed_table('right_table', 'c');
+INSERT INTO right_table SELECT i, i % 10 FROM generate_series(1, 50) i;
+
+-- repartition joins are disabled by default
+SELECT count(*) FROM left_table, right_table WHERE b = d;
+
+SET citus.enable_repartition_joins TO on;
+SET citus.enable_adaptive_repartition_joins TO on;
+
+-- repartitions both tables
+SELECT count(*) FROM left_table, right_table WHERE b = d;
+SELECT count(*), sum(a), sum(c) FROM left_table JOIN right_table ON (b = d) WHERE a < 20;
+
+-- join on the distribution column of one of the tables
+SELECT count(*) FROM left_table, right_table WHERE a = d;
+
+-- fetch the partition files to disk instead of streaming them
+SET citus.enable_streaming_shuffle TO off;
+SELECT count(*) FROM left_table, right_table WHERE b = d;
+SELECT count(*) FROM left_table, right_table WHERE a = d;
+RESET citus.enable_streaming_shuffle;
+
+-- the job schemas are removed after execution
+SELECT result FROM run_command_on_workers($$
+	SELECT count(*) FROM pg_namespace WHERE nspname LIKE 'pg_merge_job_%'
+$$);
+
+-- also when the query fails
+\set VERBOSITY terse
+SELECT count(*) FROM left_table, right_table WHERE b = d AND a / (c - c) = 1;
+\set VERBOSITY default
+SELECT result FROM run_command_on_workers($$
+	SELECT count(*) FROM pg_namespace WHERE nspname LIKE 'pg_merge_job_%'
+$$);
+
+-- repartition joins can run in a transaction block before modifications
+BEGIN;
+SELECT count(*) FROM left_table, right_table WHERE b = d;
+SELECT count(*) FROM left_table, right_table WHERE a = d;
+INSERT INTO left_table VALUES (101, 1);
+SELECT count(*) FROM left_table;
+COMMIT;
+
+-- but not after modifications
+BEGIN;
+INSERT INTO left_table VALUES (102, 2);
+SELECT count(*) FROM left_table, right_table WHERE b = d;
+ROLLBACK;
+
+SET client_min_messages TO WARNING;
+DROP SCHEMA adaptive_repartition_join CASCADE;
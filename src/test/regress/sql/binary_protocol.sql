@@ -0,0 +1,67 @@
+--
+-- BINARY_PROTOCOL
+--
+-- Tests that results requested in binary format from the workers are
+-- decoded into the same values as results in text format.
+--
+CREATE SCHEMA binary_protocol;
+SET search_path TO binary_protocol;
+
+SET citus.shard_count TO 4;
+SET citus.shard_replication_factor TO 1;
+SET citus.next_shard_id TO 4130000;
+SET citus.task_executor_type TO 'adaptive';
+
+CREATE FUNCTION benchmark_result_decoding(query_string text, iteration_count int,
+										  OUT text_rows_per_second float8,
+										  OUT binary_rows_per_second float8)
+	RETURNS record
+	AS 'citus'
+	LANGUAGE C STRICT;
+
+CREATE TABLE typed_values (id int, n numeric, d date, j jsonb, tags text[], t text);
+SELECT create_distributed_table('typed_values', 'id');
+
+INSERT INTO typed_values
+  SELECT i, i * 1.5, '2019-01-01'::date + i, jsonb_build_object('a', i), ARRAY['x' || i], 'row ' || i
+  FROM generate_series(1, 4) i;
+INSERT INTO typed_values VALUES (5, NULL, NULL, NULL, NULL, 'nulls');
+
+SET citus.enable_binary_protocol TO on;
+
+-- multi-shard query
+SELECT * FROM typed_values ORDER BY id;
+
+-- router query
+SELECT * FROM typed_values WHERE id = 3;
+
+-- expressions and aggregates
+SELECT j->>'a' AS a, n * 2 AS double_n FROM typed_values WHERE id IN (1, 2) ORDER BY 1;
+SELECT count(*), sum(n), max(d) FROM typed_values;
+
+-- RETURNING is decoded in binary format as well
+INSERT INTO typed_values VALUES (6, 9.0, '2019-01-07', '{"a": 6}', '{x6}', 'row 6') RETURNING *;
+UPDATE typed_values SET n = n + 1 WHERE id = 6 RETURNING id, n;
+
+-- prepared statements with parameters
+PREPARE select_by_id(int) AS SELECT id, n, t FROM typed_values WHERE id = $1;
+EXECUTE select_by_id(2);
+EXECUTE select_by_id(6);
+
+-- same results in text format
+SET citus.enable_binary_protocol TO off;
+SELECT * FROM typed_values ORDER BY id;
+EXECUTE select_by_id(6);
+
+-- compare decoding rows in text and in binary format on the coordinator
+SELECT text_rows_per_second > 0, binary_rows_per_second > 0
+FROM benchmark_result_decoding($$
+	SELECT i, i * 1.5 AS n, '2019-01-01 00:00:00+00'::timestamptz + i * interval '1 minute' AS ts,
+		   jsonb_build_object('a', i, 'b', 'value ' || i) AS j, NULLIF(i % 3, 0) AS nullable
+	FROM generate_series(1, 1000) i
+$$, 10);
+
+SELECT * FROM benchmark_result_decoding('SELECT 1 WHERE false', 10);
+
+SET client_min_messages TO WARNING;
+DROP SCHEMA binary_protocol CASCADE;
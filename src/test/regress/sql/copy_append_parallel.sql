@@ -0,0 +1,75 @@
+--
+-- COPY_APPEND_PARALLEL
+--
+-- Tests COPY into append-distributed tables that fills multiple new shards
+-- concurrently and computes their statistics from the copied rows
+CREATE SCHEMA copy_append_parallel;
+SET search_path TO 'copy_append_parallel';
+SET citus.next_shard_id TO 4280000;
+SET citus.shard_replication_factor TO 1;
+
+CREATE TABLE events (key int, value text);
+SELECT create_distributed_table('events', 'key', 'append');
+
+-- shards are only created once they receive rows
+SET citus.copy_append_shard_count TO 4;
+COPY events FROM STDIN WITH (format 'csv');
+1,one
+5,five
+3,three
+\.
+SELECT shardid, shardminvalue, shardmaxvalue FROM pg_dist_shard
+WHERE logicalrelid = 'events'::regclass ORDER BY shardid;
+SELECT shardid, shardlength > 0 FROM pg_dist_shard_placement
+WHERE shardid IN (SELECT shardid FROM pg_dist_shard WHERE logicalrelid = 'events'::regclass)
+ORDER BY shardid;
+
+-- blocks of rows go to two shards at a time, which are spread over the workers
+SET citus.copy_append_shard_count TO 2;
+SET citus.shard_max_size TO '128kB';
+COPY events (key) FROM PROGRAM 'seq 1 20000';
+SELECT count(*), count(DISTINCT key), min(key), max(key) FROM events;
+
+SELECT count(*) > 2 AS multiple_shards, count(DISTINCT nodeport) AS node_count
+FROM pg_dist_shard_placement
+WHERE shardid IN (SELECT shardid FROM pg_dist_shard WHERE logicalrelid = 'events'::regclass);
+
+-- shard sizes are the number of bytes sent, which never exceed the maximum by much
+SELECT bool_and(shardlength > 0 AND shardlength < 256 * 1024)
+FROM pg_dist_shard_placement
+WHERE shardid IN (SELECT shardid FROM pg_dist_shard WHERE logicalrelid = 'events'::regclass);
+
+-- shard min/max values match the rows that were copied into the shards
+SELECT bool_and(result = shardminvalue || ',' || shardmaxvalue)
+FROM run_command_on_placements('events', $$
+	SELECT min(key) || ',' || max(key) FROM %s
+$$) JOIN pg_dist_shard USING (shardid);
+
+-- queries can prune on the statistics
+SELECT count(*) FROM events WHERE key = 15000;
+
+-- statistics of a text partition column are computed with its collation
+CREATE TABLE names (name text COLLATE "C", value int);
+SELECT create_distributed_table('names', 'name', 'append');
+COPY names (name) FROM PROGRAM 'seq 1 20000';
+SELECT count(*), min(name), max(name) FROM names;
+SELECT bool_and(result = shardminvalue || ',' || shardmaxvalue)
+FROM run_command_on_placements('names', $$
+	SELECT min(name) || ',' || max(name) FROM %s
+$$) JOIN pg_dist_shard USING (shardid);
+
+-- with a single shard, statistics are fetched from the placement, and shards
+-- without a partition column value have no min/max values
+SET citus.copy_append_shard_count TO 1;
+COPY names (value) FROM PROGRAM 'seq 1 3';
+SELECT shardminvalue, shardmaxvalue FROM pg_dist_shard
+WHERE shardid = (SELECT max(shardid) FROM pg_dist_shard WHERE logicalrelid = 'names'::regclass);
+SELECT shardlength FROM pg_dist_shard_placement
+WHERE shardid = (SELECT max(shardid) FROM pg_dist_shard WHERE logicalrelid = 'names'::regclass);
+
+SET citus.copy_append_shard_count TO 0;
+
+RESET citus.shard_max_size;
+RESET citus.copy_append_shard_count;
+SET client_min_messages TO WARNING;
+DROP SCHEMA copy_append_parallel CASCADE;
@@ -0,0 +1,38 @@
+--
+-- COPY_BATCHING
+--
+-- Tests that rows which COPY sends in batches reach all the placements,
+-- including placements that share a connection
+CREATE SCHEMA copy_batching;
+SET search_path TO 'copy_batching';
+SET citus.next_shard_id TO 4210000;
+SET citus.shard_count TO 4;
+SET citus.shard_replication_factor TO 2;
+
+CREATE TABLE data (key int, value text);
+SELECT create_distributed_table('data', 'key');
+
+-- every shard receives well over a single batch of rows
+COPY data (key) FROM PROGRAM 'seq 1 100000';
+UPDATE data SET value = repeat('x', key % 100);
+
+-- the placements share a single connection per worker
+BEGIN;
+SET LOCAL citus.max_adaptive_executor_pool_size TO 1;
+COPY data (key) FROM PROGRAM 'seq 100001 200000';
+COMMIT;
+
+-- rows that go through the coordinator
+INSERT INTO data SELECT key + 200000, value FROM data ORDER BY key LIMIT 10000;
+
+SELECT count(*), count(DISTINCT key), sum(length(value)) FROM data;
+
+-- all placements of a shard have the same rows
+SELECT shardid, count(DISTINCT result)
+FROM run_command_on_placements('data', 'SELECT count(*) FROM %s')
+GROUP BY shardid ORDER BY shardid;
+
+SELECT sum(result::int) / 2 FROM run_command_on_placements('data', 'SELECT count(*) FROM %s');
+
+SET client_min_messages TO WARNING;
+DROP SCHEMA copy_batching CASCADE;
@@ -0,0 +1,58 @@
+--
+-- COPY_CONNECTION_POOL
+--
+-- Tests that COPY uses up to citus.max_adaptive_executor_pool_size
+-- connections per worker node
+CREATE SCHEMA copy_connection_pool;
+SET search_path TO 'copy_connection_pool';
+SET citus.next_shard_id TO 4200000;
+SET citus.shard_count TO 8;
+SET citus.shard_replication_factor TO 1;
+
+CREATE TABLE events (key int, value int);
+SELECT create_distributed_table('events', 'key');
+
+-- each worker has 4 shards, which are loaded over 4 connections
+BEGIN;
+COPY events (key) FROM PROGRAM 'seq 1 100';
+SELECT nodeport, result FROM run_command_on_workers($$
+	SELECT count(*) FROM pg_stat_activity
+	WHERE application_name = 'citus' AND state = 'idle in transaction'
+$$) ORDER BY nodeport;
+COMMIT;
+
+-- the shards share the connections once the pool size is reached
+SET citus.max_adaptive_executor_pool_size TO 2;
+BEGIN;
+COPY events (key) FROM PROGRAM 'seq 1 100';
+SELECT nodeport, result FROM run_command_on_workers($$
+	SELECT count(*) FROM pg_stat_activity
+	WHERE application_name = 'citus' AND state = 'idle in transaction'
+$$) ORDER BY nodeport;
+COMMIT;
+
+SET citus.max_adaptive_executor_pool_size TO 1;
+BEGIN;
+COPY events (key) FROM PROGRAM 'seq 1 100';
+SELECT nodeport, result FROM run_command_on_workers($$
+	SELECT count(*) FROM pg_stat_activity
+	WHERE application_name = 'citus' AND state = 'idle in transaction'
+$$) ORDER BY nodeport;
+COMMIT;
+RESET citus.max_adaptive_executor_pool_size;
+
+-- sequential mode uses a single connection per worker
+BEGIN;
+SET LOCAL citus.multi_shard_modify_mode TO 'sequential';
+COPY events (key) FROM PROGRAM 'seq 1 100';
+SELECT nodeport, result FROM run_command_on_workers($$
+	SELECT count(*) FROM pg_stat_activity
+	WHERE application_name = 'citus' AND state = 'idle in transaction'
+$$) ORDER BY nodeport;
+COMMIT;
+
+-- all rows made it into the table
+SELECT count(*), count(DISTINCT key), sum(key) FROM events;
+
+SET client_min_messages TO WARNING;
+DROP SCHEMA copy_connection_pool CASCADE;
@@ -0,0 +1,65 @@
+--
+-- COPY_OUT_STREAMING
+--
+-- Tests COPY distributed_table TO STDOUT that streams the output of the shards
+-- to the client
+CREATE SCHEMA copy_out_streaming;
+SET search_path TO 'copy_out_streaming';
+SET citus.next_shard_id TO 4230000;
+SET citus.shard_replication_factor TO 1;
+
+SET citus.shard_count TO 4;
+CREATE TABLE multi_shard (key int, value text, payload text);
+SELECT create_distributed_table('multi_shard', 'key');
+INSERT INTO multi_shard SELECT i, 'same', 'row ' || i FROM generate_series(1, 8) i;
+
+SET citus.shard_count TO 1;
+CREATE TABLE single_shard (key int, value text, note text);
+SELECT create_distributed_table('single_shard', 'key');
+INSERT INTO single_shard VALUES (1, 'a,b', NULL), (2, 'c"d', 'e');
+
+-- rows of different shards arrive in any order, so copy out equal values
+-- (quiet off to force number of copied records to be displayed)
+\set QUIET off
+COPY multi_shard (value) TO STDOUT;
+\set QUIET on
+
+-- shards that do not get a connection of their own wait for their turn
+SET citus.max_adaptive_executor_pool_size TO 1;
+\set QUIET off
+COPY multi_shard (value) TO STDOUT WITH (format csv, force_quote *);
+\set QUIET on
+RESET citus.max_adaptive_executor_pool_size;
+
+-- options are passed on to the workers
+COPY single_shard TO STDOUT WITH (format csv, delimiter ';', null 'NULL', force_quote (value));
+COPY single_shard (note, key) TO STDOUT WITH (null '-');
+
+-- placements that were modified in the transaction are read over the same connection
+BEGIN;
+INSERT INTO single_shard VALUES (3, 'f', 'g');
+COPY single_shard TO STDOUT;
+DELETE FROM multi_shard WHERE key > 4;
+\set QUIET off
+COPY multi_shard (value) TO STDOUT;
+\set QUIET on
+ROLLBACK;
+
+-- partitioned tables cannot be copied from, so they are handled by a distributed SELECT
+CREATE TABLE partitioned (key int, value text) PARTITION BY RANGE (key);
+CREATE TABLE partitioned_1 PARTITION OF partitioned FOR VALUES FROM (1) TO (3);
+CREATE TABLE partitioned_2 PARTITION OF partitioned FOR VALUES FROM (3) TO (5);
+SELECT create_distributed_table('partitioned', 'key');
+INSERT INTO partitioned VALUES (1, 'a'), (2, 'b'), (3, 'c'), (4, 'd');
+COPY partitioned TO STDOUT;
+COPY partitioned_2 TO STDOUT;
+
+-- header lines and the binary format are handled by a distributed SELECT
+COPY single_shard TO STDOUT WITH (format csv, header true);
+
+SET citus.enable_streaming_copy_out TO off;
+COPY single_shard TO STDOUT;
+RESET citus.enable_streaming_copy_out;
+
+SET client_min_messages TO WARNING;
+DROP SCHEMA copy_out_streaming CASCADE;
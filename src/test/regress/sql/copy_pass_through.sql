@@ -0,0 +1,56 @@
+--
+-- COPY_PASS_THROUGH
+--
+-- Tests COPY FROM that only decodes the distribution column and forwards
+-- the other fields to the workers as they are
+CREATE SCHEMA copy_pass_through;
+SET search_path TO 'copy_pass_through';
+SET citus.next_shard_id TO 4220000;
+SET citus.shard_count TO 4;
+SET citus.shard_replication_factor TO 1;
+
+-- a dropped column shifts the distribution column in the raw fields
+CREATE TABLE wide (dropped int, key int, a text, b numeric, c jsonb, d int[]);
+ALTER TABLE wide DROP COLUMN dropped;
+SELECT create_distributed_table('wide', 'key');
+
+SET citus.enable_copy_pass_through TO on;
+
+-- escaped fields are forwarded with their original values
+COPY wide FROM STDIN;
+1	hello	1.5	{"x": 1}	{1,2}
+2	\\N	\N	[]	{}
+3	back\\slash	-2	null	\N
+\.
+
+COPY wide (key, a, b, c, d) FROM STDIN WITH CSV;
+4,"comma, inside",3.25,"{""y"": [1, 2]}","{3}"
+\.
+
+SELECT key, a, b, c, d, a IS NULL AS a_is_null FROM wide ORDER BY key;
+
+-- rows that do not have all the columns are decoded as usual
+COPY wide (key, a) FROM STDIN WITH CSV;
+5,partial
+\.
+
+SELECT * FROM wide WHERE key = 5;
+
+-- the number of fields is checked on the coordinator
+COPY wide FROM STDIN WITH CSV;
+6,x,1,{},{1},extra
+\.
+COPY wide FROM STDIN WITH CSV;
+6,x
+\.
+
+-- the distribution column cannot be NULL
+COPY wide FROM STDIN WITH CSV;
+,x,1,{},{1}
+\.
+
+SELECT count(*) FROM wide;
+
+RESET citus.enable_copy_pass_through;
+SET client_min_messages TO WARNING;
+DROP SCHEMA copy_pass_through CASCADE;
@@ -0,0 +1,50 @@
+--
+-- COPY_PROGRESS
+--
+-- Tests citus_copy_progress, which shows the progress of ongoing COPY commands
+-- into distributed tables
+CREATE SCHEMA copy_progress;
+SET search_path TO 'copy_progress';
+SET citus.next_shard_id TO 4260000;
+SET citus.shard_replication_factor TO 1;
+SET citus.shard_count TO 4;
+SET citus.enable_copy_progress TO on;
+
+CREATE TABLE target (key int, value text);
+SELECT create_distributed_table('target', 'key');
+
+-- returns the number of nodes and rows sent by the COPY of this backend
+CREATE FUNCTION own_copy_progress()
+RETURNS text LANGUAGE sql VOLATILE AS $$
+	SELECT count(*) || '/' || coalesce(sum(rows_sent), 0) || '/' || coalesce(max(rows_routed), 0)
+	FROM citus_copy_progress WHERE pid = pg_backend_pid()
+$$;
+
+-- nothing to show outside of a COPY
+SELECT count(*) FROM citus_copy_progress;
+
+-- INSERT ... SELECT via the coordinator copies the rows into the shards, and
+-- the SELECT sees how many rows were sent before the current one
+INSERT INTO target SELECT i, own_copy_progress() FROM generate_series(1, 5) i;
+SELECT * FROM target ORDER BY key;
+
+-- every shard that received rows is counted on its node
+CREATE FUNCTION own_copy_shards()
+RETURNS bigint LANGUAGE sql VOLATILE AS $$
+	SELECT coalesce(sum(shards), 0) FROM citus_copy_progress WHERE pid = pg_backend_pid()
+$$;
+TRUNCATE target;
+INSERT INTO target SELECT i, own_copy_shards() FROM generate_series(1, 100) i;
+SELECT max(value::int) FROM target;
+
+-- the monitor is gone after the COPY
+SELECT count(*) FROM citus_copy_progress;
+
+-- no progress is tracked when disabled, which is the default
+RESET citus.enable_copy_progress;
+TRUNCATE target;
+INSERT INTO target SELECT i, own_copy_progress() FROM generate_series(1, 2) i;
+SELECT * FROM target ORDER BY key;
+
+SET client_min_messages TO WARNING;
+DROP SCHEMA copy_progress CASCADE;
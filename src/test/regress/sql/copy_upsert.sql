@@ -0,0 +1,91 @@
+--
+-- COPY_UPSERT
+--
+-- Tests COPY FROM with citus.copy_on_conflict, which inserts the copied rows
+-- with ON CONFLICT into the shards
+CREATE SCHEMA copy_upsert;
+SET search_path TO 'copy_upsert';
+SET citus.next_shard_id TO 4250000;
+SET citus.shard_replication_factor TO 1;
+SET citus.shard_count TO 4;
+
+CREATE TABLE accounts (key int primary key, name text, balance int);
+SELECT create_distributed_table('accounts', 'key');
+COPY accounts FROM STDIN WITH (format csv);
+1,one,10
+2,two,20
+3,three,30
+4,four,40
+\.
+
+-- do_nothing keeps the existing rows
+SET citus.copy_on_conflict TO do_nothing;
+COPY accounts FROM STDIN WITH (format csv);
+3,new three,300
+5,five,50
+\.
+SELECT * FROM accounts ORDER BY key;
+
+-- do_update overwrites the columns that are not part of the primary key
+SET citus.copy_on_conflict TO do_update;
+COPY accounts FROM STDIN WITH (format csv);
+1,new one,100
+6,six,60
+\.
+SELECT * FROM accounts ORDER BY key;
+
+-- columns that are not copied keep their values
+COPY accounts (key, balance) FROM STDIN WITH (format csv);
+2,200
+\.
+SELECT * FROM accounts WHERE key = 2;
+
+-- upserts roll back with the transaction
+BEGIN;
+COPY accounts FROM STDIN WITH (format csv);
+4,rolled back,0
+\.
+SELECT * FROM accounts WHERE key = 4;
+ROLLBACK;
+SELECT * FROM accounts WHERE key = 4;
+
+-- staged rows also work in text format and with pass-through
+SET citus.enable_copy_pass_through TO on;
+COPY accounts FROM STDIN;
+5	passed five	500
+7	seven	70
+\.
+RESET citus.enable_copy_pass_through;
+SELECT * FROM accounts ORDER BY key;
+
+-- shards that share a connection are upserted one after another
+SET citus.max_adaptive_executor_pool_size TO 1;
+COPY accounts (key) FROM PROGRAM 'seq 1 20';
+RESET citus.max_adaptive_executor_pool_size;
+SELECT count(*), sum(key), count(name) FROM accounts;
+
+-- reference tables are upserted on every placement
+CREATE TABLE currencies (code text primary key, rate numeric);
+SELECT create_reference_table('currencies');
+COPY currencies FROM STDIN WITH (format csv);
+EUR,1.1
+USD,1.0
+\.
+COPY currencies FROM STDIN WITH (format csv);
+EUR,1.2
+GBP,1.3
+\.
+SELECT * FROM currencies ORDER BY code;
+
+-- do_update needs a primary key to find the conflicting rows
+CREATE TABLE events (key int, value text);
+SELECT create_distributed_table('events', 'key');
+COPY events FROM PROGRAM 'echo 1,one' WITH (format csv);
+
+-- do_nothing does not
+SET citus.copy_on_conflict TO do_nothing;
+COPY events FROM PROGRAM 'echo 1,one' WITH (format csv);
+SELECT * FROM events;
+
+SET client_min_messages TO WARNING;
+DROP SCHEMA copy_upsert CASCADE;
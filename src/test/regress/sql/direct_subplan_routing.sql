@@ -0,0 +1,86 @@
+--
+-- DIRECT_SUBPLAN_ROUTING
+--
+-- Tests creating the results of single-shard subplans directly on the
+-- worker node that reads them
+CREATE SCHEMA direct_subplan_routing;
+SET search_path TO 'direct_subplan_routing';
+SET citus.next_shard_id TO 4190000;
+SET citus.task_executor_type TO 'adaptive';
+
+SELECT groupid AS worker_2_group FROM pg_dist_node WHERE nodeport=:worker_2_port \gset
+
+-- sources has a single shard on the first worker
+SET citus.shard_count TO 1;
+SET citus.shard_replication_factor TO 1;
+CREATE TABLE sources (key int, value int);
+SELECT create_distributed_table('sources', 'key', colocate_with => 'none');
+INSERT INTO sources SELECT s, s * 10 FROM generate_series(1,10) s;
+
+-- targets has two shards, and only their placements on the first worker are active
+SET citus.shard_count TO 2;
+SET citus.shard_replication_factor TO 2;
+CREATE TABLE targets (key int, value int);
+SELECT create_distributed_table('targets', 'key', colocate_with => 'none');
+INSERT INTO targets SELECT s, s FROM generate_series(1,10) s;
+
+UPDATE pg_dist_placement SET shardstate = 3
+WHERE groupid = :worker_2_group AND shardid IN (
+	SELECT shardid FROM pg_dist_shard WHERE logicalrelid = 'targets'::regclass);
+
+-- the result of the CTE is created on the first worker only
+BEGIN;
+WITH top_sources AS (
+	SELECT key, value FROM sources ORDER BY value DESC LIMIT 3
+)
+SELECT t.key, t.value, s.value
+FROM targets t JOIN top_sources s USING (key)
+ORDER BY key;
+SELECT nodeport, result FROM run_command_on_workers($$
+	SELECT count(*) FROM pg_ls_dir('base/pgsql_job_cache') d WHERE d ~ '^[0-9]+_[0-9]+_[0-9]+'
+$$) ORDER BY nodeport;
+COMMIT;
+
+-- without direct routing, the result is sent to all workers
+SET citus.enable_direct_subplan_routing TO off;
+BEGIN;
+WITH top_sources AS (
+	SELECT key, value FROM sources ORDER BY value DESC LIMIT 3
+)
+SELECT t.key, t.value, s.value
+FROM targets t JOIN top_sources s USING (key)
+ORDER BY key;
+SELECT nodeport, result FROM run_command_on_workers($$
+	SELECT count(*) FROM pg_ls_dir('base/pgsql_job_cache') d WHERE d ~ '^[0-9]+_[0-9]+_[0-9]+'
+$$) ORDER BY nodeport;
+COMMIT;
+RESET citus.enable_direct_subplan_routing;
+
+-- results that are also read by other subplans are sent as usual
+WITH top_sources AS (
+	SELECT key, value FROM sources ORDER BY value DESC LIMIT 3
+),
+top_keys AS (
+	SELECT key FROM top_sources WHERE value > 80
+)
+SELECT t.key, t.value
+FROM targets t JOIN top_keys k USING (key)
+ORDER BY key;
+
+-- direct routing also works in prepared statements
+PREPARE top_targets(int) AS
+WITH top_sources AS (
+	SELECT key, value FROM sources ORDER BY value DESC LIMIT $1
+)
+SELECT t.key, t.value, s.value
+FROM targets t JOIN top_sources s USING (key)
+ORDER BY key;
+EXECUTE top_targets(2);
+EXECUTE top_targets(2);
+EXECUTE top_targets(2);
+EXECUTE top_targets(2);
+EXECUTE top_targets(2);
+EXECUTE top_targets(2);
+
+SET client_min_messages TO WARNING;
+DROP SCHEMA direct_subplan_routing CASCADE;
@@ -0,0 +1,81 @@
+--
+-- FAST_PATH_PLAN_CACHE
+--
+-- Tests prepared fast path router queries that are planned once and pruned
+-- in the executor, using the tasks that are cached for each shard.
+--
+CREATE SCHEMA fast_path_plan_cache;
+SET search_path TO fast_path_plan_cache;
+
+SET citus.shard_count TO 4;
+SET citus.shard_replication_factor TO 1;
+SET citus.next_shard_id TO 4150000;
+SET citus.enable_fast_path_plan_cache TO on;
+
+CREATE TABLE kv (key int, value int);
+SELECT create_distributed_table('kv', 'key');
+
+INSERT INTO kv SELECT i, i * 10 FROM generate_series(1, 10) i;
+
+PREPARE select_by_key(int) AS SELECT value FROM kv WHERE key = $1;
+EXECUTE select_by_key(1);
+EXECUTE select_by_key(2);
+EXECUTE select_by_key(3);
+EXECUTE select_by_key(4);
+EXECUTE select_by_key(5);
+EXECUTE select_by_key(6);
+EXECUTE select_by_key(7);
+EXECUTE select_by_key(8);
+EXECUTE select_by_key(9);
+EXECUTE select_by_key(10);
+EXECUTE select_by_key(1);
+
+-- NULL does not hit any shard
+EXECUTE select_by_key(NULL);
+
+-- other parameters are sent to the worker along with the shard query
+PREPARE count_by_key_and_value(int, int) AS
+	SELECT count(*) FROM kv WHERE key = $1 AND value > $2;
+EXECUTE count_by_key_and_value(1, 0);
+EXECUTE count_by_key_and_value(2, 0);
+EXECUTE count_by_key_and_value(3, 0);
+EXECUTE count_by_key_and_value(4, 0);
+EXECUTE count_by_key_and_value(5, 0);
+EXECUTE count_by_key_and_value(6, 0);
+EXECUTE count_by_key_and_value(7, 100);
+EXECUTE count_by_key_and_value(NULL, 0);
+
+PREPARE update_by_key(int, int) AS UPDATE kv SET value = $2 WHERE key = $1;
+EXECUTE update_by_key(1, 11);
+EXECUTE update_by_key(2, 21);
+EXECUTE update_by_key(3, 31);
+EXECUTE update_by_key(4, 41);
+EXECUTE update_by_key(5, 51);
+EXECUTE update_by_key(6, 61);
+EXECUTE update_by_key(7, 71);
+EXECUTE update_by_key(NULL, 0);
+
+PREPARE delete_by_key(int) AS DELETE FROM kv WHERE key = $1;
+EXECUTE delete_by_key(8);
+EXECUTE delete_by_key(9);
+EXECUTE delete_by_key(10);
+EXECUTE delete_by_key(8);
+EXECUTE delete_by_key(9);
+EXECUTE delete_by_key(10);
+EXECUTE delete_by_key(10);
+
+SELECT * FROM kv ORDER BY key;
+
+-- plans are cached per prepared statement, new statements are planned per execution
+SET citus.enable_fast_path_plan_cache TO off;
+PREPARE select_by_key_uncached(int) AS SELECT value FROM kv WHERE key = $1;
+EXECUTE select_by_key_uncached(1);
+EXECUTE select_by_key_uncached(2);
+EXECUTE select_by_key_uncached(3);
+EXECUTE select_by_key_uncached(4);
+EXECUTE select_by_key_uncached(5);
+EXECUTE select_by_key_uncached(6);
+EXECUTE select_by_key_uncached(7);
+
+SET client_min_messages TO WARNING;
+DROP SCHEMA fast_path_plan_cache CASCADE;
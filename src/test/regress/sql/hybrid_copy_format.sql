@@ -0,0 +1,67 @@
+--
+-- HYBRID_COPY_FORMAT
+--
+-- Tests intermediate results of a mix of column types that can and cannot use
+-- the binary copy format, which are written in the hybrid row format
+CREATE SCHEMA hybrid_copy_format;
+SET search_path TO 'hybrid_copy_format';
+SET citus.next_shard_id TO 4290000;
+SET citus.shard_replication_factor TO 1;
+
+-- arrays of user-defined types are sent as text, the other columns in binary
+CREATE TYPE hybrid_copy_format.mood AS ENUM ('sad', 'ok', 'happy');
+SELECT run_command_on_workers('CREATE SCHEMA hybrid_copy_format');
+SELECT run_command_on_workers($$CREATE TYPE hybrid_copy_format.mood AS ENUM ('sad', 'ok', 'happy')$$);
+
+CREATE TABLE diary (key int, moods hybrid_copy_format.mood[], note text, score numeric);
+SELECT create_distributed_table('diary', 'key');
+INSERT INTO diary VALUES
+  (1, '{sad,ok}', 'monday', 1.5),
+  (2, '{happy}', NULL, 2),
+  (3, NULL, 'back\slash', 3.25),
+  (4, '{ok,NULL,happy}', 'thursday', NULL);
+
+-- the result can be read in either format
+BEGIN;
+SELECT create_intermediate_result('moods', 'SELECT key, moods, note, score FROM diary');
+SELECT * FROM read_intermediate_result('moods', 'binary')
+  AS res (key int, moods hybrid_copy_format.mood[], note text, score numeric)
+ORDER BY key;
+SELECT * FROM read_intermediate_result('moods', 'text')
+  AS res (key int, moods hybrid_copy_format.mood[], note text, score numeric)
+ORDER BY key;
+END;
+
+-- postgres refuses the hybrid row format when the column types do not match
+BEGIN;
+SELECT create_intermediate_result('moods', 'SELECT key, moods FROM diary');
+SELECT * FROM read_intermediate_result('moods', 'binary')
+  AS res (key int, moods text)
+ORDER BY key;
+END;
+
+-- CTEs are read from intermediate results
+WITH notes AS (
+  SELECT key, moods, note FROM diary ORDER BY key LIMIT 3
+)
+SELECT * FROM notes ORDER BY key;
+
+-- INSERT ... SELECT via the coordinator
+CREATE TABLE diary_archive (key int, moods hybrid_copy_format.mood[], note text, score numeric);
+SELECT create_distributed_table('diary_archive', 'key');
+INSERT INTO diary_archive SELECT key, moods, note, score FROM diary ORDER BY key LIMIT 3;
+SELECT * FROM diary_archive ORDER BY key;
+
+-- COPY with ON CONFLICT stages the rows in intermediate results
+ALTER TABLE diary ADD PRIMARY KEY (key);
+SET citus.copy_on_conflict TO do_update;
+COPY diary FROM STDIN WITH (format csv);
+2,"{sad}",again,2.5
+5,"{ok,ok}",friday,5
+\.
+RESET citus.copy_on_conflict;
+SELECT * FROM diary ORDER BY key;
+
+SET client_min_messages TO WARNING;
+DROP SCHEMA hybrid_copy_format CASCADE;
+SELECT run_command_on_workers('DROP SCHEMA hybrid_copy_format CASCADE');
@@ -0,0 +1,60 @@
+--
+-- INTERMEDIATE_RESULT_COMPRESSION
+--
+-- Tests reading and writing compressed intermediate results
+CREATE SCHEMA intermediate_result_compression;
+SET search_path TO 'intermediate_result_compression';
+SET citus.next_shard_id TO 4180000;
+SET citus.shard_count TO 4;
+SET citus.compress_intermediate_results TO on;
+
+-- a small result fits in a single block
+BEGIN;
+SELECT create_intermediate_result('squares', 'SELECT s, s*s FROM generate_series(1,5) s');
+SELECT * FROM read_intermediate_result('squares', 'binary') AS res (x int, x2 int);
+COMMIT;
+
+-- a large result spans many blocks
+BEGIN;
+SELECT create_intermediate_result('many_squares', 'SELECT s, s::bigint*s FROM generate_series(1,100000) s');
+SELECT count(*), sum(x), max(x2) FROM read_intermediate_result('many_squares', 'binary') AS res (x int, x2 bigint);
+COMMIT;
+
+-- data that compresses poorly is read back correctly as well
+BEGIN;
+SELECT create_intermediate_result('hashes', 'SELECT md5(s::text) FROM generate_series(1,10000) s');
+SELECT count(DISTINCT h), sum(length(h)) FROM read_intermediate_result('hashes', 'binary') AS res (h text);
+COMMIT;
+
+-- results that are written without compression can still be read
+BEGIN;
+SET LOCAL citus.compress_intermediate_results TO off;
+SELECT create_intermediate_result('squares', 'SELECT s, s*s FROM generate_series(1,5) s');
+SET LOCAL citus.compress_intermediate_results TO on;
+SELECT * FROM read_intermediate_result('squares', 'binary') AS res (x int, x2 int);
+COMMIT;
+
+-- compressed results are broadcast to the workers as is
+CREATE TABLE interesting_squares (user_id text, interested_in text);
+SELECT create_distributed_table('interesting_squares', 'user_id');
+INSERT INTO interesting_squares VALUES ('jon', '2'), ('jon', '5'), ('jack', '3');
+
+BEGIN;
+SELECT broadcast_intermediate_result('squares', 'SELECT s, s*s FROM generate_series(1,5) s');
+SELECT x, x2
+FROM interesting_squares
+JOIN (SELECT * FROM read_intermediate_result('squares', 'binary') AS res (x int, x2 int)) squares ON (x::text = interested_in)
+ORDER BY x;
+END;
+
+-- subplans of recursively planned queries use compressed results as well
+WITH squares AS (
+	SELECT s AS x, s*s AS x2 FROM generate_series(1,100000) s ORDER BY s LIMIT 50000
+)
+SELECT user_id, x, x2
+FROM interesting_squares JOIN squares ON (x::text = interested_in)
+ORDER BY x;
+
+RESET citus.compress_intermediate_results;
+SET client_min_messages TO WARNING;
+DROP SCHEMA intermediate_result_compression CASCADE;
@@ -0,0 +1,79 @@
+--
+-- LOCAL_FILE_LOAD
+--
+-- Tests master_load_local_files() that loads files which are present on the
+-- worker nodes into the shards of a distributed table
+CREATE SCHEMA local_file_load;
+SET search_path TO 'local_file_load';
+SET citus.next_shard_id TO 4240000;
+SET citus.shard_replication_factor TO 1;
+SET citus.shard_count TO 4;
+
+CREATE TABLE events (key int, value text);
+SELECT create_distributed_table('events', 'key');
+
+-- each worker writes a file of its own into its data directory
+SELECT result FROM run_command_on_workers($cmd$
+	DO $$
+	BEGIN
+		EXECUTE format('COPY (SELECT i, ''row '' || i FROM generate_series(1, 50) i) TO %L',
+					   current_setting('data_directory') || '/local_file_load.data');
+	END;
+	$$
+$cmd$);
+
+-- relative file patterns are resolved in the data directory of each worker
+SELECT master_load_local_files('events', 'local_file_load.data');
+SELECT count(*), count(DISTINCT key) FROM events;
+
+-- every row ends up in the shard that covers its key
+SELECT count(*) FROM events WHERE key = 7;
+SELECT result FROM run_command_on_placements('events', $$
+	SELECT count(*) FROM %s WHERE key = 7
+$$) ORDER BY result;
+
+-- the rows are loaded in the transaction of the caller
+BEGIN;
+SELECT master_load_local_files('events', 'local_file_load.data');
+SELECT count(*) FROM events;
+ROLLBACK;
+SELECT count(*) FROM events;
+
+-- patterns that match no files load nothing
+SELECT master_load_local_files('events', 'does_not_exist_*.data');
+
+-- COPY options apply to the files on the workers
+SELECT result FROM run_command_on_workers($cmd$
+	DO $$
+	BEGIN
+		EXECUTE format('COPY (SELECT i, ''csv'' FROM generate_series(1, 5) i) TO %L WITH (format csv)',
+					   current_setting('data_directory') || '/local_file_load.csv');
+	END;
+	$$
+$cmd$);
+SELECT master_load_local_files('events', 'local_file_load.csv', 'format csv');
+SELECT count(*) FROM events WHERE value = 'csv';
+
+-- range distributed tables route by the shard intervals
+CREATE TABLE ranges (key int, value text);
+SELECT create_distributed_table('ranges', 'key', 'range');
+SELECT master_create_empty_shard('ranges') AS shardid1 \gset
+SELECT master_create_empty_shard('ranges') AS shardid2 \gset
+UPDATE pg_dist_shard SET shardminvalue = 1, shardmaxvalue = 25 WHERE shardid = :shardid1;
+UPDATE pg_dist_shard SET shardminvalue = 26, shardmaxvalue = 50 WHERE shardid = :shardid2;
+SELECT master_load_local_files('ranges', 'local_file_load.data');
+SELECT count(*) FROM ranges WHERE key <= 25;
+SELECT count(*) FROM ranges WHERE key > 25;
+
+-- append distributed tables are not supported
+CREATE TABLE appends (key int, value text);
+SELECT create_distributed_table('appends', 'key', 'append');
+SELECT master_load_local_files('appends', 'local_file_load.data');
+
+-- remove the files from the data directories of the workers
+SELECT result FROM run_command_on_workers($$
+	COPY (SELECT 1 WHERE false) TO PROGRAM 'rm -f local_file_load.data local_file_load.csv'
+$$);
+
+SET client_min_messages TO WARNING;
+DROP SCHEMA local_file_load CASCADE;
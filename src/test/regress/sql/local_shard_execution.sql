@@ -0,0 +1,97 @@
+CREATE SCHEMA local_shard_execution;
+SET search_path TO local_shard_execution;
+
+SET citus.shard_count TO 4;
+SET citus.shard_replication_factor TO 1;
+SET citus.replication_model TO 'streaming';
+SET citus.next_shard_id TO 1470000;
+
+CREATE TABLE reference_table (key int PRIMARY KEY, value text);
+SELECT create_reference_table('reference_table');
+
+CREATE TABLE distributed_table (key int PRIMARY KEY, value text);
+SELECT create_distributed_table('distributed_table', 'key');
+
+INSERT INTO reference_table SELECT i, 'value_' || i FROM generate_series(1, 10) i;
+INSERT INTO distributed_table SELECT i, 'value_' || i FROM generate_series(1, 100) i;
+
+\c - - - :worker_1_port
+SET search_path TO local_shard_execution;
+SET citus.enable_local_execution TO on;
+
+-- the reference table has a placement on this node, so it is read locally
+SELECT count(*) FROM reference_table;
+SELECT value FROM reference_table WHERE key = 3;
+
+-- modifications and reads in the same transaction see each other
+BEGIN;
+INSERT INTO reference_table VALUES (11, 'value_11');
+SELECT count(*) FROM reference_table;
+UPDATE reference_table SET value = 'updated' WHERE key = 11 RETURNING *;
+DELETE FROM reference_table WHERE key = 1 RETURNING key;
+SELECT count(*) FROM reference_table;
+
+-- multi-shard queries mix local and remote execution afterwards
+SELECT count(*) FROM distributed_table;
+SELECT count(*) FROM distributed_table d JOIN reference_table r USING (key);
+ROLLBACK;
+
+SELECT count(*) FROM reference_table;
+
+-- committed local modifications are also applied to the remote placements
+INSERT INTO reference_table VALUES (12, 'value_12');
+UPDATE reference_table SET value = 'updated' WHERE key = 12 RETURNING *;
+
+\c - - - :worker_2_port
+SET search_path TO local_shard_execution;
+SET citus.enable_local_execution TO on;
+SELECT key, value FROM reference_table WHERE key = 12;
+
+\c - - - :worker_1_port
+SET search_path TO local_shard_execution;
+SET citus.enable_local_execution TO on;
+
+-- prepared statements use the parameters locally
+PREPARE local_select(int) AS SELECT value FROM reference_table WHERE key = $1;
+EXECUTE local_select(2);
+EXECUTE local_select(3);
+EXECUTE local_select(4);
+EXECUTE local_select(5);
+EXECUTE local_select(6);
+EXECUTE local_select(7);
+EXECUTE local_select(12);
+
+PREPARE local_update(int, text) AS UPDATE reference_table SET value = $2 WHERE key = $1 RETURNING key, value;
+EXECUTE local_update(2, 'prepared_2');
+EXECUTE local_update(3, 'prepared_3');
+EXECUTE local_update(4, 'prepared_4');
+EXECUTE local_update(5, 'prepared_5');
+EXECUTE local_update(6, 'prepared_6');
+EXECUTE local_update(7, 'prepared_7');
+
+-- commands that cannot execute locally error out after a local execution
+BEGIN;
+SELECT count(*) FROM reference_table;
+INSERT INTO reference_table SELECT i, 'value_' || i FROM generate_series(20, 25) i;
+ROLLBACK;
+
+-- unless local execution is disabled
+BEGIN;
+SET LOCAL citus.enable_local_execution TO off;
+SELECT count(*) FROM reference_table;
+INSERT INTO reference_table SELECT i, 'value_' || i FROM generate_series(20, 25) i;
+SELECT count(*) FROM reference_table;
+ROLLBACK;
+
+-- local execution does not start once a connection accessed the placements
+BEGIN;
+SET LOCAL citus.enable_local_execution TO off;
+SELECT count(*) FROM reference_table;
+SET LOCAL citus.enable_local_execution TO on;
+INSERT INTO reference_table SELECT i, 'value_' || i FROM generate_series(20, 25) i;
+SELECT count(*) FROM reference_table;
+ROLLBACK;
+
+\c - - - :master_port
+SET client_min_messages TO WARNING;
+DROP SCHEMA local_shard_execution CASCADE;
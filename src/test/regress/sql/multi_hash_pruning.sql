@@ -83,6 +83,41 @@ SELECT count(*) FROM lineitem_hash_part
 SELECT count(*) FROM lineitem_hash_part
 	WHERE l_orderkey IN (1,2,3);
 
+-- Check that all values of a list are looked up, including duplicates and NULLs,
+-- and that only the shards of the values remain. Values 3 and 4 share a shard.
+SELECT count(*) FROM lineitem_hash_part
+	WHERE l_orderkey IN (3,2,1,3,NULL);
+
+SELECT count(*) FROM lineitem_hash_part
+	WHERE l_orderkey IN (1,2,3) AND l_orderkey = 2;
+
+SELECT count(*) FROM lineitem_hash_part
+	WHERE l_orderkey IN (1,2) OR l_orderkey = ANY ('{3,4}');
+
+SELECT coordinator_plan($Q$
+EXPLAIN (COSTS FALSE)
+SELECT l_orderkey FROM lineitem_hash_part
+	WHERE l_orderkey IN (3,2,1,3,NULL);
+$Q$);
+
+SELECT coordinator_plan($Q$
+EXPLAIN (COSTS FALSE)
+SELECT l_orderkey FROM lineitem_hash_part
+	WHERE l_orderkey IN (3,4);
+$Q$);
+
+SELECT coordinator_plan($Q$
+EXPLAIN (COSTS FALSE)
+SELECT l_orderkey FROM lineitem_hash_part
+	WHERE l_orderkey IN (1,2,3) AND l_orderkey = 2;
+$Q$);
+
+SELECT coordinator_plan($Q$
+EXPLAIN (COSTS FALSE)
+SELECT l_orderkey FROM lineitem_hash_part
+	WHERE l_orderkey IN (1,2) OR l_orderkey = ANY ('{3,4}');
+$Q$);
+
 -- Check whether we can deal with null arrays
 SELECT count(*) FROM lineitem_hash_part
 	WHERE l_orderkey IN (NULL);
@@ -0,0 +1,94 @@
+--
+-- MULTI_ROW_INSERT_ROUTING
+--
+-- Tests routing the rows of multi-row INSERTs to shards in a single pass, and
+-- compares its throughput with sorting the rows by shard
+CREATE SCHEMA multi_row_insert_routing;
+SET search_path TO 'multi_row_insert_routing';
+SET citus.next_shard_id TO 4270000;
+SET citus.shard_replication_factor TO 1;
+SET citus.shard_count TO 4;
+
+CREATE FUNCTION benchmark_insert_routing(query_string text, iteration_count int,
+										 OUT row_at_a_time_rows_per_second float8,
+										 OUT batch_rows_per_second float8)
+	RETURNS record
+	AS 'citus'
+	LANGUAGE C STRICT;
+
+CREATE TABLE hash_table (key int, value text);
+SELECT create_distributed_table('hash_table', 'key');
+
+-- rows keep their order within a shard
+INSERT INTO hash_table VALUES (1, 'a'), (2, 'b'), (3, 'c'), (1, 'd'), (2, 'e'), (5, 'f');
+
+SET citus.enable_batched_insert_routing TO off;
+INSERT INTO hash_table VALUES (1, 'g'), (2, 'h'), (3, 'i'), (1, 'j'), (2, 'k'), (5, 'l');
+RESET citus.enable_batched_insert_routing;
+
+SELECT key, string_agg(value, ',' ORDER BY value) FROM hash_table GROUP BY key ORDER BY key;
+
+-- partition column values that are evaluated at execution time
+PREPARE insert_values(int, int) AS
+INSERT INTO hash_table VALUES ($1, 'm'), ($2, 'n'), ($1 + $2, 'o');
+EXECUTE insert_values(1, 2);
+EXECUTE insert_values(3, 4);
+SELECT key, string_agg(value, ',' ORDER BY value) FROM hash_table WHERE value >= 'm'
+GROUP BY key ORDER BY key;
+
+INSERT INTO hash_table VALUES (1, 'p'), (NULL, 'q');
+
+-- rows outside the shards of a range distributed table
+CREATE TABLE range_table (key int, value text);
+SELECT create_distributed_table('range_table', 'key', 'range');
+SELECT master_create_empty_shard('range_table') AS shardid \gset
+UPDATE pg_dist_shard SET shardminvalue = 1, shardmaxvalue = 100 WHERE shardid = :shardid;
+SELECT master_create_empty_shard('range_table') AS shardid \gset
+UPDATE pg_dist_shard SET shardminvalue = 101, shardmaxvalue = 200 WHERE shardid = :shardid;
+
+INSERT INTO range_table VALUES (150, 'a'), (50, 'b'), (100, 'c');
+INSERT INTO range_table VALUES (50, 'd'), (250, 'e');
+SELECT * FROM range_table ORDER BY key;
+
+-- rows that fall within multiple shards are routed one at a time
+CREATE TABLE overlapping_range_table (key int, value text);
+SELECT create_distributed_table('overlapping_range_table', 'key', 'range');
+SELECT master_create_empty_shard('overlapping_range_table') AS shardid \gset
+UPDATE pg_dist_shard SET shardminvalue = 1, shardmaxvalue = 100 WHERE shardid = :shardid;
+SELECT master_create_empty_shard('overlapping_range_table') AS shardid \gset
+UPDATE pg_dist_shard SET shardminvalue = 51, shardmaxvalue = 150 WHERE shardid = :shardid;
+
+INSERT INTO overlapping_range_table VALUES (120, 'a'), (10, 'b'), (30, 'c');
+INSERT INTO overlapping_range_table VALUES (10, 'd'), (75, 'e');
+SELECT * FROM overlapping_range_table ORDER BY key;
+
+-- a shard without min/max values may contain any row
+CREATE TABLE uninitialized_range_table (key int, value text);
+SELECT create_distributed_table('uninitialized_range_table', 'key', 'range');
+SELECT master_create_empty_shard('uninitialized_range_table') AS shardid \gset
+UPDATE pg_dist_shard SET shardminvalue = 1, shardmaxvalue = 100 WHERE shardid = :shardid;
+SELECT master_create_empty_shard('uninitialized_range_table') AS shardid \gset
+
+INSERT INTO uninitialized_range_table VALUES (10, 'a'), (20, 'b');
+SELECT * FROM uninitialized_range_table ORDER BY key;
+
+-- both paths route 1000 rows to the same shards
+SELECT row_at_a_time_rows_per_second > 0, batch_rows_per_second > 0
+FROM benchmark_insert_routing(
+	(SELECT 'INSERT INTO hash_table VALUES ' ||
+			string_agg(format('(%s, %L)', i * 7919, 'value_' || i), ', ')
+	 FROM generate_series(1, 1000) i),
+	10);
+
+SELECT row_at_a_time_rows_per_second > 0, batch_rows_per_second > 0
+FROM benchmark_insert_routing(
+	(SELECT 'INSERT INTO range_table VALUES ' ||
+			string_agg(format('(%s, %L)', i % 200 + 1, 'value_' || i), ', ')
+	 FROM generate_series(1, 1000) i),
+	10);
+
+SELECT * FROM benchmark_insert_routing('INSERT INTO hash_table VALUES (1, ''a'')', 10);
+SELECT * FROM benchmark_insert_routing('INSERT INTO range_table VALUES (1, ''a''), (300, ''b'')', 10);
+
+SET client_min_messages TO WARNING;
+DROP SCHEMA multi_row_insert_routing CASCADE;
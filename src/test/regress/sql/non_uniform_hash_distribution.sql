@@ -0,0 +1,56 @@
+--
+-- NON_UNIFORM_HASH_DISTRIBUTION
+--
+-- Tests that values are mapped to the right shards of a hash distributed table
+-- whose shards cover hash ranges of different sizes. Hash values of 1, 2, 3
+-- and 4 are consecutively -1905060026, 1134484726, -28094569 and -1011077333.
+CREATE SCHEMA non_uniform_hash_distribution;
+SET search_path TO 'non_uniform_hash_distribution';
+SET citus.next_shard_id TO 4320000;
+SET citus.shard_count TO 4;
+SET citus.shard_replication_factor TO 1;
+
+CREATE FUNCTION benchmark_find_shard_interval_index(distributed_table regclass,
+													iteration_count int,
+													OUT uniform_hash_distribution bool,
+													OUT lookups_per_second float8)
+	RETURNS record
+	AS 'citus'
+	LANGUAGE C STRICT;
+
+CREATE TABLE events (key int, value text);
+SELECT create_distributed_table('events', 'key');
+
+-- let the hash values of 1, 4 and 3 be the minimum values of the last shards
+UPDATE pg_dist_shard SET
+	shardminvalue = CASE shardid
+		WHEN 4320000 THEN '-2147483648'
+		WHEN 4320001 THEN '-1905060026'
+		WHEN 4320002 THEN '-1011077333'
+		ELSE '-28094569' END,
+	shardmaxvalue = CASE shardid
+		WHEN 4320000 THEN '-1905060027'
+		WHEN 4320001 THEN '-1011077334'
+		WHEN 4320002 THEN '-28094570'
+		ELSE '2147483647' END
+WHERE logicalrelid = 'events'::regclass;
+
+SELECT get_shard_id_for_distribution_column('events', 1);
+SELECT get_shard_id_for_distribution_column('events', 2);
+SELECT get_shard_id_for_distribution_column('events', 3);
+SELECT get_shard_id_for_distribution_column('events', 4);
+
+INSERT INTO events VALUES (1, 'one'), (2, 'two'), (3, 'three'), (4, 'four');
+SELECT value FROM events WHERE key = 4;
+SELECT value FROM events WHERE key IN (1, 3) ORDER BY key;
+
+-- time lookups on uniform and non-uniform shard layouts, which find the shard of each value
+CREATE TABLE uniform_events (key int, value text);
+SELECT create_distributed_table('uniform_events', 'key');
+SELECT uniform_hash_distribution, lookups_per_second > 0
+FROM benchmark_find_shard_interval_index('uniform_events', 100);
+SELECT uniform_hash_distribution, lookups_per_second > 0
+FROM benchmark_find_shard_interval_index('events', 100);
+
+SET client_min_messages TO WARNING;
+DROP SCHEMA non_uniform_hash_distribution CASCADE;
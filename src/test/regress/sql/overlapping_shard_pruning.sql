@@ -0,0 +1,57 @@
+--
+-- OVERLAPPING_SHARD_PRUNING
+--
+-- Tests that shards of append distributed tables are pruned correctly when
+-- their ranges overlap
+CREATE SCHEMA overlapping_shard_pruning;
+SET search_path TO 'overlapping_shard_pruning';
+SET citus.next_shard_id TO 4330000;
+SET citus.shard_replication_factor TO 1;
+
+CREATE TABLE events (key int, value text);
+SELECT create_distributed_table('events', 'key', 'append');
+SELECT master_create_empty_shard('events') FROM generate_series(1, 5);
+
+-- a long shard overlaps with most others
+UPDATE pg_dist_shard SET
+	shardminvalue = CASE shardid
+		WHEN 4330000 THEN '1'
+		WHEN 4330001 THEN '5'
+		WHEN 4330002 THEN '15'
+		WHEN 4330003 THEN '2'
+		ELSE '35' END,
+	shardmaxvalue = CASE shardid
+		WHEN 4330000 THEN '10'
+		WHEN 4330001 THEN '20'
+		WHEN 4330002 THEN '30'
+		WHEN 4330003 THEN '40'
+		ELSE '50' END
+WHERE logicalrelid = 'events'::regclass;
+
+SELECT coordinator_plan($Q$
+EXPLAIN (COSTS FALSE)
+SELECT * FROM events WHERE key = 12;
+$Q$);
+
+SELECT coordinator_plan($Q$
+EXPLAIN (COSTS FALSE)
+SELECT * FROM events WHERE key < 3;
+$Q$);
+
+SELECT coordinator_plan($Q$
+EXPLAIN (COSTS FALSE)
+SELECT * FROM events WHERE key BETWEEN 31 AND 34;
+$Q$);
+
+SELECT coordinator_plan($Q$
+EXPLAIN (COSTS FALSE)
+SELECT * FROM events WHERE key > 38;
+$Q$);
+
+SELECT coordinator_plan($Q$
+EXPLAIN (COSTS FALSE)
+SELECT * FROM events WHERE key >= 10 AND key <= 16;
+$Q$);
+
+SET client_min_messages TO WARNING;
+DROP SCHEMA overlapping_shard_pruning CASCADE;
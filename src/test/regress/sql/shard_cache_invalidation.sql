@@ -0,0 +1,60 @@
+--
+-- SHARD_CACHE_INVALIDATION
+--
+-- Tests that backends reload the placements of a shard when only its
+-- placements change
+CREATE SCHEMA shard_cache_invalidation;
+SET search_path TO 'shard_cache_invalidation';
+SET citus.next_shard_id TO 4310000;
+SET citus.shard_count TO 1;
+SET citus.shard_replication_factor TO 2;
+
+CREATE TABLE items (key int, value text);
+SELECT create_distributed_table('items', 'key');
+SELECT shardid FROM pg_dist_shard WHERE logicalrelid = 'items'::regclass \gset
+SELECT groupid AS worker_1_group FROM pg_dist_node WHERE nodeport = :worker_1_port \gset
+INSERT INTO items VALUES (1, 'one');
+SELECT count(*) FROM items;
+
+-- only the placement on the second worker gets the new row
+UPDATE pg_dist_placement SET shardstate = 3
+WHERE shardid = :shardid AND groupid = :worker_1_group;
+INSERT INTO items VALUES (2, 'two');
+SELECT count(*) FROM items;
+
+-- reads go to the placement on the first worker once it is the only active one
+UPDATE pg_dist_placement SET shardstate = CASE WHEN groupid = :worker_1_group THEN 1 ELSE 3 END
+WHERE shardid = :shardid;
+SELECT count(*) FROM items;
+
+-- a transaction sees its own placement changes, and they are undone on rollback
+BEGIN;
+UPDATE pg_dist_placement SET shardstate = CASE WHEN groupid = :worker_1_group THEN 3 ELSE 1 END
+WHERE shardid = :shardid;
+SELECT count(*) FROM items;
+ROLLBACK;
+SELECT count(*) FROM items;
+
+-- transactions that change the placements of many shards invalidate all tables
+SET citus.shard_count TO 80;
+CREATE TABLE many_shards (key int, value text);
+SELECT create_distributed_table('many_shards', 'key');
+INSERT INTO many_shards SELECT i, 'value' FROM generate_series(1, 100) i;
+BEGIN;
+UPDATE pg_dist_placement SET shardstate = 3
+WHERE groupid = :worker_1_group AND shardid IN (
+	SELECT shardid FROM pg_dist_shard WHERE logicalrelid = 'many_shards'::regclass);
+SELECT count(*) FROM many_shards;
+SELECT count(*) FROM items;
+COMMIT;
+INSERT INTO many_shards VALUES (101, 'value');
+SELECT count(*) FROM many_shards;
+
+-- other backends see the committed placement changes
+\c - - - :master_port
+SET search_path TO 'shard_cache_invalidation';
+SELECT count(*) FROM items;
+SELECT count(*) FROM many_shards;
+
+SET client_min_messages TO WARNING;
+DROP SCHEMA shard_cache_invalidation CASCADE;
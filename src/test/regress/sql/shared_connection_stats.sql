@@ -0,0 +1,46 @@
+--
+-- SHARED_CONNECTION_STATS
+--
+-- Tests that multi-shard queries still succeed when the number of connections
+-- to the workers is limited across backends via citus.max_shared_pool_size.
+--
+CREATE SCHEMA shared_connection_stats;
+SET search_path TO shared_connection_stats;
+
+SET citus.shard_count TO 32;
+SET citus.shard_replication_factor TO 1;
+SET citus.next_shard_id TO 4160000;
+SET citus.task_executor_type TO 'adaptive';
+
+CREATE TABLE test (a int, b int);
+SELECT create_distributed_table('test', 'a');
+INSERT INTO test SELECT i, i FROM generate_series(1, 100) i;
+
+-- allow only a single connection per worker
+ALTER SYSTEM SET citus.max_shared_pool_size TO 1;
+SELECT pg_reload_conf();
+SELECT pg_sleep(0.1);
+
+-- would open a connection per shard without the limit
+SET citus.force_max_query_parallelization TO on;
+SELECT count(*), sum(b) FROM test;
+
+BEGIN;
+UPDATE test SET b = b + 1;
+SELECT count(*), sum(b) FROM test;
+ROLLBACK;
+
+RESET citus.force_max_query_parallelization;
+
+-- disable throttling
+ALTER SYSTEM SET citus.max_shared_pool_size TO -1;
+SELECT pg_reload_conf();
+SELECT pg_sleep(0.1);
+
+SELECT count(*), sum(b) FROM test;
+
+ALTER SYSTEM RESET citus.max_shared_pool_size;
+SELECT pg_reload_conf();
+
+SET client_min_messages TO WARNING;
+DROP SCHEMA shared_connection_stats CASCADE;
@@ -0,0 +1,47 @@
+--
+-- SHARED_METADATA_CACHE
+--
+-- Tests that backends see the metadata changes of other backends when they
+-- copy the shard metadata of distributed tables from shared memory
+CREATE SCHEMA shared_metadata_cache;
+SET search_path TO 'shared_metadata_cache';
+SET citus.next_shard_id TO 4300000;
+SET citus.shard_replication_factor TO 1;
+
+SHOW citus.shared_metadata_cache_size;
+
+CREATE TABLE ranges (key int, value text);
+SELECT create_distributed_table('ranges', 'key', 'range');
+SELECT master_create_empty_shard('ranges') AS shardid1 \gset
+UPDATE pg_dist_shard SET shardminvalue = 1, shardmaxvalue = 25 WHERE shardid = :shardid1;
+INSERT INTO ranges VALUES (1, 'one'), (20, 'twenty');
+SELECT get_shard_id_for_distribution_column('ranges', 20);
+SELECT get_shard_id_for_distribution_column('ranges', 30);
+
+-- a new backend copies the shards that the previous one shared
+\c - - - :master_port
+SET search_path TO 'shared_metadata_cache';
+SET citus.next_shard_id TO 4300010;
+SET citus.shard_replication_factor TO 1;
+SELECT get_shard_id_for_distribution_column('ranges', 20);
+
+-- a transaction that adds a shard sees it before it commits
+BEGIN;
+SELECT master_create_empty_shard('ranges') AS shardid2 \gset
+UPDATE pg_dist_shard SET shardminvalue = 26, shardmaxvalue = 50 WHERE shardid = :shardid2;
+SELECT get_shard_id_for_distribution_column('ranges', 30);
+ROLLBACK;
+SELECT get_shard_id_for_distribution_column('ranges', 30);
+
+SELECT master_create_empty_shard('ranges') AS shardid2 \gset
+UPDATE pg_dist_shard SET shardminvalue = 26, shardmaxvalue = 50 WHERE shardid = :shardid2;
+INSERT INTO ranges VALUES (30, 'thirty');
+
+-- other backends see the shard once the transaction committed
+\c - - - :master_port
+SET search_path TO 'shared_metadata_cache';
+SELECT get_shard_id_for_distribution_column('ranges', 30);
+SELECT * FROM ranges ORDER BY key;
+
+SET client_min_messages TO WARNING;
+DROP SCHEMA shared_metadata_cache CASCADE;
@@ -0,0 +1,68 @@
+--
+-- STATEMENT_CACHING
+--
+-- Tests that parameterized shard queries that are prepared on the worker
+-- connections return correct results, also after the table changes.
+--
+CREATE SCHEMA statement_caching;
+SET search_path TO statement_caching;
+
+SET citus.shard_count TO 4;
+SET citus.shard_replication_factor TO 1;
+SET citus.next_shard_id TO 4140000;
+SET citus.task_executor_type TO 'adaptive';
+
+CREATE TABLE cached (key int, value int);
+SELECT create_distributed_table('cached', 'key');
+
+INSERT INTO cached SELECT 1, i FROM generate_series(1, 10) i;
+
+SET citus.enable_statement_caching TO on;
+
+-- the parameter is not the distribution column, so it remains in the shard query
+PREPARE select_value(int) AS SELECT key, value FROM cached WHERE key = 1 AND value = $1;
+EXECUTE select_value(1);
+EXECUTE select_value(2);
+EXECUTE select_value(3);
+EXECUTE select_value(4);
+EXECUTE select_value(5);
+EXECUTE select_value(6);
+EXECUTE select_value(7);
+
+PREPARE update_value(int, int) AS UPDATE cached SET value = $2 WHERE key = 1 AND value = $1 RETURNING value;
+EXECUTE update_value(1, 11);
+EXECUTE update_value(2, 12);
+EXECUTE update_value(3, 13);
+EXECUTE update_value(4, 14);
+EXECUTE update_value(5, 15);
+EXECUTE update_value(6, 16);
+EXECUTE update_value(7, 17);
+
+-- fast-path queries filter the distribution column by a parameter, which is
+-- replaced by its value during deferred pruning, so they are not cached
+PREPARE select_key(int) AS SELECT count(*) FROM cached WHERE key = $1;
+EXECUTE select_key(1);
+EXECUTE select_key(1);
+EXECUTE select_key(1);
+EXECUTE select_key(1);
+EXECUTE select_key(1);
+EXECUTE select_key(1);
+SET citus.log_remote_commands TO on;
+SET client_min_messages TO log;
+EXECUTE select_key(1);
+RESET client_min_messages;
+RESET citus.log_remote_commands;
+
+-- DDL invalidates the statements that are prepared on the workers
+ALTER TABLE cached ALTER COLUMN value TYPE bigint;
+EXECUTE select_value(8);
+EXECUTE select_value(13);
+EXECUTE update_value(8, 18);
+
+-- same results without caching
+SET citus.enable_statement_caching TO off;
+EXECUTE select_value(18);
+SELECT value FROM cached ORDER BY value;
+
+SET client_min_messages TO WARNING;
+DROP SCHEMA statement_caching CASCADE;
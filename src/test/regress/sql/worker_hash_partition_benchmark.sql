@@ -0,0 +1,28 @@
+--
+-- WORKER_HASH_PARTITION_BENCHMARK
+--
+-- Compares the partitions that value-at-a-time and batched hash partitioning
+-- assign, and reports their throughput for the specialized column types.
+--
+
+CREATE FUNCTION benchmark_hash_partitioning(type_id regtype, value_count int,
+											partition_count int,
+											OUT row_at_a_time_rows_per_second float8,
+											OUT batch_rows_per_second float8)
+	RETURNS record
+	AS 'citus'
+	LANGUAGE C STRICT;
+
+SELECT row_at_a_time_rows_per_second > 0, batch_rows_per_second > 0
+FROM benchmark_hash_partitioning('int', 100000, 32);
+
+SELECT row_at_a_time_rows_per_second > 0, batch_rows_per_second > 0
+FROM benchmark_hash_partitioning('bigint', 100000, 32);
+
+SELECT row_at_a_time_rows_per_second > 0, batch_rows_per_second > 0
+FROM benchmark_hash_partitioning('text', 100000, 7);
+
+-- only the specialized types can be generated
+SELECT * FROM benchmark_hash_partitioning('numeric', 100, 4);
+
+DROP FUNCTION benchmark_hash_partitioning(regtype, int, int);